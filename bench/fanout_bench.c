@@ -0,0 +1,216 @@
+// Fan-out benchmark: delivers synthetic chat traffic, many small channels and
+// a few large ones, once with every message sent by its posting thread
+// (direct) and once with large channels cut into partitions for the fan-out
+// threads (parallel), and prints the delivery latency per channel size.
+//
+//   fanout_bench [messages] [posting threads]
+//
+// FANOUT_THRESHOLD and FANOUT_THREADS apply as they do in the server.
+// Recipients are Unix socket pairs drained by a reader thread, so every send
+// is a real syscall under a per-connection lock, like client_send.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "server/fanout.h"
+#include "network/protocol.h"
+
+#define SMALL_CHANNELS 1000
+#define SMALL_MEMBERS 8
+#define LARGE_CHANNELS 4
+#define LARGE_MEMBERS 2000
+#define LARGE_EVERY 50 // One message in this many goes to a large channel
+#define CONNECTIONS 256 // Socket pairs the recipients share
+
+typedef struct {
+    int fd;
+    pthread_mutex_t send_mutex;
+} Connection;
+
+typedef struct {
+    const char *frame;
+    size_t length;
+    const uint32_t *members;
+} Delivery;
+
+typedef struct {
+    double *micros;
+    size_t count;
+} Samples;
+
+static Connection connections[CONNECTIONS];
+static int drain_fds[CONNECTIONS];
+static volatile int draining = 1;
+static uint32_t small_members[SMALL_CHANNELS][SMALL_MEMBERS];
+static uint32_t large_members[LARGE_CHANNELS][LARGE_MEMBERS];
+static char frame[sizeof(Message) + sizeof(ChatMessage)];
+
+static bool parallel_mode;
+static int messages_per_thread;
+static pthread_mutex_t samples_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Samples samples[2]; // Small, large
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *drain_main(void *arg) {
+    (void)arg;
+    struct pollfd fds[CONNECTIONS];
+    for (int i = 0; i < CONNECTIONS; i++) {
+        fds[i].fd = drain_fds[i];
+        fds[i].events = POLLIN;
+    }
+    char buffer[64 * 1024];
+    while (draining) {
+        if (poll(fds, CONNECTIONS, 100) <= 0) continue;
+        for (int i = 0; i < CONNECTIONS; i++) {
+            if (fds[i].revents & POLLIN) {
+                while (read(fds[i].fd, buffer, sizeof(buffer)) == (ssize_t)sizeof(buffer)) {}
+            }
+        }
+    }
+    return NULL;
+}
+
+static void send_part(void *ctx, size_t begin, size_t end) {
+    const Delivery *delivery = ctx;
+    for (size_t i = begin; i < end; i++) {
+        Connection *c = &connections[delivery->members[i] % CONNECTIONS];
+        pthread_mutex_lock(&c->send_mutex);
+        size_t sent = 0;
+        while (sent < delivery->length) {
+            ssize_t n = send(c->fd, delivery->frame + sent, delivery->length - sent, 0);
+            if (n <= 0) break;
+            sent += (size_t)n;
+        }
+        pthread_mutex_unlock(&c->send_mutex);
+    }
+}
+
+static void record(int tier, double micros) {
+    pthread_mutex_lock(&samples_mutex);
+    samples[tier].micros[samples[tier].count++] = micros;
+    pthread_mutex_unlock(&samples_mutex);
+}
+
+static void *post_main(void *arg) {
+    unsigned seed = (unsigned)(size_t)arg;
+    for (int m = 0; m < messages_per_thread; m++) {
+        bool large = m % LARGE_EVERY == 0;
+        Delivery delivery = {frame, sizeof(frame), NULL};
+        size_t count;
+        if (large) {
+            delivery.members = large_members[rand_r(&seed) % LARGE_CHANNELS];
+            count = LARGE_MEMBERS;
+        } else {
+            delivery.members = small_members[rand_r(&seed) % SMALL_CHANNELS];
+            count = SMALL_MEMBERS;
+        }
+        double started = now_us();
+        if (parallel_mode && count >= fanout_threshold()) {
+            fanout_run(count, send_part, &delivery);
+        } else {
+            send_part(&delivery, 0, count);
+        }
+        record(large ? 1 : 0, now_us() - started);
+    }
+    return NULL;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const Samples *s, double q) {
+    size_t i = (size_t)(q * (double)(s->count - 1));
+    return s->micros[i];
+}
+
+static void report(const char *mode, double wall_us) {
+    static const char *tiers[2] = {"small", "large"};
+    for (int t = 0; t < 2; t++) {
+        Samples *s = &samples[t];
+        if (s->count == 0) continue;
+        qsort(s->micros, s->count, sizeof(double), compare_double);
+        printf("%-8s  %-5s  %7zu  %9.0f  %9.0f  %9.0f  %9.0f\n", mode, tiers[t], s->count,
+               percentile(s, 0.5), percentile(s, 0.99), percentile(s, 0.999), s->micros[s->count - 1]);
+        s->count = 0;
+    }
+    printf("%-8s  total  %.0f ms\n", mode, wall_us / 1000);
+}
+
+static void run(const char *mode, bool parallel, int threads) {
+    parallel_mode = parallel;
+    pthread_t posters[64];
+    double started = now_us();
+    for (int i = 0; i < threads; i++) pthread_create(&posters[i], NULL, post_main, (void *)(size_t)(i + 1));
+    for (int i = 0; i < threads; i++) pthread_join(posters[i], NULL);
+    report(mode, now_us() - started);
+}
+
+int main(int argc, char **argv) {
+    int messages = argc > 1 ? atoi(argv[1]) : 20000;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    if (messages <= 0 || threads <= 0 || threads > 64) {
+        fprintf(stderr, "usage: %s [messages] [posting threads, at most 64]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    messages_per_thread = messages / threads;
+
+    for (int i = 0; i < CONNECTIONS; i++) {
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+            perror("socketpair");
+            return EXIT_FAILURE;
+        }
+        connections[i].fd = pair[0];
+        drain_fds[i] = pair[1];
+        pthread_mutex_init(&connections[i].send_mutex, NULL);
+    }
+    uint32_t next = 0;
+    for (int c = 0; c < SMALL_CHANNELS; c++) {
+        for (int m = 0; m < SMALL_MEMBERS; m++) small_members[c][m] = next++;
+    }
+    for (int c = 0; c < LARGE_CHANNELS; c++) {
+        for (int m = 0; m < LARGE_MEMBERS; m++) large_members[c][m] = next++;
+    }
+    Message *header = (Message *)frame;
+    header->type = MSG_CHAT;
+    header->length = sizeof(ChatMessage);
+    memset(frame + sizeof(Message), 'x', sizeof(ChatMessage));
+
+    for (int t = 0; t < 2; t++) {
+        samples[t].micros = malloc(sizeof(double) * (size_t)messages);
+        if (!samples[t].micros) {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+    }
+    pthread_t drainer;
+    pthread_create(&drainer, NULL, drain_main, NULL);
+
+    printf("%d messages from %d threads: %d channels of %d, %d of %d (1 message in %d)\n", messages, threads,
+           SMALL_CHANNELS, SMALL_MEMBERS, LARGE_CHANNELS, LARGE_MEMBERS, LARGE_EVERY);
+    printf("mode      tier   messages  p50 (µs)  p99 (µs)  p99.9 (µs) max (µs)\n");
+    run("direct", false, threads);
+    if (!fanout_start()) {
+        fprintf(stderr, "No fan-out thread could start\n");
+        return EXIT_FAILURE;
+    }
+    run("parallel", true, threads);
+    fanout_stop();
+
+    draining = 0;
+    pthread_join(drainer, NULL);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+// UTF-8 repair and markup benchmark: builds the markup of one history row per
+// message the way the client used to (sanitize_utf8, then
+// g_markup_escape_text, then snprintf) and with utf8_markup_copy, on
+// ASCII-heavy and mixed input, and prints the time per message.
+//
+//   utf8_markup_bench [iterations]
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils/utf8_markup.h"
+
+#define BUFFER_SIZE 1024
+
+static const char row_head[] = "<b><span foreground='#786ee1' size='large'>";
+static const char row_middle[] = "</span></b> <span foreground='grey' size='small'>";
+static const char row_tail[] = "</span>\n";
+
+// The client's sanitize_utf8 before utf8_markup, verbatim
+static const char* sanitize_utf8(const char* input) {
+    static char sanitized[BUFFER_SIZE];
+
+    if (!input) {
+        sanitized[0] = '\0';
+        return sanitized;
+    }
+
+    // Check if the string is valid UTF-8
+    if (!g_utf8_validate(input, -1, NULL)) {
+        // If invalid, copy character by character, replacing invalid sequences
+        size_t i = 0, j = 0;
+        while (input[i] != '\0' && j < BUFFER_SIZE - 1) {
+            if ((input[i] & 0x80) == 0) {
+                // ASCII character
+                sanitized[j++] = input[i++];
+            } else if ((input[i] & 0xE0) == 0xC0 && (input[i+1] & 0xC0) == 0x80) {
+                // 2-byte UTF-8 sequence
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+            } else if ((input[i] & 0xF0) == 0xE0 && (input[i+1] & 0xC0) == 0x80 && (input[i+2] & 0xC0) == 0x80) {
+                // 3-byte UTF-8 sequence
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+            } else if ((input[i] & 0xF8) == 0xF0 && (input[i+1] & 0xC0) == 0x80 && (input[i+2] & 0xC0) == 0x80 && (input[i+3] & 0xC0) == 0x80) {
+                // 4-byte UTF-8 sequence
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+                sanitized[j++] = input[i++];
+            } else {
+                // Invalid sequence, replace with '?'
+                sanitized[j++] = '?';
+                i++;
+            }
+        }
+        sanitized[j] = '\0';
+    } else {
+        // If valid, simply copy the string
+        strncpy(sanitized, input, BUFFER_SIZE - 1);
+        sanitized[BUFFER_SIZE - 1] = '\0';
+    }
+
+    return sanitized;
+}
+
+static size_t old_chain(const char *sender, const char *time, const char *content, char *out, size_t out_size) {
+    char *sender_escaped = g_markup_escape_text(sender, -1);
+    char *time_escaped = g_markup_escape_text(time, -1);
+    char *content_escaped = g_markup_escape_text(sanitize_utf8(content), -1);
+    int length = snprintf(out, out_size, "%s%s%s%s%s%s", row_head, sender_escaped, row_middle, time_escaped,
+                          row_tail, content_escaped);
+    g_free(sender_escaped);
+    g_free(time_escaped);
+    g_free(content_escaped);
+    return length > 0 ? (size_t)length : 0;
+}
+
+// As chat_history_view's row_markup
+static size_t kernel(const char *sender, const char *time, const char *content, char *out, size_t out_size) {
+    size_t o = 0;
+    memcpy(out + o, row_head, sizeof(row_head) - 1);
+    o += sizeof(row_head) - 1;
+    o += utf8_markup_copy(sender, strlen(sender), out + o, out_size - o, true);
+    memcpy(out + o, row_middle, sizeof(row_middle) - 1);
+    o += sizeof(row_middle) - 1;
+    o += utf8_markup_copy(time, strlen(time), out + o, out_size - o, true);
+    memcpy(out + o, row_tail, sizeof(row_tail) - 1);
+    o += sizeof(row_tail) - 1;
+    o += utf8_markup_copy(content, strlen(content), out + o, out_size - o, true);
+    return o;
+}
+
+static void repeat(char *out, size_t size, const char *phrase) {
+    out[0] = '\0';
+    while (strlen(out) + strlen(phrase) < size) strcat(out, phrase);
+}
+
+int main(int argc, char **argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [iterations]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static const char *names[] = {"ASCII, short", "ASCII, long", "ASCII, markup", "Latin accents", "CJK and emoji",
+                                  "Invalid bytes"};
+    static char inputs[6][BUFFER_SIZE];
+    snprintf(inputs[0], sizeof(inputs[0]), "hey, are we still on for tonight? I'll bring the snacks");
+    repeat(inputs[1], 950, "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod. ");
+    repeat(inputs[2], 950, "if (a < b && c > d) { print(\"x\"); } ");
+    repeat(inputs[3], 400, "Le café était très bon, à côté de l'hôtel où nous étions. ");
+    repeat(inputs[4], 400, "今日は😀 良い天気ですね 🎉🎉 ");
+    repeat(inputs[5], 400, "caf\xe9 na\xefve \xff\xfe ok ");
+
+    static char out[UTF8_MARKUP_MAX_OUTPUT(3 * BUFFER_SIZE) + 256];
+    volatile size_t sink = 0;
+    printf("%-14s %6s  %12s  %12s  %7s\n", "input", "bytes", "old (ns/msg)", "new (ns/msg)", "speedup");
+    for (size_t m = 0; m < sizeof(names) / sizeof(names[0]); m++) {
+        const char *content = inputs[m];
+        gint64 started = g_get_monotonic_time();
+        for (int i = 0; i < iterations; i++) sink += old_chain("ada@example.com", "14:05", content, out, sizeof(out));
+        gint64 old_us = g_get_monotonic_time() - started;
+        started = g_get_monotonic_time();
+        for (int i = 0; i < iterations; i++) sink += kernel("ada@example.com", "14:05", content, out, sizeof(out));
+        gint64 new_us = g_get_monotonic_time() - started;
+
+        double old_ns = (double)old_us * 1000.0 / iterations, new_ns = (double)new_us * 1000.0 / iterations;
+        printf("%-14s %6zu  %12.0f  %12.0f  %6.1fx\n", names[m], strlen(content), old_ns, new_ns,
+               new_ns > 0 ? old_ns / new_ns : 0.0);
+    }
+    (void)sink;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,670 @@
+#include <gtk/gtk.h>
+#include <string.h>
+#include "chat_history_view.h"
+#include "../utils/utf8_markup.h"
+
+#define HISTORY_OVERSCAN_PX 400          // Rows kept rendered above and below the viewport
+#define HISTORY_DEFAULT_ROW_HEIGHT 48    // Assumed height of rows never measured
+#define HISTORY_MAX_MESSAGES 200000      // Beyond this the oldest quarter is dropped
+#define HISTORY_ROW_MARGIN_X 10
+#define HISTORY_ROW_MARGIN_Y 5
+
+typedef struct {
+    const char *sender;  // In view->strings
+    const char *content; // In view->strings
+    char time[12];
+    uint64_t seq;        // 0 until the server sequenced it (sent from this client)
+    uint32_t local_id;   // Set on messages sent from this client
+    ChatRowState state;
+} HistoryItem;
+
+// A label of the recycling pool and the item it currently shows (-1: none)
+typedef struct {
+    GtkWidget *label;
+    gint64 item;
+    int width;
+} HistorySlot;
+
+struct ChatHistoryView {
+    GtkWidget *scroll;
+    GtkWidget *layout;
+    GtkAdjustment *vadj;
+
+    HistoryItem *items;
+    int *heights;        // Row heights; negative while only estimated
+    gint64 *tree;        // Fenwick tree over |heights|, 1-based, for offset <-> row in O(log n)
+    guint count;
+    guint capacity;
+    uint64_t last_seq;   // Highest seq shown
+    GStringChunk *strings;
+
+    GPtrArray *slots;    // HistorySlot*
+    int width;           // Width the measured heights are valid for
+    gint64 measured_sum;
+    guint measured_count;
+    gboolean stick_to_bottom;
+    gboolean in_relayout;
+    guint relayout_id;
+
+    char *markup;        // Reused for every row's markup
+    size_t markup_size;
+
+    ChatHistoryTopFn top_reached;
+    gpointer top_data;
+};
+
+// --- Height index ---
+
+static int row_estimate(ChatHistoryView *view) {
+    return view->measured_count ? (int)(view->measured_sum / view->measured_count) : HISTORY_DEFAULT_ROW_HEIGHT;
+}
+
+static void tree_add(ChatHistoryView *view, guint index, gint64 delta) {
+    for (guint i = index + 1; i <= view->count; i += i & (~i + 1)) {
+        view->tree[i] += delta;
+    }
+}
+
+// Total height of the rows before index
+static gint64 tree_prefix(ChatHistoryView *view, guint index) {
+    gint64 sum = 0;
+    for (guint i = index; i > 0; i -= i & (~i + 1)) {
+        sum += view->tree[i];
+    }
+    return sum;
+}
+
+// Row that contains vertical offset y
+static guint tree_find(ChatHistoryView *view, gint64 y) {
+    guint pos = 0;
+    guint step = 1;
+    while (step * 2 <= view->count) step *= 2;
+    for (; step > 0; step /= 2) {
+        if (pos + step <= view->count && view->tree[pos + step] <= y) {
+            pos += step;
+            y -= view->tree[pos];
+        }
+    }
+    return pos < view->count ? pos : (view->count ? view->count - 1 : 0);
+}
+
+static void tree_rebuild(ChatHistoryView *view) {
+    view->tree[0] = 0;
+    for (guint i = 1; i <= view->count; i++) {
+        view->tree[i] = ABS(view->heights[i - 1]);
+    }
+    for (guint i = 1; i <= view->count; i++) {
+        guint parent = i + (i & (~i + 1));
+        if (parent <= view->count) view->tree[parent] += view->tree[i];
+    }
+}
+
+static void set_row_height(ChatHistoryView *view, guint index, int height) {
+    int old = view->heights[index];
+    if (old > 0) {
+        view->measured_sum -= old;
+    } else {
+        view->measured_count++;
+    }
+    view->measured_sum += height;
+    view->heights[index] = height;
+    tree_add(view, index, (gint64)height - ABS(old));
+}
+
+// After a width change every measurement is stale
+static void forget_heights(ChatHistoryView *view) {
+    int estimate = row_estimate(view);
+    for (guint i = 0; i < view->count; i++) {
+        if (view->heights[i] > 0) view->heights[i] = -view->heights[i];
+        else view->heights[i] = -estimate;
+    }
+    view->measured_sum = 0;
+    view->measured_count = 0;
+    tree_rebuild(view);
+}
+
+// --- Label pool ---
+
+static HistorySlot* new_slot(ChatHistoryView *view) {
+    HistorySlot *slot = g_new0(HistorySlot, 1);
+    slot->item = -1;
+    slot->label = gtk_label_new(NULL);
+    gtk_label_set_xalign(GTK_LABEL(slot->label), 0.0);
+    gtk_label_set_line_wrap(GTK_LABEL(slot->label), TRUE);
+    gtk_label_set_line_wrap_mode(GTK_LABEL(slot->label), PANGO_WRAP_WORD_CHAR);
+    gtk_widget_set_margin_start(slot->label, HISTORY_ROW_MARGIN_X);
+    gtk_widget_set_margin_end(slot->label, HISTORY_ROW_MARGIN_X);
+    gtk_widget_set_margin_top(slot->label, HISTORY_ROW_MARGIN_Y);
+    gtk_widget_set_margin_bottom(slot->label, HISTORY_ROW_MARGIN_Y);
+    gtk_widget_set_name(slot->label, "chat-message-row");
+    gtk_layout_put(GTK_LAYOUT(view->layout), slot->label, 0, 0);
+    g_ptr_array_add(view->slots, slot);
+    return slot;
+}
+
+// Fixed markup around the text of a row, by part
+static const char *const row_head = "<b><span foreground='#786ee1' size='large'>";
+static const char *const row_middle = "</span></b> <span foreground='grey' size='small'>";
+static const char *const row_tail = "</span>\n";
+static const char *const pending_head = "<span foreground='grey'>";
+static const char *const pending_tail = "</span>";
+static const char *const failed_tail = "\n<span foreground='#e05252' size='small'>Not sent</span>";
+static const char *const unconfirmed_tail = "\n<span foreground='#faa61a' size='small'>Not confirmed</span>";
+#define ROW_MARKUP_FIXED 256 // Room for all of the above
+
+static size_t put_literal(char *out, const char *text) {
+    size_t len = strlen(text);
+    memcpy(out, text, len);
+    return len;
+}
+
+// Markup of one row, built in the view's buffer: repaired and escaped in one pass
+static const char* row_markup(ChatHistoryView *view, const HistoryItem *item) {
+    size_t sender_len = strlen(item->sender);
+    size_t time_len = strlen(item->time);
+    size_t content_len = strlen(item->content);
+
+    size_t needed = ROW_MARKUP_FIXED + UTF8_MARKUP_MAX_OUTPUT(sender_len) +
+                    UTF8_MARKUP_MAX_OUTPUT(time_len) + UTF8_MARKUP_MAX_OUTPUT(content_len);
+    if (needed > view->markup_size) {
+        view->markup = g_realloc(view->markup, needed);
+        view->markup_size = needed;
+    }
+
+    char *out = view->markup;
+    size_t o = put_literal(out, row_head);
+    o += utf8_markup_copy(item->sender, sender_len, out + o, view->markup_size - o, true);
+    o += put_literal(out + o, row_middle);
+    o += utf8_markup_copy(item->time, time_len, out + o, view->markup_size - o, true);
+    o += put_literal(out + o, row_tail);
+    gboolean greyed = item->state == CHAT_ROW_PENDING || item->state == CHAT_ROW_UNCONFIRMED;
+    if (greyed) o += put_literal(out + o, pending_head);
+    o += utf8_markup_copy(item->content, content_len, out + o, view->markup_size - o, true);
+    if (greyed) o += put_literal(out + o, pending_tail);
+    if (item->state == CHAT_ROW_FAILED) o += put_literal(out + o, failed_tail);
+    if (item->state == CHAT_ROW_UNCONFIRMED) o += put_literal(out + o, unconfirmed_tail);
+    out[o] = '\0';
+    return out;
+}
+
+// Label showing item index, reusing one that is off screen when possible
+static HistorySlot* bind_slot(ChatHistoryView *view, guint index) {
+    HistorySlot *free_slot = NULL;
+    for (guint i = 0; i < view->slots->len; i++) {
+        HistorySlot *slot = g_ptr_array_index(view->slots, i);
+        if (slot->item == (gint64)index) return slot;
+        if (slot->item < 0 && !free_slot) free_slot = slot;
+    }
+
+    HistorySlot *slot = free_slot ? free_slot : new_slot(view);
+    const HistoryItem *item = &view->items[index];
+    gtk_label_set_markup(GTK_LABEL(slot->label), row_markup(view, item));
+    slot->item = index;
+    gtk_widget_show(slot->label);
+    return slot;
+}
+
+static void release_slots_outside(ChatHistoryView *view, guint first, guint end) {
+    for (guint i = 0; i < view->slots->len; i++) {
+        HistorySlot *slot = g_ptr_array_index(view->slots, i);
+        if (slot->item >= 0 && (slot->item < (gint64)first || slot->item >= (gint64)end)) {
+            slot->item = -1;
+            gtk_widget_hide(slot->label);
+        }
+    }
+}
+
+// Rows from index on moved by delta
+static void shift_slots(ChatHistoryView *view, guint index, int delta) {
+    for (guint i = 0; i < view->slots->len; i++) {
+        HistorySlot *slot = g_ptr_array_index(view->slots, i);
+        if (slot->item >= (gint64)index) slot->item += delta;
+    }
+}
+
+static HistorySlot* find_slot(ChatHistoryView *view, guint index) {
+    for (guint i = 0; i < view->slots->len; i++) {
+        HistorySlot *slot = g_ptr_array_index(view->slots, i);
+        if (slot->item == (gint64)index) return slot;
+    }
+    return NULL;
+}
+
+// --- Layout ---
+
+// Bind, measure and position the rows around the viewport
+static void relayout(ChatHistoryView *view) {
+    int width = gtk_widget_get_allocated_width(view->layout);
+    if (width <= 1) return;
+    if (width != view->width) {
+        view->width = width;
+        forget_heights(view);
+    }
+
+    view->in_relayout = TRUE;
+    double page = gtk_adjustment_get_page_size(view->vadj);
+    gint64 total = tree_prefix(view, view->count);
+    double top = view->stick_to_bottom ? MAX(0.0, total - page) : gtk_adjustment_get_value(view->vadj);
+    gint64 from = (gint64)MAX(0.0, top - HISTORY_OVERSCAN_PX);
+    gint64 bottom = (gint64)(top + page + HISTORY_OVERSCAN_PX);
+
+    guint first = tree_find(view, from);
+    guint end = view->count ? MIN(view->count, tree_find(view, bottom) + 1) : 0;
+    release_slots_outside(view, first, end);
+
+    // Measure with real labels. Rows above the viewport that change height
+    // shift the content, which is compensated so nothing jumps.
+    double shift = 0;
+    gint64 y = tree_prefix(view, first);
+    end = first;
+    while (end < view->count && y < bottom) {
+        HistorySlot *slot = bind_slot(view, end);
+        int label_width = MAX(1, width - 2 * HISTORY_ROW_MARGIN_X);
+        if (slot->width != label_width) {
+            gtk_widget_set_size_request(slot->label, label_width, -1);
+            slot->width = label_width;
+        }
+        int height = 0;
+        gtk_widget_get_preferred_height_for_width(slot->label, width, &height, NULL);
+        height = MAX(height, 1);
+        int old = ABS(view->heights[end]);
+        if (view->heights[end] < 0 || height != old) {
+            if (y < top) shift += height - old;
+            set_row_height(view, end, height);
+        }
+        y += height;
+        end++;
+    }
+    release_slots_outside(view, first, end);
+
+    y = tree_prefix(view, first);
+    for (guint i = first; i < end; i++) {
+        HistorySlot *slot = find_slot(view, i);
+        if (slot) gtk_layout_move(GTK_LAYOUT(view->layout), slot->label, 0, (int)y);
+        y += ABS(view->heights[i]);
+    }
+
+    total = tree_prefix(view, view->count);
+    gtk_layout_set_size(GTK_LAYOUT(view->layout), (guint)width, (guint)MAX(total, 1));
+    if (view->stick_to_bottom) {
+        gtk_adjustment_set_value(view->vadj, MAX(0.0, total - page));
+    } else if (shift != 0) {
+        gtk_adjustment_set_value(view->vadj, top + shift);
+    }
+    view->in_relayout = FALSE;
+}
+
+static gboolean relayout_idle(gpointer data) {
+    ChatHistoryView *view = data;
+    view->relayout_id = 0;
+    relayout(view);
+    return G_SOURCE_REMOVE;
+}
+
+// Appends arriving in bursts (a snapshot frame, a backlog) cost one relayout
+static void schedule_relayout(ChatHistoryView *view) {
+    if (view->relayout_id == 0) {
+        // Before GTK's redraw, so the new rows are painted in the same frame
+        view->relayout_id = g_idle_add_full(G_PRIORITY_HIGH_IDLE + 10, relayout_idle, view, NULL);
+    }
+}
+
+static void on_value_changed(GtkAdjustment *adj, gpointer user_data) {
+    ChatHistoryView *view = user_data;
+    if (view->in_relayout) return;
+    double upper = gtk_adjustment_get_upper(adj);
+    double page = gtk_adjustment_get_page_size(adj);
+    view->stick_to_bottom = gtk_adjustment_get_value(adj) + page >= upper - 1;
+    relayout(view);
+    // Ask for older messages while the oldest ones are still in the overscan
+    if (view->top_reached && view->count > 0 && gtk_adjustment_get_value(adj) < HISTORY_OVERSCAN_PX) {
+        view->top_reached(view->top_data);
+    }
+}
+
+// Scrolling up when everything already fits, or is already at the top
+static void on_edge_overshot(GtkScrolledWindow *scroll, GtkPositionType pos, gpointer user_data) {
+    (void)scroll;
+    ChatHistoryView *view = user_data;
+    if (pos == GTK_POS_TOP && view->top_reached && view->count > 0) {
+        view->top_reached(view->top_data);
+    }
+}
+
+static void on_size_allocate(GtkWidget *widget, GdkRectangle *allocation, gpointer user_data) {
+    (void)widget;
+    ChatHistoryView *view = user_data;
+    if (!view->in_relayout && allocation->width != view->width) {
+        schedule_relayout(view);
+    }
+}
+
+static void on_adjustment_changed(GtkAdjustment *adj, gpointer user_data) {
+    (void)adj;
+    ChatHistoryView *view = user_data;
+    if (!view->in_relayout) schedule_relayout(view);
+}
+
+// Rows of `added` estimated height went in above the viewport: grow the
+// content and scroll by as much, so the rows the user is reading don't move;
+// relayout corrects the estimates the same way
+static void keep_viewport(ChatHistoryView *view, double added) {
+    if (view->stick_to_bottom) return;
+    view->in_relayout = TRUE;
+    gint64 total = tree_prefix(view, view->count);
+    gtk_layout_set_size(GTK_LAYOUT(view->layout), (guint)MAX(view->width, 1), (guint)MAX(total, 1));
+    gtk_adjustment_set_value(view->vadj, gtk_adjustment_get_value(view->vadj) + added);
+    view->in_relayout = FALSE;
+}
+
+// --- Public API ---
+
+ChatHistoryView* chat_history_view_new(void) {
+    ChatHistoryView *view = g_new0(ChatHistoryView, 1);
+    view->strings = g_string_chunk_new(64 * 1024);
+    view->slots = g_ptr_array_new_with_free_func(g_free);
+    view->stick_to_bottom = TRUE;
+    view->tree = g_new0(gint64, 1);
+
+    view->layout = gtk_layout_new(NULL, NULL);
+    gtk_widget_set_name(view->layout, "chat-history-list");
+    view->scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(view->scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_container_add(GTK_CONTAINER(view->scroll), view->layout);
+    view->vadj = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(view->layout));
+
+    g_signal_connect(view->vadj, "value-changed", G_CALLBACK(on_value_changed), view);
+    g_signal_connect(view->vadj, "changed", G_CALLBACK(on_adjustment_changed), view);
+    g_signal_connect(view->layout, "size-allocate", G_CALLBACK(on_size_allocate), view);
+    g_signal_connect(view->scroll, "edge-overshot", G_CALLBACK(on_edge_overshot), view);
+    return view;
+}
+
+void chat_history_view_free(ChatHistoryView *view) {
+    if (!view) return;
+    if (view->relayout_id) g_source_remove(view->relayout_id);
+    g_ptr_array_free(view->slots, TRUE);
+    g_string_chunk_free(view->strings);
+    g_free(view->items);
+    g_free(view->heights);
+    g_free(view->tree);
+    g_free(view->markup);
+    g_free(view);
+}
+
+GtkWidget* chat_history_view_get_container(ChatHistoryView *view) {
+    return view->scroll;
+}
+
+guint chat_history_view_get_count(ChatHistoryView *view) {
+    return view->count;
+}
+
+// Keep memory bounded: drop the oldest quarter and compact the string store
+static void drop_oldest(ChatHistoryView *view) {
+    guint drop = HISTORY_MAX_MESSAGES / 4;
+    gint64 dropped_height = tree_prefix(view, drop);
+
+    GStringChunk *strings = g_string_chunk_new(64 * 1024);
+    for (guint i = drop; i < view->count; i++) {
+        HistoryItem *item = &view->items[i];
+        item->sender = g_string_chunk_insert_const(strings, item->sender);
+        item->content = g_string_chunk_insert(strings, item->content);
+    }
+    g_string_chunk_free(view->strings);
+    view->strings = strings;
+
+    view->count -= drop;
+    memmove(view->items, view->items + drop, view->count * sizeof(HistoryItem));
+    memmove(view->heights, view->heights + drop, view->count * sizeof(int));
+    tree_rebuild(view);
+
+    release_slots_outside(view, 0, 0);
+    if (!view->stick_to_bottom) {
+        gtk_adjustment_set_value(view->vadj, MAX(0.0, gtk_adjustment_get_value(view->vadj) - dropped_height));
+    }
+}
+
+static void reserve_items(ChatHistoryView *view, guint needed) {
+    if (needed <= view->capacity) return;
+    while (view->capacity < needed) {
+        view->capacity = view->capacity ? view->capacity * 2 : 256;
+    }
+    view->items = g_renew(HistoryItem, view->items, view->capacity);
+    view->heights = g_renew(int, view->heights, view->capacity);
+    view->tree = g_renew(gint64, view->tree, view->capacity + 1);
+}
+
+static void set_item(ChatHistoryView *view, HistoryItem *item, uint64_t seq, const char *sender,
+                     const char *time_str, const char *content) {
+    // Senders repeat, so they are stored once
+    item->sender = g_string_chunk_insert_const(view->strings, sender ? sender : "");
+    item->content = g_string_chunk_insert(view->strings, content ? content : "");
+    g_strlcpy(item->time, time_str ? time_str : "", sizeof(item->time));
+    item->seq = seq;
+    item->local_id = 0;
+    item->state = CHAT_ROW_SENT;
+    if (seq > view->last_seq) view->last_seq = seq;
+}
+
+// Where a message goes: after every shown message with a lower seq, and
+// after the unsequenced rows that were already below those. Sets *shown
+// when that seq is already there.
+static guint seq_position(ChatHistoryView *view, uint64_t seq, gboolean *shown) {
+    *shown = FALSE;
+    if (seq == 0 || seq > view->last_seq) return view->count;
+    guint index = view->count;
+    for (; index > 0; index--) {
+        uint64_t above = view->items[index - 1].seq;
+        if (above == seq) *shown = TRUE;
+        if (above != 0 && above <= seq) break;
+    }
+    return index;
+}
+
+static HistoryItem* append_item(ChatHistoryView *view, uint64_t seq, const char *sender, const char *time_str, const char *content) {
+    if (view->count >= HISTORY_MAX_MESSAGES) {
+        drop_oldest(view);
+    }
+    reserve_items(view, view->count + 1);
+
+    HistoryItem *item = &view->items[view->count];
+    set_item(view, item, seq, sender, time_str, content);
+
+    // Fenwick append: the new node covers its own row plus the rows below its lowbit
+    guint k = view->count + 1;
+    int estimate = row_estimate(view);
+    view->heights[view->count] = -estimate;
+    view->tree[k] = estimate + tree_prefix(view, k - 1) - tree_prefix(view, k - (k & (~k + 1)));
+    view->count++;
+
+    schedule_relayout(view);
+    return item;
+}
+
+// A late message among the others: the rows below it move down
+static HistoryItem* insert_item(ChatHistoryView *view, guint index, uint64_t seq, const char *sender,
+                                const char *time_str, const char *content) {
+    if (index == view->count) {
+        return append_item(view, seq, sender, time_str, content);
+    }
+    if (view->count >= HISTORY_MAX_MESSAGES) {
+        guint before = view->count;
+        drop_oldest(view);
+        index -= MIN(index, before - view->count);
+    }
+    reserve_items(view, view->count + 1);
+
+    memmove(view->items + index + 1, view->items + index, (view->count - index) * sizeof(HistoryItem));
+    memmove(view->heights + index + 1, view->heights + index, (view->count - index) * sizeof(int));
+    set_item(view, &view->items[index], seq, sender, time_str, content);
+    int estimate = row_estimate(view);
+    view->heights[index] = -estimate;
+    view->count++;
+    tree_rebuild(view);
+    shift_slots(view, index, 1);
+
+    if (tree_prefix(view, index) < gtk_adjustment_get_value(view->vadj)) {
+        keep_viewport(view, estimate);
+    }
+    schedule_relayout(view);
+    return &view->items[index];
+}
+
+// Take a row out; its strings stay in the store
+static void remove_item(ChatHistoryView *view, guint index) {
+    int height = view->heights[index];
+    gboolean above = tree_prefix(view, index) < gtk_adjustment_get_value(view->vadj);
+    if (height > 0) {
+        view->measured_sum -= height;
+        view->measured_count--;
+    }
+    view->count--;
+    memmove(view->items + index, view->items + index + 1, (view->count - index) * sizeof(HistoryItem));
+    memmove(view->heights + index, view->heights + index + 1, (view->count - index) * sizeof(int));
+    tree_rebuild(view);
+
+    for (guint i = 0; i < view->slots->len; i++) {
+        HistorySlot *slot = g_ptr_array_index(view->slots, i);
+        if (slot->item == (gint64)index) {
+            slot->item = -1;
+            gtk_widget_hide(slot->label);
+        }
+    }
+    shift_slots(view, index + 1, -1);
+
+    if (above) keep_viewport(view, -ABS(height));
+    schedule_relayout(view);
+}
+
+// Whether seq belongs at index, judging by the nearest sequenced rows around it
+static gboolean seq_fits(ChatHistoryView *view, guint index, uint64_t seq) {
+    for (guint i = index; i > 0; i--) {
+        uint64_t above = view->items[i - 1].seq;
+        if (above == 0) continue;
+        if (above >= seq) return FALSE;
+        break;
+    }
+    for (guint i = index + 1; i < view->count; i++) {
+        uint64_t below = view->items[i].seq;
+        if (below != 0) return below > seq;
+    }
+    return TRUE;
+}
+
+static gint64 find_local(ChatHistoryView *view, uint32_t local_id) {
+    // Rows sent from here are among the newest, so search from the end
+    for (guint i = view->count; i > 0; i--) {
+        if (view->items[i - 1].local_id == local_id) return i - 1;
+    }
+    return -1;
+}
+
+gboolean chat_history_view_insert(ChatHistoryView *view, uint64_t seq, const char *sender,
+                                  const char *time_str, const char *content) {
+    if (!view) return FALSE;
+    gboolean shown;
+    guint index = seq_position(view, seq, &shown);
+    if (shown) return FALSE;
+    insert_item(view, index, seq, sender, time_str, content);
+    return TRUE;
+}
+
+void chat_history_view_append_local(ChatHistoryView *view, uint32_t local_id, const char *sender,
+                                    const char *time_str, const char *content) {
+    if (!view) return;
+    HistoryItem *item = append_item(view, 0, sender, time_str, content);
+    item->local_id = local_id;
+    item->state = CHAT_ROW_PENDING;
+}
+
+void chat_history_view_set_state(ChatHistoryView *view, uint32_t local_id, ChatRowState state) {
+    if (!view || local_id == 0) return;
+    gint64 index = find_local(view, local_id);
+    if (index < 0) return;
+    HistoryItem *item = &view->items[index];
+    if (item->state != state) {
+        item->state = state;
+        HistorySlot *slot = find_slot(view, (guint)index);
+        if (slot) {
+            gtk_label_set_markup(GTK_LABEL(slot->label), row_markup(view, item));
+            schedule_relayout(view); // The height may change
+        }
+    }
+}
+
+gboolean chat_history_view_confirm(ChatHistoryView *view, uint32_t local_id, uint64_t seq) {
+    if (!view || local_id == 0) return FALSE;
+    gint64 index = find_local(view, local_id);
+    if (index < 0) return FALSE;
+    HistoryItem *item = &view->items[index];
+    if (item->seq == seq) return TRUE; // Already placed
+
+    if (seq == 0 || seq_fits(view, (guint)index, seq)) {
+        item->seq = seq;
+        if (seq > view->last_seq) view->last_seq = seq;
+        chat_history_view_set_state(view, local_id, CHAT_ROW_SENT);
+        return TRUE;
+    }
+    // Messages posted meanwhile were sequenced before it: move it above them
+    HistoryItem moved = *item;
+    remove_item(view, (guint)index);
+    gboolean shown;
+    guint to = seq_position(view, seq, &shown);
+    if (!shown) {
+        item = insert_item(view, to, seq, moved.sender, moved.time, moved.content);
+        item->local_id = moved.local_id;
+    }
+    return TRUE;
+}
+
+void chat_history_view_prepend(ChatHistoryView *view, const ChatHistoryLine *lines, guint count) {
+    if (!view || count == 0) return;
+    // A full view keeps the newest of the page: the rest would be dropped first anyway
+    if (view->count + count > HISTORY_MAX_MESSAGES) {
+        guint room = view->count < HISTORY_MAX_MESSAGES ? HISTORY_MAX_MESSAGES - view->count : 0;
+        lines += count - room;
+        count = room;
+        if (count == 0) return;
+    }
+    reserve_items(view, view->count + count);
+
+    memmove(view->items + count, view->items, view->count * sizeof(HistoryItem));
+    memmove(view->heights + count, view->heights, view->count * sizeof(int));
+    int estimate = row_estimate(view);
+    for (guint i = 0; i < count; i++) {
+        set_item(view, &view->items[i], lines[i].seq, lines[i].sender, lines[i].time_str, lines[i].content);
+        view->heights[i] = -estimate;
+    }
+    view->count += count;
+    tree_rebuild(view);
+    shift_slots(view, 0, (int)count);
+
+    keep_viewport(view, (double)count * estimate);
+    schedule_relayout(view);
+}
+
+void chat_history_view_set_top_reached(ChatHistoryView *view, ChatHistoryTopFn fn, gpointer user_data) {
+    if (!view) return;
+    view->top_reached = fn;
+    view->top_data = user_data;
+}
+
+void chat_history_view_clear(ChatHistoryView *view) {
+    if (!view) return;
+    release_slots_outside(view, 0, 0);
+    view->count = 0;
+    view->last_seq = 0;
+    view->measured_sum = 0;
+    view->measured_count = 0;
+    view->stick_to_bottom = TRUE;
+    g_string_chunk_clear(view->strings);
+    schedule_relayout(view);
+}
+
+void chat_history_view_flush(ChatHistoryView *view) {
+    if (!view || view->relayout_id == 0) return;
+    g_source_remove(view->relayout_id);
+    view->relayout_id = 0;
+    relayout(view);
+}
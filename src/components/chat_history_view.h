@@ -0,0 +1,63 @@
+#ifndef CHAT_HISTORY_VIEW_H
+#define CHAT_HISTORY_VIEW_H
+
+#include <gtk/gtk.h>
+
+// Virtualized chat history: messages live in a compact array store and
+// labels exist only for the rows on screen (plus a margin). The labels are
+// recycled while scrolling, so a channel of 100k messages costs the same
+// number of widgets as a channel of 20.
+typedef struct ChatHistoryView ChatHistoryView;
+
+typedef enum {
+    CHAT_ROW_SENT,
+    CHAT_ROW_PENDING, // Sent from here, not yet acknowledged by the server
+    CHAT_ROW_FAILED,     // Rejected by the server or never sent
+    CHAT_ROW_UNCONFIRMED // The server couldn't tell whether it was taken; its echo confirms it
+} ChatRowState;
+
+ChatHistoryView* chat_history_view_new(void);
+void chat_history_view_free(ChatHistoryView *view);
+GtkWidget* chat_history_view_get_container(ChatHistoryView *view);
+
+// Add a message in seq order: at the bottom when it is the newest, among the
+// others when it arrived late (e.g. replayed into a hole); seq 0 goes to the
+// bottom. FALSE, and nothing is added, if that seq is already shown. The view
+// follows new messages unless the user scrolled up.
+// Text is repaired and escaped for markup when a row is shown, so raw input is fine.
+gboolean chat_history_view_insert(ChatHistoryView *view, uint64_t seq, const char *sender,
+                                  const char *time_str, const char *content);
+
+// Append a message sent from this client, not sequenced yet. It shows as
+// pending until chat_history_view_confirm places it or
+// chat_history_view_set_state marks it failed.
+void chat_history_view_append_local(ChatHistoryView *view, uint32_t local_id, const char *sender,
+                                    const char *time_str, const char *content);
+void chat_history_view_set_state(ChatHistoryView *view, uint32_t local_id, ChatRowState state);
+
+// The server sequenced a message sent from this client as seq: its row shows
+// as sent and moves to its place among the others. FALSE if it isn't shown.
+gboolean chat_history_view_confirm(ChatHistoryView *view, uint32_t local_id, uint64_t seq);
+
+// Older messages, inserted above the oldest one shown, oldest first. Rows on
+// screen stay where they are.
+typedef struct {
+    const char *sender;
+    const char *time_str;
+    const char *content;
+    uint64_t seq;
+} ChatHistoryLine;
+void chat_history_view_prepend(ChatHistoryView *view, const ChatHistoryLine *lines, guint count);
+
+// Called when the user scrolls up to (or tries to scroll past) the oldest
+// message shown, so the owner can fetch older ones
+typedef void (*ChatHistoryTopFn)(gpointer user_data);
+void chat_history_view_set_top_reached(ChatHistoryView *view, ChatHistoryTopFn fn, gpointer user_data);
+
+void chat_history_view_clear(ChatHistoryView *view);
+// Run a pending relayout now instead of from its idle, so a batch of
+// appends is laid out and scrolled once within the current frame
+void chat_history_view_flush(ChatHistoryView *view);
+guint chat_history_view_get_count(ChatHistoryView *view);
+
+#endif // CHAT_HISTORY_VIEW_H
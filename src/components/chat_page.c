@@ -4,7 +4,9 @@
 #include "../utils/string_utils.h"
 #include "../types/app_types.h"
 #include "chat_page.h"
+#include "search_panel.h"
 #include "../utils/chat_utils.h"
+#include "../utils/read_marker.h"
 #include <stdlib.h>
 #include <libpq-fe.h>
 
@@ -25,29 +27,8 @@ static void on_send_message(GtkButton *button, gpointer user_data) {
         return;
     }
     
-    // Store message in database
-    if (!store_message(page->app_widgets, message, page->app_widgets->current_channel_id)) {
-        return;
-    }
-    
-    // Update chat history immediately
-    update_chat_history(page->app_widgets, page->app_widgets->username, message, NULL);
-    
-    // Create and send message to server
-    ChatMessage chat_msg;
-    memset(&chat_msg, 0, sizeof(ChatMessage));
-    chat_msg.channel_id = page->app_widgets->current_channel_id;
-    strncpy(chat_msg.sender_username, page->app_widgets->username, sizeof(chat_msg.sender_username) - 1);
-    strncpy(chat_msg.content, message, sizeof(chat_msg.content) - 1);
-    
-    Message *msg = create_message(MSG_CHAT, &chat_msg, sizeof(ChatMessage));
-    if (!msg) return;
-    
-    if (send_message(page->app_widgets->server_socket, msg) < 0) {
-        show_error_dialog(page->app_widgets->window, "Failed to send message to server");
-    }
-    
-    free(msg);
+    // Shown at once as pending; the server's ack confirms it or marks it failed
+    send_chat_message(page->app_widgets, message);
     gtk_entry_set_text(GTK_ENTRY(page->chat_input), "");
 }
 
@@ -122,24 +103,19 @@ static void on_logout_button_clicked(GtkButton *button, gpointer user_data) {
     ChatPage *page = (ChatPage *)user_data;
     AppWidgets *widgets = page->app_widgets;
 
-    // Update user status to offline
-    update_user_status(widgets, widgets->username, "offline");
-
-    // Switch back to the login page
-    gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "login");
+    read_marker_flush(widgets);
 
-    // Optionally clear fields or reset state if needed
-    gtk_entry_set_text(GTK_ENTRY(widgets->username_entry), ""); // Clear username on login page
-    gtk_entry_set_text(GTK_ENTRY(widgets->password_entry), ""); // Clear password on login page
-    widgets->current_channel_id = 0; // Reset current channel
-    // Clear chat history display?
-    GtkListBox *list_box = GTK_LIST_BOX(widgets->chat_history);
-    GList *children = gtk_container_get_children(GTK_CONTAINER(list_box));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
+    // Tell the server; it marks us offline and stops sending us channel traffic
+    Message *logout_msg = create_message(MSG_LOGOUT, NULL, 0);
+    if (logout_msg) {
+        if (send_to_server(widgets, logout_msg) < 0) {
+            perror("Failed to send LOGOUT message");
+        }
+        free(logout_msg);
     }
-    g_list_free(children);
-    gtk_label_set_text(GTK_LABEL(widgets->channel_name), "# Select a channel"); // Reset channel name label
+
+    // Switch back to the login page
+    end_chat_session(widgets);
 }
 
 static void on_channel_selected(GtkListBox *list, GtkListBoxRow *row, gpointer user_data) {
@@ -160,41 +136,15 @@ static void on_channel_selected(GtkListBox *list, GtkListBoxRow *row, gpointer u
         return;
     }
     
-    // Update current channel ID locally
-    page->app_widgets->current_channel_id = new_channel_id;
-
-    // --- Notify server about the channel change --- //
-    printf("🚀 Sending JOIN_CHANNEL message for channel ID: %u\n", new_channel_id);
-    Message *join_msg = create_join_channel_message(new_channel_id);
-    if (join_msg) {
-        if (send_message(page->app_widgets->server_socket, join_msg) < 0) {
-            perror("Failed to send JOIN_CHANNEL message");
-            // Optionally show error to user?
-        }
-        free(join_msg);
-    } else {
-        fprintf(stderr, "Failed to create JOIN_CHANNEL message\n");
-    }
-    // --------------------------------------------- //
-    
-    // Update channel name label locally
-    char channel_id_str_verify[32];
-    snprintf(channel_id_str_verify, sizeof(channel_id_str_verify), "%u", new_channel_id);
-    const char *query = "SELECT name FROM channels WHERE channel_id = $1";
-    const char *params[1] = {channel_id_str_verify};
-    PGresult *res = PQexecParams(page->app_widgets->db_conn, query, 1, NULL, params, NULL, NULL, 0);
-    
-    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) {
-        const char *channel_name = PQgetvalue(res, 0, 0);
-        char label_text[128];
-        snprintf(label_text, sizeof(label_text), "# %s", channel_name);
-        gtk_label_set_text(GTK_LABEL(page->channel_name), label_text);
+    // Update channel name label locally from the row itself ("# name")
+    const char *title = g_object_get_data(G_OBJECT(row), "channel_title");
+    if (title) {
+        gtk_label_set_text(GTK_LABEL(page->channel_name), title);
     }
-    
-    PQclear(res);
-    
-    // Load channel history
-    load_channel_history(page->app_widgets, new_channel_id);
+
+    // Notify the server; it answers with a snapshot of the channel's recent history,
+    // so switching channels doesn't touch the database
+    join_channel(page->app_widgets, new_channel_id);
 }
 
 ChatPage* chat_page_new(AppWidgets *app_widgets) {
@@ -215,6 +165,10 @@ ChatPage* chat_page_new(AppWidgets *app_widgets) {
     
     page->chat_channels_list = gtk_list_box_new();
     gtk_widget_set_name(page->chat_channels_list, "channels-list");
+    gtk_list_box_set_sort_func(GTK_LIST_BOX(page->chat_channels_list), compare_list_rows, NULL, NULL);
+    GtkWidget *no_channels_label = gtk_label_new("No channels available");
+    gtk_widget_show(no_channels_label);
+    gtk_list_box_set_placeholder(GTK_LIST_BOX(page->chat_channels_list), no_channels_label);
     g_signal_connect(page->chat_channels_list, "row-selected", G_CALLBACK(on_channel_selected), page);
     
     GtkWidget *channels_scroll = gtk_scrolled_window_new(NULL, NULL);
@@ -230,6 +184,15 @@ ChatPage* chat_page_new(AppWidgets *app_widgets) {
     gtk_widget_set_margin_end(page->app_widgets->user_display_label, 10);
     gtk_box_pack_end(GTK_BOX(channels_box), page->app_widgets->user_display_label, FALSE, FALSE, 5); // Pack before logout
 
+    // Connection state, updated by apply_connection_state
+    page->app_widgets->connection_status = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(page->app_widgets->connection_status), "<span foreground='#43b581'>●</span> Connected");
+    gtk_widget_set_name(page->app_widgets->connection_status, "connection-status");
+    gtk_widget_set_halign(page->app_widgets->connection_status, GTK_ALIGN_START);
+    gtk_widget_set_margin_start(page->app_widgets->connection_status, 10);
+    gtk_widget_set_margin_end(page->app_widgets->connection_status, 10);
+    gtk_box_pack_end(GTK_BOX(channels_box), page->app_widgets->connection_status, FALSE, FALSE, 0);
+
     // Add Logout button at the bottom of the channels box
     page->logout_button = gtk_button_new_with_label("Logout");
     gtk_widget_set_name(page->logout_button, "logout-button");
@@ -244,20 +207,25 @@ ChatPage* chat_page_new(AppWidgets *app_widgets) {
     GtkWidget *chat_center_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
     gtk_widget_set_hexpand(chat_center_box, TRUE);
     
-    // Channel name
+    // Channel name, with message search at the other end of the header
+    GtkWidget *header_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
     page->channel_name = gtk_label_new("# Select a channel");
     gtk_widget_set_name(page->channel_name, "channel-name");
     gtk_widget_set_halign(page->channel_name, GTK_ALIGN_START);
     gtk_widget_set_margin_start(page->channel_name, 10);
-    gtk_box_pack_start(GTK_BOX(chat_center_box), page->channel_name, FALSE, FALSE, 10);
-    
-    // Chat history - Use GtkListBox
-    page->chat_history = gtk_list_box_new();
-    gtk_list_box_set_selection_mode(GTK_LIST_BOX(page->chat_history), GTK_SELECTION_NONE); // Disable row selection
-    gtk_widget_set_name(page->chat_history, "chat-history-list"); // New ID for CSS
+    gtk_box_pack_start(GTK_BOX(header_box), page->channel_name, FALSE, FALSE, 0);
+
+    page->search_panel = search_panel_new(app_widgets);
+    app_widgets->search_panel = page->search_panel;
+    GtkWidget *search_entry = search_panel_get_container(page->search_panel);
+    gtk_widget_set_margin_end(search_entry, 10);
+    gtk_box_pack_end(GTK_BOX(header_box), search_entry, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(chat_center_box), header_box, FALSE, FALSE, 10);
+    
+    // Chat history - virtualized, only the visible rows have widgets
+    page->chat_history = chat_history_view_new();
 
-    GtkWidget *history_scroll = gtk_scrolled_window_new(NULL, NULL);
-    gtk_container_add(GTK_CONTAINER(history_scroll), page->chat_history);
+    GtkWidget *history_scroll = chat_history_view_get_container(page->chat_history);
     gtk_widget_set_vexpand(history_scroll, TRUE);
     gtk_box_pack_start(GTK_BOX(chat_center_box), history_scroll, TRUE, TRUE, 0);
     
@@ -291,6 +259,7 @@ ChatPage* chat_page_new(AppWidgets *app_widgets) {
     
     page->contacts_list = gtk_list_box_new();
     gtk_widget_set_name(page->contacts_list, "contacts-list");
+    gtk_list_box_set_sort_func(GTK_LIST_BOX(page->contacts_list), compare_list_rows, NULL, NULL);
     
     GtkWidget *contacts_scroll = gtk_scrolled_window_new(NULL, NULL);
     gtk_container_add(GTK_CONTAINER(contacts_scroll), page->contacts_list);
@@ -306,6 +275,8 @@ ChatPage* chat_page_new(AppWidgets *app_widgets) {
 
 void chat_page_free(ChatPage *page) {
     if (page) {
+        chat_history_view_free(page->chat_history);
+        search_panel_free(page->search_panel);
         free(page);
     }
 }
@@ -3,16 +3,18 @@
 
 #include <gtk/gtk.h>
 #include "../types/app_types.h"
+#include "chat_history_view.h"
 
 typedef struct {
     AppWidgets *app_widgets;
     GtkWidget *container;
     GtkWidget *chat_input;
-    GtkWidget *chat_history;
+    ChatHistoryView *chat_history;
     GtkWidget *chat_channels_list;
     GtkWidget *contacts_list;
     GtkWidget *channel_name;
     GtkWidget *logout_button;
+    struct SearchPanel *search_panel;
 } ChatPage;
 
 ChatPage* chat_page_new(AppWidgets *app_widgets);
@@ -87,7 +87,7 @@ void on_login_button_clicked(GtkButton *button, gpointer user_data) {
             return;
         }
 
-        if (send_message(widgets->server_socket, msg) < 0) {
+        if (send_to_server(widgets, msg) < 0) {
             fprintf(stderr, "❌ Failed to send login request message\n");
             show_error_dialog(widgets->window, "Login failed: Could not send request to server");
         }
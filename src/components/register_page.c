@@ -51,7 +51,7 @@ static void on_register_button_clicked(GtkButton *button, gpointer user_data) {
         return;
     }
 
-    if (send_message(widgets->server_socket, msg) < 0) {
+    if (send_to_server(widgets, msg) < 0) {
         fprintf(stderr, "❌ Failed to send registration request message\n");
         show_error_dialog(widgets->window, "Registration failed: Could not send request to server");
     }
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "search_panel.h"
+#include "../utils/chat_utils.h"
+#include "../utils/utf8_markup.h"
+
+struct SearchPanel {
+    AppWidgets *app_widgets;
+    GtkWidget *entry;
+    GtkWidget *popover;
+    GtkWidget *results;     // One row per result
+    GtkWidget *status;      // "Searching…", "No messages found"
+    GtkWidget *more_button;
+    uint32_t request_id;    // Of the search on screen
+    char query[SEARCH_QUERY_MAX];
+    float last_rank;        // Cursor: the last result received
+    uint32_t last_message_id;
+};
+
+static void send_search(SearchPanel *panel) {
+    AppWidgets *widgets = panel->app_widgets;
+    if (widgets->connection_state != CONNECTION_ONLINE) {
+        gtk_label_set_text(GTK_LABEL(panel->status), "Not connected");
+        return;
+    }
+
+    SearchRequest request = {0};
+    request.request_id = panel->request_id;
+    request.after_rank = panel->last_rank;
+    request.after_message_id = panel->last_message_id;
+    memcpy(request.query, panel->query, sizeof(request.query));
+
+    Message *msg = create_message(MSG_SEARCH_REQUEST, &request, sizeof(request));
+    if (!msg) return;
+    if (send_to_server(widgets, msg) < 0) {
+        perror("Failed to send SEARCH_REQUEST message");
+        gtk_label_set_text(GTK_LABEL(panel->status), "Search failed");
+    }
+    free(msg);
+}
+
+static void on_search_activate(GtkEntry *entry, gpointer user_data) {
+    SearchPanel *panel = (SearchPanel *)user_data;
+    const char *text = gtk_entry_get_text(entry);
+    if (!text || !*text) return;
+
+    // A new search: earlier pages still in flight no longer match request_id
+    panel->request_id++;
+    g_strlcpy(panel->query, text, sizeof(panel->query));
+    panel->last_rank = 0;
+    panel->last_message_id = 0;
+
+    GList *children = gtk_container_get_children(GTK_CONTAINER(panel->results));
+    for (GList *iter = children; iter != NULL; iter = iter->next) {
+        gtk_widget_destroy(GTK_WIDGET(iter->data));
+    }
+    g_list_free(children);
+    gtk_widget_hide(panel->more_button);
+    gtk_label_set_text(GTK_LABEL(panel->status), "Searching…");
+    gtk_widget_show(panel->status);
+    gtk_popover_popup(GTK_POPOVER(panel->popover));
+
+    send_search(panel);
+}
+
+static void on_more_clicked(GtkButton *button, gpointer user_data) {
+    (void)button;
+    SearchPanel *panel = (SearchPanel *)user_data;
+    gtk_widget_hide(panel->more_button);
+    send_search(panel);
+}
+
+// Open the channel of the result
+static void on_result_activated(GtkListBox *box, GtkListBoxRow *row, gpointer user_data) {
+    (void)box;
+    SearchPanel *panel = (SearchPanel *)user_data;
+    AppWidgets *widgets = panel->app_widgets;
+    uint32_t channel_id = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "channel_id"));
+    GtkWidget *channel_row = g_hash_table_lookup(widgets->channel_rows, GUINT_TO_POINTER(channel_id));
+    if (channel_row) {
+        // Selecting the row switches channels, as a click would
+        gtk_list_box_select_row(GTK_LIST_BOX(widgets->chat_channels_list), GTK_LIST_BOX_ROW(channel_row));
+    }
+    gtk_popover_popdown(GTK_POPOVER(panel->popover));
+}
+
+static void add_result_row(SearchPanel *panel, const SearchResultEntry *entry, const char *sender, const char *content) {
+    AppWidgets *widgets = panel->app_widgets;
+
+    GtkWidget *channel_row = g_hash_table_lookup(widgets->channel_rows, GUINT_TO_POINTER(entry->channel_id));
+    const char *channel_title = channel_row ? g_object_get_data(G_OBJECT(channel_row), "channel_title") : NULL;
+
+    char email[256];
+    memcpy(email, sender, entry->sender_len);
+    email[entry->sender_len] = '\0';
+    char display_name[128];
+    get_display_name(widgets, email, display_name, sizeof(display_name));
+
+    time_t sent_at = (time_t)entry->sent_at;
+    char time_str[32];
+    strftime(time_str, sizeof(time_str), "%d/%m %H:%M", localtime(&sent_at));
+
+    char *head = g_markup_printf_escaped("<b>%s</b>  %s  <span foreground='grey' size='small'>%s</span>\n",
+                                         channel_title ? channel_title : "#?", display_name, time_str);
+    size_t snippet_size = UTF8_MARKUP_MAX_OUTPUT(entry->content_len);
+    char *snippet = g_malloc(snippet_size);
+    utf8_markup_copy(content, entry->content_len, snippet, snippet_size, true);
+    char *markup = g_strconcat(head, snippet, NULL);
+
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(label), markup);
+    gtk_label_set_line_wrap(GTK_LABEL(label), TRUE);
+    gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+    gtk_widget_set_margin_start(label, 6);
+    gtk_widget_set_margin_end(label, 6);
+    gtk_widget_set_margin_top(label, 4);
+    gtk_widget_set_margin_bottom(label, 4);
+
+    GtkWidget *row = gtk_list_box_row_new();
+    gtk_container_add(GTK_CONTAINER(row), label);
+    g_object_set_data(G_OBJECT(row), "channel_id", GUINT_TO_POINTER(entry->channel_id));
+    gtk_list_box_insert(GTK_LIST_BOX(panel->results), row, -1);
+    gtk_widget_show_all(row);
+
+    g_free(markup);
+    g_free(snippet);
+    g_free(head);
+}
+
+gboolean apply_search_results(gpointer data) {
+    SearchResultsData *results_data = (SearchResultsData *)data;
+    SearchPanel *panel = results_data->widgets->search_panel;
+
+    SearchResultsHeader header;
+    memcpy(&header, results_data->payload, sizeof(header));
+    if (!panel || header.request_id != panel->request_id) {
+        free(results_data);
+        return G_SOURCE_REMOVE;
+    }
+
+    size_t offset = sizeof(SearchResultsHeader);
+    SearchResultEntry entry;
+    const char *sender, *content;
+    uint16_t added = 0;
+    while (added < header.count &&
+           search_result_next_entry(results_data->payload, results_data->length, &offset, &entry, &sender, &content)) {
+        add_result_row(panel, &entry, sender, content);
+        panel->last_rank = entry.rank;
+        panel->last_message_id = entry.message_id;
+        added++;
+    }
+
+    if (added == 0 && panel->last_message_id == 0) {
+        gtk_label_set_text(GTK_LABEL(panel->status), "No messages found");
+    } else {
+        gtk_widget_hide(panel->status);
+    }
+    gtk_widget_set_visible(panel->more_button, (header.flags & SEARCH_MORE) && panel->last_message_id != 0);
+
+    free(results_data);
+    return G_SOURCE_REMOVE;
+}
+
+SearchPanel* search_panel_new(AppWidgets *app_widgets) {
+    SearchPanel *panel = calloc(1, sizeof(SearchPanel));
+    if (!panel) return NULL;
+    panel->app_widgets = app_widgets;
+
+    panel->entry = gtk_search_entry_new();
+    gtk_widget_set_name(panel->entry, "search-entry");
+    gtk_entry_set_placeholder_text(GTK_ENTRY(panel->entry), "Search messages");
+    gtk_entry_set_max_length(GTK_ENTRY(panel->entry), SEARCH_QUERY_MAX - 1);
+    gtk_widget_set_size_request(panel->entry, 260, -1);
+    g_signal_connect(panel->entry, "activate", G_CALLBACK(on_search_activate), panel);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+    gtk_container_set_border_width(GTK_CONTAINER(box), 6);
+
+    panel->status = gtk_label_new(NULL);
+    gtk_box_pack_start(GTK_BOX(box), panel->status, FALSE, FALSE, 0);
+
+    panel->results = gtk_list_box_new();
+    gtk_widget_set_name(panel->results, "search-results");
+    g_signal_connect(panel->results, "row-activated", G_CALLBACK(on_result_activated), panel);
+    GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_widget_set_size_request(scroll, 420, 360);
+    gtk_container_add(GTK_CONTAINER(scroll), panel->results);
+    gtk_box_pack_start(GTK_BOX(box), scroll, TRUE, TRUE, 0);
+
+    panel->more_button = gtk_button_new_with_label("More results");
+    g_signal_connect(panel->more_button, "clicked", G_CALLBACK(on_more_clicked), panel);
+    gtk_box_pack_start(GTK_BOX(box), panel->more_button, FALSE, FALSE, 0);
+    gtk_widget_set_no_show_all(panel->more_button, TRUE);
+
+    panel->popover = gtk_popover_new(panel->entry);
+    gtk_popover_set_position(GTK_POPOVER(panel->popover), GTK_POS_BOTTOM);
+    gtk_container_add(GTK_CONTAINER(panel->popover), box);
+    gtk_widget_show_all(box);
+
+    return panel;
+}
+
+void search_panel_free(SearchPanel *panel) {
+    free(panel);
+}
+
+GtkWidget* search_panel_get_container(SearchPanel *panel) {
+    return panel->entry;
+}
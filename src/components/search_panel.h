@@ -0,0 +1,19 @@
+#ifndef SEARCH_PANEL_H
+#define SEARCH_PANEL_H
+
+#include <gtk/gtk.h>
+#include "../types/app_types.h"
+
+// Message search: an entry above the chat history and a popover listing the
+// results, a page at a time. Activating a result opens its channel.
+typedef struct SearchPanel SearchPanel;
+
+SearchPanel* search_panel_new(AppWidgets *app_widgets);
+void search_panel_free(SearchPanel *panel);
+GtkWidget* search_panel_get_container(SearchPanel *panel);
+
+// Apply one MSG_SEARCH_RESULTS frame (a SearchResultsData); pages of an
+// earlier search are dropped
+gboolean apply_search_results(gpointer data);
+
+#endif // SEARCH_PANEL_H
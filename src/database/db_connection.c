@@ -1,9 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <libpq-fe.h>
 #include "../config/env_loader.h"
 #include "db_connection.h"
 
+// Connection string for host:port with the database and credentials of the
+// primary. False if the string doesn't fit.
+static bool build_conninfo(char *out, size_t size, const char *host, const char *port) {
+    const char *dbname = getenv("PG_DB"), *user = getenv("PG_USER"), *password = getenv("PG_PASSWORD");
+    int written = snprintf(out, size, "host=%s port=%s dbname=%s user=%s password=%s sslmode=prefer",
+                           host, port ? port : "5432", dbname ? dbname : "", user ? user : "", password ? password : "");
+    if (written < 0 || (size_t)written >= size) {
+        fprintf(stderr, "❌ Connection settings for %s are too long\n", host);
+        return false;
+    }
+    return true;
+}
+
 PGconn* connect_to_db() {
     const char *host = getenv("PG_HOST");
     const char *port = getenv("PG_PORT");
@@ -54,9 +70,7 @@ PGconn* connect_to_db() {
     }
 
     char conninfo[512];
-    snprintf(conninfo, sizeof(conninfo),
-             "host=%s port=%s dbname=%s user=%s password=%s sslmode=prefer",
-             host, port, dbname, user, password);
+    build_conninfo(conninfo, sizeof(conninfo), host, port);
 
     PGconn *conn = PQconnectdb(conninfo);
 
@@ -68,4 +82,208 @@ PGconn* connect_to_db() {
 
     printf("✅ Connected to database successfully.\n");
     return conn;
-}
\ No newline at end of file
+}
+
+// --- Read replicas ---
+
+typedef struct {
+    int number;             // Position in PG_REPLICAS, from 1, for the logs
+    char conninfo[512];
+    PGconn *conn;
+    pthread_mutex_t mutex;  // Held by whoever is using conn
+    bool up;                // Connected and answering
+    bool lagging;           // Up, but further behind than the pool allows
+    time_t checked_at;      // Last lag check
+    time_t retry_at;        // While down: next reconnect attempt
+} Replica;
+
+struct DbReplicaPool {
+    Replica replicas[DB_REPLICA_MAX];
+    int count;
+    int max_lag_ms;
+    atomic_uint next;       // Round-robin start
+};
+
+// How far behind the primary the connection is, in ms; -1 if it doesn't
+// answer. A replica that is streaming and has replayed all it received is not
+// behind, however old its last transaction; a server that isn't a replica
+// never is. One whose WAL receiver is not streaming can't tell what it is
+// missing, so it counts as behind by the age of its last replayed
+// transaction. (Without pg_read_all_stats the receiver's status reads as
+// NULL; then a running receiver is taken to be streaming.)
+static int replica_lag_ms(PGconn *conn) {
+    PGresult *res = PQexec(conn,
+        "SELECT CASE WHEN NOT pg_is_in_recovery() THEN 0"
+        " WHEN pg_last_wal_receive_lsn() = pg_last_wal_replay_lsn() AND EXISTS"
+        "   (SELECT 1 FROM pg_stat_wal_receiver WHERE COALESCE(status, 'streaming') = 'streaming') THEN 0"
+        " ELSE LEAST(COALESCE(EXTRACT(EPOCH FROM now() - pg_last_xact_replay_timestamp()) * 1000, 2147483647),"
+        "   2147483647) END::int");
+    int lag = -1;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) lag = atoi(PQgetvalue(res, 0, 0));
+    PQclear(res);
+    return lag;
+}
+
+static void mark_down(Replica *replica, time_t now) {
+    if (replica->up) fprintf(stderr, "⚠️ Read replica %d is down: %s\n", replica->number, PQerrorMessage(replica->conn));
+    replica->up = false;
+    replica->retry_at = now + DB_REPLICA_RETRY_S;
+}
+
+// A replica that is down must not hold a reader up for long. The DSN's own
+// connect_timeout, if it has one, comes later and wins.
+static PGconn *replica_connect(const Replica *replica) {
+    char timeout[16];
+    snprintf(timeout, sizeof(timeout), "%d", DB_REPLICA_CONNECT_TIMEOUT_S);
+    const char *const keywords[] = {"connect_timeout", "dbname", NULL};
+    const char *const values[] = {timeout, replica->conninfo, NULL};
+    return PQconnectdbParams(keywords, values, 1);
+}
+
+// Under replica->mutex. Reconnects a replica that is due for it and checks
+// the lag of one that hasn't been checked lately. The mutex is let go while
+// connecting, so readers queued on it move on to another replica or the
+// primary instead of waiting out the connect.
+static bool replica_usable(DbReplicaPool *pool, Replica *replica) {
+    time_t now = time(NULL);
+    if (!replica->up) {
+        if (now < replica->retry_at) return false;
+        replica->retry_at = now + DB_REPLICA_RETRY_S; // Nobody else tries meanwhile
+        PGconn *old = replica->conn;
+        replica->conn = NULL;
+        pthread_mutex_unlock(&replica->mutex);
+        PQfinish(old);
+        PGconn *conn = replica_connect(replica);
+        pthread_mutex_lock(&replica->mutex);
+        replica->conn = conn;
+        if (PQstatus(replica->conn) != CONNECTION_OK) {
+            replica->retry_at = time(NULL) + DB_REPLICA_RETRY_S;
+            return false;
+        }
+        now = time(NULL);
+        replica->up = true;
+        replica->checked_at = 0;
+    }
+    if (now - replica->checked_at >= DB_REPLICA_CHECK_S) {
+        replica->checked_at = now;
+        int lag = replica_lag_ms(replica->conn);
+        if (lag < 0) {
+            mark_down(replica, now);
+            return false;
+        }
+        bool lagging = lag > pool->max_lag_ms;
+        if (lagging != replica->lagging) {
+            if (lagging) printf("🐢 Read replica %d is %d ms behind, reading elsewhere\n", replica->number, lag);
+            else printf("✅ Read replica %d caught up\n", replica->number);
+        }
+        replica->lagging = lagging;
+    }
+    return !replica->lagging;
+}
+
+DbReplicaPool* db_replicas_open(void) {
+    const char *list = getenv("PG_REPLICAS");
+    if (!list || !*list) return NULL;
+    DbReplicaPool *pool = calloc(1, sizeof(DbReplicaPool));
+    if (!pool) return NULL;
+    const char *max_lag = getenv("PG_REPLICA_MAX_LAG_MS");
+    pool->max_lag_ms = max_lag && *max_lag ? atoi(max_lag) : DEFAULT_REPLICA_MAX_LAG_MS;
+
+    for (const char *next = list; *next; ) {
+        const char *comma = strchr(next, ',');
+        size_t length = comma ? (size_t)(comma - next) : strlen(next);
+        char entry[512];
+        snprintf(entry, sizeof(entry), "%.*s", (int)length, next);
+        next += comma ? length + 1 : length;
+
+        char *start = entry;
+        while (*start == ' ') start++;
+        for (char *end = start + strlen(start); end > start && end[-1] == ' '; ) *--end = '\0';
+        if (!*start) continue;
+        if (pool->count == DB_REPLICA_MAX) {
+            fprintf(stderr, "⚠️ Only the first %d read replicas are used\n", DB_REPLICA_MAX);
+            break;
+        }
+        Replica *replica = &pool->replicas[pool->count];
+        if (strchr(start, '=') || strstr(start, "://")) {
+            snprintf(replica->conninfo, sizeof(replica->conninfo), "%s", start);
+        } else {
+            char *port = strrchr(start, ':');
+            if (port) *port++ = '\0';
+            if (!build_conninfo(replica->conninfo, sizeof(replica->conninfo), start, port ? port : getenv("PG_PORT"))) continue;
+        }
+        replica->number = pool->count + 1;
+        pthread_mutex_init(&replica->mutex, NULL);
+        pool->count++;
+    }
+    if (pool->count == 0) {
+        free(pool);
+        return NULL;
+    }
+
+    int up = 0;
+    for (int i = 0; i < pool->count; i++) {
+        pthread_mutex_lock(&pool->replicas[i].mutex);
+        if (replica_usable(pool, &pool->replicas[i])) up++;
+        pthread_mutex_unlock(&pool->replicas[i].mutex);
+    }
+    printf("✅ %d of %d read replicas available\n", up, pool->count);
+    return pool;
+}
+
+void db_replicas_close(DbReplicaPool *pool) {
+    if (!pool) return;
+    for (int i = 0; i < pool->count; i++) {
+        PQfinish(pool->replicas[i].conn);
+        pthread_mutex_destroy(&pool->replicas[i].mutex);
+    }
+    free(pool);
+}
+
+PGconn* db_replica_acquire(DbReplicaPool *pool) {
+    if (!pool) return NULL;
+    unsigned start = atomic_fetch_add_explicit(&pool->next, 1, memory_order_relaxed);
+    // First a replica nobody is using, then whichever is next in turn
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < pool->count; i++) {
+            Replica *replica = &pool->replicas[(start + (unsigned)i) % (unsigned)pool->count];
+            if (pass == 0) {
+                if (pthread_mutex_trylock(&replica->mutex) != 0) continue;
+            } else {
+                pthread_mutex_lock(&replica->mutex);
+            }
+            if (replica_usable(pool, replica)) return replica->conn; // Stays locked
+            pthread_mutex_unlock(&replica->mutex);
+        }
+    }
+    return NULL;
+}
+
+void db_replica_release(DbReplicaPool *pool, PGconn *conn, bool failed) {
+    for (int i = 0; i < pool->count; i++) {
+        Replica *replica = &pool->replicas[i];
+        if (replica->conn != conn) continue;
+        if (failed) {
+            if (PQstatus(conn) != CONNECTION_OK) mark_down(replica, time(NULL));
+            else replica->checked_at = 0; // Answering but failing, perhaps behind on the schema
+        }
+        pthread_mutex_unlock(&replica->mutex);
+        return;
+    }
+}
+
+PGresult* db_exec_read(DbReplicaPool *pool, PGconn *primary, pthread_mutex_t *primary_mutex,
+                       const char *query, int n_params, const char *const *params) {
+    PGconn *replica = db_replica_acquire(pool);
+    if (replica) {
+        PGresult *res = PQexecParams(replica, query, n_params, NULL, params, NULL, NULL, 0);
+        bool ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+        db_replica_release(pool, replica, !ok);
+        if (ok) return res;
+        PQclear(res);
+    }
+    if (primary_mutex) pthread_mutex_lock(primary_mutex);
+    PGresult *res = PQexecParams(primary, query, n_params, NULL, params, NULL, NULL, 0);
+    if (primary_mutex) pthread_mutex_unlock(primary_mutex);
+    return res;
+}
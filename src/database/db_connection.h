@@ -1,8 +1,43 @@
 #ifndef DB_CONNECTION_H
 #define DB_CONNECTION_H
 
+#include <stdbool.h>
+#include <pthread.h>
 #include <libpq-fe.h>
 
+// The primary: every write, and the reads that must see one
 PGconn* connect_to_db();
 
-#endif
\ No newline at end of file
+// Read replicas, listed in PG_REPLICAS separated by commas. An entry is a
+// full DSN (key=value pairs or a postgresql:// URI) or just host[:port],
+// which uses the primary's PG_DB, PG_USER and PG_PASSWORD. Reads that can
+// tolerate some lag go round-robin to the replicas that answer and are no
+// further behind than PG_REPLICA_MAX_LAG_MS; with none left they go to the
+// primary.
+
+#define DB_REPLICA_MAX 8
+#define DEFAULT_REPLICA_MAX_LAG_MS 5000
+// How often a replica's lag is checked, and how long one that failed is left alone
+#define DB_REPLICA_CHECK_S 5
+#define DB_REPLICA_RETRY_S 10
+// Connection timeout of the replicas, unless their DSN sets one
+#define DB_REPLICA_CONNECT_TIMEOUT_S 2
+
+typedef struct DbReplicaPool DbReplicaPool;
+
+// NULL when PG_REPLICAS is not set. Replicas that can't be reached yet are retried later.
+DbReplicaPool* db_replicas_open(void);
+void db_replicas_close(DbReplicaPool *pool);
+
+// A replica connection, locked for the caller until db_replica_release.
+// NULL when pool is NULL or no replica is usable: read from the primary.
+PGconn* db_replica_acquire(DbReplicaPool *pool);
+// failed: the caller's query failed, the replica is checked before its next use
+void db_replica_release(DbReplicaPool *pool, PGconn *conn, bool failed);
+
+// Runs a lag-tolerant read on a replica, or on primary (under primary_mutex,
+// if given) when no replica can answer it
+PGresult* db_exec_read(DbReplicaPool *pool, PGconn *primary, pthread_mutex_t *primary_mutex,
+                       const char *query, int n_params, const char *const *params);
+
+#endif
@@ -1,6 +1,10 @@
 -- CREATE DATABASE db_discord;
 -- \c db_discord;
 
+-- Baseline schema. Later changes (sequence numbers, read state, search,
+-- monthly partitions of messages...) are versioned migrations in
+-- src/database/migrations.c, applied by the server when it starts.
+
 CREATE TABLE users (
                        user_id SERIAL PRIMARY KEY,
                        first_name VARCHAR(50),
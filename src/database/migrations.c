@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "migrations.h"
+
+// Arbitrary key for pg_advisory_lock, shared by every server of a database
+#define MIGRATION_LOCK_KEY "5802001"
+
+typedef struct {
+    int version;
+    const char *name;
+    const char *sql;
+} Migration;
+
+// Append only: a migration that has shipped is never edited, a fix is a new
+// migration. Statements use IF NOT EXISTS where databases created from a
+// development snapshot of db_discord.sql may already have the change.
+static const Migration migrations[] = {
+    {1, "message sequence numbers and read state",
+     // Per-channel sequence numbers let resuming clients ask for "everything after seq N"
+     "ALTER TABLE messages ADD COLUMN IF NOT EXISTS seq BIGINT;"
+     "CREATE INDEX IF NOT EXISTS idx_messages_channel_seq ON messages (channel_id, seq);"
+     // Newest message of each channel, kept up to date by the server as it stores messages
+     "CREATE TABLE IF NOT EXISTS channel_summary ("
+     "  channel_id INTEGER PRIMARY KEY REFERENCES channels(channel_id) ON DELETE CASCADE,"
+     "  last_message_id INTEGER,"
+     "  last_seq BIGINT NOT NULL DEFAULT 0,"
+     "  last_activity TIMESTAMP"
+     ");"
+     // How far each user has read each channel. Unread count = last_seq - last_read_seq,
+     // so the channel list never counts messages.
+     "CREATE TABLE IF NOT EXISTS channel_read_state ("
+     "  user_id INTEGER REFERENCES users(user_id) ON DELETE CASCADE,"
+     "  channel_id INTEGER REFERENCES channels(channel_id) ON DELETE CASCADE,"
+     "  last_read_message_id INTEGER,"
+     "  last_read_seq BIGINT NOT NULL DEFAULT 0,"
+     "  updated_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,"
+     "  PRIMARY KEY (user_id, channel_id)"
+     ");"
+     "INSERT INTO channel_summary (channel_id, last_message_id, last_seq, last_activity)"
+     "  SELECT DISTINCT ON (channel_id) channel_id, message_id, seq, timestamp FROM messages"
+     "  WHERE seq IS NOT NULL ORDER BY channel_id, seq DESC "
+     "ON CONFLICT (channel_id) DO NOTHING;"},
+
+    {2, "full-text search",
+     // Search terms, kept up to date by PostgreSQL. 'simple' because
+     // conversations mix languages: no stemming, no stop words.
+     "ALTER TABLE messages ADD COLUMN IF NOT EXISTS content_tsv tsvector"
+     "  GENERATED ALWAYS AS (to_tsvector('simple', content)) STORED;"
+     "CREATE INDEX IF NOT EXISTS idx_messages_content_tsv ON messages USING GIN (content_tsv);"},
+
+    {3, "monthly message partitions",
+     // messages becomes range-partitioned by month, one table per month named
+     // messages_YYYY_MM. The partition key must be part of the primary key, and
+     // a foreign key can't point at message_id alone any more: reactions, files
+     // and mentions keep their message_id without the constraint.
+     "ALTER TABLE reactions DROP CONSTRAINT IF EXISTS reactions_message_id_fkey;"
+     "ALTER TABLE files DROP CONSTRAINT IF EXISTS files_message_id_fkey;"
+     "ALTER TABLE mentions DROP CONSTRAINT IF EXISTS mentions_message_id_fkey;"
+     "ALTER TABLE messages RENAME TO messages_unpartitioned;"
+     "ALTER INDEX messages_pkey RENAME TO messages_unpartitioned_pkey;"
+     "DROP INDEX IF EXISTS idx_messages_channel_seq;"
+     "DROP INDEX IF EXISTS idx_messages_content_tsv;"
+     "CREATE TABLE messages ("
+     "  message_id INTEGER NOT NULL DEFAULT nextval('messages_message_id_seq'),"
+     "  channel_id INTEGER REFERENCES channels(channel_id) ON DELETE CASCADE,"
+     "  sender_id INTEGER REFERENCES users(user_id) ON DELETE SET NULL,"
+     "  content TEXT NOT NULL,"
+     "  timestamp TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP,"
+     "  seq BIGINT,"
+     "  content_tsv tsvector GENERATED ALWAYS AS (to_tsvector('simple', content)) STORED,"
+     "  PRIMARY KEY (message_id, timestamp)"
+     ") PARTITION BY RANGE (timestamp);"
+     "ALTER SEQUENCE messages_message_id_seq OWNED BY messages.message_id;"
+
+     // Create the partitions from first_month up to months_ahead months past
+     // the current one. Returns how many were missing.
+     "CREATE OR REPLACE FUNCTION create_message_partitions(first_month DATE, months_ahead INTEGER)"
+     "  RETURNS INTEGER AS $$ "
+     "DECLARE"
+     "  part_month DATE := date_trunc('month', first_month)::date;"
+     "  last_month DATE := (date_trunc('month', CURRENT_DATE) + make_interval(months => months_ahead))::date;"
+     "  part_name TEXT;"
+     "  created INTEGER := 0;"
+     "BEGIN"
+     "  WHILE part_month <= last_month LOOP"
+     "    part_name := 'messages_' || to_char(part_month, 'YYYY_MM');"
+     "    IF to_regclass(part_name) IS NULL THEN"
+     "      EXECUTE format('CREATE TABLE %I PARTITION OF messages FOR VALUES FROM (%L) TO (%L)',"
+     "                     part_name, part_month, (part_month + INTERVAL '1 month')::date);"
+     "      created := created + 1;"
+     "    END IF;"
+     "    part_month := (part_month + INTERVAL '1 month')::date;"
+     "  END LOOP;"
+     "  RETURN created;"
+     "END $$ LANGUAGE plpgsql;"
+
+     // Detach every monthly partition that ends on or before cutoff. The
+     // tables are kept, out of the way of queries, to be archived or dropped.
+     "CREATE OR REPLACE FUNCTION detach_message_partitions(cutoff DATE)"
+     "  RETURNS SETOF TEXT AS $$ "
+     "DECLARE"
+     "  part_name TEXT;"
+     "BEGIN"
+     "  FOR part_name IN"
+     "    SELECT c.relname FROM pg_inherits i JOIN pg_class c ON c.oid = i.inhrelid"
+     "    WHERE i.inhparent = 'messages'::regclass AND c.relname ~ '^messages_[0-9]{4}_[0-9]{2}$'"
+     "      AND to_date(substr(c.relname, 10), 'YYYY_MM') + INTERVAL '1 month' <= cutoff"
+     "    ORDER BY c.relname"
+     "  LOOP"
+     "    EXECUTE format('ALTER TABLE messages DETACH PARTITION %I', part_name);"
+     "    RETURN NEXT part_name;"
+     "  END LOOP;"
+     "END $$ LANGUAGE plpgsql;"
+
+     "SELECT create_message_partitions("
+     "  COALESCE((SELECT min(timestamp) FROM messages_unpartitioned), CURRENT_TIMESTAMP)::date, 1);"
+     "INSERT INTO messages (message_id, channel_id, sender_id, content, timestamp, seq)"
+     "  SELECT message_id, channel_id, sender_id, content, COALESCE(timestamp, CURRENT_TIMESTAMP), seq"
+     "  FROM messages_unpartitioned;"
+     "DROP TABLE messages_unpartitioned;"
+     // Created on the parent after the copy, so every partition gets its own
+     // copy of each index, the ones created later included
+     "CREATE INDEX idx_messages_channel_time ON messages (channel_id, timestamp, message_id);"
+     "CREATE INDEX idx_messages_channel_seq ON messages (channel_id, seq);"
+     "CREATE INDEX idx_messages_content_tsv ON messages USING GIN (content_tsv);"},
+
+    {4, "channel retention",
+     // Days of history each channel keeps; NULL follows the server default
+     "ALTER TABLE channels ADD COLUMN IF NOT EXISTS retention_days INTEGER CHECK (retention_days > 0);"
+     // The purge removes the rows hanging off each batch of messages by message_id
+     "CREATE INDEX IF NOT EXISTS idx_reactions_message ON reactions (message_id);"
+     "CREATE INDEX IF NOT EXISTS idx_files_message ON files (message_id);"
+     "CREATE INDEX IF NOT EXISTS idx_mentions_message ON mentions (message_id);"},
+
+    {5, "archive segments",
+     // Cold history moved out of messages into segment files (src/server/archive.c).
+     // path is relative to ARCHIVE_DIR.
+     "CREATE TABLE IF NOT EXISTS archive_segments ("
+     "  segment_id SERIAL PRIMARY KEY,"
+     "  channel_id INTEGER NOT NULL REFERENCES channels(channel_id) ON DELETE CASCADE,"
+     "  first_message_id INTEGER NOT NULL,"
+     "  last_message_id INTEGER NOT NULL,"
+     "  first_seq BIGINT NOT NULL,"
+     "  last_seq BIGINT NOT NULL,"
+     "  last_sent_at TIMESTAMP NOT NULL,"
+     "  message_count INTEGER NOT NULL,"
+     "  path TEXT NOT NULL,"
+     "  created_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+     ");"
+     "CREATE INDEX IF NOT EXISTS idx_archive_segments_seq ON archive_segments (channel_id, first_seq);"
+     "CREATE INDEX IF NOT EXISTS idx_archive_segments_message ON archive_segments (channel_id, first_message_id, last_message_id);"},
+
+    {6, "idempotent message ingest",
+     // Messages reach the table from the ingest log (src/server/ingest_log.c),
+     // which may ship a batch again after a crash: a message is identified by
+     // its channel and seq, so the repeat is skipped. The partition key has to
+     // be part of a unique index.
+     "CREATE UNIQUE INDEX IF NOT EXISTS idx_messages_channel_seq_unique ON messages (channel_id, seq, timestamp);"
+     "DROP INDEX IF EXISTS idx_messages_channel_seq;"},
+
+    {7, "membership versions",
+     // Every user is made a member of every channel, once. Each channel is
+     // stamped with the value of a counter bumped as it is created, and each
+     // user remembers the counter at their last sync, so a sync only looks at
+     // the channels created since, and at nothing when there are none. The
+     // counter row stays locked until the creating transaction commits: a
+     // sync that reads version N sees every channel stamped up to N.
+     "CREATE TABLE IF NOT EXISTS membership_version ("
+     "  singleton BOOLEAN PRIMARY KEY DEFAULT TRUE CHECK (singleton),"
+     "  version BIGINT NOT NULL"
+     ");"
+     "INSERT INTO membership_version (singleton, version) VALUES (TRUE, 1) ON CONFLICT DO NOTHING;"
+     "ALTER TABLE channels ADD COLUMN IF NOT EXISTS membership_version BIGINT NOT NULL DEFAULT 1;"
+     "ALTER TABLE users ADD COLUMN IF NOT EXISTS channels_synced_version BIGINT NOT NULL DEFAULT 0;"
+     "CREATE INDEX IF NOT EXISTS idx_channels_membership_version ON channels (membership_version);"
+
+     "CREATE OR REPLACE FUNCTION stamp_channel_membership_version() RETURNS TRIGGER AS $$ "
+     "BEGIN"
+     "  UPDATE membership_version SET version = version + 1 RETURNING version INTO NEW.membership_version;"
+     "  RETURN NEW;"
+     "END $$ LANGUAGE plpgsql;"
+     "DROP TRIGGER IF EXISTS channels_membership_version ON channels;"
+     "CREATE TRIGGER channels_membership_version BEFORE INSERT ON channels"
+     "  FOR EACH ROW EXECUTE FUNCTION stamp_channel_membership_version();"
+
+     // Adds uid to the channels created since its last sync, in one
+     // statement. Returns the memberships added.
+     "CREATE OR REPLACE FUNCTION sync_user_channels(uid INTEGER) RETURNS INTEGER AS $$ "
+     "DECLARE"
+     "  latest BIGINT;"
+     "  synced BIGINT;"
+     "  added INTEGER;"
+     "BEGIN"
+     "  SELECT version INTO latest FROM membership_version;"
+     "  SELECT channels_synced_version INTO synced FROM users WHERE user_id = uid;"
+     "  IF synced IS NULL OR synced >= latest THEN"
+     "    RETURN 0;"
+     "  END IF;"
+     "  INSERT INTO user_channels (user_id, channel_id, role_id)"
+     "    SELECT uid, channel_id, 1 FROM channels"
+     "    WHERE membership_version > synced AND membership_version <= latest"
+     "    ON CONFLICT DO NOTHING;"
+     "  GET DIAGNOSTICS added = ROW_COUNT;"
+     "  UPDATE users SET channels_synced_version = latest"
+     "    WHERE user_id = uid AND channels_synced_version < latest;"
+     "  RETURN added;"
+     "END $$ LANGUAGE plpgsql;"},
+
+    {8, "cache invalidation notifications",
+     // Every server process caches memberships and sessions; writes made by
+     // one process (or by hand) are announced on the cache_invalidation
+     // channel so the others drop or patch their copies (src/server/invalidation.c).
+     // Payloads: "m+:<user>:<channel>:<role>", "m-:<user>:<channel>",
+     // "c-:<channel>" and "u:<user>". NOTIFY is delivered at commit, so
+     // listeners never see a change that was rolled back.
+     "CREATE OR REPLACE FUNCTION notify_user_channels_change() RETURNS TRIGGER AS $$ "
+     "BEGIN"
+     "  IF TG_OP <> 'INSERT' THEN"
+     "    IF TG_OP = 'DELETE' OR OLD.user_id <> NEW.user_id OR OLD.channel_id <> NEW.channel_id THEN"
+     "      PERFORM pg_notify('cache_invalidation', 'm-:' || OLD.user_id || ':' || OLD.channel_id);"
+     "    END IF;"
+     "  END IF;"
+     "  IF TG_OP <> 'DELETE' THEN"
+     "    PERFORM pg_notify('cache_invalidation',"
+     "      'm+:' || NEW.user_id || ':' || NEW.channel_id || ':' || COALESCE(NEW.role_id, 0));"
+     "  END IF;"
+     "  RETURN NULL;"
+     "END $$ LANGUAGE plpgsql;"
+     "DROP TRIGGER IF EXISTS user_channels_notify ON user_channels;"
+     "CREATE TRIGGER user_channels_notify AFTER INSERT OR UPDATE OR DELETE ON user_channels"
+     "  FOR EACH ROW EXECUTE FUNCTION notify_user_channels_change();"
+     "CREATE OR REPLACE FUNCTION notify_channels_change() RETURNS TRIGGER AS $$ "
+     "BEGIN"
+     "  PERFORM pg_notify('cache_invalidation', 'c-:' || OLD.channel_id);"
+     "  RETURN NULL;"
+     "END $$ LANGUAGE plpgsql;"
+     "DROP TRIGGER IF EXISTS channels_notify ON channels;"
+     "CREATE TRIGGER channels_notify AFTER DELETE ON channels"
+     "  FOR EACH ROW EXECUTE FUNCTION notify_channels_change();"
+     // Sessions outlive a password or email change otherwise
+     "CREATE OR REPLACE FUNCTION notify_users_change() RETURNS TRIGGER AS $$ "
+     "BEGIN"
+     "  PERFORM pg_notify('cache_invalidation', 'u:' || OLD.user_id);"
+     "  RETURN NULL;"
+     "END $$ LANGUAGE plpgsql;"
+     "DROP TRIGGER IF EXISTS users_notify ON users;"
+     "CREATE TRIGGER users_notify AFTER UPDATE OF email, password OR DELETE ON users"
+     "  FOR EACH ROW EXECUTE FUNCTION notify_users_change();"},
+    {9, "persistent sessions",
+     // Resume tokens survive a server restart and work on every server
+     // process. Only a hash of the token is stored; a credential change drops
+     // the user's sessions in the same transaction.
+     "CREATE TABLE IF NOT EXISTS sessions ("
+     "  token_hash TEXT PRIMARY KEY,"
+     "  user_id INTEGER NOT NULL REFERENCES users(user_id) ON DELETE CASCADE,"
+     "  last_used TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+     ");"
+     "CREATE INDEX IF NOT EXISTS idx_sessions_user ON sessions(user_id);"
+     "CREATE OR REPLACE FUNCTION drop_user_sessions() RETURNS TRIGGER AS $$ "
+     "BEGIN"
+     "  DELETE FROM sessions WHERE user_id = OLD.user_id;"
+     "  RETURN NULL;"
+     "END $$ LANGUAGE plpgsql;"
+     "DROP TRIGGER IF EXISTS users_drop_sessions ON users;"
+     "CREATE TRIGGER users_drop_sessions AFTER UPDATE OF email, password ON users"
+     "  FOR EACH ROW EXECUTE FUNCTION drop_user_sessions();"},
+    {10, "backfill message sequence numbers",
+     // Messages stored before migration 1 kept a NULL seq: every read path
+     // skipped them and their channels got no summary. They are numbered per
+     // channel in (timestamp, message_id) order, ahead of the messages
+     // sequenced since, which move up by as many along with the read state,
+     // the summary and the archive catalog (segment files keep their numbers;
+     // seq_shift is added as they are read). Stop the servers cleanly first,
+     // so the ingest log holds nothing under the old numbers.
+     "CREATE TEMPORARY TABLE seq_backfill ON COMMIT DROP AS"
+     "  SELECT channel_id, count(*) AS shift FROM messages WHERE seq IS NULL GROUP BY channel_id;"
+     // Rows pass each other while they move up
+     "DROP INDEX IF EXISTS idx_messages_channel_seq_unique;"
+     "UPDATE messages m SET seq = m.seq + b.shift FROM seq_backfill b"
+     "  WHERE m.channel_id IS NOT DISTINCT FROM b.channel_id AND m.seq IS NOT NULL;"
+     "UPDATE messages m SET seq = n.seq FROM ("
+     "  SELECT message_id, timestamp,"
+     "         row_number() OVER (PARTITION BY channel_id ORDER BY timestamp, message_id) AS seq"
+     "  FROM messages WHERE seq IS NULL"
+     ") n WHERE m.message_id = n.message_id AND m.timestamp = n.timestamp;"
+     "ALTER TABLE messages ALTER COLUMN seq SET NOT NULL;"
+     "CREATE UNIQUE INDEX idx_messages_channel_seq_unique ON messages (channel_id, seq, timestamp);"
+
+     "UPDATE channel_read_state r SET last_read_seq = COALESCE("
+     "  (SELECT m.seq FROM messages m WHERE m.channel_id = r.channel_id AND m.message_id = r.last_read_message_id LIMIT 1),"
+     "  CASE WHEN r.last_read_seq > 0 THEN r.last_read_seq + b.shift ELSE 0 END)"
+     "FROM seq_backfill b WHERE r.channel_id = b.channel_id;"
+     "UPDATE channel_summary s SET last_seq = s.last_seq + b.shift FROM seq_backfill b"
+     "  WHERE s.channel_id = b.channel_id AND s.last_seq > 0;"
+     "INSERT INTO channel_summary (channel_id, last_message_id, last_seq, last_activity)"
+     "  SELECT DISTINCT ON (channel_id) channel_id, message_id, seq, timestamp FROM messages"
+     "  WHERE channel_id IN (SELECT channel_id FROM seq_backfill) ORDER BY channel_id, seq DESC "
+     "ON CONFLICT (channel_id) DO UPDATE SET last_message_id = EXCLUDED.last_message_id,"
+     "  last_seq = EXCLUDED.last_seq, last_activity = EXCLUDED.last_activity"
+     "  WHERE channel_summary.last_seq < EXCLUDED.last_seq;"
+
+     "ALTER TABLE archive_segments ADD COLUMN IF NOT EXISTS seq_shift BIGINT NOT NULL DEFAULT 0;"
+     "UPDATE archive_segments a SET first_seq = a.first_seq + b.shift, last_seq = a.last_seq + b.shift,"
+     "  seq_shift = a.seq_shift + b.shift FROM seq_backfill b WHERE a.channel_id = b.channel_id;"},
+};
+
+#define MIGRATION_COUNT ((int)(sizeof(migrations) / sizeof(migrations[0])))
+
+static bool exec_command(PGconn *conn, const char *sql) {
+    PGresult *res = PQexec(conn, sql);
+    ExecStatusType status = PQresultStatus(res);
+    bool ok = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+    if (!ok) fprintf(stderr, "❌ Migration query failed: %s\n", PQerrorMessage(conn));
+    PQclear(res);
+    return ok;
+}
+
+// Highest version recorded, -1 on error
+static int current_version(PGconn *conn) {
+    PGresult *res = PQexec(conn, "SELECT COALESCE(MAX(version), 0) FROM schema_migrations");
+    int version = -1;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) {
+        version = atoi(PQgetvalue(res, 0, 0));
+    } else {
+        fprintf(stderr, "❌ Failed to read schema version: %s\n", PQerrorMessage(conn));
+    }
+    PQclear(res);
+    return version;
+}
+
+static bool apply_migration(PGconn *conn, const Migration *migration) {
+    char version_str[16];
+    snprintf(version_str, sizeof(version_str), "%d", migration->version);
+    const char *params[2] = {version_str, migration->name};
+
+    if (!exec_command(conn, "BEGIN")) return false;
+    if (!exec_command(conn, migration->sql)) {
+        exec_command(conn, "ROLLBACK");
+        return false;
+    }
+    PGresult *res = PQexecParams(conn, "INSERT INTO schema_migrations (version, name) VALUES ($1::int, $2)",
+                                 2, NULL, params, NULL, NULL, 0);
+    bool recorded = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!recorded) fprintf(stderr, "❌ Failed to record migration %d: %s\n", migration->version, PQerrorMessage(conn));
+    PQclear(res);
+    if (!recorded) {
+        exec_command(conn, "ROLLBACK");
+        return false;
+    }
+    return exec_command(conn, "COMMIT");
+}
+
+bool run_migrations(PGconn *conn) {
+    if (!exec_command(conn, "SELECT pg_advisory_lock(" MIGRATION_LOCK_KEY ")")) return false;
+
+    bool ok = exec_command(conn,
+        "CREATE TABLE IF NOT EXISTS schema_migrations ("
+        "  version INTEGER PRIMARY KEY,"
+        "  name TEXT NOT NULL,"
+        "  applied_at TIMESTAMP NOT NULL DEFAULT CURRENT_TIMESTAMP"
+        ")");
+    int version = ok ? current_version(conn) : -1;
+    ok = version >= 0;
+
+    for (int i = 0; ok && i < MIGRATION_COUNT; i++) {
+        if (migrations[i].version <= version) continue;
+        printf("🗄️ Applying migration %d: %s\n", migrations[i].version, migrations[i].name);
+        ok = apply_migration(conn, &migrations[i]);
+        if (!ok) fprintf(stderr, "❌ Migration %d failed, schema left at version %d\n", migrations[i].version, version);
+        else version = migrations[i].version;
+    }
+    if (ok) printf("✅ Database schema is at version %d\n", version);
+
+    exec_command(conn, "SELECT pg_advisory_unlock(" MIGRATION_LOCK_KEY ")");
+    return ok;
+}
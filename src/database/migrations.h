@@ -0,0 +1,17 @@
+#ifndef MIGRATIONS_H
+#define MIGRATIONS_H
+
+#include <stdbool.h>
+#include <libpq-fe.h>
+
+// Versioned schema migrations. db_discord.sql creates the baseline schema;
+// every change since is a numbered migration in migrations.c, applied in
+// order by the server at startup and recorded in schema_migrations. Each
+// migration runs in its own transaction, and an advisory lock keeps two
+// servers starting together from applying the same one twice.
+
+// Apply the migrations the database doesn't have yet. Returns false (and
+// leaves the failed migration rolled back) on the first error.
+bool run_migrations(PGconn *conn);
+
+#endif // MIGRATIONS_H
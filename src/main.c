@@ -7,6 +7,7 @@
 #include <libpq-fe.h>
 #include <glib.h>
 #include <stdio.h>
+#include <signal.h>
 #ifdef _WIN32
     #include <winsock2.h>
     #include <ws2tcpip.h>
@@ -19,147 +20,49 @@
 #include "network/platform.h"
 #include "config/env_loader.h"
 #include "network/protocol.h"
+#include "network/reconnect.h"
 #include "database/db_connection.h"
 #include "security/encryption.h"
 #include "types/app_types.h"
 #include "components/login_page.h"
 #include "components/register_page.h"
 #include "components/chat_page.h"
+#include "components/search_panel.h"
 #include "utils/chat_utils.h"
+#include "utils/channel_sync.h"
+#include "utils/history_loader.h"
+#include "utils/ui_dispatch.h"
+#include "utils/utf8_markup.h"
 #include "utils/string_utils.h"
 
 #define BUFFER_SIZE 1024
+#define SERVER_PORT 8080
+// Granularity at which a reconnect wait notices the window closing
+#define RECONNECT_POLL_MS 100
 
 // Function declarations for functions defined in this file
-static gboolean update_user_list(gpointer data);
-static gboolean update_channel_list(gpointer data);
 static bool is_valid_channel_id(AppWidgets *widgets, uint32_t channel_id);
 void show_error_dialog(GtkWidget *parent, const char *message);
 static void ensure_default_role(PGconn *db_conn);
 static gboolean on_window_delete(GtkWidget *widget, GdkEvent *event, gpointer data);
 void* receive_messages(void *arg);
-static gboolean show_login_error_idle(gpointer data);
-static gboolean show_registration_success_idle(gpointer data);
-static gboolean show_registration_failure_idle(gpointer data);
-
-// Function to sanitize UTF-8 strings for Pango
-// NOTE: Consider moving this to gtk_string_utils.c if not already there
-static const char* sanitize_utf8(const char* input) {
-    static char sanitized[BUFFER_SIZE];
-    
-    if (!input) {
-        sanitized[0] = '\0';
-        return sanitized;
-    }
-    
-    // Check if the string is valid UTF-8
-    if (!g_utf8_validate(input, -1, NULL)) {
-        // If invalid, copy character by character, replacing invalid sequences
-        size_t i = 0, j = 0;
-        while (input[i] != '\0' && j < BUFFER_SIZE - 1) {
-            if ((input[i] & 0x80) == 0) {
-                // ASCII character
-                sanitized[j++] = input[i++];
-            } else if ((input[i] & 0xE0) == 0xC0 && (input[i+1] & 0xC0) == 0x80) {
-                // 2-byte UTF-8 sequence
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-            } else if ((input[i] & 0xF0) == 0xE0 && (input[i+1] & 0xC0) == 0x80 && (input[i+2] & 0xC0) == 0x80) {
-                // 3-byte UTF-8 sequence
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-            } else if ((input[i] & 0xF8) == 0xF0 && (input[i+1] & 0xC0) == 0x80 && (input[i+2] & 0xC0) == 0x80 && (input[i+3] & 0xC0) == 0x80) {
-                // 4-byte UTF-8 sequence
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-                sanitized[j++] = input[i++];
-            } else {
-                // Invalid sequence, replace with '?'
-                sanitized[j++] = '?';
-                i++;
-            }
-        }
-        sanitized[j] = '\0';
-    } else {
-        // If valid, simply copy the string
-        strncpy(sanitized, input, BUFFER_SIZE - 1);
-        sanitized[BUFFER_SIZE - 1] = '\0';
-    }
-    
-    return sanitized;
-}
-
-// Helper to sanitize UTF-8 strings for GTK display
-static const char* sanitize_utf8_gtk(const char *str) {
-    if (!str || !g_utf8_validate(str, -1, NULL)) {
-        return "[Invalid UTF-8]";
-    }
-    return str;
-}
-
-// Function to update user list
-static gboolean update_user_list(gpointer data) {
-    UserInfo *users = (UserInfo *)data;
-    AppWidgets *widgets = (AppWidgets *)g_object_get_data(G_OBJECT(widgets->window), "widgets");
-    
-    // Clear existing users
-    GList *children = gtk_container_get_children(GTK_CONTAINER(widgets->contacts_list));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-    
-    // Add new users
-    for (int i = 0; i < 10; i++) { // Assuming max 10 users for now
-        if (strlen(users[i].username) == 0) break;
-        
-        char user_text[64];
-        snprintf(user_text, sizeof(user_text), "%s (%s)", users[i].username, 
-                users[i].status == STATUS_ONLINE ? "online" : 
-                users[i].status == STATUS_AWAY ? "away" : "offline");
-        
-        GtkWidget *user_label = gtk_label_new(user_text);
-        gtk_widget_set_halign(user_label, GTK_ALIGN_START);
-        gtk_widget_set_margin_start(user_label, 10);
-        gtk_list_box_insert(GTK_LIST_BOX(widgets->contacts_list), user_label, -1);
-    }
-    
-    free(users);
-    return G_SOURCE_REMOVE;
-}
-
-// Function to update channel list
-static gboolean update_channel_list(gpointer data) {
-    ChannelInfo *channels = (ChannelInfo *)data;
-    AppWidgets *widgets = (AppWidgets *)g_object_get_data(G_OBJECT(widgets->window), "widgets");
-    
-    // Clear existing channels
-    GList *children = gtk_container_get_children(GTK_CONTAINER(widgets->chat_channels_list));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-    
-    // Add new channels
-    for (int i = 0; i < 10; i++) { // Assuming max 10 channels for now
-        if (strlen(channels[i].name) == 0) break;
-        
-        char channel_text[64];
-        snprintf(channel_text, sizeof(channel_text), "#%s%s", 
-                channels[i].name,
-                channels[i].is_private ? " (private)" : "");
-        
-        GtkWidget *channel_label = gtk_label_new(channel_text);
-        gtk_widget_set_halign(channel_label, GTK_ALIGN_START);
-        gtk_widget_set_margin_start(channel_label, 10);
-        gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), channel_label, -1);
-    }
-    
-    free(channels);
-    return G_SOURCE_REMOVE;
-}
+static gboolean apply_login_failure(gpointer data);
+static gboolean apply_registration_success(gpointer data);
+static gboolean apply_registration_failure(gpointer data);
+static gboolean apply_server_error(gpointer data);
+static void on_ui_frame_done(gpointer data);
+static gboolean apply_session_end(gpointer data);
+
+// Receive thread only: where and how to reconnect
+static const char *server_ip = NULL;
+static uint16_t server_port = SERVER_PORT;
+static ReconnectPolicy reconnect_policy;
+
+// MSG_ERROR text handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    char text[256];
+} ServerErrorData;
 
 // Helper to check if a channel ID exists in the database
 static bool is_valid_channel_id(AppWidgets *widgets, uint32_t channel_id) {
@@ -174,94 +77,304 @@ static bool is_valid_channel_id(AppWidgets *widgets, uint32_t channel_id) {
 }
 
 // Function to show error dialog
-void show_error_dialog(GtkWidget *parent, const char *message) {
+static void run_message_dialog(GtkWidget *parent, GtkMessageType type, const char *message) {
     // Sanitize message for UTF-8
-    const char *safe_message = sanitize_utf8(message);
+    if (!message) message = "[No message]";
+    char safe_message[BUFFER_SIZE];
+    utf8_markup_copy(message, strlen(message), safe_message, sizeof(safe_message), false);
     GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(parent),
                                                GTK_DIALOG_DESTROY_WITH_PARENT,
-                                               GTK_MESSAGE_ERROR,
-                                               GTK_BUTTONS_CLOSE,
-                                               "%s", safe_message ? safe_message : "[No message]");
+                                               type,
+                                               type == GTK_MESSAGE_ERROR ? GTK_BUTTONS_CLOSE : GTK_BUTTONS_OK,
+                                               "%s", safe_message);
     gtk_dialog_run(GTK_DIALOG(dialog));
     gtk_widget_destroy(dialog);
 }
 
+void show_error_dialog(GtkWidget *parent, const char *message) {
+    run_message_dialog(parent, GTK_MESSAGE_ERROR, message);
+}
+
+typedef struct {
+    GtkWidget *parent;
+    GtkMessageType type;
+    char *message;
+} PendingDialog;
+
+static gboolean run_pending_dialog(gpointer data) {
+    PendingDialog *pending = data;
+    run_message_dialog(pending->parent, pending->type, pending->message);
+    g_free(pending->message);
+    g_free(pending);
+    return G_SOURCE_REMOVE;
+}
+
+// Tasks from ui_dispatch run inside a frame, where a modal dialog must not
+// run its loop: the dialog follows from an idle source, once the frame is done
+static void post_message_dialog(GtkWidget *parent, GtkMessageType type, const char *message) {
+    PendingDialog *pending = g_new(PendingDialog, 1);
+    pending->parent = parent;
+    pending->type = type;
+    pending->message = g_strdup(message);
+    g_idle_add(run_pending_dialog, pending);
+}
+
 // Function to handle window close
 static gboolean on_window_delete(GtkWidget *widget, GdkEvent *event, gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
+    // Under the lock, so a reconnect can't put a new socket in place after this
+    pthread_mutex_lock(&widgets->socket_mutex);
     widgets->is_running = FALSE;
     
-    // Close the socket to wake up the received thread
-    CLOSE_SOCKET(widgets->server_socket);
+    // Shut the socket down to wake up the received thread; it is closed once
+    // the thread is gone, so its descriptor can't be reused under it
+    if (widgets->server_socket != INVALID_SOCKET) SHUTDOWN_SOCKET(widgets->server_socket);
+    pthread_mutex_unlock(&widgets->socket_mutex);
     
-    // Wait for the received thread to finish
+    // Wait for the received thread to finish; a pending connect sees is_running
     pthread_join(widgets->receive_thread, NULL);
     
+    SOCKET sock = swap_server_socket(widgets, INVALID_SOCKET);
+    if (sock != INVALID_SOCKET) CLOSE_SOCKET(sock);
+    
     return FALSE; // Allow the window to close
 }
 
+// Hand a connection state change to the UI, in order with the messages before it
+static void post_connection_state(AppWidgets *widgets, ConnectionState state, uint32_t attempt, uint32_t delay_ms) {
+    ConnectionStateData *state_data = malloc(sizeof(ConnectionStateData));
+    if (!state_data) {
+        fprintf(stderr, "Failed to allocate memory for connection state data\n");
+        return;
+    }
+    state_data->widgets = widgets;
+    state_data->state = state;
+    state_data->attempt = attempt;
+    state_data->delay_ms = delay_ms;
+    ui_dispatch((GSourceFunc)apply_connection_state, state_data);
+}
+
+// Sleep for delay_ms unless the window closes first; returns whether still running
+static bool wait_while_running(AppWidgets *widgets, uint32_t delay_ms) {
+    while (widgets->is_running && delay_ms > 0) {
+        uint32_t step = delay_ms < RECONNECT_POLL_MS ? delay_ms : RECONNECT_POLL_MS;
+        g_usleep((gulong)step * 1000);
+        delay_ms -= step;
+    }
+    return widgets->is_running;
+}
+
+// Connect again after the server went away, with exponential backoff and full
+// jitter, then resume the session (which rejoins the current channel and
+// replays what was missed). Returns false if the window closed or we gave up.
+static bool reconnect(AppWidgets *widgets) {
+    // Sends fail fast while there is no connection
+    SOCKET lost = swap_server_socket(widgets, INVALID_SOCKET);
+    if (lost != INVALID_SOCKET) CLOSE_SOCKET(lost);
+    for (uint32_t attempt = 0; reconnect_policy.max_attempts == 0 || attempt < reconnect_policy.max_attempts; attempt++) {
+        uint32_t delay_ms = reconnect_delay_ms(&reconnect_policy, attempt);
+        post_connection_state(widgets, CONNECTION_RECONNECTING, attempt + 1, delay_ms);
+        if (!wait_while_running(widgets, delay_ms)) return false;
+
+        SOCKET sock;
+        if (!connect_to_server(server_ip, server_port, CONNECT_TIMEOUT_MS, &widgets->is_running, &sock)) continue;
+        pthread_mutex_lock(&widgets->socket_mutex);
+        bool running = widgets->is_running;
+        if (running) widgets->server_socket = sock;
+        pthread_mutex_unlock(&widgets->socket_mutex);
+        if (!running) {
+            CLOSE_SOCKET(sock);
+            return false;
+        }
+        printf("🔌 Reconnected to server after %u attempt(s)\n", attempt + 1);
+
+        if (!widgets->session_token[0]) {
+            post_connection_state(widgets, CONNECTION_ONLINE, 0, 0); // Not logged in, nothing to resume
+            return true;
+        }
+        post_connection_state(widgets, CONNECTION_RESUMING, 0, 0);
+        Message *resume = create_resume_message(widgets->session_token, widgets->current_channel_id, channel_sync_resume_point());
+        if (resume && send_to_server(widgets, resume) == 0) {
+            free(resume);
+            return true;
+        }
+        free(resume);
+        lost = swap_server_socket(widgets, INVALID_SOCKET); // Lost again already; keep backing off
+        if (lost != INVALID_SOCKET) CLOSE_SOCKET(lost);
+    }
+    fprintf(stderr, "Giving up reconnecting after %u attempts.\n", reconnect_policy.max_attempts);
+    post_connection_state(widgets, CONNECTION_OFFLINE, 0, 0);
+    return false;
+}
+
 // Function to receive messages from the server
 void* receive_messages(void *arg) {
     AppWidgets *widgets = (AppWidgets *)arg;
     while (widgets->is_running) {
-        Message *msg = receive_message(widgets->server_socket);
+        // Only this thread replaces the socket; on_window_delete merely shuts it down
+        pthread_mutex_lock(&widgets->socket_mutex);
+        SOCKET sock = widgets->server_socket;
+        pthread_mutex_unlock(&widgets->socket_mutex);
+        Message *msg = receive_message(sock);
         if (!msg) {
-            // Server disconnected or error
+            if (!widgets->is_running) break; // Socket shut down by on_window_delete
             fprintf(stderr, "Connection lost to server.\n");
-            // Optionally, show an error and switch to login page or exit
-            // g_idle_add(... show_error_dialog_and_quit ... , widgets);
-            widgets->is_running = FALSE; // Stop the loop
-            break;
+            if (!reconnect(widgets)) {
+                widgets->is_running = FALSE; // Stop the loop
+                break;
+            }
+            continue;
         }
 
         switch (msg->type) {
             case MSG_LOGIN_SUCCESS: {
                 LoginSuccessResponse *resp = (LoginSuccessResponse*)msg->payload;
                 printf("✅ Login successful for user: %s\n", resp->username);
-                // Need to run the UI updates on the main GTK thread
-                // Create a copy of the username to pass to the idle function
+                memcpy(widgets->session_token, resp->session_token, SESSION_TOKEN_SIZE);
+                widgets->session_token[SESSION_TOKEN_SIZE - 1] = '\0';
+                // Need to run the UI updates on the main GTK thread, ahead of
+                // the messages that follow: through the same queue
                 char *username_copy = g_strdup(resp->username);
-                g_idle_add((GSourceFunc)finalize_login_ui_setup, username_copy); // Pass username
+                ui_dispatch((GSourceFunc)finalize_login_ui_setup, username_copy); // Pass username
+                break;
+            }
+            case MSG_RESUME_SUCCESS: {
+                printf("🔁 Session resumed\n");
+                post_connection_state(widgets, CONNECTION_ONLINE, 0, 0);
+                break;
+            }
+            case MSG_RESUME_FAILURE: {
+                // The session is gone, e.g. the server restarted: the user has to log in again
+                printf("❌ Session could not be resumed.\n");
+                widgets->session_token[0] = '\0';
+                post_connection_state(widgets, CONNECTION_ONLINE, 0, 0);
+                ui_dispatch((GSourceFunc)apply_session_end, widgets);
                 break;
             }
             case MSG_LOGIN_FAILURE: {
                 printf("❌ Login failed.\n");
                 // Show error dialog on the main thread
-                g_idle_add((GSourceFunc)show_login_error_idle, widgets);
+                ui_dispatch((GSourceFunc)apply_login_failure, widgets);
                 break;
             }
             case MSG_REGISTER_SUCCESS: {
                 printf("✅ Registration successful.\n");
-                g_idle_add((GSourceFunc)show_registration_success_idle, widgets);
+                ui_dispatch((GSourceFunc)apply_registration_success, widgets);
                 break;
             }
             case MSG_REGISTER_FAILURE: {
                  printf("❌ Registration failed.\n");
                  // TODO: Server could send back a reason (e.g., email exists) in payload
-                 g_idle_add((GSourceFunc)show_registration_failure_idle, widgets);
+                 ui_dispatch((GSourceFunc)apply_registration_failure, widgets);
                  break;
             }
             case MSG_CHAT: {
                 ChatMessage *chat_msg = (ChatMessage *)msg->payload;
 
-                // Server now sets the correct sender, so no need to check against widgets->username
-                // Just prepare data for UI update
-                ChatUpdateData *update_data = malloc(sizeof(ChatUpdateData));
-                if (!update_data) {
-                    fprintf(stderr, "Failed to allocate memory for chat update data\n");
-                    break; // Break switch case, msg will be freed below
+                // Replays overlap what arrived past a hole; drop what we already have
+                if (!channel_sync_note(chat_msg->channel_id, chat_msg->seq)) {
+                    break;
                 }
-                update_data->widgets = widgets;
-                strncpy(update_data->sender, chat_msg->sender_username, sizeof(update_data->sender) - 1);
-                strncpy(update_data->content, chat_msg->content, sizeof(update_data->content) - 1);
-                update_data->channel_id = chat_msg->channel_id;
-                update_data->sender[sizeof(update_data->sender) - 1] = '\0';
-                update_data->content[sizeof(update_data->content) - 1] = '\0';
 
-                g_idle_add((GSourceFunc)update_chat_history_from_network, update_data);
+                // Decoded off the UI thread, in order with any snapshot still being painted
+                history_loader_submit_chat(chat_msg);
                 break; // Don't free msg here, let it be freed after switch
             }
-            // Add cases for other message types like MSG_USER_LIST, MSG_CHANNEL_LIST etc.
+            case MSG_CHANNEL_SNAPSHOT: {
+                if (msg->length < sizeof(ChannelSnapshotHeader)) break;
+                // The resume point moves with the MSG_CHANNEL_SYNCED that follows
+                history_loader_submit_snapshot(msg->payload, msg->length);
+                break;
+            }
+            case MSG_CHANNEL_SYNCED: {
+                if (msg->length < sizeof(ChannelSynced)) break;
+                ChannelSynced synced;
+                memcpy(&synced, msg->payload, sizeof(synced));
+                channel_sync_synced(synced.channel_id, synced.through_seq);
+                break;
+            }
+            case MSG_HISTORY_PAGE: {
+                // Older than anything shown, so the resume point doesn't move
+                history_loader_submit_page(msg->payload, msg->length);
+                break;
+            }
+            case MSG_ERROR: {
+                ServerErrorData *error_data = malloc(sizeof(ServerErrorData));
+                if (!error_data) break;
+                error_data->widgets = widgets;
+                size_t text_len = msg->length < sizeof(error_data->text) ? msg->length : sizeof(error_data->text) - 1;
+                memcpy(error_data->text, msg->payload, text_len);
+                error_data->text[text_len] = '\0';
+                fprintf(stderr, "Server error: %s\n", error_data->text);
+                ui_dispatch((GSourceFunc)apply_server_error, error_data);
+                break;
+            }
+            case MSG_USER_LIST: {
+                if (msg->length < sizeof(UserListHeader)) break;
+                SnapshotUpdateData *update_data = malloc(sizeof(SnapshotUpdateData) + msg->length);
+                if (!update_data) {
+                    fprintf(stderr, "Failed to allocate memory for user list update data\n");
+                    break;
+                }
+                update_data->widgets = widgets;
+                update_data->length = msg->length;
+                memcpy(update_data->payload, msg->payload, msg->length);
+                ui_dispatch((GSourceFunc)apply_user_list, update_data);
+                break;
+            }
+            case MSG_PRESENCE_UPDATE: {
+                uint32_t count = msg->length / sizeof(PresenceUpdate);
+                if (count == 0) break;
+                PresenceUpdateData *update_data = malloc(sizeof(PresenceUpdateData) + count * sizeof(PresenceUpdate));
+                if (!update_data) {
+                    fprintf(stderr, "Failed to allocate memory for presence update data\n");
+                    break;
+                }
+                update_data->widgets = widgets;
+                update_data->count = count;
+                memcpy(update_data->updates, msg->payload, count * sizeof(PresenceUpdate));
+                ui_dispatch((GSourceFunc)apply_presence_updates, update_data);
+                break;
+            }
+            case MSG_CHAT_ACK: {
+                if (msg->length < sizeof(ChatAck)) break;
+                ChatAckData *ack_data = malloc(sizeof(ChatAckData));
+                if (!ack_data) {
+                    fprintf(stderr, "Failed to allocate memory for chat ack data\n");
+                    break;
+                }
+                ack_data->widgets = widgets;
+                memcpy(&ack_data->ack, msg->payload, sizeof(ChatAck));
+                // Not a delivery: our own copy of the message moves the resume point
+                ui_dispatch((GSourceFunc)apply_chat_ack, ack_data);
+                break;
+            }
+            case MSG_SEARCH_RESULTS: {
+                if (msg->length < sizeof(SearchResultsHeader)) break;
+                SearchResultsData *results_data = malloc(sizeof(SearchResultsData) + msg->length);
+                if (!results_data) {
+                    fprintf(stderr, "Failed to allocate memory for search results\n");
+                    break;
+                }
+                results_data->widgets = widgets;
+                results_data->length = msg->length;
+                memcpy(results_data->payload, msg->payload, msg->length);
+                ui_dispatch((GSourceFunc)apply_search_results, results_data);
+                break;
+            }
+            case MSG_CHANNEL_ACTIVITY: {
+                if (msg->length < sizeof(ChannelActivity)) break;
+                ChannelActivityData *activity_data = malloc(sizeof(ChannelActivityData));
+                if (!activity_data) {
+                    fprintf(stderr, "Failed to allocate memory for channel activity data\n");
+                    break;
+                }
+                activity_data->widgets = widgets;
+                memcpy(&activity_data->activity, msg->payload, sizeof(ChannelActivity));
+                ui_dispatch((GSourceFunc)apply_channel_activity, activity_data);
+                break;
+            }
+            // Add cases for other message types like MSG_CHANNEL_LIST etc.
             default: {
                  printf("❓ Received unhandled message type: %d\n", msg->type);
                  break;
@@ -273,24 +386,40 @@ void* receive_messages(void *arg) {
     return NULL;
 }
 
-// Helper function to show login error dialog from idle callback
-static gboolean show_login_error_idle(gpointer data) {
+// Everything dispatched this frame is in the view; lay it out once
+static void on_ui_frame_done(gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
-    show_error_dialog(widgets->window, "Invalid username or password");
+    chat_history_view_flush(widgets->chat_history);
+}
+
+// Helper function to show the login error from the UI dispatch
+static gboolean apply_login_failure(gpointer data) {
+    AppWidgets *widgets = (AppWidgets *)data;
+    post_message_dialog(widgets->window, GTK_MESSAGE_ERROR, "Invalid username or password");
     return G_SOURCE_REMOVE; // Run only once
 }
 
+static gboolean apply_session_end(gpointer data) {
+    AppWidgets *widgets = (AppWidgets *)data;
+    end_chat_session(widgets);
+    post_message_dialog(widgets->window, GTK_MESSAGE_ERROR, "Your session has expired, please log in again");
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean apply_server_error(gpointer data) {
+    ServerErrorData *error_data = (ServerErrorData *)data;
+    if (g_utf8_validate(error_data->text, -1, NULL)) {
+        post_message_dialog(error_data->widgets->window, GTK_MESSAGE_ERROR, error_data->text);
+    }
+    free(error_data);
+    return G_SOURCE_REMOVE;
+}
+
 // Helper function for registration success
-static gboolean show_registration_success_idle(gpointer data) {
+static gboolean apply_registration_success(gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
     // Show a success message
-    GtkWidget *dialog = gtk_message_dialog_new(GTK_WINDOW(widgets->window),
-                                               GTK_DIALOG_DESTROY_WITH_PARENT,
-                                               GTK_MESSAGE_INFO,
-                                               GTK_BUTTONS_OK,
-                                               "Registration successful! You can now log in.");
-    gtk_dialog_run(GTK_DIALOG(dialog));
-    gtk_widget_destroy(dialog);
+    post_message_dialog(widgets->window, GTK_MESSAGE_INFO, "Registration successful! You can now log in.");
 
     // Switch to the login page
     gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "login");
@@ -305,10 +434,10 @@ static gboolean show_registration_success_idle(gpointer data) {
 }
 
 // Helper function for registration failure
-static gboolean show_registration_failure_idle(gpointer data) {
+static gboolean apply_registration_failure(gpointer data) {
     AppWidgets *widgets = (AppWidgets *)data;
     // TODO: Use specific error from server if provided in payload
-    show_error_dialog(widgets->window, "Registration failed. Email might already exist.");
+    post_message_dialog(widgets->window, GTK_MESSAGE_ERROR, "Registration failed. Email might already exist.");
     return G_SOURCE_REMOVE; // Run only once
 }
 
@@ -359,36 +488,26 @@ int main(int argc, char *argv[]) {
     }
 
     // Retrieve the server IP from environment variable
-    const char *server_ip = getenv("SERVER_IP");
+    server_ip = getenv("SERVER_IP");
     if (!server_ip) {
         fprintf(stderr, "SERVER_IP environment variable not set!\n");
         return 1;
     }
+    const char *port_env = getenv("SERVER_PORT");
+    if (port_env && atoi(port_env) > 0) server_port = (uint16_t)atoi(port_env);
+
+    reconnect_policy_init(&reconnect_policy);
 
     // Initialize networking
     INIT_NETWORKING();
-
-    // Create socket
-    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock < 0) {
-        perror("Socket creation failed");
-        return 1;
-    }
+#ifndef _WIN32
+    // A send on a connection the server dropped must fail, not kill the client
+    signal(SIGPIPE, SIG_IGN);
+#endif
 
     // Connect to server using the IP from the environment variable
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(8080);
-
-    if (inet_pton(AF_INET, server_ip, &serv_addr.sin_addr) <= 0) {
-        perror("inet_pton failed");
-        CLOSE_SOCKET(sock);
-        return 1;
-    }
-
-    if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("Connection failed");
-        CLOSE_SOCKET(sock);
+    SOCKET sock;
+    if (!connect_to_server(server_ip, server_port, CONNECT_TIMEOUT_MS, NULL, &sock)) {
         return 1;
     }
 
@@ -406,9 +525,11 @@ int main(int argc, char *argv[]) {
     // Initialize AppWidgets
     AppWidgets app_widgets = {0};  // Zero initialize
     app_widgets.server_socket = sock;
+    pthread_mutex_init(&app_widgets.socket_mutex, NULL);
     app_widgets.is_running = TRUE;
     app_widgets.current_channel_id = 0;
     app_widgets.db_conn = db_conn;
+    app_widgets.db_replicas = db_replicas_open();
 
     // Create the window
     app_widgets.window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -445,6 +566,9 @@ int main(int argc, char *argv[]) {
     app_widgets.chat_history = chat_page->chat_history;
     app_widgets.chat_channels_list = chat_page->chat_channels_list;
     app_widgets.contacts_list = chat_page->contacts_list;
+    app_widgets.contact_rows = g_hash_table_new(g_direct_hash, g_direct_equal);
+    app_widgets.channel_rows = g_hash_table_new(g_direct_hash, g_direct_equal);
+    app_widgets.pending_messages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
     app_widgets.channel_name = chat_page->channel_name;
 
     // Add pages to stack
@@ -480,6 +604,16 @@ int main(int argc, char *argv[]) {
     GTK_STYLE_PROVIDER_PRIORITY_USER
     );
 
+    // Frequent updates from the network reach the UI once per frame
+    ui_dispatch_init(app_widgets.window, on_ui_frame_done, &app_widgets);
+    channel_sync_init(&app_widgets);
+
+    // Decodes history for the view; must run before anything is received
+    if (!history_loader_start(&app_widgets)) {
+        CLOSE_SOCKET(sock);
+        return 1;
+    }
+
     // Start receive thread
     if (pthread_create(&app_widgets.receive_thread, NULL, receive_messages, &app_widgets) != 0) {
         perror("Failed to create receive thread");
@@ -491,9 +625,11 @@ int main(int argc, char *argv[]) {
     gtk_main();
 
     // Cleanup
+    history_loader_stop();
     login_page_free(login_page);
     register_page_free(register_page);
     chat_page_free(chat_page);
+    db_replicas_close(app_widgets.db_replicas);
     PQfinish(db_conn);
     CLEANUP_NETWORKING();
 
@@ -1,69 +1,206 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <pthread.h> // <-- NEW!
 #include <stdbool.h> // <-- ADD THIS FOR bool, true, false
+#include <time.h>
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
 typedef int socklen_t;
 #define CLOSESOCKET closesocket
+#define SHUTDOWN_BOTH SD_BOTH
+#define strncasecmp _strnicmp
 #else
 #include <unistd.h>
+#include <signal.h>
+#include <strings.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <sys/time.h>
 #define CLOSESOCKET close
+#define SHUTDOWN_BOTH SHUT_RDWR
 #endif
 
 #include "network/platform.h"
 #include "config/env_loader.h"
 #include "database/db_connection.h"
+#include "database/migrations.h"
 #include "network/protocol.h"
 #include "security/encryption.h" // Include for decryption
+#include "server/session.h"
+#include "server/message_window.h"
+#include "server/presence.h"
+#include "server/membership.h"
+#include "server/search.h"
+#include "server/partitions.h"
+#include "server/retention.h"
+#include "server/archive.h"
+#include "server/ingest_log.h"
+#include "server/invalidation.h"
+#include "server/federation.h"
+#include "server/fanout.h"
 
 #define PORT 8080
 #define BUFFER_SIZE 1024
-#define MAX_CLIENTS 100 // Define max concurrent clients
+#define MAX_CLIENTS 4096 // Define max concurrent clients
+#define CLIENT_SEND_TIMEOUT_MS 5000 // A client that takes no data for this long is disconnected
+#define REPLAY_LIMIT 500 // Max messages replayed to a resuming client
+#define HISTORY_PAGE_SIZE 50 // Messages looked up per MSG_HISTORY_REQUEST (fewer if they don't fit a frame)
+#define PRIMARY_STICKY_S 10  // After a membership write, the client's reads stay on the primary this long
 
 // Structure to pass data to client handler thread
 typedef struct {
     int socket;
     PGconn *db_conn;
     char authenticated_username[50]; // Store username after successful login
+    uint32_t user_id;                // users.user_id of the authenticated user
     uint32_t current_channel_id;     // Channel the client is currently viewing
+    time_t primary_until;            // Until then reads must see this client's writes: no replicas
+    pthread_mutex_t send_mutex;      // Keeps frames from broadcasts and replies from interleaving
 } ClientData;
 
 // --- Global Client List Management ---
 ClientData* client_list[MAX_CLIENTS];
-pthread_mutex_t client_list_mutex;
+static size_t client_count = 0; // Clients in the list
+// Broadcasts only read the list, so messages of different channels go out
+// concurrently; adding or removing a client waits for them
+pthread_rwlock_t client_list_lock;
+
+// The database connection is shared by every client thread, and libpq connections
+// must not be used concurrently, so all queries go through this lock.
+pthread_mutex_t db_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PGconn *server_db_conn = NULL; // Used by callbacks that don't get a ClientData
+// Read replicas for queries that tolerate lag; NULL without PG_REPLICAS
+static DbReplicaPool *read_replicas = NULL;
+
+// A read that may lag behind the primary: on a replica, unless this client
+// wrote recently and must see it
+static PGresult *client_read(ClientData *data, const char *query, int n_params, const char *const *params) {
+    DbReplicaPool *pool = time(NULL) < data->primary_until ? NULL : read_replicas;
+    return db_exec_read(pool, data->db_conn, &db_mutex, query, n_params, params);
+}
+
+static void client_wrote(ClientData *data) {
+    data->primary_until = time(NULL) + PRIMARY_STICKY_S;
+}
 
 // Add a client to the global list
 void add_client(ClientData* client) {
-    pthread_mutex_lock(&client_list_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_list[i] == NULL) {
-            client_list[i] = client;
-            break;
-        }
+    pthread_rwlock_wrlock(&client_list_lock);
+    int i = 0;
+    while (i < MAX_CLIENTS && client_list[i] != NULL) i++;
+    if (i < MAX_CLIENTS) {
+        client_list[i] = client;
+        client_count++;
+    } else {
+        fprintf(stderr, "⚠️ Client list is full, socket %d gets no broadcasts\n", client->socket);
     }
-    pthread_mutex_unlock(&client_list_mutex);
+    pthread_rwlock_unlock(&client_list_lock);
+}
+
+// A send that failed or timed out may have left half a frame behind, so the
+// connection is unusable: shut it down, and its thread sees that and cleans up.
+// Broadcasts hold client_list_lock while they send, so one stalled client can
+// hold up a channel at most CLIENT_SEND_TIMEOUT_MS, once.
+static int client_send_failed(ClientData* client) {
+    shutdown(client->socket, SHUTDOWN_BOTH);
+    return -1;
+}
+
+// Send a message to one client without interleaving with other senders
+static int client_send(ClientData* client, const Message* msg) {
+    pthread_mutex_lock(&client->send_mutex);
+    int result = send_message(client->socket, msg);
+    if (result < 0) result = client_send_failed(client);
+    pthread_mutex_unlock(&client->send_mutex);
+    return result;
+}
+
+static int client_send_buffer(ClientData* client, const char* data, size_t length) {
+    pthread_mutex_lock(&client->send_mutex);
+    int result = send_buffer(client->socket, data, length);
+    if (result < 0) result = client_send_failed(client);
+    pthread_mutex_unlock(&client->send_mutex);
+    return result;
 }
 
 // Remove a client from the global list
 void remove_client(ClientData* client) {
-    pthread_mutex_lock(&client_list_mutex);
+    pthread_rwlock_wrlock(&client_list_lock);
     for (int i = 0; i < MAX_CLIENTS; i++) {
         if (client_list[i] == client) {
             client_list[i] = NULL;
+            client_count--;
             break;
         }
     }
-    pthread_mutex_unlock(&client_list_mutex);
+    pthread_rwlock_unlock(&client_list_lock);
+}
+
+// Does content mention the user, as "@everyone" or "@" + the local part of their email?
+static bool mentions_user(const char *content, const char *username) {
+    size_t name_len = strcspn(username, "@");
+    for (const char *at = strchr(content, '@'); at; at = strchr(at + 1, '@')) {
+        const char *word = at + 1;
+        size_t word_len = 0;
+        while (isalnum((unsigned char)word[word_len]) || word[word_len] == '.' ||
+               word[word_len] == '_' || word[word_len] == '-') {
+            word_len++;
+        }
+        if (word_len == 8 && strncasecmp(word, "everyone", 8) == 0) return true;
+        if (word_len == name_len && name_len > 0 && strncasecmp(word, username, name_len) == 0) return true;
+    }
+    return false;
 }
 
-// Broadcast a message only to authenticated clients in the correct channel
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+typedef struct {
+    ClientData *client;
+    bool viewing; // Gets the full message, not the ChannelActivity delta
+} Recipient;
+
+// One chat message on its way to the subscribers of its channel
+typedef struct {
+    const Message *msg;
+    const ChatMessage *chat;
+    ChannelActivity activity;
+    const Recipient *recipients;
+} ChatFanout;
+
+static void send_chat_part(void *ctx, size_t begin, size_t end) {
+    const ChatFanout *fanout = ctx;
+    // A delta per part: the mention flag differs per recipient
+    Message *delta = create_message(MSG_CHANNEL_ACTIVITY, &fanout->activity, sizeof(ChannelActivity));
+    for (size_t i = begin; i < end; i++) {
+        ClientData *client = fanout->recipients[i].client;
+        if (fanout->recipients[i].viewing) {
+            if (client_send(client, fanout->msg) < 0) {
+                perror("Broadcast send failed to socket");
+            }
+        } else if (delta) {
+            ChannelActivity *out = (ChannelActivity *)delta->payload;
+            out->mention = mentions_user(fanout->chat->content, client->authenticated_username) ? 1 : 0;
+            if (client_send(client, delta) < 0) {
+                perror("Activity send failed to socket");
+            }
+        }
+    }
+    free(delta);
+}
+
+// Deliver a chat message to every other connection subscribed to its channel:
+// the full message to those viewing it, a ChannelActivity delta to the members
+// viewing another channel, so they keep live unread counts without the content.
+// Large channels are sent to in parallel partitions (src/server/fanout.c).
 void broadcast_message(Message* msg, int sender_socket) {
     // We need the payload to check the channel ID
     if (msg->type != MSG_CHAT || msg->length < sizeof(ChatMessage)) {
@@ -73,33 +210,702 @@ void broadcast_message(Message* msg, int sender_socket) {
     ChatMessage* chat_payload = (ChatMessage*)msg->payload;
     uint32_t target_channel_id = chat_payload->channel_id;
 
-    pthread_mutex_lock(&client_list_mutex);
+    ChatFanout fanout = {0};
+    fanout.msg = msg;
+    fanout.chat = chat_payload;
+    fanout.activity.channel_id = target_channel_id;
+    fanout.activity.message_id = chat_payload->message_id;
+    fanout.activity.seq = chat_payload->seq;
+    size_t count = 0;
+    double started = now_us();
+
+    // Held until every send is done: a client can't go away meanwhile
+    pthread_rwlock_rdlock(&client_list_lock);
+    Recipient *recipients = client_count > 0 ? malloc(client_count * sizeof(Recipient)) : NULL;
+    if (!recipients) {
+        if (client_count > 0) fprintf(stderr, "Failed to allocate the recipients of a message in channel %u\n", target_channel_id);
+        pthread_rwlock_unlock(&client_list_lock);
+        return;
+    }
+    fanout.recipients = recipients;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        ClientData *client = client_list[i];
+        if (client == NULL || client->socket == sender_socket || client->authenticated_username[0] == '\0') {
+            continue;
+        }
+        if (client->current_channel_id == target_channel_id) {
+            recipients[count++] = (Recipient){client, true};
+        } else if (membership_lookup(client->user_id, target_channel_id, NULL)) {
+            recipients[count++] = (Recipient){client, false};
+        }
+    }
+    bool parallel = count >= fanout_threshold();
+    if (parallel) {
+        fanout_run(count, send_chat_part, &fanout);
+    } else {
+        send_chat_part(&fanout, 0, count);
+    }
+    pthread_rwlock_unlock(&client_list_lock);
+    free(recipients);
+    if (count > 0) fanout_record(parallel, now_us() - started);
+}
+// ------------------------------------
+
+// Presence changes are pushed to every authenticated client: all users share the public channels
+static void deliver_presence(const char *frames, size_t length) {
+    pthread_rwlock_rdlock(&client_list_lock);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (client_list[i] != NULL && client_list[i]->authenticated_username[0] != '\0') {
+            if (client_send_buffer(client_list[i], frames, length) < 0) {
+                perror("Presence send failed to socket");
+            }
+        }
+    }
+    pthread_rwlock_unlock(&client_list_lock);
+}
+
+// Warms the message window of a channel the first time it is needed:
+// its newest messages plus the sequence counter to continue from. Messages
+// the ingest log hasn't shipped yet come from its tail; while the database is
+// down, a channel this node has sequenced since it started loads from the
+// tail alone.
+static bool load_recent_messages(uint32_t channel_id, WindowMessage *out, int max, int *count, uint64_t *last_seq) {
+    ChatMessage *unshipped = malloc(sizeof(ChatMessage) * (size_t)max);
+    int64_t *unshipped_at = malloc(sizeof(int64_t) * (size_t)max);
+    if (!unshipped || !unshipped_at) {
+        fprintf(stderr, "Failed to allocate window load buffers\n");
+        free(unshipped);
+        free(unshipped_at);
+        return false;
+    }
+    int tail = ingest_log_unshipped(channel_id, 0, unshipped, unshipped_at, max);
+    if (tail > max) tail = max;
+    // Messages still on their way from the ingest log aren't in the table yet,
+    // but their seqs are taken
+    uint64_t logged_seq = ingest_log_last_seq(channel_id);
+
+    char channel_id_str[32], limit_str[16];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(limit_str, sizeof(limit_str), "%d", max);
+    const char *query = "SELECT m.message_id, m.seq, COALESCE(u.email, ''), m.content, "
+                        "EXTRACT(EPOCH FROM m.timestamp::timestamptz)::bigint FROM messages m "
+                        "LEFT JOIN users u ON m.sender_id = u.user_id "
+                        "WHERE m.channel_id = $1 ORDER BY m.seq DESC LIMIT $2";
+    const char *params[2] = {channel_id_str, limit_str};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *res = PQexecParams(server_db_conn, query, 2, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
+
+    bool db_ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!db_ok) {
+        fprintf(stderr, "DB Error loading recent messages for channel %u: %s\n", channel_id, PQerrorMessage(server_db_conn));
+    }
+    if (!db_ok && (logged_seq == 0 || tail < 0)) {
+        PQclear(res);
+        free(unshipped);
+        free(unshipped_at);
+        return false;
+    }
+    if (!db_ok) printf("⚠️ Loading channel %u from the ingest log alone\n", channel_id);
+
+    // Table rows older than the tail, then the tail, keeping the newest max.
+    // Rows come newest first: skip the ones the tail has too.
+    if (tail < 0) tail = 0; // Not all in memory: the window misses some, which it notices
+    int rows = db_ok ? PQntuples(res) : 0;
+    uint64_t tail_first = tail > 0 ? unshipped[0].seq : UINT64_MAX;
+    int first = 0;
+    while (first < rows && strtoull(PQgetvalue(res, first, 1), NULL, 10) >= tail_first) first++;
+    int older = rows - first;
+    if (older + tail > max) older = max - tail;
+    *count = older + tail;
+    *last_seq = rows > 0 ? strtoull(PQgetvalue(res, 0, 1), NULL, 10) : 0;
+    if (logged_seq > *last_seq) *last_seq = logged_seq;
+    for (int i = 0; i < tail; i++) {
+        WindowMessage *wm = &out[older + i];
+        wm->chat = unshipped[i];
+        wm->sent_at = unshipped_at[i];
+        if (wm->chat.seq > *last_seq) *last_seq = wm->chat.seq;
+    }
+    free(unshipped);
+    free(unshipped_at);
+    for (int i = first; i < first + older; i++) {
+        WindowMessage *wm = &out[first + older - 1 - i];
+        memset(wm, 0, sizeof(WindowMessage));
+        wm->chat.channel_id = channel_id;
+        wm->chat.message_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+        wm->chat.seq = strtoull(PQgetvalue(res, i, 1), NULL, 10);
+        strncpy(wm->chat.sender_username, PQgetvalue(res, i, 2), sizeof(wm->chat.sender_username) - 1);
+        strncpy(wm->chat.content, PQgetvalue(res, i, 3), sizeof(wm->chat.content) - 1);
+        wm->sent_at = strtoll(PQgetvalue(res, i, 4), NULL, 10);
+    }
+    PQclear(res);
+    return true;
+}
+
+// Sequence, log durably and remember in the window a message of a channel
+// this node owns. The ingest log stores it in the database in the background.
+static FederationAccept accept_chat(uint32_t sender_id, ChatMessage *chat, int64_t *sent_at) {
+    chat->seq = message_window_next_seq(chat->channel_id);
+    if (chat->seq == 0) {
+        fprintf(stderr, "Dropping message from %s: channel %u unavailable\n", chat->sender_username, chat->channel_id);
+        return FEDERATION_REJECTED;
+    }
+    // Another node may have taken the channel over since the caller looked;
+    // it continues after whatever we handed out before it did
+    if (!federation_owns(chat->channel_id)) {
+        message_window_cancel_seq(chat->channel_id, chat->seq);
+        return FEDERATION_MOVED;
+    }
+    if (!ingest_log_append(sender_id, chat, sent_at)) {
+        fprintf(stderr, "Dropping message from %s: could not be stored\n", chat->sender_username);
+        message_window_cancel_seq(chat->channel_id, chat->seq);
+        return FEDERATION_REJECTED;
+    }
+    chat->sent_at = *sent_at;
+    message_window_store(chat, *sent_at);
+    return FEDERATION_ACCEPTED;
+}
+
+static void send_chat_to_client(ClientData *client, const ChatMessage *chat) {
+    Message *out = create_message(MSG_CHAT, chat, sizeof(ChatMessage));
+    if (out) {
+        client_send(client, out);
+        free(out);
+    }
+}
+
+// The sender's own copy keeps its client_id, so the sender confirms its
+// pending row and puts it in its place among the others
+static void echo_to_sender(const ChatMessage *chat, int sender_socket) {
+    pthread_rwlock_rdlock(&client_list_lock);
     for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_list[i] != NULL && 
-            client_list[i]->socket != sender_socket && 
+        ClientData *client = client_list[i];
+        if (client != NULL && client->socket == sender_socket && client->current_channel_id == chat->channel_id &&
+            strcmp(client->authenticated_username, chat->sender_username) == 0) {
+            send_chat_to_client(client, chat);
+            break;
+        }
+    }
+    pthread_rwlock_unlock(&client_list_lock);
+}
+
+// A sequenced message, for the subscribers connected here. Runs under the
+// channel's order lock, so the sender's copy too comes in seq order.
+static void deliver_chat(const ChatMessage *chat, int sender_socket) {
+    ChatMessage copy = *chat;
+    copy.client_id = 0; // Only meaningful to the sender
+    Message *msg = create_message(MSG_CHAT, &copy, sizeof(ChatMessage));
+    if (msg) {
+        printf("💬 Broadcasting [Channel %u #%llu] %s: %s\n", copy.channel_id, (unsigned long long)copy.seq, copy.sender_username, copy.content);
+        broadcast_message(msg, sender_socket);
+        free(msg);
+    }
+    if (sender_socket >= 0 && chat->client_id != 0) {
+        echo_to_sender(chat, sender_socket);
+    }
+}
+
+// Tell the sender what became of its message
+static void send_chat_ack(ClientData *client, const ChatMessage *chat, FederationAccept outcome, int64_t sent_at) {
+    ChatAck ack = {0};
+    ack.channel_id = chat->channel_id;
+    ack.client_id = chat->client_id;
+    ack.status = outcome == FEDERATION_ACCEPTED ? CHAT_ACK_ACCEPTED
+               : outcome == FEDERATION_UNKNOWN ? CHAT_ACK_UNKNOWN : CHAT_ACK_REJECTED;
+    if (outcome == FEDERATION_ACCEPTED) {
+        ack.message_id = chat->message_id;
+        ack.seq = chat->seq;
+        ack.sent_at = sent_at;
+    }
+    Message *out = create_message(MSG_CHAT_ACK, &ack, sizeof(ack));
+    if (out) {
+        client_send(client, out);
+        free(out);
+    }
+}
+
+// Write one MSG_USER_LIST entry at out and return its size
+static size_t put_user_list_entry(char *out, uint32_t user_id, UserStatus status, const char *username) {
+    size_t name_len = strlen(username);
+    UserListEntry entry = {0};
+    entry.user_id = user_id;
+    entry.status = (uint8_t)status;
+    entry.username_len = (uint8_t)(name_len > UINT8_MAX ? UINT8_MAX : name_len);
+    memcpy(out, &entry, sizeof(entry));
+    memcpy(out + sizeof(entry), username, entry.username_len);
+    return sizeof(entry) + entry.username_len;
+}
+
+static void put_user_list_frame(char *frame_start, uint32_t payload_len, const UserListHeader *header) {
+    Message frame = {0};
+    frame.type = MSG_USER_LIST;
+    frame.length = payload_len;
+    memcpy(frame_start, &frame, sizeof(Message));
+    memcpy(frame_start + sizeof(Message), header, sizeof(UserListHeader));
+}
+
+// Send the members of channel_id as a USER_LIST_SNAPSHOT. Statuses come from
+// the presence table, so the database is only asked who the members are.
+static void send_channel_members(ClientData *data, uint32_t channel_id) {
+    char channel_id_str[32];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    const char *query = "SELECT u.user_id, u.email FROM user_channels uc "
+                        "JOIN users u ON u.user_id = uc.user_id "
+                        "WHERE uc.channel_id = $1 ORDER BY u.email";
+    const char *params[1] = {channel_id_str};
+
+    PGresult *res = client_read(data, query, 1, params);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Member List Error for channel %u: %s\n", channel_id, PQerrorMessage(data->db_conn));
+        PQclear(res);
+        return;
+    }
+
+    const size_t frame_overhead = sizeof(Message) + sizeof(UserListHeader);
+    int rows = PQntuples(res);
+    // Worst case every entry opens a new frame
+    size_t capacity = frame_overhead + (size_t)rows * (frame_overhead + sizeof(UserListEntry) + UINT8_MAX);
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate member list for channel %u\n", channel_id);
+        PQclear(res);
+        return;
+    }
+
+    UserListHeader header = {channel_id, 0, USER_LIST_SNAPSHOT, SNAPSHOT_FIRST};
+    size_t frame_start = 0, length = frame_overhead;
+    uint32_t payload_len = sizeof(UserListHeader);
+    for (int i = 0; i < rows; i++) {
+        uint32_t user_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+        const char *email = PQgetvalue(res, i, 1);
+        size_t entry_size = sizeof(UserListEntry) + (strlen(email) > UINT8_MAX ? UINT8_MAX : strlen(email));
+
+        if (payload_len + entry_size > MAX_PAYLOAD_SIZE) {
+            put_user_list_frame(buffer + frame_start, payload_len, &header);
+            frame_start = length;
+            length += frame_overhead;
+            payload_len = sizeof(UserListHeader);
+            header.count = 0;
+            header.flags = 0;
+        }
+
+        put_user_list_entry(buffer + length, user_id, presence_status(user_id), email);
+        length += entry_size;
+        payload_len += (uint32_t)entry_size;
+        header.count++;
+    }
+    header.flags |= SNAPSHOT_LAST;
+    put_user_list_frame(buffer + frame_start, payload_len, &header);
+    PQclear(res);
+
+    client_send_buffer(data, buffer, length);
+    free(buffer);
+}
+
+// Tell the clients viewing channel_id that a member was added or removed.
+// One small frame per viewer, however large the channel is.
+static void broadcast_member_delta(uint32_t channel_id, UserListOp op, uint32_t user_id, const char *username) {
+    char payload[sizeof(UserListHeader) + sizeof(UserListEntry) + UINT8_MAX];
+    UserListHeader header = {channel_id, 1, (uint8_t)op, 0};
+    memcpy(payload, &header, sizeof(header));
+    size_t length = sizeof(header) + put_user_list_entry(payload + sizeof(header), user_id, presence_status(user_id), username);
+
+    Message *delta = create_message(MSG_USER_LIST, payload, (uint32_t)length);
+    if (!delta) return;
+    pthread_rwlock_rdlock(&client_list_lock);
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (client_list[i] != NULL &&
             client_list[i]->authenticated_username[0] != '\0' &&
-            client_list[i]->current_channel_id == target_channel_id) // <-- Check channel ID!
+            client_list[i]->current_channel_id == channel_id)
         {
-            if (send_message(client_list[i]->socket, msg) < 0) {
-                perror("Broadcast send failed to socket"); 
-                // Consider removing the client if send fails repeatedly
-                // remove_client(client_list[i]); // Be careful with locking/iteration if you do this
+            if (client_send(client_list[i], delta) < 0) {
+                perror("Member delta send failed to socket");
             }
         }
     }
-    pthread_mutex_unlock(&client_list_mutex);
+    pthread_rwlock_unlock(&client_list_lock);
+    free(delta);
 }
-// ------------------------------------
 
-// Function to update user status (moved here or keep in a utils file? Let's put a simple version here for now)
-static void update_user_db_status(PGconn *conn, const char *username, const char *status) {
-    const char *update_query = "UPDATE users SET status = $1 WHERE email = $2";
-    const char *params[2] = {status, username};
-    PGresult *res = PQexecParams(conn, update_query, 2, NULL, params, NULL, NULL, 0);
+static void send_error(ClientData *data, const char *text) {
+    Message *response = create_message(MSG_ERROR, text, (uint32_t)strlen(text) + 1);
+    if (response) {
+        client_send(data, response);
+        free(response);
+    }
+}
+
+// Cache the user's channel memberships for this connection (shared by all
+// connections of the same user). The user first joins the channels created
+// since their last login: a set-based sync that costs two index lookups when
+// there are none, however many channels exist.
+static void load_user_memberships(ClientData *data) {
+    if (membership_retain(data->user_id)) return;
+
+    char user_id_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%u", data->user_id);
+    const char *query = "SELECT channel_id, COALESCE(role_id, 0) FROM user_channels WHERE user_id = $1";
+    const char *params[1] = {user_id_str};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *sync_res = PQexecParams(data->db_conn, "SELECT sync_user_channels($1::int)", 1, NULL, params, NULL, NULL, 0);
+    if (PQresultStatus(sync_res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Membership Sync Error for %s: %s\n", data->authenticated_username, PQerrorMessage(data->db_conn));
+    } else if (atoi(PQgetvalue(sync_res, 0, 0)) > 0) {
+        printf("➕ %s joined %s new channels\n", data->authenticated_username, PQgetvalue(sync_res, 0, 0));
+        client_wrote(data);
+    }
+    PQclear(sync_res);
+    PGresult *res = PQexecParams(data->db_conn, query, 1, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
+
+    ChannelRole *roles = NULL;
+    int rows = 0;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
+        rows = PQntuples(res);
+        roles = rows > 0 ? malloc((size_t)rows * sizeof(ChannelRole)) : NULL;
+        if (rows > 0 && !roles) rows = 0;
+        for (int i = 0; i < rows; i++) {
+            roles[i].channel_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+            roles[i].role_id = atoi(PQgetvalue(res, i, 1));
+        }
+    } else {
+        fprintf(stderr, "DB Membership Load Error for %s: %s\n", data->authenticated_username, PQerrorMessage(data->db_conn));
+    }
+    PQclear(res);
+
+    // Stored even when empty so the reference taken here is balanced on disconnect;
+    // joins that miss the cache are checked against the database anyway
+    membership_store(data->user_id, roles, (size_t)rows);
+    free(roles);
+}
+
+// Cache miss on join: the membership may have been created outside this server,
+// or the channel is public and this is the user's first join, which makes them a
+// member. One round trip answers both. Returns false for private channels the
+// user is not in and for channels that don't exist.
+static bool resolve_channel_membership(ClientData *data, uint32_t channel_id, int *role_id, bool *added) {
+    char user_id_str[32], channel_id_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%u", data->user_id);
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    const char *query =
+        "WITH existing AS ("
+        "  SELECT COALESCE(role_id, 0) AS role_id FROM user_channels WHERE user_id = $1::int AND channel_id = $2::int"
+        "), inserted AS ("
+        "  INSERT INTO user_channels (user_id, channel_id, role_id)"
+        "  SELECT $1::int, channel_id, 1 FROM channels"
+        "  WHERE channel_id = $2::int AND NOT is_private AND NOT EXISTS (SELECT 1 FROM existing)"
+        "  ON CONFLICT DO NOTHING RETURNING COALESCE(role_id, 0) AS role_id"
+        ") "
+        "SELECT role_id, false FROM existing UNION ALL SELECT role_id, true FROM inserted";
+    const char *params[2] = {user_id_str, channel_id_str};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *res = PQexecParams(data->db_conn, query, 2, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
+    bool member = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0;
+    if (member) {
+        *role_id = atoi(PQgetvalue(res, 0, 0));
+        *added = PQgetvalue(res, 0, 1)[0] == 't';
+    } else if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Membership Error for %s in channel %u: %s\n", data->authenticated_username, channel_id, PQerrorMessage(data->db_conn));
+    }
+    PQclear(res);
+    return member;
+}
+
+// May this client see and post in channel_id? Answered from the membership
+// cache; only a miss goes to the database, and its answer is cached.
+static bool authorize_channel(ClientData *data, uint32_t channel_id, bool *added) {
+    int role_id = 0;
+    *added = false;
+    if (membership_lookup(data->user_id, channel_id, &role_id)) {
+        return true;
+    }
+    if (!resolve_channel_membership(data, channel_id, &role_id, added)) {
+        return false;
+    }
+    if (*added) client_wrote(data);
+    membership_add(data->user_id, channel_id, role_id);
+    return true;
+}
+
+// Move the user's read marker in channel_id forward to seq (never back).
+// A seq that is handed out but not in the messages table yet (the ingest log
+// hasn't shipped it) is taken too, without its message_id.
+static void store_read_marker(ClientData *data, uint32_t channel_id, uint64_t seq) {
+    uint64_t handed_out = ingest_log_last_seq(channel_id);
+    uint64_t window_seq = message_window_peek_seq(channel_id);
+    if (window_seq > handed_out) handed_out = window_seq;
+
+    char user_id_str[32], channel_id_str[32], seq_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%u", data->user_id);
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(seq_str, sizeof(seq_str), "%llu", (unsigned long long)seq);
+    const char *query =
+        "INSERT INTO channel_read_state (user_id, channel_id, last_read_message_id, last_read_seq) "
+        "SELECT $1::int, $2::int, m.message_id, $3::bigint FROM (SELECT 1) one "
+        "LEFT JOIN messages m ON m.channel_id = $2::int AND m.seq = $3::bigint "
+        "WHERE m.message_id IS NOT NULL OR $4::bool "
+        "ON CONFLICT (user_id, channel_id) DO UPDATE SET last_read_message_id = EXCLUDED.last_read_message_id,"
+        "  last_read_seq = EXCLUDED.last_read_seq, updated_at = CURRENT_TIMESTAMP "
+        "WHERE channel_read_state.last_read_seq < EXCLUDED.last_read_seq";
+    const char *params[4] = {user_id_str, channel_id_str, seq_str, seq <= handed_out ? "true" : "false"};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *res = PQexecParams(data->db_conn, query, 4, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
     if (PQresultStatus(res) != PGRES_COMMAND_OK) {
-        fprintf(stderr, "DB Status Update Error for %s: %s\n", username, PQerrorMessage(conn));
+        fprintf(stderr, "DB Read Marker Error for %s in channel %u: %s\n", data->authenticated_username, channel_id, PQerrorMessage(data->db_conn));
+    }
+    PQclear(res);
+}
+
+static bool leave_channel(ClientData *data, uint32_t channel_id) {
+    char user_id_str[32], channel_id_str[32];
+    snprintf(user_id_str, sizeof(user_id_str), "%u", data->user_id);
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    const char *query = "DELETE FROM user_channels WHERE user_id = $1 AND channel_id = $2 RETURNING user_id";
+    const char *params[2] = {user_id_str, channel_id_str};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *res = PQexecParams(data->db_conn, query, 2, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
+    bool removed = PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0;
+    if (removed) client_wrote(data);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Leave Error for %s in channel %u: %s\n", data->authenticated_username, channel_id, PQerrorMessage(data->db_conn));
+    }
+    PQclear(res);
+    return removed;
+}
+
+// Send a client every message of channel_id newer than last_seq, setting
+// *through to the newest one sent.
+// Served from the in-memory window when it covers the gap, from the DB and the
+// ingest log's unshipped tail otherwise.
+// Returns false, without sending anything, when the gap is longer than REPLAY_LIMIT
+// or can't be read completely; the client then needs a full snapshot.
+static bool replay_channel_gap(ClientData *data, uint32_t channel_id, uint64_t last_seq, uint64_t *through) {
+    *through = last_seq;
+    ChatMessage *missed = malloc(sizeof(ChatMessage) * REPLAY_LIMIT);
+    if (!missed) {
+        fprintf(stderr, "Failed to allocate replay buffer\n");
+        return false;
+    }
+
+    bool complete = false;
+    int count = message_window_collect(channel_id, last_seq, missed, REPLAY_LIMIT, &complete);
+    if (complete) {
+        for (int i = 0; i < count; i++) {
+            send_chat_to_client(data, &missed[i]);
+            *through = missed[i].seq;
+        }
+        printf("⏩ Replayed %d messages of channel %u from memory to socket %d\n", count, channel_id, data->socket);
+        free(missed);
+        return true;
+    }
+
+    // What the database doesn't have yet; read first, see ingest_log_unshipped
+    int tail = ingest_log_unshipped(channel_id, last_seq, missed, NULL, REPLAY_LIMIT);
+    if (tail > REPLAY_LIMIT) {
+        printf("⏩ Gap after seq %llu in channel %u is too long to replay to socket %d\n", (unsigned long long)last_seq, channel_id, data->socket);
+        free(missed);
+        return false;
+    }
+    uint64_t tail_first = tail > 0 ? missed[0].seq : UINT64_MAX;
+
+    char channel_id_str[32], seq_str[32], limit_str[16];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(seq_str, sizeof(seq_str), "%llu", (unsigned long long)last_seq);
+    snprintf(limit_str, sizeof(limit_str), "%d", REPLAY_LIMIT + 1); // One more tells a gap too long
+    const char *query = "SELECT m.message_id, m.seq, COALESCE(u.email, ''), m.content, "
+                        "EXTRACT(EPOCH FROM m.timestamp::timestamptz)::bigint FROM messages m "
+                        "LEFT JOIN users u ON m.sender_id = u.user_id "
+                        "WHERE m.channel_id = $1 AND m.seq > $2 ORDER BY m.seq ASC LIMIT $3";
+    const char *params[3] = {channel_id_str, seq_str, limit_str};
+
+    pthread_mutex_lock(&db_mutex);
+    PGresult *res = PQexecParams(data->db_conn, query, 3, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&db_mutex);
+
+    // Rows the tail has too come last
+    int rows = PQresultStatus(res) == PGRES_TUPLES_OK ? PQntuples(res) : 0;
+    while (rows > 0 && strtoull(PQgetvalue(res, rows - 1, 1), NULL, 10) >= tail_first) rows--;
+    uint64_t newest = rows > 0 ? strtoull(PQgetvalue(res, rows - 1, 1), NULL, 10) : last_seq;
+    if (tail > 0) newest = missed[tail - 1].seq;
+
+    bool replayed = false;
+    if (PQresultStatus(res) != PGRES_TUPLES_OK && !(tail > 0 && tail_first == last_seq + 1)) {
+        fprintf(stderr, "DB Error replaying channel %u: %s\n", channel_id, PQerrorMessage(data->db_conn));
+    } else if (rows + (tail > 0 ? tail : 0) > REPLAY_LIMIT) {
+        printf("⏩ Gap after seq %llu in channel %u is too long to replay to socket %d\n", (unsigned long long)last_seq, channel_id, data->socket);
+    } else if (tail < 0 && newest < ingest_log_last_seq(channel_id)) {
+        // Logged messages after these may not be in the table yet
+        printf("⏩ Gap after seq %llu in channel %u is not fully stored yet, sending socket %d a snapshot\n", (unsigned long long)last_seq, channel_id, data->socket);
+    } else {
+        for (int i = 0; i < rows; i++) {
+            ChatMessage chat = {0};
+            chat.channel_id = channel_id;
+            chat.message_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+            chat.seq = strtoull(PQgetvalue(res, i, 1), NULL, 10);
+            strncpy(chat.sender_username, PQgetvalue(res, i, 2), sizeof(chat.sender_username) - 1);
+            strncpy(chat.content, PQgetvalue(res, i, 3), sizeof(chat.content) - 1);
+            chat.sent_at = strtoll(PQgetvalue(res, i, 4), NULL, 10);
+            send_chat_to_client(data, &chat);
+            *through = chat.seq;
+        }
+        for (int i = 0; i < tail; i++) {
+            send_chat_to_client(data, &missed[i]);
+            *through = missed[i].seq;
+        }
+        printf("⏩ Replayed %d messages of channel %u from database and %d from the ingest log to socket %d\n",
+               rows, channel_id, tail > 0 ? tail : 0, data->socket);
+        replayed = true;
+    }
+    PQclear(res);
+    free(missed);
+    return replayed;
+}
+
+// Bring a client up to date on a channel: only the messages after the ones it
+// already has when it knows where it stopped, the shared snapshot otherwise,
+// then MSG_CHANNEL_SYNCED. Called under the channel's order lock, so nothing
+// is sequenced meanwhile and the client's live traffic continues right after.
+static void send_channel_history(ClientData *data, uint32_t channel_id, uint64_t after_seq) {
+    uint64_t through = 0;
+    if (after_seq == 0 || !replay_channel_gap(data, channel_id, after_seq, &through)) {
+        // The encoded snapshot is shared by every joiner until the channel changes
+        WindowSnapshot *snapshot = message_window_snapshot(channel_id);
+        if (snapshot) {
+            client_send_buffer(data, snapshot->data, snapshot->length);
+            message_window_snapshot_release(snapshot);
+        } else {
+            fprintf(stderr, "No history snapshot available for channel %u\n", channel_id);
+        }
+    }
+    uint64_t last_seq = message_window_peek_seq(channel_id);
+    ChannelSynced synced = {channel_id, last_seq > through ? last_seq : through};
+    Message *out = create_message(MSG_CHANNEL_SYNCED, &synced, sizeof(synced));
+    if (out) {
+        client_send(data, out);
+        free(out);
+    }
+}
+
+// Catch a client up on a channel and make it a live viewer of it, with
+// nothing posted in between falling through
+static void start_viewing(ClientData *data, uint32_t channel_id, uint64_t after_seq) {
+    message_window_order_lock(channel_id);
+    send_channel_history(data, channel_id, after_seq);
+    data->current_channel_id = channel_id;
+    message_window_order_unlock(channel_id);
+}
+
+// One message of a history page, newest first until the page is encoded
+typedef struct {
+    SnapshotEntry entry;
+    char sender[UINT8_MAX + 1];
+    char content[sizeof(((ChatMessage *)0)->content)];
+} HistoryPageEntry;
+
+typedef struct {
+    HistoryPageEntry *entries;
+    int count;
+} HistoryPage;
+
+static void add_page_entry(HistoryPage *page, uint32_t message_id, uint64_t seq, int64_t sent_at,
+                           const char *sender, size_t sender_len, const char *content, size_t content_len) {
+    HistoryPageEntry *e = &page->entries[page->count++];
+    memset(&e->entry, 0, sizeof(e->entry));
+    e->entry.message_id = message_id;
+    e->entry.seq = seq;
+    e->entry.sent_at = sent_at;
+    e->entry.sender_len = (uint8_t)(sender_len < sizeof(e->sender) ? sender_len : sizeof(e->sender) - 1);
+    e->entry.content_len = (uint16_t)(content_len < sizeof(e->content) ? content_len : sizeof(e->content) - 1);
+    memcpy(e->sender, sender, e->entry.sender_len);
+    memcpy(e->content, content, e->entry.content_len);
+}
+
+static void add_archived_entry(const SnapshotEntry *entry, const char *sender, const char *content, void *user_data) {
+    add_page_entry(user_data, entry->message_id, entry->seq, entry->sent_at,
+                   sender, entry->sender_len, content, entry->content_len);
+}
+
+// Answer a MSG_HISTORY_REQUEST: the messages before before_seq from the table,
+// continued from the archive segments once the table has no older ones
+static void send_history_page(ClientData *data, uint32_t channel_id, uint64_t before_seq) {
+    HistoryPage page = {calloc(HISTORY_PAGE_SIZE, sizeof(HistoryPageEntry)), 0};
+    Message *msg = create_message(MSG_HISTORY_PAGE, NULL, MAX_PAYLOAD_SIZE);
+    if (!page.entries || !msg) {
+        fprintf(stderr, "Failed to allocate history page\n");
+        free(page.entries);
+        free(msg);
+        return;
+    }
+
+    char channel_id_str[32], seq_str[32], limit_str[16];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(seq_str, sizeof(seq_str), "%llu", (unsigned long long)before_seq);
+    snprintf(limit_str, sizeof(limit_str), "%d", HISTORY_PAGE_SIZE);
+    const char *query = "SELECT m.message_id, m.seq, COALESCE(u.email, ''), m.content, "
+                        "EXTRACT(EPOCH FROM m.timestamp::timestamptz)::bigint FROM messages m "
+                        "LEFT JOIN users u ON m.sender_id = u.user_id "
+                        "WHERE m.channel_id = $1 AND m.seq < $2 ORDER BY m.seq DESC LIMIT $3";
+    const char *params[3] = {channel_id_str, seq_str, limit_str};
+
+    // Older than anything the client has: a replica a little behind has it too
+    PGresult *res = db_exec_read(read_replicas, data->db_conn, &db_mutex, query, 3, params);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error loading history of channel %u: %s\n", channel_id, PQresultErrorMessage(res));
+        PQclear(res);
+        free(page.entries);
+        free(msg);
+        send_error(data, "History is unavailable right now");
+        return;
+    }
+    for (int i = 0; i < PQntuples(res); i++) {
+        add_page_entry(&page, (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10),
+                       strtoull(PQgetvalue(res, i, 1), NULL, 10), strtoll(PQgetvalue(res, i, 4), NULL, 10),
+                       PQgetvalue(res, i, 2), (size_t)PQgetlength(res, i, 2),
+                       PQgetvalue(res, i, 3), (size_t)PQgetlength(res, i, 3));
     }
     PQclear(res);
+    int from_table = page.count;
+    if (page.count < HISTORY_PAGE_SIZE) {
+        uint64_t archive_before = page.count > 0 ? page.entries[page.count - 1].entry.seq : before_seq;
+        archive_read_before(channel_id, archive_before, HISTORY_PAGE_SIZE - page.count, add_archived_entry, &page);
+    }
+
+    // Keep the newest that fit: the client continues from the oldest it gets
+    size_t length = sizeof(ChannelSnapshotHeader);
+    int fit = 0;
+    while (fit < page.count) {
+        const SnapshotEntry *e = &page.entries[fit].entry;
+        size_t size = sizeof(SnapshotEntry) + e->sender_len + e->content_len;
+        if (length + size > MAX_PAYLOAD_SIZE) break;
+        length += size;
+        fit++;
+    }
+    length = sizeof(ChannelSnapshotHeader);
+    for (int i = fit - 1; i >= 0; i--) {
+        const HistoryPageEntry *e = &page.entries[i];
+        memcpy(msg->payload + length, &e->entry, sizeof(SnapshotEntry));
+        memcpy(msg->payload + length + sizeof(SnapshotEntry), e->sender, e->entry.sender_len);
+        memcpy(msg->payload + length + sizeof(SnapshotEntry) + e->entry.sender_len, e->content, e->entry.content_len);
+        length += sizeof(SnapshotEntry) + e->entry.sender_len + e->entry.content_len;
+    }
+    ChannelSnapshotHeader header = {channel_id, (uint16_t)fit, 0};
+    if (page.count < HISTORY_PAGE_SIZE && fit == page.count) header.flags |= HISTORY_OLDEST;
+    memcpy(msg->payload, &header, sizeof(header));
+    msg->length = (uint32_t)length;
+    client_send(data, msg);
+
+    printf("📜 History page of channel %u before seq %llu: %d from the table, %d archived, %d sent to socket %d\n",
+           channel_id, (unsigned long long)before_seq, from_table, page.count - from_table, fit, data->socket);
+    free(page.entries);
+    free(msg);
 }
 
 // Thread function for handling a client
@@ -116,9 +922,10 @@ void* handle_client(void* arg) {
         Message* msg = receive_message(client_socket);
         if (!msg) {
             printf("❌ Client disconnected or error on socket %d (User: %s)\n", client_socket, data->authenticated_username[0] ? data->authenticated_username : "Unauthenticated");
-            // If user was authenticated, update status to offline
+            // If user was authenticated, mark them offline (flushed to the DB in the next batch)
             if (data->authenticated_username[0]) {
-                update_user_db_status(conn, data->authenticated_username, "offline");
+                presence_disconnect(data->user_id);
+                membership_release(data->user_id);
             }
             break;
         }
@@ -140,10 +947,14 @@ void* handle_client(void* arg) {
                 // --- Database Authentication --- //
                 const char *query = "SELECT user_id, password FROM users WHERE email = $1";
                 const char *params[1] = {req->username};
+                pthread_mutex_lock(&db_mutex);
                 PGresult *res = PQexecParams(conn, query, 1, NULL, params, NULL, NULL, 0);
+                pthread_mutex_unlock(&db_mutex);
 
                 bool login_ok = false;
+                uint32_t user_id = 0;
                 if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) {
+                    user_id = (uint32_t)strtoul(PQgetvalue(res, 0, 0), NULL, 10);
                     const char *stored_password_encrypted = PQgetvalue(res, 0, 1);
                     // Basic check if password looks encrypted (adjust if needed)
                     int is_encrypted = 0;
@@ -179,20 +990,24 @@ void* handle_client(void* arg) {
                     // Store authenticated username
                     strncpy(data->authenticated_username, req->username, sizeof(data->authenticated_username) - 1);
                     data->authenticated_username[sizeof(data->authenticated_username) - 1] = '\0'; // Ensure null termination
+                    data->user_id = user_id;
 
-                    // Update DB status to online
-                    update_user_db_status(conn, data->authenticated_username, "online");
+                    presence_connect(data->user_id, data->authenticated_username);
+                    load_user_memberships(data);
 
                     // Add client to list *after* successful authentication
                     add_client(data); 
 
-                    // Send success response
-                    LoginSuccessResponse resp_payload;
+                    // Send success response with a token the client can resume with
+                    LoginSuccessResponse resp_payload = {0};
                     strncpy(resp_payload.username, data->authenticated_username, sizeof(resp_payload.username) -1 );
                     resp_payload.username[sizeof(resp_payload.username)-1] = '\0';
+                    if (!session_create(data->user_id, data->authenticated_username, resp_payload.session_token)) {
+                        resp_payload.session_token[0] = '\0'; // Client will fall back to a full login
+                    }
                     Message *response = create_message(MSG_LOGIN_SUCCESS, &resp_payload, sizeof(LoginSuccessResponse));
                     if (response) {
-                         send_message(client_socket, response);
+                         client_send(data, response);
                          free(response);
                     }
                 } else {
@@ -200,13 +1015,78 @@ void* handle_client(void* arg) {
                     // Send failure response
                     Message *response = create_message(MSG_LOGIN_FAILURE, NULL, 0);
                      if (response) {
-                         send_message(client_socket, response);
+                         client_send(data, response);
                          free(response);
                     }
                 }
                 break;
             }
 
+            case MSG_RESUME_REQUEST: {
+                if (data->authenticated_username[0]) {
+                    fprintf(stderr, "Warning: Already logged in user (%s) sent RESUME_REQUEST on socket %d\n", data->authenticated_username, client_socket);
+                    break;
+                }
+                if (msg->length < sizeof(ResumeRequest)) {
+                    fprintf(stderr, "Warning: Received invalid MSG_RESUME_REQUEST payload size from socket %d\n", client_socket);
+                    break;
+                }
+
+                ResumeRequest *req = (ResumeRequest*)msg->payload;
+                req->session_token[SESSION_TOKEN_SIZE - 1] = '\0';
+
+                // No password check: the token proves a recent login, and it is cached
+                // in memory or stored in the sessions table (survives a restart)
+                if (!session_resume(req->session_token, &data->user_id, data->authenticated_username, sizeof(data->authenticated_username))) {
+                    printf("❌ Session resume rejected on socket %d\n", client_socket);
+                    Message *response = create_message(MSG_RESUME_FAILURE, NULL, 0);
+                    if (response) {
+                        client_send(data, response);
+                        free(response);
+                    }
+                    break;
+                }
+
+                printf("🔁 Session resumed for %s on socket %d (channel %u after seq %llu)\n", data->authenticated_username, client_socket, req->channel_id, (unsigned long long)req->last_seq);
+                presence_connect(data->user_id, data->authenticated_username);
+                load_user_memberships(data);
+
+                LoginSuccessResponse resp_payload = {0};
+                strncpy(resp_payload.username, data->authenticated_username, sizeof(resp_payload.username) - 1);
+                memcpy(resp_payload.session_token, req->session_token, SESSION_TOKEN_SIZE);
+                Message *response = create_message(MSG_RESUME_SUCCESS, &resp_payload, sizeof(LoginSuccessResponse));
+                if (response) {
+                    client_send(data, response);
+                    free(response);
+                }
+
+                // Replay the gap, then start receiving live traffic for the channel
+                bool added = false;
+                add_client(data);
+                if (req->channel_id > 0 && req->channel_id <= INT32_MAX && authorize_channel(data, req->channel_id, &added)) {
+                    if (added) {
+                        broadcast_member_delta(req->channel_id, USER_LIST_ADD, data->user_id, data->authenticated_username);
+                    }
+                    send_channel_members(data, req->channel_id);
+                    start_viewing(data, req->channel_id, req->last_seq);
+                }
+                break;
+            }
+
+            case MSG_LOGOUT: {
+                if (!data->authenticated_username[0]) {
+                    break;
+                }
+                printf("👋 %s logged out on socket %d\n", data->authenticated_username, client_socket);
+                presence_disconnect(data->user_id);
+                membership_release(data->user_id);
+                remove_client(data);
+                memset(data->authenticated_username, 0, sizeof(data->authenticated_username));
+                data->user_id = 0;
+                data->current_channel_id = 0;
+                break;
+            }
+
             case MSG_REGISTER_REQUEST: {
                 // Can only register if not already logged in
                 if (data->authenticated_username[0]) {
@@ -214,7 +1094,7 @@ void* handle_client(void* arg) {
                     // Send failure? Or just ignore?
                     Message *response = create_message(MSG_REGISTER_FAILURE, NULL, 0); // Generic failure
                     if (response) {
-                        send_message(client_socket, response);
+                        client_send(data, response);
                         free(response);
                     }
                     break;
@@ -230,7 +1110,9 @@ void* handle_client(void* arg) {
                 // 1. Check if email exists
                 const char *check_query = "SELECT 1 FROM users WHERE email = $1";
                 const char *check_params[1] = {req->email};
+                pthread_mutex_lock(&db_mutex);
                 PGresult *check_res = PQexecParams(conn, check_query, 1, NULL, check_params, NULL, NULL, 0);
+                pthread_mutex_unlock(&db_mutex);
                 if (PQresultStatus(check_res) == PGRES_TUPLES_OK) {
                     if (PQntuples(check_res) > 0) {
                         email_exists = true;
@@ -240,7 +1122,7 @@ void* handle_client(void* arg) {
                     // Send generic failure
                      Message *response = create_message(MSG_REGISTER_FAILURE, NULL, 0);
                     if (response) {
-                        send_message(client_socket, response);
+                        client_send(data, response);
                         free(response);
                     }
                     PQclear(check_res);
@@ -259,7 +1141,7 @@ void* handle_client(void* arg) {
                         // Send generic failure
                         Message *response = create_message(MSG_REGISTER_FAILURE, NULL, 0);
                         if (response) {
-                             send_message(client_socket, response);
+                             client_send(data, response);
                             free(response);
                         }
                         break; // Exit case
@@ -275,7 +1157,9 @@ void* handle_client(void* arg) {
                     const char *insert_query = "INSERT INTO users (first_name, last_name, email, password, status) VALUES ($1, $2, $3, $4, 'offline')";
                     // Use the encrypted password
                     const char *insert_params[4] = {req->firstname, req->lastname, req->email, encrypted_password};
+                    pthread_mutex_lock(&db_mutex);
                     PGresult *insert_res = PQexecParams(conn, insert_query, 4, NULL, insert_params, NULL, NULL, 0);
+                    pthread_mutex_unlock(&db_mutex);
 
                     if (PQresultStatus(insert_res) == PGRES_COMMAND_OK) {
                         registration_ok = true;
@@ -291,7 +1175,7 @@ void* handle_client(void* arg) {
                     // Send success response
                     Message *response = create_message(MSG_REGISTER_SUCCESS, NULL, 0);
                     if (response) {
-                        send_message(client_socket, response);
+                        client_send(data, response);
                         free(response);
                     }
                 } else {
@@ -299,7 +1183,7 @@ void* handle_client(void* arg) {
                     // Send failure response (could add payload with specific reason)
                     Message *response = create_message(MSG_REGISTER_FAILURE, NULL, 0); 
                      if (response) {
-                        send_message(client_socket, response);
+                        client_send(data, response);
                         free(response);
                     }
                 }
@@ -313,31 +1197,140 @@ void* handle_client(void* arg) {
                 }
                 if (msg->length >= sizeof(uint32_t)) {
                     uint32_t requested_channel_id = *((uint32_t*)msg->payload);
-                    // TODO: Add server-side validation: Does channel exist? Does user have permission?
-                    data->current_channel_id = requested_channel_id;
-                    printf("👤 User %s (socket %d) joined channel %u\n", data->authenticated_username, client_socket, data->current_channel_id);
+                    uint64_t after_seq = 0;
+                    if (msg->length >= sizeof(JoinChannelRequest)) {
+                        after_seq = ((JoinChannelRequest*)msg->payload)->after_seq;
+                    }
+                    bool added = false;
+                    if (!authorize_channel(data, requested_channel_id, &added)) {
+                        printf("⛔ User %s (socket %d) may not join channel %u\n", data->authenticated_username, client_socket, requested_channel_id);
+                        send_error(data, "You are not a member of this channel");
+                        break;
+                    }
+                    data->current_channel_id = 0; // Until it is caught up on the new one
+                    printf("👤 User %s (socket %d) joined channel %u\n", data->authenticated_username, client_socket, requested_channel_id);
+
+                    if (added) {
+                        broadcast_member_delta(requested_channel_id, USER_LIST_ADD, data->user_id, data->authenticated_username);
+                    }
+                    send_channel_members(data, requested_channel_id);
+
+                    // Answer with the recent history straight from memory, or just
+                    // what is newer than the client's local cache
+                    start_viewing(data, requested_channel_id, after_seq);
                 } else {
                     fprintf(stderr, "Warning: Received invalid MSG_JOIN_CHANNEL payload size from socket %d\n", client_socket);
                 }
                 break;
             }
 
+            case MSG_LEAVE_CHANNEL: {
+                if (!data->authenticated_username[0] || msg->length < sizeof(uint32_t)) {
+                    break;
+                }
+                uint32_t channel_id;
+                memcpy(&channel_id, msg->payload, sizeof(channel_id));
+                if (data->current_channel_id == channel_id) {
+                    data->current_channel_id = 0;
+                }
+                membership_remove(data->user_id, channel_id);
+                if (leave_channel(data, channel_id)) {
+                    printf("🚪 User %s left channel %u\n", data->authenticated_username, channel_id);
+                    broadcast_member_delta(channel_id, USER_LIST_REMOVE, data->user_id, data->authenticated_username);
+                }
+                break;
+            }
+
+            case MSG_READ_MARKER: {
+                if (!data->authenticated_username[0] || msg->length < sizeof(ReadMarker)) {
+                    break;
+                }
+                ReadMarker marker;
+                memcpy(&marker, msg->payload, sizeof(marker));
+                if (marker.seq == 0 || !membership_lookup(data->user_id, marker.channel_id, NULL)) {
+                    break;
+                }
+                store_read_marker(data, marker.channel_id, marker.seq);
+                break;
+            }
+
+            case MSG_HISTORY_REQUEST: {
+                if (!data->authenticated_username[0] || msg->length < sizeof(HistoryRequest)) {
+                    break;
+                }
+                HistoryRequest request;
+                memcpy(&request, msg->payload, sizeof(request));
+                if (!membership_lookup(data->user_id, request.channel_id, NULL)) {
+                    send_error(data, "You are not a member of this channel");
+                    break;
+                }
+                send_history_page(data, request.channel_id, request.before_seq);
+                break;
+            }
+
+            case MSG_REPLAY_REQUEST: {
+                if (!data->authenticated_username[0] || msg->length < sizeof(ReplayRequest)) {
+                    break;
+                }
+                ReplayRequest request;
+                memcpy(&request, msg->payload, sizeof(request));
+                // Only the channel being viewed gets holes filled; a join brings any other up to date
+                if (request.channel_id == 0 || request.channel_id != data->current_channel_id) {
+                    break;
+                }
+                printf("🕳️ %s is missing messages of channel %u after seq %llu\n", data->authenticated_username, request.channel_id, (unsigned long long)request.after_seq);
+                message_window_order_lock(request.channel_id);
+                send_channel_history(data, request.channel_id, request.after_seq);
+                message_window_order_unlock(request.channel_id);
+                break;
+            }
+
+            case MSG_SEARCH_REQUEST: {
+                if (!data->authenticated_username[0] || msg->length < sizeof(SearchRequest)) {
+                    break;
+                }
+                SearchRequest *req = (SearchRequest*)msg->payload;
+                req->query[SEARCH_QUERY_MAX - 1] = '\0';
+                printf("🔎 Search by %s: \"%s\" (channel %u)\n", data->authenticated_username, req->query, req->channel_id);
+                Message *results = search_messages(data->user_id, req);
+                if (!results) {
+                    send_error(data, "Search is unavailable right now");
+                    break;
+                }
+                client_send(data, results);
+                free(results);
+                break;
+            }
+
             case MSG_CHAT: {
                  if (!data->authenticated_username[0]) {
                     fprintf(stderr, "Warning: Unauthenticated user tried to send chat message.\n");
                     break;
                  }
+                 if (msg->length < sizeof(ChatMessage)) {
+                    fprintf(stderr, "Warning: Received invalid MSG_CHAT payload size from socket %d\n", client_socket);
+                    break;
+                 }
                  
                  ChatMessage* chat = (ChatMessage*)msg->payload;
-                 // Ensure the message is for the channel the client *claims* to be in?
-                 // Or just trust the client sent it to the right place initially?
-                 // For now, we'll trust the payload's channel_id for broadcasting.
-                 
+                 // The channel_id comes from the client: only members may post.
+                 // In-memory check, no DB query per message.
+                 if (!membership_lookup(data->user_id, chat->channel_id, NULL)) {
+                     fprintf(stderr, "Dropping message from %s: not a member of channel %u\n", data->authenticated_username, chat->channel_id);
+                     send_chat_ack(data, chat, FEDERATION_REJECTED, 0);
+                     send_error(data, "You are not a member of this channel");
+                     break;
+                 }
+
                  strncpy(chat->sender_username, data->authenticated_username, sizeof(chat->sender_username) - 1);
                  chat->sender_username[sizeof(chat->sender_username) - 1] = '\0';
+                 chat->content[sizeof(chat->content) - 1] = '\0';
 
-                 printf("💬 Broadcasting [Channel %u] %s: %s (from socket %d)\n", chat->channel_id, chat->sender_username, chat->content, client_socket);
-                 broadcast_message(msg, client_socket);
+                 // Sequenced and logged by the channel's owner (this node or
+                 // another one), which delivers it to every node's subscribers
+                 int64_t sent_at = 0;
+                 FederationAccept outcome = federation_submit(data->user_id, client_socket, chat, &sent_at);
+                 send_chat_ack(data, chat, outcome, sent_at);
                  break;
             }
 
@@ -354,6 +1347,7 @@ void* handle_client(void* arg) {
     remove_client(data); // Remove from global list
     CLOSESOCKET(client_socket);
     printf("🔒 Connection closed for socket %d (User: %s)\n", client_socket, data->authenticated_username[0] ? data->authenticated_username : "Previously Unauthenticated");
+    pthread_mutex_destroy(&data->send_mutex);
     free(data); // Free the ClientData struct itself
     pthread_exit(NULL);
 }
@@ -361,7 +1355,7 @@ void* handle_client(void* arg) {
 int main(int argc, char *argv[]) {
     // Initialize client list and mutex
     memset(client_list, 0, sizeof(client_list));
-    if (pthread_mutex_init(&client_list_mutex, NULL) != 0) {
+    if (pthread_rwlock_init(&client_list_lock, NULL) != 0) {
         perror("Mutex initialization failed");
         return EXIT_FAILURE;
     }
@@ -372,20 +1366,76 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
+    // Sockets are opened before clients are accepted (links to other nodes)
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
+        fprintf(stderr, "WSAStartup failed.\n");
+        return EXIT_FAILURE;
+    }
+#else
+    // A send to a client or node that went away must fail, not kill the server
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
     PGconn *conn = connect_to_db();
     if (conn == NULL || PQstatus(conn) != CONNECTION_OK) {
         fprintf(stderr, "Database connection failed: %s\n", PQerrorMessage(conn));
         PQfinish(conn);
         return EXIT_FAILURE;
     }
+    server_db_conn = conn;
+    if (!run_migrations(conn)) {
+        PQfinish(conn);
+        return EXIT_FAILURE;
+    }
+    read_replicas = db_replicas_open();
 
-#ifdef _WIN32
-    WSADATA wsaData;
-    if (WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
-        fprintf(stderr, "WSAStartup failed.\n");
+    session_table_init(conn, &db_mutex);
+    const char *budget_mb = getenv("HOT_WINDOW_BUDGET_MB");
+    size_t window_budget = (size_t)(budget_mb ? atoi(budget_mb) : DEFAULT_HOT_WINDOW_BUDGET_MB) * 1024 * 1024;
+    message_window_init(load_recent_messages, window_budget);
+    if (!presence_start(conn, &db_mutex, deliver_presence)) {
+        PQfinish(conn);
         return EXIT_FAILURE;
     }
-#endif
+    if (!partitions_start(conn, &db_mutex)) {
+        presence_stop();
+        PQfinish(conn);
+        return EXIT_FAILURE;
+    }
+    // Before clients: a message is only accepted once it is in the log
+    if (!ingest_log_start()) {
+        partitions_stop();
+        presence_stop();
+        PQfinish(conn);
+        return EXIT_FAILURE;
+    }
+    if (!fanout_start()) {
+        fprintf(stderr, "⚠️ Large channels are sent to one recipient at a time\n");
+    }
+    // Before clients too: which channels are sequenced here depends on the other nodes
+    if (!federation_start(accept_chat, deliver_chat)) {
+        fanout_stop();
+        ingest_log_stop();
+        partitions_stop();
+        presence_stop();
+        PQfinish(conn);
+        return EXIT_FAILURE;
+    }
+    if (!search_start(read_replicas)) {
+        fprintf(stderr, "⚠️ Message search is disabled\n"); // Chat works without it
+    }
+    if (!archive_start()) {
+        fprintf(stderr, "⚠️ Archived history is unavailable\n");
+    }
+    if (!retention_start()) {
+        fprintf(stderr, "⚠️ Message retention is disabled\n");
+    }
+    if (!invalidation_start()) {
+        // Fine for a single server process; with several, their caches drift
+        fprintf(stderr, "⚠️ Cache invalidation is disabled\n");
+    }
 
     int server_fd;
     struct sockaddr_in address;
@@ -418,7 +1468,10 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    address.sin_port = htons(PORT);
+    // Several nodes on one machine need a port each
+    const char *port_env = getenv("SERVER_PORT");
+    int port = port_env && atoi(port_env) > 0 ? atoi(port_env) : PORT;
+    address.sin_port = htons((uint16_t)port);
 
     if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         perror("bind failed");
@@ -432,7 +1485,7 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    printf("✅ Server is listening on IP %s and port %d...\n", server_ip, PORT);
+    printf("✅ Server is listening on IP %s and port %d...\n", server_ip, port);
 
     while (1) {
         ClientData *data = malloc(sizeof(ClientData));
@@ -447,9 +1500,19 @@ int main(int argc, char *argv[]) {
             free(data);
             continue;
         }
+        // Bounds how long a stalled client can hold up a broadcast
+#ifdef _WIN32
+        DWORD send_timeout = CLIENT_SEND_TIMEOUT_MS;
+#else
+        struct timeval send_timeout = {CLIENT_SEND_TIMEOUT_MS / 1000, (CLIENT_SEND_TIMEOUT_MS % 1000) * 1000};
+#endif
+        setsockopt(data->socket, SOL_SOCKET, SO_SNDTIMEO, (const char *)&send_timeout, sizeof(send_timeout));
         data->db_conn = conn;
         // Initialize the username field before passing to thread
         memset(data->authenticated_username, 0, sizeof(data->authenticated_username));
+        data->user_id = 0;
+        data->primary_until = 0;
+        pthread_mutex_init(&data->send_mutex, NULL);
 
         printf("🔗 Accepted connection, socket %d\n", data->socket);
 
@@ -458,6 +1521,7 @@ int main(int argc, char *argv[]) {
         if (pthread_create(&thread_id, NULL, handle_client, data) != 0) {
             perror("pthread_create failed");
             CLOSESOCKET(data->socket);
+            pthread_mutex_destroy(&data->send_mutex);
             free(data);
             continue;
         }
@@ -467,7 +1531,18 @@ int main(int argc, char *argv[]) {
     }
 
     // Cleanup
-    pthread_mutex_destroy(&client_list_mutex);
+    federation_stop();
+    fanout_stop();
+    invalidation_stop();
+    ingest_log_stop();
+    presence_stop();
+    partitions_stop();
+    retention_stop();
+    archive_stop();
+    search_stop();
+    db_replicas_close(read_replicas);
+    pthread_rwlock_destroy(&client_list_lock);
+    pthread_mutex_destroy(&db_mutex);
     PQfinish(conn);
     CLOSESOCKET(server_fd);
 
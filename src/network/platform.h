@@ -7,6 +7,7 @@
     #pragma comment(lib, "ws2_32.lib") // Optional: Auto-link Winsock on MSVC
     typedef int socklen_t;
 #define CLOSE_SOCKET(s) closesocket(s)
+#define SHUTDOWN_SOCKET(s) shutdown(s, SD_BOTH)
 #define INIT_NETWORKING() \
 WSADATA wsaData; \
 if (WSAStartup(MAKEWORD(2,2), &wsaData) != 0) { \
@@ -21,6 +22,7 @@ exit(EXIT_FAILURE); \
 #include <unistd.h>
 typedef int SOCKET;
 #define CLOSE_SOCKET(s) close(s)
+#define SHUTDOWN_SOCKET(s) shutdown(s, SHUT_RDWR)
 #define INIT_NETWORKING()  // No-op on Unix
 #define CLEANUP_NETWORKING() // No-op on Unix
 #endif
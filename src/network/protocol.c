@@ -5,6 +5,31 @@
 #include "protocol.h"
 #include "platform.h"
 
+// send()/recv() may transfer fewer bytes than asked for on a stream socket
+static int send_all(SOCKET sock, const char* data, size_t length) {
+    size_t sent = 0;
+    while (sent < length) {
+        int result = send(sock, data + sent, (int)(length - sent), 0);
+        if (result <= 0) {
+            return -1;
+        }
+        sent += (size_t)result;
+    }
+    return 0;
+}
+
+static int recv_all(SOCKET sock, char* data, size_t length) {
+    size_t received = 0;
+    while (received < length) {
+        int result = recv(sock, data + received, (int)(length - received), 0);
+        if (result <= 0) {
+            return result;
+        }
+        received += (size_t)result;
+    }
+    return (int)received;
+}
+
 Message* create_message(MessageType type, const void* payload, uint32_t payload_size) {
     if (payload_size > MAX_PAYLOAD_SIZE) {
         fprintf(stderr, "Payload size too large: %u > %u\n", payload_size, MAX_PAYLOAD_SIZE);
@@ -54,13 +79,16 @@ Message* create_chat_message(uint32_t channel_id, const char* content) {
     return create_message(MSG_CHAT, &chat, sizeof(ChatMessage));
 }
 
-Message* create_join_channel_message(uint32_t channel_id) {
+Message* create_join_channel_message(uint32_t channel_id, uint64_t after_seq) {
     if (channel_id == 0 || channel_id > INT32_MAX) {
         fprintf(stderr, "Invalid channel ID: %u\n", channel_id);
         return NULL;
     }
     
-    return create_message(MSG_JOIN_CHANNEL, &channel_id, sizeof(uint32_t));
+    JoinChannelRequest request = {0};
+    request.channel_id = channel_id;
+    request.after_seq = after_seq;
+    return create_message(MSG_JOIN_CHANNEL, &request, sizeof(request));
 }
 
 Message* create_leave_channel_message(uint32_t channel_id) {
@@ -72,6 +100,56 @@ Message* create_leave_channel_message(uint32_t channel_id) {
     return create_message(MSG_LEAVE_CHANNEL, &channel_id, sizeof(uint32_t));
 }
 
+Message* create_resume_message(const char* session_token, uint32_t channel_id, uint64_t last_seq) {
+    if (!session_token || session_token[0] == '\0') {
+        fprintf(stderr, "Session token is NULL or empty\n");
+        return NULL;
+    }
+
+    ResumeRequest resume = {0};
+    strncpy(resume.session_token, session_token, sizeof(resume.session_token) - 1);
+    resume.channel_id = channel_id;
+    resume.last_seq = last_seq;
+
+    return create_message(MSG_RESUME_REQUEST, &resume, sizeof(ResumeRequest));
+}
+
+Message* create_read_marker_message(uint32_t channel_id, uint64_t seq) {
+    if (channel_id == 0 || channel_id > INT32_MAX || seq == 0) {
+        fprintf(stderr, "Invalid read marker: channel %u, seq %llu\n", channel_id, (unsigned long long)seq);
+        return NULL;
+    }
+
+    ReadMarker marker = {0};
+    marker.channel_id = channel_id;
+    marker.seq = seq;
+    return create_message(MSG_READ_MARKER, &marker, sizeof(ReadMarker));
+}
+
+Message* create_history_request_message(uint32_t channel_id, uint64_t before_seq) {
+    if (channel_id == 0 || channel_id > INT32_MAX || before_seq <= 1) {
+        fprintf(stderr, "Invalid history request: channel %u, before seq %llu\n", channel_id, (unsigned long long)before_seq);
+        return NULL;
+    }
+
+    HistoryRequest request = {0};
+    request.channel_id = channel_id;
+    request.before_seq = before_seq;
+    return create_message(MSG_HISTORY_REQUEST, &request, sizeof(HistoryRequest));
+}
+
+Message* create_replay_request_message(uint32_t channel_id, uint64_t after_seq) {
+    if (channel_id == 0 || channel_id > INT32_MAX) {
+        fprintf(stderr, "Invalid replay request: channel %u\n", channel_id);
+        return NULL;
+    }
+
+    ReplayRequest request = {0};
+    request.channel_id = channel_id;
+    request.after_seq = after_seq;
+    return create_message(MSG_REPLAY_REQUEST, &request, sizeof(ReplayRequest));
+}
+
 int send_message(SOCKET sock, const Message* msg) {
     if (sock == INVALID_SOCKET || !msg) {
         fprintf(stderr, "Invalid socket or message\n");
@@ -90,20 +168,27 @@ int send_message(SOCKET sock, const Message* msg) {
         return -1;
     }
     
-    // Send header
-    if (send(sock, (const char*)msg, sizeof(Message), 0) < 0) {
-        perror("Failed to send message header");
+    // Send header and payload in one go so frames are never split across calls
+    if (send_all(sock, (const char*)msg, sizeof(Message) + msg->length) < 0) {
+        perror("Failed to send message");
         return -1;
     }
     
-    // Send payload if exists
-    if (msg->length > 0) {
-        if (send(sock, msg->payload, msg->length, 0) < 0) {
-            perror("Failed to send message payload");
-            return -1;
-        }
+    return 0;
+}
+
+// Send pre-encoded frames (e.g. a shared channel snapshot) as-is
+int send_buffer(SOCKET sock, const char* data, size_t length) {
+    if (sock == INVALID_SOCKET || !data) {
+        fprintf(stderr, "Invalid socket or buffer\n");
+        return -1;
     }
-    
+
+    if (send_all(sock, data, length) < 0) {
+        perror("Failed to send buffer");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -115,7 +200,7 @@ Message* receive_message(SOCKET sock) {
     
     // Receive header
     Message header;
-    int result = recv(sock, (char*)&header, sizeof(Message), 0);
+    int result = recv_all(sock, (char*)&header, sizeof(Message));
     if (result <= 0) {
         if (result < 0) {
             perror("Failed to receive message header");
@@ -146,7 +231,7 @@ Message* receive_message(SOCKET sock) {
     
     // Receive payload if exists
     if (header.length > 0) {
-        result = recv(sock, msg->payload, header.length, 0);
+        result = recv_all(sock, msg->payload, header.length);
         if (result <= 0) {
             if (result < 0) {
                 perror("Failed to receive message payload");
@@ -167,4 +252,60 @@ Message* receive_message(SOCKET sock) {
     }
     
     return msg;
-}
\ No newline at end of file
+}
+
+bool snapshot_next_entry(const char* payload, uint32_t length, size_t* offset,
+                         SnapshotEntry* entry, const char** sender, const char** content) {
+    if (!payload || !offset || !entry || *offset + sizeof(SnapshotEntry) > length) {
+        return false;
+    }
+
+    memcpy(entry, payload + *offset, sizeof(SnapshotEntry));
+    size_t body = sizeof(SnapshotEntry) + entry->sender_len + entry->content_len;
+    if (*offset + body > length) {
+        fprintf(stderr, "Truncated snapshot entry at offset %zu\n", *offset);
+        return false;
+    }
+
+    *sender = payload + *offset + sizeof(SnapshotEntry);
+    *content = *sender + entry->sender_len;
+    *offset += body;
+    return true;
+}
+
+bool user_list_next_entry(const char* payload, uint32_t length, size_t* offset,
+                          UserListEntry* entry, const char** username) {
+    if (!payload || !offset || !entry || *offset + sizeof(UserListEntry) > length) {
+        return false;
+    }
+
+    memcpy(entry, payload + *offset, sizeof(UserListEntry));
+    size_t body = sizeof(UserListEntry) + entry->username_len;
+    if (*offset + body > length) {
+        fprintf(stderr, "Truncated user list entry at offset %zu\n", *offset);
+        return false;
+    }
+
+    *username = payload + *offset + sizeof(UserListEntry);
+    *offset += body;
+    return true;
+}
+
+bool search_result_next_entry(const char* payload, uint32_t length, size_t* offset,
+                              SearchResultEntry* entry, const char** sender, const char** content) {
+    if (!payload || !offset || !entry || *offset + sizeof(SearchResultEntry) > length) {
+        return false;
+    }
+
+    memcpy(entry, payload + *offset, sizeof(SearchResultEntry));
+    size_t body = sizeof(SearchResultEntry) + entry->sender_len + entry->content_len;
+    if (*offset + body > length) {
+        fprintf(stderr, "Truncated search result at offset %zu\n", *offset);
+        return false;
+    }
+
+    *sender = payload + *offset + sizeof(SearchResultEntry);
+    *content = *sender + entry->sender_len;
+    *offset += body;
+    return true;
+}
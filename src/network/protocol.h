@@ -8,6 +8,9 @@
 // Define maximum payload size
 #define MAX_PAYLOAD_SIZE 4096
 
+// Session tokens are 16 random bytes sent as 32 hex characters + NUL
+#define SESSION_TOKEN_SIZE 33
+
 // Make sure INVALID_SOCKET is defined
 #ifndef INVALID_SOCKET
 #ifdef _WIN32
@@ -32,6 +35,27 @@ typedef enum {
     MSG_REGISTER_REQUEST,
     MSG_REGISTER_SUCCESS,
     MSG_REGISTER_FAILURE,
+    MSG_RESUME_REQUEST,
+    MSG_RESUME_SUCCESS,
+    MSG_RESUME_FAILURE,
+    MSG_CHANNEL_SNAPSHOT,
+    MSG_PRESENCE_UPDATE,
+    MSG_LOGOUT,
+    MSG_CHAT_ACK,
+    MSG_CHANNEL_ACTIVITY,
+    MSG_READ_MARKER,
+    MSG_SEARCH_REQUEST,
+    MSG_SEARCH_RESULTS,
+    MSG_HISTORY_REQUEST,
+    MSG_HISTORY_PAGE,
+    MSG_REPLAY_REQUEST,
+    MSG_CHANNEL_SYNCED,
+    MSG_NODE_HELLO,
+    MSG_NODE_PING,
+    MSG_NODE_HANDOFF,
+    MSG_NODE_CHAT_FORWARD,
+    MSG_NODE_CHAT_RESULT,
+    MSG_NODE_CHAT_PUBLISH,
     MSG_ERROR
 } MessageType;
 
@@ -59,8 +83,33 @@ typedef struct {
     uint32_t channel_id;
     char sender_username[32];
     char content[1024];
+    uint32_t message_id; // Assigned by the server when the message is stored
+    uint64_t seq;        // Per-channel sequence number assigned by the server
+    uint32_t client_id;  // Sender's local id for the message; kept in MSG_CHAT_ACK and the sender's own copy
+    int64_t sent_at;     // Unix time the server stored the message at
 } ChatMessage;
 
+// MSG_CHAT_ACK: the server's answer to the sender of a MSG_CHAT. When
+// accepted, message_id/seq/sent_at are what the members received; the sender
+// also gets the message itself in seq order, with its client_id, like the
+// others. When rejected the message was dropped. When unknown, the node that
+// sequences the channel stopped answering: the sender's copy confirms the
+// message if it was taken after all.
+typedef enum {
+    CHAT_ACK_REJECTED,
+    CHAT_ACK_ACCEPTED,
+    CHAT_ACK_UNKNOWN
+} ChatAckStatus;
+
+typedef struct {
+    uint32_t channel_id;
+    uint32_t client_id;
+    uint32_t message_id;
+    uint8_t status; // ChatAckStatus
+    uint64_t seq;
+    int64_t sent_at; // Unix time
+} ChatAck;
+
 typedef struct {
     char username[32];
     UserStatus status;
@@ -72,6 +121,66 @@ typedef struct {
     bool is_private;
 } ChannelInfo;
 
+// MSG_PRESENCE_UPDATE payload is an array of these: the users whose status
+// changed during the last presence tick, coalesced to their latest status
+typedef struct {
+    uint32_t user_id;
+    uint32_t status; // UserStatus
+    char username[50];
+} PresenceUpdate;
+
+// MSG_CHANNEL_ACTIVITY: a message was posted in a channel the client is a
+// member of but not viewing. Only the full MSG_CHAT goes to viewers; everyone
+// else subscribed gets this, enough to count unread messages and mentions.
+typedef struct {
+    uint32_t channel_id;
+    uint32_t message_id;
+    uint64_t seq;
+    uint8_t mention; // The message mentions the recipient (@name or @everyone)
+} ChannelActivity;
+
+// MSG_READ_MARKER: the user has read channel_id up to seq. Sent debounced by
+// the client; the server only ever moves a marker forward.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t seq;
+} ReadMarker;
+
+// MSG_SEARCH_REQUEST: full-text search over the messages of the channels the
+// user can see, or of channel_id alone when it is non-zero. Results are ordered
+// by rank, then message_id, both descending. For the next page, send the rank
+// and message_id of the last result received as the cursor.
+#define SEARCH_QUERY_MAX 128
+
+typedef struct {
+    uint32_t request_id;       // Echoed in the results, so stale pages can be dropped
+    uint32_t channel_id;       // 0: every visible channel
+    float after_rank;          // Cursor, only used when after_message_id != 0
+    uint32_t after_message_id;
+    char query[SEARCH_QUERY_MAX]; // Web-search syntax: words, "phrases", -excluded, or
+} SearchRequest;
+
+// MSG_SEARCH_RESULTS payload: a SearchResultsHeader followed by `count`
+// entries, every entry being a SearchResultEntry followed by sender_len +
+// content_len bytes (no NULs). content is a snippet of the message.
+#define SEARCH_MORE 0x01 // More results follow the last entry
+
+typedef struct {
+    uint32_t request_id;
+    uint16_t count;
+    uint8_t flags;
+} SearchResultsHeader;
+
+typedef struct {
+    uint32_t message_id;
+    uint32_t channel_id;
+    uint64_t seq;
+    int64_t sent_at; // Unix time
+    float rank;
+    uint16_t content_len;
+    uint8_t sender_len;
+} SearchResultEntry;
+
 typedef struct {
     char username[50];
     char password[50];
@@ -79,8 +188,150 @@ typedef struct {
 
 typedef struct {
     char username[50];
+    char session_token[SESSION_TOKEN_SIZE]; // Presented in MSG_RESUME_REQUEST after a reconnect
 } LoginSuccessResponse;
 
+// Sent instead of MSG_LOGIN_REQUEST by a client reconnecting with a session token.
+// The server answers with MSG_RESUME_SUCCESS (LoginSuccessResponse payload) followed by
+// every MSG_CHAT in channel_id newer than last_seq and MSG_CHANNEL_SYNCED, or
+// MSG_RESUME_FAILURE.
+typedef struct {
+    char session_token[SESSION_TOKEN_SIZE];
+    uint32_t channel_id;
+    uint64_t last_seq;
+} ResumeRequest;
+
+// MSG_JOIN_CHANNEL payload. A client with a local copy of the channel sets
+// after_seq to its newest cached message and gets only the newer ones as
+// MSG_CHAT; with after_seq 0, or a gap too large to replay, the server sends a
+// MSG_CHANNEL_SNAPSHOT instead; MSG_CHANNEL_SYNCED follows either way. A bare
+// uint32_t channel id is still accepted.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t after_seq;
+} JoinChannelRequest;
+
+// MSG_HISTORY_REQUEST: the user scrolled to the oldest message shown and the
+// client asks for the ones before before_seq. The answer is one
+// MSG_HISTORY_PAGE laid out like a MSG_CHANNEL_SNAPSHOT frame, oldest first,
+// flagged HISTORY_OLDEST once the start of the channel is reached. Pages come
+// from the messages table and then from the cold archive, seamlessly.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t before_seq;
+} HistoryRequest;
+
+// MSG_REPLAY_REQUEST: the client has the channel up to after_seq but saw newer
+// messages arrive past a hole. Answered like a join: the missing messages as
+// MSG_CHAT (or a MSG_CHANNEL_SNAPSHOT if too many are missing), then
+// MSG_CHANNEL_SYNCED.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t after_seq;
+} ReplayRequest;
+
+// MSG_CHANNEL_SYNCED: ends the history sent for a join, resume or replay. The
+// client now has every message of channel_id up to through_seq, and the
+// messages that follow arrive live, in seq order.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t through_seq;
+} ChannelSynced;
+
+// MSG_CHANNEL_SNAPSHOT: the server's window of recent messages for a channel,
+// sent in answer to MSG_JOIN_CHANNEL. A snapshot spans one or more frames; each
+// payload is a ChannelSnapshotHeader followed by `count` entries, every entry
+// being a SnapshotEntry followed by sender_len + content_len bytes (no NULs).
+#define SNAPSHOT_FIRST 0x01 // First frame: client clears the channel view
+#define SNAPSHOT_LAST  0x02 // Last frame: client scrolls to the bottom
+#define HISTORY_OLDEST 0x04 // MSG_HISTORY_PAGE: nothing older exists
+
+typedef struct {
+    uint32_t channel_id;
+    uint16_t count;
+    uint8_t flags;
+} ChannelSnapshotHeader;
+
+typedef struct {
+    uint64_t seq;
+    int64_t sent_at;      // Unix time
+    uint32_t message_id;
+    uint16_t content_len;
+    uint8_t sender_len;
+} SnapshotEntry;
+
+// MSG_USER_LIST: the members of a channel and their status. On join the server
+// sends a USER_LIST_SNAPSHOT (one or more frames flagged SNAPSHOT_FIRST/LAST);
+// afterwards only single-entry USER_LIST_ADD / USER_LIST_REMOVE frames follow.
+// Status changes of members arrive as MSG_PRESENCE_UPDATE. Each payload is a
+// UserListHeader followed by `count` UserListEntry, each followed by
+// username_len bytes (no NUL).
+typedef enum {
+    USER_LIST_SNAPSHOT,
+    USER_LIST_ADD,
+    USER_LIST_REMOVE
+} UserListOp;
+
+typedef struct {
+    uint32_t channel_id;
+    uint16_t count;
+    uint8_t op;    // UserListOp
+    uint8_t flags; // SNAPSHOT_FIRST / SNAPSHOT_LAST for USER_LIST_SNAPSHOT
+} UserListHeader;
+
+typedef struct {
+    uint32_t user_id;
+    uint8_t status; // UserStatus
+    uint8_t username_len;
+} UserListEntry;
+
+// --- Links between server nodes (src/server/federation.c), never seen by clients ---
+
+// MSG_NODE_HELLO: first frame on a link, from the node that dialed.
+// MSG_NODE_PING has no payload and only keeps an idle link alive.
+typedef struct {
+    uint32_t node_id;
+} NodeHello;
+
+// MSG_NODE_HANDOFF: a channel that now belongs to the receiver was last
+// sequenced by the sender up to last_seq. Sent when a link comes up, ending
+// with channel_id 0 once the sender has nothing more to hand over.
+typedef struct {
+    uint32_t channel_id;
+    uint64_t last_seq;
+} NodeHandoff;
+
+// MSG_NODE_CHAT_FORWARD: a message posted on the sender for a channel the
+// receiver owns, answered with a MSG_NODE_CHAT_RESULT carrying request_id
+typedef struct {
+    uint32_t request_id;
+    uint32_t sender_id;     // users.user_id, membership already checked
+    int32_t sender_socket;  // The sender's connection on the node it came from
+    ChatMessage chat;
+} NodeChatForward;
+
+typedef enum {
+    NODE_CHAT_ACCEPTED,
+    NODE_CHAT_REJECTED,
+    NODE_CHAT_NOT_OWNER // The receiver's view of the ring differs: route again
+} NodeChatStatus;
+
+typedef struct {
+    uint32_t request_id;
+    uint8_t status; // NodeChatStatus
+    uint32_t message_id;
+    uint64_t seq;
+    int64_t sent_at; // Unix time
+} NodeChatResult;
+
+// MSG_NODE_CHAT_PUBLISH: a message sequenced by the channel's owner, for the
+// receiver's own subscribers. Sent in seq order per channel.
+typedef struct {
+    int64_t sent_at;       // Unix time
+    int32_t sender_socket; // The sender's connection if it is on the receiver, else -1
+    ChatMessage chat;
+} NodeChatPublish;
+
 typedef struct {
     char firstname[64];
     char lastname[64];
@@ -98,9 +349,28 @@ typedef struct {
 Message* create_message(MessageType type, const void* payload, uint32_t payload_size);
 Message* create_auth_message(const char* username, const char* password);
 Message* create_chat_message(uint32_t channel_id, const char* content);
-Message* create_join_channel_message(uint32_t channel_id);
+Message* create_join_channel_message(uint32_t channel_id, uint64_t after_seq);
 Message* create_leave_channel_message(uint32_t channel_id);
+Message* create_resume_message(const char* session_token, uint32_t channel_id, uint64_t last_seq);
+Message* create_read_marker_message(uint32_t channel_id, uint64_t seq);
+Message* create_history_request_message(uint32_t channel_id, uint64_t before_seq);
+Message* create_replay_request_message(uint32_t channel_id, uint64_t after_seq);
 int send_message(SOCKET sock, const Message* msg);
+int send_buffer(SOCKET sock, const char* data, size_t length);
 Message* receive_message(SOCKET sock);
 
+// Walk the entries of a MSG_CHANNEL_SNAPSHOT payload. *offset starts at
+// sizeof(ChannelSnapshotHeader); sender/content point into the payload and are
+// not NUL-terminated. Returns false at the end or on a malformed entry.
+bool snapshot_next_entry(const char* payload, uint32_t length, size_t* offset,
+                         SnapshotEntry* entry, const char** sender, const char** content);
+
+// Walk the entries of a MSG_USER_LIST payload, same contract as snapshot_next_entry
+bool user_list_next_entry(const char* payload, uint32_t length, size_t* offset,
+                          UserListEntry* entry, const char** username);
+
+// Walk the entries of a MSG_SEARCH_RESULTS payload, same contract as snapshot_next_entry
+bool search_result_next_entry(const char* payload, uint32_t length, size_t* offset,
+                              SearchResultEntry* entry, const char** sender, const char** content);
+
 #endif // PROTOCOL_H 
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/select.h>
+#endif
+#include "reconnect.h"
+
+static uint32_t env_u32(const char *name, uint32_t fallback) {
+    const char *value = getenv(name);
+    if (!value || !*value) return fallback;
+    char *end;
+    unsigned long parsed = strtoul(value, &end, 10);
+    if (*end != '\0' || parsed > UINT32_MAX) {
+        fprintf(stderr, "Ignoring invalid %s=%s\n", name, value);
+        return fallback;
+    }
+    return (uint32_t)parsed;
+}
+
+void reconnect_policy_init(ReconnectPolicy *policy) {
+    policy->base_ms = env_u32("RECONNECT_BASE_MS", DEFAULT_RECONNECT_BASE_MS);
+    policy->max_ms = env_u32("RECONNECT_MAX_MS", DEFAULT_RECONNECT_MAX_MS);
+    policy->max_attempts = env_u32("RECONNECT_MAX_ATTEMPTS", DEFAULT_RECONNECT_MAX_ATTEMPTS);
+    if (policy->base_ms == 0) policy->base_ms = 1;
+    if (policy->max_ms < policy->base_ms) policy->max_ms = policy->base_ms;
+
+    // Seeded from the clock and the state's address, which differ between
+    // clients started from the same image at the same second
+    policy->rng = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 20) ^ (uint64_t)(uintptr_t)policy;
+    if (policy->rng == 0) policy->rng = 0x9E3779B97F4A7C15ull;
+}
+
+static uint64_t next_random(ReconnectPolicy *policy) {
+    // xorshift64*
+    uint64_t x = policy->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    policy->rng = x;
+    return x * 0x2545F4914F6CDD1Dull;
+}
+
+uint32_t reconnect_delay_ms(ReconnectPolicy *policy, uint32_t attempt) {
+    uint64_t bound = policy->base_ms;
+    for (uint32_t i = 0; i < attempt && bound < policy->max_ms; i++) {
+        bound *= 2;
+    }
+    if (bound > policy->max_ms) bound = policy->max_ms;
+    return (uint32_t)(next_random(policy) % (bound + 1));
+}
+
+static bool set_blocking(SOCKET sock, bool blocking) {
+#ifdef _WIN32
+    u_long nonblocking = blocking ? 0 : 1;
+    return ioctlsocket(sock, FIONBIO, &nonblocking) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0) return false;
+    return fcntl(sock, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK) == 0;
+#endif
+}
+
+// Wait for a non-blocking connect to finish; 0 on success, else the error
+static int finish_connect(SOCKET sock, uint32_t timeout_ms, const volatile int *running) {
+    while (timeout_ms > 0 && (!running || *running)) {
+        uint32_t step = timeout_ms < CONNECT_POLL_MS ? timeout_ms : CONNECT_POLL_MS;
+        struct timeval tv = {(long)(step / 1000), (long)(step % 1000) * 1000};
+        fd_set writable, failed;
+        FD_ZERO(&writable);
+        FD_ZERO(&failed);
+        FD_SET(sock, &writable);
+        FD_SET(sock, &failed); // Where Windows reports a refused connection
+        int ready = select((int)sock + 1, NULL, &writable, &failed, &tv);
+        if (ready < 0) return errno;
+        if (ready > 0) {
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(sock, SOL_SOCKET, SO_ERROR, (char *)&error, &length) != 0) return errno;
+            return error;
+        }
+        timeout_ms -= step;
+    }
+    return running && !*running ? ECANCELED : ETIMEDOUT;
+}
+
+bool connect_to_server(const char *ip, uint16_t port, uint32_t timeout_ms, const volatile int *running, SOCKET *out) {
+    struct sockaddr_in serv_addr;
+    memset(&serv_addr, 0, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, ip, &serv_addr.sin_addr) <= 0) {
+        fprintf(stderr, "Invalid server address: %s\n", ip);
+        return false;
+    }
+
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("Socket creation failed");
+        return false;
+    }
+    // Non-blocking while connecting, so an unreachable host can't hold us past timeout_ms
+    int error = 0;
+    if (!set_blocking(sock, false)) {
+        error = errno;
+    } else if (connect(sock, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
+#ifdef _WIN32
+        bool pending = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+        bool pending = errno == EINPROGRESS;
+#endif
+        error = pending ? finish_connect(sock, timeout_ms, running) : errno;
+    }
+    if (error == 0 && !set_blocking(sock, true)) error = errno;
+    if (error != 0) {
+        fprintf(stderr, "Connection failed: %s\n", strerror(error));
+        CLOSE_SOCKET(sock);
+        return false;
+    }
+    *out = sock;
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef RECONNECT_H
+#define RECONNECT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "platform.h"
+
+// Client side of a lost connection: when to try again and how to connect.
+// Delays grow exponentially with "full jitter" (uniform between 0 and the
+// exponential bound), so clients dropped together by a server restart come
+// back spread out instead of all at once.
+
+#define DEFAULT_RECONNECT_BASE_MS 500
+#define DEFAULT_RECONNECT_MAX_MS 30000
+#define DEFAULT_RECONNECT_MAX_ATTEMPTS 0 // 0: keep trying
+// A connection attempt gives up after this long instead of the kernel's SYN retries
+#define CONNECT_TIMEOUT_MS 5000
+// How often a pending connection attempt checks whether it is still wanted
+#define CONNECT_POLL_MS 100
+
+typedef struct {
+    uint32_t base_ms;      // Bound of the first delay; doubles per attempt
+    uint32_t max_ms;       // Cap of the bound
+    uint32_t max_attempts; // Give up after this many, 0 for never
+    uint64_t rng;          // Per-process jitter state
+} ReconnectPolicy;
+
+// Defaults, overridden by RECONNECT_BASE_MS, RECONNECT_MAX_MS and RECONNECT_MAX_ATTEMPTS
+void reconnect_policy_init(ReconnectPolicy *policy);
+
+// Delay before attempt (0-based): uniform in [0, min(max_ms, base_ms * 2^attempt)]
+uint32_t reconnect_delay_ms(ReconnectPolicy *policy, uint32_t attempt);
+
+// Open a TCP connection to ip:port within timeout_ms, abandoned early once
+// *running turns false (NULL: never). Returns false (after logging) on failure.
+bool connect_to_server(const char *ip, uint16_t port, uint32_t timeout_ms, const volatile int *running, SOCKET *out);
+
+#endif // RECONNECT_H
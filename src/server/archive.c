@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#include <zlib.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <io.h>
+#define make_dir(path) _mkdir(path)
+#define sync_file(f) _commit(_fileno(f))
+#else
+#include <sys/stat.h>
+#include <unistd.h>
+#define make_dir(path) mkdir(path, 0755)
+#define sync_file(f) fsync(fileno(f))
+#endif
+#include "archive.h"
+#include "../database/db_connection.h"
+
+#define SEGMENT_MAGIC "X2RSEG01"
+// Pause between two segments of a pass, so archiving never hogs the database
+#define ARCHIVE_PAUSE_MS 200
+#define ARCHIVE_PATH_MAX 768 // archive_dir, a separator and a relative segment path
+
+// Segment file: a SegmentHeader, the compressed blocks, then the block
+// directory (block_count SegmentBlock at index_offset)
+typedef struct {
+    char magic[8];
+    uint32_t channel_id;
+    uint32_t block_count;
+    uint64_t index_offset;
+} SegmentHeader;
+
+typedef struct {
+    uint64_t first_seq;
+    uint64_t last_seq;
+    uint64_t offset;
+    uint32_t compressed_len;
+    uint32_t raw_len; // Entries as in MSG_CHANNEL_SNAPSHOT once inflated
+    uint16_t count;
+} SegmentBlock;
+
+static char archive_dir[512] = DEFAULT_ARCHIVE_DIR;
+static int after_days = DEFAULT_ARCHIVE_AFTER_DAYS;
+
+// Reads and drops are short and share one connection; the archiver holds a
+// transaction open while it writes a segment, so it has its own
+static PGconn *reader_db = NULL;
+static pthread_mutex_t reader_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PGconn *archiver_db = NULL;
+static pthread_t archiver_thread;
+static volatile bool archiver_running = false;
+
+// Take the oldest messages of a channel past the cutoff out of the table,
+// with what the segment needs, in seq order. Their reactions, files and
+// mentions stay in their tables, found by message_id as before (nothing
+// references messages since migration 3), until the segment expires.
+// Rolled back unless the segment is written.
+// Every message has a seq since migration 10 numbered the older ones.
+static const char *take_query =
+    "WITH old AS ("
+    "  SELECT message_id, timestamp FROM messages"
+    "  WHERE channel_id = $1::int"
+    "    AND timestamp < LOCALTIMESTAMP - make_interval(days => $2::int)"
+    "  ORDER BY seq LIMIT $3::int"
+    "), gone AS ("
+    "  DELETE FROM messages m USING old"
+    "  WHERE m.message_id = old.message_id AND m.timestamp = old.timestamp"
+    "  RETURNING m.message_id, m.seq, m.sender_id, m.content, m.timestamp AS sent"
+    ") "
+    "SELECT gone.message_id, gone.seq, COALESCE(u.email, ''), gone.content,"
+    "  EXTRACT(EPOCH FROM gone.sent::timestamptz)::bigint, gone.sent "
+    "FROM gone LEFT JOIN users u ON u.user_id = gone.sender_id ORDER BY gone.seq";
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+// Sleep in short naps so archive_stop never waits long
+static void nap(int ms) {
+    while (ms > 0 && archiver_running) {
+        int step = ms < 500 ? ms : 500;
+        sleep_ms(step);
+        ms -= step;
+    }
+}
+
+static bool exec_command(PGconn *conn, const char *sql) {
+    PGresult *res = PQexec(conn, sql);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) fprintf(stderr, "DB Error in archive (%s): %s\n", sql, PQerrorMessage(conn));
+    PQclear(res);
+    return ok;
+}
+
+// --- Writing ---
+
+// Append one block of rows [first, end) to the segment
+static bool write_block(FILE *f, PGresult *res, int first, int end, SegmentBlock *block) {
+    size_t raw_size = 0;
+    for (int i = first; i < end; i++) {
+        raw_size += sizeof(SnapshotEntry) + PQgetlength(res, i, 2) + PQgetlength(res, i, 3);
+    }
+    char *raw = malloc(raw_size);
+    uLongf compressed_len = compressBound((uLong)raw_size);
+    Bytef *compressed = malloc(compressed_len);
+    if (!raw || !compressed) {
+        fprintf(stderr, "Failed to allocate archive block\n");
+        free(raw);
+        free(compressed);
+        return false;
+    }
+
+    size_t length = 0;
+    for (int i = first; i < end; i++) {
+        const char *sender = PQgetvalue(res, i, 2);
+        const char *content = PQgetvalue(res, i, 3);
+        SnapshotEntry entry = {0};
+        entry.message_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+        entry.seq = strtoull(PQgetvalue(res, i, 1), NULL, 10);
+        entry.sent_at = strtoll(PQgetvalue(res, i, 4), NULL, 10);
+        entry.sender_len = (uint8_t)(PQgetlength(res, i, 2) > UINT8_MAX ? UINT8_MAX : PQgetlength(res, i, 2));
+        entry.content_len = (uint16_t)(PQgetlength(res, i, 3) > UINT16_MAX ? UINT16_MAX : PQgetlength(res, i, 3));
+        memcpy(raw + length, &entry, sizeof(entry));
+        memcpy(raw + length + sizeof(entry), sender, entry.sender_len);
+        memcpy(raw + length + sizeof(entry) + entry.sender_len, content, entry.content_len);
+        length += sizeof(entry) + entry.sender_len + entry.content_len;
+    }
+
+    bool ok = compress2(compressed, &compressed_len, (const Bytef *)raw, (uLong)length, Z_DEFAULT_COMPRESSION) == Z_OK;
+    if (ok) {
+        block->first_seq = strtoull(PQgetvalue(res, first, 1), NULL, 10);
+        block->last_seq = strtoull(PQgetvalue(res, end - 1, 1), NULL, 10);
+        block->offset = (uint64_t)ftell(f);
+        block->compressed_len = (uint32_t)compressed_len;
+        block->raw_len = (uint32_t)length;
+        block->count = (uint16_t)(end - first);
+        ok = fwrite(compressed, 1, compressed_len, f) == compressed_len;
+    }
+    free(raw);
+    free(compressed);
+    return ok;
+}
+
+// Write the rows as a segment at path, durably: through a temporary file,
+// synced and then renamed, so a crash never leaves half a segment
+static bool write_segment(const char *path, uint32_t channel_id, PGresult *res) {
+    int rows = PQntuples(res);
+    uint32_t block_count = (uint32_t)((rows + ARCHIVE_BLOCK_MESSAGES - 1) / ARCHIVE_BLOCK_MESSAGES);
+    SegmentBlock *blocks = calloc(block_count, sizeof(SegmentBlock));
+    char tmp_path[ARCHIVE_PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *f = blocks ? fopen(tmp_path, "wb") : NULL;
+    if (!f) {
+        fprintf(stderr, "Failed to create archive segment %s\n", tmp_path);
+        free(blocks);
+        return false;
+    }
+
+    SegmentHeader header = {0};
+    memcpy(header.magic, SEGMENT_MAGIC, sizeof(header.magic));
+    header.channel_id = channel_id;
+    header.block_count = block_count;
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (uint32_t b = 0; ok && b < block_count; b++) {
+        int first = (int)b * ARCHIVE_BLOCK_MESSAGES;
+        int end = first + ARCHIVE_BLOCK_MESSAGES < rows ? first + ARCHIVE_BLOCK_MESSAGES : rows;
+        ok = write_block(f, res, first, end, &blocks[b]);
+    }
+    if (ok) {
+        header.index_offset = (uint64_t)ftell(f);
+        ok = fwrite(blocks, sizeof(SegmentBlock), block_count, f) == block_count &&
+             fseek(f, 0, SEEK_SET) == 0 &&
+             fwrite(&header, sizeof(header), 1, f) == 1 &&
+             fflush(f) == 0 && sync_file(f) == 0;
+    }
+    ok = fclose(f) == 0 && ok;
+    free(blocks);
+
+#ifdef _WIN32
+    if (ok) remove(path); // rename doesn't replace on Windows
+#endif
+    if (!ok || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Failed to write archive segment %s\n", path);
+        remove(tmp_path);
+        return false;
+    }
+    return true;
+}
+
+// Archive the next segment of a channel. Returns the messages archived, 0
+// when too few are eligible, -1 on error.
+static int archive_segment(const char *channel_id) {
+    char days_str[16], limit_str[16];
+    snprintf(days_str, sizeof(days_str), "%d", after_days);
+    snprintf(limit_str, sizeof(limit_str), "%d", ARCHIVE_SEGMENT_MESSAGES);
+    const char *params[3] = {channel_id, days_str, limit_str};
+
+    if (!exec_command(archiver_db, "BEGIN")) return -1;
+    PGresult *res = PQexecParams(archiver_db, take_query, 3, NULL, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error archiving channel %s: %s\n", channel_id, PQresultErrorMessage(res));
+        PQclear(res);
+        exec_command(archiver_db, "ROLLBACK");
+        return -1;
+    }
+    int rows = PQntuples(res);
+    if (rows < ARCHIVE_SEGMENT_MIN_MESSAGES) {
+        PQclear(res);
+        exec_command(archiver_db, "ROLLBACK");
+        return 0;
+    }
+
+    const char *first_seq = PQgetvalue(res, 0, 1);
+    const char *last_seq = PQgetvalue(res, rows - 1, 1);
+    char relative[128], path[ARCHIVE_PATH_MAX], first_id[16], last_id[16];
+    snprintf(relative, sizeof(relative), "%s/%s-%s.seg", channel_id, first_seq, last_seq);
+    snprintf(path, sizeof(path), "%s/%s", archive_dir, channel_id);
+    make_dir(path); // Usually there already
+    snprintf(path, sizeof(path), "%s/%s", archive_dir, relative);
+
+    // message_id follows insertion order, seq the channel's order: take the real bounds
+    uint32_t min_id = UINT32_MAX, max_id = 0;
+    for (int i = 0; i < rows; i++) {
+        uint32_t id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+        if (id < min_id) min_id = id;
+        if (id > max_id) max_id = id;
+    }
+    snprintf(first_id, sizeof(first_id), "%u", min_id);
+    snprintf(last_id, sizeof(last_id), "%u", max_id);
+    char count_str[16];
+    snprintf(count_str, sizeof(count_str), "%d", rows);
+    const char *catalog_params[8] = {channel_id, first_id, last_id, first_seq, last_seq,
+                                     PQgetvalue(res, rows - 1, 5), count_str, relative};
+
+    bool ok = write_segment(path, (uint32_t)strtoul(channel_id, NULL, 10), res);
+    if (ok) {
+        PGresult *ins = PQexecParams(archiver_db,
+            "INSERT INTO archive_segments (channel_id, first_message_id, last_message_id, first_seq, last_seq,"
+            " last_sent_at, message_count, path) VALUES ($1::int, $2::int, $3::int, $4::bigint, $5::bigint,"
+            " $6::timestamp, $7::int, $8)",
+            8, NULL, catalog_params, NULL, NULL, 0);
+        ok = PQresultStatus(ins) == PGRES_COMMAND_OK;
+        if (!ok) fprintf(stderr, "DB Error cataloguing segment %s: %s\n", relative, PQresultErrorMessage(ins));
+        PQclear(ins);
+    }
+    // Without a commit the messages stay in the table; a segment file left
+    // behind has no catalog row and is overwritten by the next attempt
+    ok = ok && exec_command(archiver_db, "COMMIT");
+    if (!ok) exec_command(archiver_db, "ROLLBACK");
+    PQclear(res);
+    return ok ? rows : -1;
+}
+
+static void archive_pass(void) {
+    PGresult *res = PQexec(archiver_db, "SELECT channel_id FROM channels ORDER BY channel_id");
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error listing channels to archive: %s\n", PQerrorMessage(archiver_db));
+        PQclear(res);
+        return;
+    }
+    for (int i = 0; i < PQntuples(res) && archiver_running; i++) {
+        const char *channel_id = PQgetvalue(res, i, 0);
+        long total = 0;
+        int archived;
+        while (archiver_running && (archived = archive_segment(channel_id)) > 0) {
+            total += archived;
+            nap(ARCHIVE_PAUSE_MS);
+        }
+        if (total > 0) {
+            printf("🧊 Archived %ld messages of channel %s older than %d days\n", total, channel_id, after_days);
+        }
+    }
+    PQclear(res);
+}
+
+static void* archiver_loop(void *arg) {
+    (void)arg;
+    while (archiver_running) {
+        if (PQstatus(archiver_db) != CONNECTION_OK) {
+            PQreset(archiver_db); // Try again next pass if this fails
+        }
+        if (PQstatus(archiver_db) == CONNECTION_OK) {
+            archive_pass();
+        }
+        nap(ARCHIVE_INTERVAL_S * 1000);
+    }
+    return NULL;
+}
+
+// --- Reading ---
+
+// Deliver the messages of one segment older than before_seq, newest first.
+// seq_shift is added to the seqs in the file (migration 10). Returns the count.
+static int read_segment(const char *relative, uint64_t seq_shift, uint64_t before_seq, int max, ArchivedEntryFn fn,
+                        void *user_data) {
+    char path[ARCHIVE_PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", archive_dir, relative);
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Archive segment %s is missing\n", path);
+        return 0;
+    }
+
+    SegmentHeader header;
+    SegmentBlock *blocks = NULL;
+    if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, SEGMENT_MAGIC, sizeof(header.magic)) != 0 ||
+        !(blocks = calloc(header.block_count ? header.block_count : 1, sizeof(SegmentBlock))) ||
+        fseek(f, (long)header.index_offset, SEEK_SET) != 0 ||
+        fread(blocks, sizeof(SegmentBlock), header.block_count, f) != header.block_count) {
+        fprintf(stderr, "Archive segment %s is damaged\n", path);
+        free(blocks);
+        fclose(f);
+        return 0;
+    }
+
+    int delivered = 0;
+    for (uint32_t b = header.block_count; b > 0 && delivered < max; b--) {
+        const SegmentBlock *block = &blocks[b - 1];
+        if (block->first_seq + seq_shift >= before_seq) continue; // The sparse index skips it unread
+
+        Bytef *compressed = malloc(block->compressed_len);
+        char *raw = malloc(block->raw_len ? block->raw_len : 1);
+        size_t *offsets = malloc((block->count ? block->count : 1) * sizeof(size_t));
+        uLongf raw_len = block->raw_len;
+        bool ok = compressed && raw && offsets &&
+                  fseek(f, (long)block->offset, SEEK_SET) == 0 &&
+                  fread(compressed, 1, block->compressed_len, f) == block->compressed_len &&
+                  uncompress((Bytef *)raw, &raw_len, compressed, block->compressed_len) == Z_OK;
+        if (!ok) {
+            fprintf(stderr, "Failed to read block %u of archive segment %s\n", b - 1, path);
+        } else {
+            // Entries are variable-sized: find them all, then walk back from the newest
+            int count = 0;
+            size_t offset = 0;
+            SnapshotEntry entry;
+            const char *sender, *content;
+            while (count < block->count) {
+                size_t at = offset;
+                if (!snapshot_next_entry(raw, (uint32_t)raw_len, &offset, &entry, &sender, &content)) break;
+                offsets[count++] = at;
+            }
+            for (int i = count - 1; i >= 0 && delivered < max; i--) {
+                offset = offsets[i];
+                snapshot_next_entry(raw, (uint32_t)raw_len, &offset, &entry, &sender, &content);
+                entry.seq += seq_shift;
+                if (entry.seq >= before_seq) continue;
+                fn(&entry, sender, content, user_data);
+                delivered++;
+            }
+        }
+        free(compressed);
+        free(raw);
+        free(offsets);
+    }
+    free(blocks);
+    fclose(f);
+    return delivered;
+}
+
+int archive_read_before(uint32_t channel_id, uint64_t before_seq, int max, ArchivedEntryFn fn, void *user_data) {
+    char channel_id_str[32], seq_str[32];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(seq_str, sizeof(seq_str), "%llu", (unsigned long long)before_seq);
+    const char *params[2] = {channel_id_str, seq_str};
+
+    pthread_mutex_lock(&reader_mutex);
+    if (!reader_db) {
+        pthread_mutex_unlock(&reader_mutex);
+        return 0;
+    }
+    PGresult *res = PQexecParams(reader_db,
+        "SELECT path, seq_shift FROM archive_segments WHERE channel_id = $1::int AND first_seq < $2::bigint "
+        "ORDER BY first_seq DESC",
+        2, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&reader_mutex);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error reading archive catalog of channel %u: %s\n", channel_id, PQresultErrorMessage(res));
+        PQclear(res);
+        return 0;
+    }
+
+    int delivered = 0;
+    for (int i = 0; i < PQntuples(res) && delivered < max; i++) {
+        delivered += read_segment(PQgetvalue(res, i, 0), strtoull(PQgetvalue(res, i, 1), NULL, 10), before_seq,
+                                  max - delivered, fn, user_data);
+    }
+    PQclear(res);
+    return delivered;
+}
+
+int archive_drop_expired(uint32_t channel_id, int days) {
+    char channel_id_str[32], days_str[16];
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
+    snprintf(days_str, sizeof(days_str), "%d", days);
+    const char *params[2] = {channel_id_str, days_str};
+
+    pthread_mutex_lock(&reader_mutex);
+    if (!reader_db) {
+        pthread_mutex_unlock(&reader_mutex);
+        return 0;
+    }
+    // Out of the catalog first: a reader that still got the path just finds no file.
+    // The rows hanging off the segments' messages go with them. A segment only
+    // has its message_id range, so a row in it is left alone while its message
+    // is still in the table or in the range of a segment that stays.
+    PGresult *res = PQexecParams(reader_db,
+        "WITH dropped AS ("
+        "  DELETE FROM archive_segments WHERE channel_id = $1::int"
+        "    AND last_sent_at < LOCALTIMESTAMP - make_interval(days => $2::int)"
+        "  RETURNING segment_id, first_message_id, last_message_id, path"
+        "), orphaned AS ("
+        "  SELECT x.message_id FROM ("
+        "    SELECT message_id FROM reactions UNION SELECT message_id FROM files"
+        "    UNION SELECT message_id FROM mentions"
+        "  ) x JOIN dropped d ON x.message_id BETWEEN d.first_message_id AND d.last_message_id"
+        "  WHERE NOT EXISTS (SELECT 1 FROM messages m WHERE m.message_id = x.message_id)"
+        "    AND NOT EXISTS (SELECT 1 FROM archive_segments s"
+        "                    WHERE s.segment_id NOT IN (SELECT segment_id FROM dropped)"
+        "                      AND x.message_id BETWEEN s.first_message_id AND s.last_message_id)"
+        "), reactions_gone AS ("
+        "  DELETE FROM reactions WHERE message_id IN (SELECT message_id FROM orphaned)"
+        "), files_gone AS ("
+        "  DELETE FROM files WHERE message_id IN (SELECT message_id FROM orphaned)"
+        "), mentions_gone AS ("
+        "  DELETE FROM mentions WHERE message_id IN (SELECT message_id FROM orphaned)"
+        ") "
+        "SELECT path FROM dropped",
+        2, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(&reader_mutex);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error dropping archive segments of channel %u: %s\n", channel_id, PQresultErrorMessage(res));
+        PQclear(res);
+        return -1;
+    }
+
+    int dropped = PQntuples(res);
+    for (int i = 0; i < dropped; i++) {
+        char path[ARCHIVE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", archive_dir, PQgetvalue(res, i, 0));
+        if (remove(path) != 0) perror("Failed to remove archive segment");
+    }
+    PQclear(res);
+    return dropped;
+}
+
+// --- Lifecycle ---
+
+bool archive_start(void) {
+    const char *dir = getenv("ARCHIVE_DIR");
+    if (dir && *dir) snprintf(archive_dir, sizeof(archive_dir), "%s", dir);
+    const char *days = getenv("ARCHIVE_AFTER_DAYS");
+    after_days = days && *days ? atoi(days) : DEFAULT_ARCHIVE_AFTER_DAYS;
+
+    reader_db = connect_to_db();
+    if (!reader_db || PQstatus(reader_db) != CONNECTION_OK) {
+        fprintf(stderr, "Archive: database unavailable: %s\n", reader_db ? PQerrorMessage(reader_db) : "no connection");
+        if (reader_db) PQfinish(reader_db);
+        reader_db = NULL;
+        return false;
+    }
+    if (after_days <= 0) return true; // Read-only
+
+    make_dir(archive_dir);
+    archiver_db = connect_to_db();
+    if (!archiver_db || PQstatus(archiver_db) != CONNECTION_OK) {
+        fprintf(stderr, "Archive: no connection for the archiver, nothing will be archived\n");
+        if (archiver_db) PQfinish(archiver_db);
+        archiver_db = NULL;
+        return true;
+    }
+    archiver_running = true;
+    if (pthread_create(&archiver_thread, NULL, archiver_loop, NULL) != 0) {
+        perror("Failed to start archiver thread");
+        archiver_running = false;
+        PQfinish(archiver_db);
+        archiver_db = NULL;
+    }
+    return true;
+}
+
+void archive_stop(void) {
+    if (archiver_running) {
+        archiver_running = false;
+        pthread_join(archiver_thread, NULL);
+        PQfinish(archiver_db);
+        archiver_db = NULL;
+    }
+    pthread_mutex_lock(&reader_mutex);
+    if (reader_db) PQfinish(reader_db);
+    reader_db = NULL;
+    pthread_mutex_unlock(&reader_mutex);
+}
@@ -0,0 +1,45 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../network/protocol.h"
+
+// Cold storage for old history. Messages older than ARCHIVE_AFTER_DAYS move
+// out of the messages table into compressed, append-only segment files under
+// ARCHIVE_DIR/<channel_id>/. A segment holds a run of one channel's messages
+// in seq order, in zlib-compressed blocks of ARCHIVE_BLOCK_MESSAGES; the block
+// directory at its end is a sparse index, so a read only inflates the blocks
+// it needs. Segments are catalogued in archive_segments with their message_id
+// and seq ranges (migration 5). A message's reactions, files and mentions
+// stay in their tables while its segment is kept.
+
+// Override with ARCHIVE_DIR / ARCHIVE_AFTER_DAYS. 0 days archives nothing;
+// segments already written are still read.
+#define DEFAULT_ARCHIVE_DIR "archive"
+#define DEFAULT_ARCHIVE_AFTER_DAYS 0
+
+// Messages per segment, at most and at least: fewer eligible messages wait
+// for the next pass rather than making tiny segments
+#define ARCHIVE_SEGMENT_MESSAGES 4096
+#define ARCHIVE_SEGMENT_MIN_MESSAGES 256
+#define ARCHIVE_BLOCK_MESSAGES 128
+// How often channels are checked for messages to archive
+#define ARCHIVE_INTERVAL_S 3600
+
+// Receives archived messages, encoded as in MSG_CHANNEL_SNAPSHOT
+typedef void (*ArchivedEntryFn)(const SnapshotEntry *entry, const char *sender, const char *content, void *user_data);
+
+// False when the database can't be reached: archived history is then unavailable
+bool archive_start(void);
+void archive_stop(void);
+
+// Call fn for up to max archived messages of channel_id older than
+// before_seq, newest first. Returns the count.
+int archive_read_before(uint32_t channel_id, uint64_t before_seq, int max, ArchivedEntryFn fn, void *user_data);
+
+// Delete the segments of channel_id whose newest message is older than days,
+// with the reactions, files and mentions of their messages. Returns the number of segments deleted, -1 on error.
+int archive_drop_expired(uint32_t channel_id, int days);
+
+#endif // ARCHIVE_H
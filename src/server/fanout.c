@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "fanout.h"
+
+// Latency histogram buckets: bucket b holds deliveries under 2^b microseconds
+#define LATENCY_BUCKETS 32
+
+// One fanout_run: partitions are claimed in order by whichever thread gets
+// there first
+typedef struct Batch {
+    FanoutPart fn;
+    void *ctx;
+    size_t count;
+    size_t parts;
+    size_t next_part; // Guarded by fanout_mutex
+    size_t done_parts;
+    pthread_cond_t done_cond;
+    struct Batch *next;
+} Batch;
+
+typedef struct {
+    uint64_t counts[LATENCY_BUCKETS];
+    uint64_t total;
+    double max_micros;
+} Latency;
+
+static pthread_mutex_t fanout_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static Batch *batch_head = NULL, *batch_tail = NULL; // Batches with unclaimed partitions
+static pthread_t threads[FANOUT_MAX_THREADS];
+static int thread_count = 0;
+static volatile bool fanout_running = false;
+static size_t threshold = DEFAULT_FANOUT_THRESHOLD;
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static Latency latency[2]; // Direct, parallel
+static time_t last_report = 0;
+
+// Under fanout_mutex: claim the next partition of a batch, which leaves the
+// queue once its last partition is claimed
+static size_t claim(Batch *batch) {
+    size_t part = batch->next_part++;
+    if (batch->next_part == batch->parts) {
+        Batch *prev = NULL;
+        for (Batch *b = batch_head; b; prev = b, b = b->next) {
+            if (b != batch) continue;
+            if (prev) prev->next = b->next; else batch_head = b->next;
+            if (batch_tail == b) batch_tail = prev;
+            break;
+        }
+    }
+    return part;
+}
+
+static void run_part(Batch *batch, size_t part) {
+    size_t begin = part * FANOUT_PARTITION;
+    size_t end = begin + FANOUT_PARTITION < batch->count ? begin + FANOUT_PARTITION : batch->count;
+    batch->fn(batch->ctx, begin, end);
+
+    pthread_mutex_lock(&fanout_mutex);
+    if (++batch->done_parts == batch->parts) pthread_cond_signal(&batch->done_cond);
+    pthread_mutex_unlock(&fanout_mutex);
+}
+
+static void* fanout_loop(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&fanout_mutex);
+        while (!batch_head && fanout_running) pthread_cond_wait(&work_cond, &fanout_mutex);
+        Batch *batch = batch_head;
+        size_t part = batch ? claim(batch) : 0;
+        pthread_mutex_unlock(&fanout_mutex);
+        if (!batch) break;
+        run_part(batch, part);
+    }
+    return NULL;
+}
+
+static int default_thread_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long cores = (long)info.dwNumberOfProcessors;
+#else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cores > 1 ? (int)(cores - 1) : 0;
+}
+
+bool fanout_start(void) {
+    const char *value = getenv("FANOUT_THRESHOLD");
+    if (value && atoi(value) > 0) threshold = (size_t)atoi(value);
+    value = getenv("FANOUT_THREADS");
+    int wanted = value && *value ? atoi(value) : default_thread_count();
+    if (wanted > FANOUT_MAX_THREADS) wanted = FANOUT_MAX_THREADS;
+
+    fanout_running = true;
+    for (int i = 0; i < wanted; i++) {
+        if (pthread_create(&threads[thread_count], NULL, fanout_loop, NULL) != 0) {
+            perror("Failed to start fan-out thread");
+            break;
+        }
+        thread_count++;
+    }
+    if (thread_count == 0) {
+        fanout_running = false;
+        return wanted <= 0; // Asked for none: not a failure
+    }
+    printf("📣 Fan-out: %d thread(s), parallel from %zu recipients\n", thread_count, threshold);
+    return true;
+}
+
+void fanout_stop(void) {
+    if (!fanout_running) return;
+    pthread_mutex_lock(&fanout_mutex);
+    fanout_running = false;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&fanout_mutex);
+    for (int i = 0; i < thread_count; i++) pthread_join(threads[i], NULL);
+    thread_count = 0;
+}
+
+size_t fanout_threshold(void) {
+    return threshold;
+}
+
+void fanout_run(size_t count, FanoutPart fn, void *ctx) {
+    if (count == 0) return;
+    Batch batch = {0};
+    batch.fn = fn;
+    batch.ctx = ctx;
+    batch.count = count;
+    batch.parts = (count + FANOUT_PARTITION - 1) / FANOUT_PARTITION;
+
+    pthread_mutex_lock(&fanout_mutex);
+    if (!fanout_running || batch.parts == 1) {
+        pthread_mutex_unlock(&fanout_mutex);
+        fn(ctx, 0, count);
+        return;
+    }
+    pthread_cond_init(&batch.done_cond, NULL);
+    if (batch_tail) batch_tail->next = &batch; else batch_head = &batch;
+    batch_tail = &batch;
+    pthread_cond_broadcast(&work_cond);
+
+    // Take partitions of our own batch while any are left
+    while (batch.next_part < batch.parts) {
+        size_t part = claim(&batch);
+        pthread_mutex_unlock(&fanout_mutex);
+        run_part(&batch, part);
+        pthread_mutex_lock(&fanout_mutex);
+    }
+    while (batch.done_parts < batch.parts) pthread_cond_wait(&batch.done_cond, &fanout_mutex);
+    pthread_mutex_unlock(&fanout_mutex);
+    pthread_cond_destroy(&batch.done_cond);
+}
+
+// Upper bound of the bucket the q-th quantile falls in
+static double quantile(const Latency *l, double q) {
+    uint64_t rank = (uint64_t)(q * (double)l->total);
+    uint64_t seen = 0;
+    for (int b = 0; b < LATENCY_BUCKETS; b++) {
+        seen += l->counts[b];
+        if (seen > rank) return (double)((uint64_t)1 << b);
+    }
+    return l->max_micros;
+}
+
+void fanout_record(bool parallel, double micros) {
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && micros >= (double)((uint64_t)1 << bucket)) bucket++;
+
+    pthread_mutex_lock(&stats_mutex);
+    Latency *l = &latency[parallel ? 1 : 0];
+    l->counts[bucket]++;
+    l->total++;
+    if (micros > l->max_micros) l->max_micros = micros;
+
+    time_t now = time(NULL);
+    if (last_report == 0) last_report = now;
+    if (now - last_report >= FANOUT_REPORT_S) {
+        static const char *tiers[2] = {"direct", "parallel"};
+        for (int t = 0; t < 2; t++) {
+            if (latency[t].total == 0) continue;
+            printf("📊 Fan-out %s: %llu message(s), p50 < %.0f µs, p99 < %.0f µs, p99.9 < %.0f µs, max %.0f µs\n",
+                   tiers[t], (unsigned long long)latency[t].total, quantile(&latency[t], 0.5),
+                   quantile(&latency[t], 0.99), quantile(&latency[t], 0.999), latency[t].max_micros);
+        }
+        memset(latency, 0, sizeof(latency));
+        last_report = now;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
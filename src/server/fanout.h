@@ -0,0 +1,44 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Delivery of one message to many connections. Below the threshold the
+// posting thread sends to every recipient itself; above it the recipients are
+// cut into partitions that a small pool of fan-out threads sends to in
+// parallel, the posting thread taking its share, so a very large channel
+// costs the time of one partition per thread rather than of the whole list.
+//
+// Delivery latency is tracked per tier and logged every FANOUT_REPORT_S, with
+// its median and tail, so the threshold can be tuned on real traffic.
+
+// Recipients from which a message goes parallel; override with FANOUT_THRESHOLD
+#define DEFAULT_FANOUT_THRESHOLD 64
+// Recipients per partition
+#define FANOUT_PARTITION 32
+// Fan-out threads besides the posting one: by default one per online core
+// beyond the first, so a single-core host keeps delivering inline (the
+// threads would only compete with the posting ones); override with FANOUT_THREADS
+#define FANOUT_MAX_THREADS 64
+// How often delivery latencies are logged, when there was traffic
+#define FANOUT_REPORT_S 60
+
+// Sends to recipients [begin, end) of whatever ctx describes
+typedef void (*FanoutPart)(void *ctx, size_t begin, size_t end);
+
+// False (and delivery stays on the posting threads) if no thread could start
+bool fanout_start(void);
+void fanout_stop(void);
+
+// Recipient count from which fanout_run is worth it
+size_t fanout_threshold(void);
+
+// Runs fn over [0, count) partition by partition, on the fan-out threads and
+// the caller, and returns once every partition is done
+void fanout_run(size_t count, FanoutPart fn, void *ctx);
+
+// Delivery of one message to its recipients took micros
+void fanout_record(bool parallel, double micros);
+
+#endif // FANOUT_H
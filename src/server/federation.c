@@ -0,0 +1,894 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#define SHUTDOWN_BOTH SD_BOTH
+#else
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <sys/time.h>
+#define SHUTDOWN_BOTH SHUT_RDWR
+#endif
+#include "federation.h"
+#include "message_window.h"
+#include "ingest_log.h"
+
+// Times a message is routed again while the nodes disagree on its owner
+#define ROUTE_ATTEMPTS 3
+#define ROUTE_RETRY_MS 50
+
+typedef struct {
+    uint32_t id;
+    char host[64];
+    char port[8];
+    pthread_t thread;
+    bool thread_started;
+    pthread_mutex_t send_mutex;
+    SOCKET sock;       // The link, INVALID_SOCKET while down; guarded by send_mutex
+    SOCKET accepted;   // Link it dialed in on, not picked up yet; guarded by fed_mutex
+    bool up;           // Guarded by fed_mutex
+    bool handoff_done; // Its handoff arrived since the link came up; fed_mutex
+} Peer;
+
+typedef struct {
+    uint32_t hash;
+    Peer *node; // NULL: this node
+} RingPoint;
+
+// A forwarded message waiting for its owner's answer
+typedef struct Pending {
+    uint32_t request_id;
+    Peer *peer;
+    bool done;
+    bool lost; // The link dropped before the answer came
+    NodeChatResult result;
+    struct Pending *next;
+} Pending;
+
+typedef struct Job {
+    Peer *from;
+    NodeChatForward request;
+    struct Job *next;
+} Job;
+
+typedef struct {
+    uint32_t channel_id; // 0 marks a free slot
+    uint64_t seq;
+} SeqFloor;
+
+static uint32_t self_id = 0;
+static Peer peers[FEDERATION_MAX_NODES];
+static int peer_count = 0;
+static volatile bool fed_running = false;
+static FederationAcceptFn accept_chat = NULL;
+static FederationDeliverFn deliver_chat = NULL;
+
+// Links, the ring and pending forwards; fed_cond signals any change to them
+static pthread_mutex_t fed_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fed_cond = PTHREAD_COND_INITIALIZER;
+static RingPoint ring[FEDERATION_MAX_NODES * FEDERATION_VNODES];
+static int ring_size = 0;
+static Pending *pending_head = NULL;
+static uint32_t next_request_id = 1;
+
+// Highest seq other nodes are known to have handed out per channel, from their
+// handoffs and publishes. A channel sequenced here continues after it.
+static pthread_mutex_t floor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SeqFloor *floors = NULL;
+static size_t floor_capacity = 0, floor_count = 0;
+
+// Forwarded messages, sequenced by the workers so a slow fsync doesn't hold
+// up the link they came in on
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static Job *job_head = NULL, *job_tail = NULL;
+static pthread_t workers[FEDERATION_WORKERS];
+static int worker_count = 0;
+
+static SOCKET listen_sock = INVALID_SOCKET;
+static pthread_t accept_thread, ping_thread;
+static bool accept_started = false, ping_started = false;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {ms / 1000, (long)(ms % 1000) * 1000000};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// Sleep in short naps so federation_stop never waits long
+static void nap(int ms) {
+    while (ms > 0 && fed_running) {
+        int step = ms < 100 ? ms : 100;
+        sleep_ms(step);
+        ms -= step;
+    }
+}
+
+static struct timespec deadline_after(int ms) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (long)(ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+// --- Hash ring ---
+
+static uint32_t mix32(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+static int compare_point(const void *a, const void *b) {
+    uint32_t x = ((const RingPoint *)a)->hash, y = ((const RingPoint *)b)->hash;
+    return x < y ? -1 : x > y;
+}
+
+// Under fed_mutex: this node and the peers whose link is up
+static void rebuild_ring(void) {
+    ring_size = 0;
+    for (int v = 0; v < FEDERATION_VNODES; v++) {
+        ring[ring_size++] = (RingPoint){mix32(self_id * 0x9e3779b1u + mix32((uint32_t)v)), NULL};
+    }
+    for (int i = 0; i < peer_count; i++) {
+        if (!peers[i].up) continue;
+        for (int v = 0; v < FEDERATION_VNODES; v++) {
+            ring[ring_size++] = (RingPoint){mix32(peers[i].id * 0x9e3779b1u + mix32((uint32_t)v)), &peers[i]};
+        }
+    }
+    qsort(ring, (size_t)ring_size, sizeof(RingPoint), compare_point);
+}
+
+// Under fed_mutex: the first point clockwise from the channel that belongs to
+// neither this node (if skip_self) nor `skip`. NULL if no node is left.
+static const RingPoint* ring_owner(uint32_t channel_id, bool skip_self, const Peer *skip) {
+    uint32_t hash = mix32(channel_id ^ 0x5bd1e995u);
+    int lo = 0, hi = ring_size;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ring[mid].hash < hash) lo = mid + 1; else hi = mid;
+    }
+    for (int n = 0; n < ring_size; n++) {
+        const RingPoint *point = &ring[(lo + n) % ring_size];
+        if (point->node == NULL ? skip_self : point->node == skip) continue;
+        return point;
+    }
+    return NULL;
+}
+
+// NULL when this node owns the channel
+static Peer* owner_of(uint32_t channel_id) {
+    if (peer_count == 0) return NULL;
+    pthread_mutex_lock(&fed_mutex);
+    Peer *owner = ring_owner(channel_id, false, NULL)->node;
+    pthread_mutex_unlock(&fed_mutex);
+    return owner;
+}
+
+bool federation_owns(uint32_t channel_id) {
+    return owner_of(channel_id) == NULL;
+}
+
+// --- Sequence floors ---
+
+static SeqFloor* floor_slot(SeqFloor *table, size_t capacity, uint32_t channel_id) {
+    size_t i = (channel_id * 2654435761u) & (capacity - 1);
+    while (table[i].channel_id != 0 && table[i].channel_id != channel_id) i = (i + 1) & (capacity - 1);
+    return &table[i];
+}
+
+static void raise_floor(uint32_t channel_id, uint64_t seq) {
+    if (channel_id == 0 || seq == 0) return;
+    pthread_mutex_lock(&floor_mutex);
+    if ((floor_count + 1) * 2 > floor_capacity) {
+        size_t capacity = floor_capacity ? floor_capacity * 2 : 64;
+        SeqFloor *grown = calloc(capacity, sizeof(SeqFloor));
+        if (grown) {
+            for (size_t i = 0; i < floor_capacity; i++) {
+                if (floors[i].channel_id != 0) *floor_slot(grown, capacity, floors[i].channel_id) = floors[i];
+            }
+            free(floors);
+            floors = grown;
+            floor_capacity = capacity;
+        } else if (floor_count + 1 >= floor_capacity) {
+            fprintf(stderr, "❌ Out of memory tracking sequence floors\n");
+            pthread_mutex_unlock(&floor_mutex);
+            return; // Keep a free slot to end lookups
+        }
+    }
+    SeqFloor *slot = floor_slot(floors, floor_capacity, channel_id);
+    if (slot->channel_id == 0) {
+        slot->channel_id = channel_id;
+        floor_count++;
+    }
+    if (seq > slot->seq) slot->seq = seq;
+    pthread_mutex_unlock(&floor_mutex);
+}
+
+static uint64_t floor_of(uint32_t channel_id) {
+    uint64_t seq = 0;
+    pthread_mutex_lock(&floor_mutex);
+    if (floor_capacity > 0) seq = floor_slot(floors, floor_capacity, channel_id)->seq;
+    pthread_mutex_unlock(&floor_mutex);
+    return seq;
+}
+
+// --- Links ---
+
+static bool link_send_message(Peer *peer, const Message *msg) {
+    pthread_mutex_lock(&peer->send_mutex);
+    bool sent = peer->sock != INVALID_SOCKET && send_message(peer->sock, msg) == 0;
+    pthread_mutex_unlock(&peer->send_mutex);
+    return sent;
+}
+
+static bool link_send(Peer *peer, MessageType type, const void *payload, uint32_t length) {
+    Message *msg = create_message(type, payload, length);
+    if (!msg) return false;
+    bool sent = link_send_message(peer, msg);
+    free(msg);
+    return sent;
+}
+
+// To every node; `origin` (NULL: this one) is where the sender is connected,
+// on sender_socket
+static void publish(const ChatMessage *chat, int64_t sent_at, const Peer *origin, int sender_socket) {
+    NodeChatPublish payload = {0};
+    payload.sent_at = sent_at;
+    payload.chat = *chat;
+    for (int i = 0; i < peer_count; i++) {
+        bool to_origin = &peers[i] == origin;
+        payload.sender_socket = to_origin ? sender_socket : -1;
+        payload.chat.client_id = to_origin ? chat->client_id : 0; // Only meaningful to the sender
+        link_send(&peers[i], MSG_NODE_CHAT_PUBLISH, &payload, sizeof(payload));
+    }
+}
+
+// A channel gained from a node that is still up is held until that node has
+// handed over its seqs, or FEDERATION_HANDOFF_WAIT_MS passed
+static void await_handoff(uint32_t channel_id) {
+    if (peer_count == 0) return;
+    struct timespec deadline = deadline_after(FEDERATION_HANDOFF_WAIT_MS);
+    pthread_mutex_lock(&fed_mutex);
+    for (;;) {
+        const RingPoint *previous = ring_owner(channel_id, true, NULL);
+        if (!previous || previous->node->handoff_done) break;
+        if (pthread_cond_timedwait(&fed_cond, &fed_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    pthread_mutex_unlock(&fed_mutex);
+}
+
+// Sequence a message of a channel owned here and hand it to every node's
+// subscribers, all under the channel's order lock: whichever thread it comes
+// in on, the nodes and the clients get a channel in seq order. `origin` is the
+// node the sender is connected to, on sender_socket (NULL: this one).
+static FederationAccept sequence_here(uint32_t sender_id, ChatMessage *chat, int64_t *sent_at,
+                                      const Peer *origin, int sender_socket) {
+    await_handoff(chat->channel_id);
+    message_window_order_lock(chat->channel_id);
+    uint64_t floor = floor_of(chat->channel_id);
+    if (floor > 0) message_window_raise_seq(chat->channel_id, floor);
+    FederationAccept result = accept_chat(sender_id, chat, sent_at);
+    if (result == FEDERATION_ACCEPTED) {
+        publish(chat, *sent_at, origin, sender_socket);
+        deliver_chat(chat, origin ? -1 : sender_socket);
+    }
+    message_window_order_unlock(chat->channel_id);
+    return result;
+}
+
+// Tell a peer that just linked up how far this node sequenced the channels
+// that now belong to it. Runs after the ring was rebuilt, so a seq taken
+// later is given back by the accept callback.
+static void send_handoffs(Peer *peer) {
+    size_t window_count, logged_count;
+    uint32_t *window_channels = message_window_channels(&window_count);
+    uint32_t *logged_channels = ingest_log_channels(&logged_count);
+    int handed = 0;
+    for (size_t i = 0; i < window_count + logged_count; i++) {
+        uint32_t channel_id = i < window_count ? window_channels[i] : logged_channels[i - window_count];
+        pthread_mutex_lock(&fed_mutex);
+        const RingPoint *owner = ring_owner(channel_id, false, NULL);
+        const RingPoint *previous = ring_owner(channel_id, false, peer);
+        bool moved = owner->node == peer && previous && previous->node == NULL;
+        pthread_mutex_unlock(&fed_mutex);
+        if (!moved) continue;
+
+        NodeHandoff handoff = {channel_id, message_window_peek_seq(channel_id)};
+        uint64_t logged = ingest_log_last_seq(channel_id);
+        if (logged > handoff.last_seq) handoff.last_seq = logged;
+        if (handoff.last_seq > 0 && link_send(peer, MSG_NODE_HANDOFF, &handoff, sizeof(handoff))) handed++;
+    }
+    free(window_channels);
+    free(logged_channels);
+
+    NodeHandoff done = {0, 0};
+    link_send(peer, MSG_NODE_HANDOFF, &done, sizeof(done));
+    if (handed > 0) printf("🤝 Handed %d channel(s) over to node %u\n", handed, peer->id);
+}
+
+static void set_link_options(SOCKET sock) {
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char *)&nodelay, sizeof(nodelay));
+#ifdef _WIN32
+    DWORD timeout = FEDERATION_DEAD_MS;
+#else
+    struct timeval timeout = {FEDERATION_DEAD_MS / 1000, (FEDERATION_DEAD_MS % 1000) * 1000};
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char *)&timeout, sizeof(timeout));
+}
+
+static SOCKET dial(Peer *peer) {
+    struct addrinfo hints = {0}, *addresses = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(peer->host, peer->port, &hints, &addresses) != 0) return INVALID_SOCKET;
+
+    SOCKET sock = INVALID_SOCKET;
+    for (struct addrinfo *a = addresses; a && sock == INVALID_SOCKET; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock == INVALID_SOCKET) continue;
+        if (connect(sock, a->ai_addr, (socklen_t)a->ai_addrlen) != 0) {
+            CLOSE_SOCKET(sock);
+            sock = INVALID_SOCKET;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    set_link_options(sock);
+    NodeHello hello = {self_id};
+    Message *msg = create_message(MSG_NODE_HELLO, &hello, sizeof(hello));
+    bool sent = msg && send_message(sock, msg) == 0;
+    free(msg);
+    if (!sent) {
+        CLOSE_SOCKET(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+// Wait a little for the acceptor to hand over a link from a lower-id node
+static SOCKET take_accepted(Peer *peer) {
+    struct timespec deadline = deadline_after(FEDERATION_PING_MS);
+    pthread_mutex_lock(&fed_mutex);
+    while (fed_running && peer->accepted == INVALID_SOCKET) {
+        if (pthread_cond_timedwait(&fed_cond, &fed_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    SOCKET sock = peer->accepted;
+    peer->accepted = INVALID_SOCKET;
+    pthread_mutex_unlock(&fed_mutex);
+    return sock;
+}
+
+static void link_up(Peer *peer, SOCKET sock) {
+    pthread_mutex_lock(&peer->send_mutex);
+    peer->sock = sock;
+    pthread_mutex_unlock(&peer->send_mutex);
+
+    pthread_mutex_lock(&fed_mutex);
+    peer->up = true;
+    peer->handoff_done = false;
+    rebuild_ring();
+    pthread_cond_broadcast(&fed_cond);
+    pthread_mutex_unlock(&fed_mutex);
+    printf("🔗 Linked with node %u\n", peer->id);
+
+    send_handoffs(peer);
+}
+
+static void link_down(Peer *peer) {
+    pthread_mutex_lock(&peer->send_mutex);
+    SOCKET sock = peer->sock;
+    peer->sock = INVALID_SOCKET;
+    pthread_mutex_unlock(&peer->send_mutex);
+    CLOSE_SOCKET(sock);
+
+    pthread_mutex_lock(&fed_mutex);
+    peer->up = false;
+    peer->handoff_done = false;
+    rebuild_ring();
+    // Whether the owner took them is unknown
+    for (Pending *p = pending_head; p; p = p->next) {
+        if (p->peer == peer && !p->done) {
+            p->lost = true;
+            p->done = true;
+        }
+    }
+    pthread_cond_broadcast(&fed_cond);
+    pthread_mutex_unlock(&fed_mutex);
+    if (fed_running) printf("💔 Lost the link with node %u, its channels move on\n", peer->id);
+}
+
+static void enqueue_forward(Peer *from, const NodeChatForward *request) {
+    Job *job = malloc(sizeof(Job));
+    if (!job) {
+        NodeChatResult result = {0};
+        result.request_id = request->request_id;
+        result.status = NODE_CHAT_REJECTED;
+        link_send(from, MSG_NODE_CHAT_RESULT, &result, sizeof(result));
+        return;
+    }
+    job->from = from;
+    job->request = *request;
+    job->next = NULL;
+    pthread_mutex_lock(&job_mutex);
+    if (job_tail) job_tail->next = job; else job_head = job;
+    job_tail = job;
+    pthread_cond_signal(&job_cond);
+    pthread_mutex_unlock(&job_mutex);
+}
+
+static void complete_forward(const NodeChatResult *result) {
+    pthread_mutex_lock(&fed_mutex);
+    for (Pending *p = pending_head; p; p = p->next) {
+        if (p->request_id == result->request_id && !p->done) {
+            p->result = *result;
+            p->done = true;
+            pthread_cond_broadcast(&fed_cond);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&fed_mutex);
+}
+
+static void terminate_chat(ChatMessage *chat) {
+    chat->sender_username[sizeof(chat->sender_username) - 1] = '\0';
+    chat->content[sizeof(chat->content) - 1] = '\0';
+}
+
+// Handle frames until the link fails or goes quiet
+static void read_link(Peer *peer, SOCKET sock) {
+    Message *msg;
+    while (fed_running && (msg = receive_message(sock)) != NULL) {
+        switch (msg->type) {
+            case MSG_NODE_PING:
+                break;
+
+            case MSG_NODE_HANDOFF: {
+                if (msg->length < sizeof(NodeHandoff)) break;
+                NodeHandoff handoff;
+                memcpy(&handoff, msg->payload, sizeof(handoff));
+                if (handoff.channel_id != 0) {
+                    raise_floor(handoff.channel_id, handoff.last_seq);
+                    break;
+                }
+                pthread_mutex_lock(&fed_mutex);
+                peer->handoff_done = true;
+                pthread_cond_broadcast(&fed_cond);
+                pthread_mutex_unlock(&fed_mutex);
+                break;
+            }
+
+            case MSG_NODE_CHAT_FORWARD: {
+                if (msg->length < sizeof(NodeChatForward)) break;
+                enqueue_forward(peer, (const NodeChatForward *)msg->payload);
+                break;
+            }
+
+            case MSG_NODE_CHAT_RESULT: {
+                if (msg->length < sizeof(NodeChatResult)) break;
+                NodeChatResult result;
+                memcpy(&result, msg->payload, sizeof(result));
+                complete_forward(&result);
+                break;
+            }
+
+            case MSG_NODE_CHAT_PUBLISH: {
+                if (msg->length < sizeof(NodeChatPublish)) break;
+                NodeChatPublish published;
+                memcpy(&published, msg->payload, sizeof(published));
+                terminate_chat(&published.chat);
+                raise_floor(published.chat.channel_id, published.chat.seq);
+                // Like a local message, so a client joining here misses nothing
+                message_window_order_lock(published.chat.channel_id);
+                message_window_observe(&published.chat, published.sent_at);
+                deliver_chat(&published.chat, published.sender_socket);
+                message_window_order_unlock(published.chat.channel_id);
+                break;
+            }
+
+            default:
+                fprintf(stderr, "Federation: unexpected message type %d from node %u\n", msg->type, peer->id);
+                break;
+        }
+        free(msg);
+    }
+}
+
+// One per peer: (re)establish the link, then serve it
+static void* link_loop(void *arg) {
+    Peer *peer = arg;
+    int retry_ms = FEDERATION_RETRY_MIN_MS;
+    while (fed_running) {
+        SOCKET sock;
+        if (peer->id > self_id) {
+            sock = dial(peer);
+            if (sock == INVALID_SOCKET) {
+                nap(retry_ms);
+                retry_ms = retry_ms * 2 > FEDERATION_RETRY_MAX_MS ? FEDERATION_RETRY_MAX_MS : retry_ms * 2;
+                continue;
+            }
+        } else {
+            sock = take_accepted(peer);
+            if (sock == INVALID_SOCKET) continue;
+        }
+        retry_ms = FEDERATION_RETRY_MIN_MS;
+        link_up(peer, sock);
+        read_link(peer, sock);
+        link_down(peer);
+    }
+    return NULL;
+}
+
+static Peer* find_peer(uint32_t node_id) {
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].id == node_id) return &peers[i];
+    }
+    return NULL;
+}
+
+// Links from lower-id nodes: check the hello, then hand the socket to the
+// peer's link thread
+static void* accept_loop(void *arg) {
+    (void)arg;
+    while (fed_running) {
+        SOCKET sock = accept(listen_sock, NULL, NULL);
+        if (sock == INVALID_SOCKET) {
+            if (fed_running) {
+                perror("Federation: accept failed");
+                nap(100);
+            }
+            continue;
+        }
+        set_link_options(sock);
+
+        Peer *peer = NULL;
+        Message *hello = receive_message(sock);
+        if (hello && hello->type == MSG_NODE_HELLO && hello->length >= sizeof(NodeHello)) {
+            NodeHello payload;
+            memcpy(&payload, hello->payload, sizeof(payload));
+            peer = find_peer(payload.node_id);
+            if (peer && peer->id > self_id) peer = NULL; // We dial that one
+        }
+        free(hello);
+        if (!peer) {
+            fprintf(stderr, "Federation: dropped a link without a valid hello\n");
+            CLOSE_SOCKET(sock);
+            continue;
+        }
+
+        pthread_mutex_lock(&fed_mutex);
+        if (peer->accepted != INVALID_SOCKET) CLOSE_SOCKET(peer->accepted);
+        peer->accepted = sock;
+        bool stale = peer->up;
+        pthread_cond_broadcast(&fed_cond);
+        pthread_mutex_unlock(&fed_mutex);
+
+        // The node came back before its old link timed out
+        if (stale) {
+            pthread_mutex_lock(&peer->send_mutex);
+            if (peer->sock != INVALID_SOCKET) shutdown(peer->sock, SHUTDOWN_BOTH);
+            pthread_mutex_unlock(&peer->send_mutex);
+        }
+    }
+    return NULL;
+}
+
+static void* ping_loop(void *arg) {
+    (void)arg;
+    while (fed_running) {
+        nap(FEDERATION_PING_MS);
+        for (int i = 0; i < peer_count && fed_running; i++) {
+            link_send(&peers[i], MSG_NODE_PING, NULL, 0);
+        }
+    }
+    return NULL;
+}
+
+// --- Chat routing ---
+
+static void handle_forward(Peer *from, NodeChatForward *request) {
+    ChatMessage *chat = &request->chat;
+    terminate_chat(chat);
+    NodeChatResult result = {0};
+    result.request_id = request->request_id;
+    int64_t sent_at = 0;
+
+    if (!federation_owns(chat->channel_id)) {
+        result.status = NODE_CHAT_NOT_OWNER;
+    } else {
+        switch (sequence_here(request->sender_id, chat, &sent_at, from, request->sender_socket)) {
+            case FEDERATION_ACCEPTED:
+                result.status = NODE_CHAT_ACCEPTED;
+                result.message_id = chat->message_id;
+                result.seq = chat->seq;
+                result.sent_at = sent_at;
+                break;
+            case FEDERATION_MOVED:
+                result.status = NODE_CHAT_NOT_OWNER;
+                break;
+            default:
+                result.status = NODE_CHAT_REJECTED;
+                break;
+        }
+    }
+    // After the publish on the same link: the sender's node has delivered it
+    // before it acks it
+    link_send(from, MSG_NODE_CHAT_RESULT, &result, sizeof(result));
+}
+
+static void* worker_loop(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_mutex_lock(&job_mutex);
+        while (!job_head && fed_running) pthread_cond_wait(&job_cond, &job_mutex);
+        Job *job = job_head;
+        if (job) {
+            job_head = job->next;
+            if (!job_head) job_tail = NULL;
+        }
+        pthread_mutex_unlock(&job_mutex);
+        if (!job) break;
+        handle_forward(job->from, &job->request);
+        free(job);
+    }
+    return NULL;
+}
+
+// Hand a message to its owner and wait for the verdict. Once it is sent, a
+// timeout or a lost link leaves the outcome unknown: the owner may have
+// sequenced it, so it must not be routed again (that would post it twice).
+static FederationAccept forward(Peer *owner, uint32_t sender_id, int sender_socket, ChatMessage *chat, int64_t *sent_at) {
+    Pending pending = {0};
+    pending.peer = owner;
+    pthread_mutex_lock(&fed_mutex);
+    pending.request_id = next_request_id++;
+    pending.next = pending_head;
+    pending_head = &pending;
+    pthread_mutex_unlock(&fed_mutex);
+
+    NodeChatForward request = {0};
+    request.request_id = pending.request_id;
+    request.sender_id = sender_id;
+    request.sender_socket = sender_socket;
+    request.chat = *chat;
+    bool sent = link_send(owner, MSG_NODE_CHAT_FORWARD, &request, sizeof(request));
+
+    struct timespec deadline = deadline_after(FEDERATION_FORWARD_TIMEOUT_MS);
+    pthread_mutex_lock(&fed_mutex);
+    while (sent && !pending.done) {
+        if (pthread_cond_timedwait(&fed_cond, &fed_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    Pending **link = &pending_head;
+    while (*link != &pending) link = &(*link)->next;
+    *link = pending.next;
+    pthread_mutex_unlock(&fed_mutex);
+
+    if (!sent) return FEDERATION_MOVED; // Never reached it: route again
+    if (!pending.done || pending.lost) {
+        fprintf(stderr, "Federation: node %u did not answer for channel %u, outcome unknown\n", owner->id, chat->channel_id);
+        return FEDERATION_UNKNOWN;
+    }
+    switch (pending.result.status) {
+        case NODE_CHAT_ACCEPTED:
+            chat->message_id = pending.result.message_id;
+            chat->seq = pending.result.seq;
+            *sent_at = pending.result.sent_at;
+            return FEDERATION_ACCEPTED;
+        case NODE_CHAT_NOT_OWNER:
+            return FEDERATION_MOVED;
+        default:
+            return FEDERATION_REJECTED;
+    }
+}
+
+FederationAccept federation_submit(uint32_t sender_id, int sender_socket, ChatMessage *chat, int64_t *sent_at) {
+    for (int attempt = 0; attempt < ROUTE_ATTEMPTS; attempt++) {
+        if (attempt > 0) sleep_ms(ROUTE_RETRY_MS);
+        Peer *owner = owner_of(chat->channel_id);
+        FederationAccept result = owner ? forward(owner, sender_id, sender_socket, chat, sent_at)
+                                        : sequence_here(sender_id, chat, sent_at, NULL, sender_socket);
+        if (result != FEDERATION_MOVED) return result;
+    }
+    fprintf(stderr, "Federation: no node took channel %u, dropping the message\n", chat->channel_id);
+    return FEDERATION_REJECTED;
+}
+
+// --- Setup ---
+
+// "id@host:port" into a peer, or this node's own port
+static bool parse_node(const char *entry, size_t length, char *own_host, size_t own_host_size, char *own_port) {
+    char text[128];
+    if (length >= sizeof(text)) return false;
+    memcpy(text, entry, length);
+    text[length] = '\0';
+
+    char *at = strchr(text, '@');
+    char *colon = strrchr(text, ':');
+    if (!at || !colon || colon < at) return false;
+    *at = '\0';
+    *colon = '\0';
+    const char *host = at + 1, *port = colon + 1;
+    uint32_t id = (uint32_t)strtoul(text, NULL, 10);
+    if (id == 0 || !*host || strlen(host) >= sizeof(peers[0].host) || !*port || strlen(port) >= sizeof(peers[0].port)) {
+        return false;
+    }
+
+    if (id == self_id) {
+        snprintf(own_host, own_host_size, "%s", host);
+        snprintf(own_port, sizeof(peers[0].port), "%s", port);
+        return true;
+    }
+    if (peer_count == FEDERATION_MAX_NODES - 1 || find_peer(id)) return false;
+    Peer *peer = &peers[peer_count++];
+    memset(peer, 0, sizeof(Peer));
+    peer->id = id;
+    snprintf(peer->host, sizeof(peer->host), "%s", host);
+    snprintf(peer->port, sizeof(peer->port), "%s", port);
+    peer->sock = INVALID_SOCKET;
+    peer->accepted = INVALID_SOCKET;
+    pthread_mutex_init(&peer->send_mutex, NULL);
+    return true;
+}
+
+static SOCKET open_listener(const char *host, const char *port) {
+    struct addrinfo hints = {0}, *addresses = NULL;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &addresses) != 0) return INVALID_SOCKET;
+
+    SOCKET sock = INVALID_SOCKET;
+    for (struct addrinfo *a = addresses; a && sock == INVALID_SOCKET; a = a->ai_next) {
+        sock = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (sock == INVALID_SOCKET) continue;
+        int opt = 1;
+        setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&opt, sizeof(opt));
+        if (bind(sock, a->ai_addr, (socklen_t)a->ai_addrlen) != 0 || listen(sock, FEDERATION_MAX_NODES) != 0) {
+            CLOSE_SOCKET(sock);
+            sock = INVALID_SOCKET;
+        }
+    }
+    freeaddrinfo(addresses);
+    return sock;
+}
+
+bool federation_start(FederationAcceptFn accept, FederationDeliverFn deliver) {
+    accept_chat = accept;
+    deliver_chat = deliver;
+    const char *nodes = getenv("FEDERATION_NODES");
+    if (!nodes || !*nodes) {
+        self_id = 0;
+        peer_count = 0;
+        return true; // Single node
+    }
+
+    const char *node_id = getenv("NODE_ID");
+    self_id = node_id ? (uint32_t)strtoul(node_id, NULL, 10) : 0;
+    if (self_id == 0) {
+        fprintf(stderr, "❌ FEDERATION_NODES is set but NODE_ID is missing\n");
+        return false;
+    }
+    char own_host[64] = "", own_port[8] = "";
+    peer_count = 0;
+    for (const char *entry = nodes; *entry;) {
+        size_t length = strcspn(entry, ",");
+        if (length > 0 && !parse_node(entry, length, own_host, sizeof(own_host), own_port)) {
+            fprintf(stderr, "❌ Bad FEDERATION_NODES entry: %.*s\n", (int)length, entry);
+            return false;
+        }
+        entry += length;
+        if (*entry == ',') entry++;
+    }
+    if (!own_port[0]) {
+        fprintf(stderr, "❌ NODE_ID %u is not in FEDERATION_NODES\n", self_id);
+        return false;
+    }
+
+    listen_sock = open_listener(own_host, own_port);
+    if (listen_sock == INVALID_SOCKET) {
+        fprintf(stderr, "❌ Could not listen for other nodes on %s:%s\n", own_host, own_port);
+        return false;
+    }
+
+    fed_running = true;
+    pthread_mutex_lock(&fed_mutex);
+    rebuild_ring();
+    pthread_mutex_unlock(&fed_mutex);
+
+    bool started = true;
+    for (int i = 0; i < FEDERATION_WORKERS && started; i++) {
+        started = pthread_create(&workers[i], NULL, worker_loop, NULL) == 0;
+        if (started) worker_count++;
+    }
+    if (started) started = accept_started = pthread_create(&accept_thread, NULL, accept_loop, NULL) == 0;
+    if (started) started = ping_started = pthread_create(&ping_thread, NULL, ping_loop, NULL) == 0;
+    for (int i = 0; i < peer_count && started; i++) {
+        started = peers[i].thread_started = pthread_create(&peers[i].thread, NULL, link_loop, &peers[i]) == 0;
+    }
+    if (!started) {
+        perror("Failed to start federation threads");
+        federation_stop();
+        return false;
+    }
+
+    // Serving clients before the other nodes are known would claim every channel
+    struct timespec deadline = deadline_after(FEDERATION_JOIN_WAIT_MS);
+    int linked = 0;
+    pthread_mutex_lock(&fed_mutex);
+    for (;;) {
+        linked = 0;
+        for (int i = 0; i < peer_count; i++) linked += peers[i].up;
+        if (linked == peer_count) break;
+        if (pthread_cond_timedwait(&fed_cond, &fed_mutex, &deadline) == ETIMEDOUT) break;
+    }
+    pthread_mutex_unlock(&fed_mutex);
+    printf("🌐 Node %u linked with %d of %d other node(s)\n", self_id, linked, peer_count);
+    return true;
+}
+
+void federation_stop(void) {
+    if (!fed_running) return;
+    fed_running = false;
+
+    if (listen_sock != INVALID_SOCKET) shutdown(listen_sock, SHUTDOWN_BOTH);
+    for (int i = 0; i < peer_count; i++) {
+        pthread_mutex_lock(&peers[i].send_mutex);
+        if (peers[i].sock != INVALID_SOCKET) shutdown(peers[i].sock, SHUTDOWN_BOTH);
+        pthread_mutex_unlock(&peers[i].send_mutex);
+    }
+#ifdef _WIN32
+    // shutdown doesn't wake accept there
+    if (listen_sock != INVALID_SOCKET) {
+        CLOSE_SOCKET(listen_sock);
+        listen_sock = INVALID_SOCKET;
+    }
+#endif
+    pthread_mutex_lock(&fed_mutex);
+    pthread_cond_broadcast(&fed_cond);
+    pthread_mutex_unlock(&fed_mutex);
+    pthread_mutex_lock(&job_mutex);
+    pthread_cond_broadcast(&job_cond);
+    pthread_mutex_unlock(&job_mutex);
+
+    if (accept_started) pthread_join(accept_thread, NULL);
+    if (ping_started) pthread_join(ping_thread, NULL);
+    for (int i = 0; i < peer_count; i++) {
+        if (peers[i].thread_started) pthread_join(peers[i].thread, NULL);
+        if (peers[i].accepted != INVALID_SOCKET) CLOSE_SOCKET(peers[i].accepted);
+        pthread_mutex_destroy(&peers[i].send_mutex);
+    }
+    for (int i = 0; i < worker_count; i++) pthread_join(workers[i], NULL);
+    accept_started = ping_started = false;
+    worker_count = 0;
+    peer_count = 0;
+
+    if (listen_sock != INVALID_SOCKET) CLOSE_SOCKET(listen_sock);
+    listen_sock = INVALID_SOCKET;
+    while (job_head) {
+        Job *job = job_head;
+        job_head = job->next;
+        free(job);
+    }
+    job_tail = NULL;
+    free(floors);
+    floors = NULL;
+    floor_capacity = floor_count = 0;
+}
@@ -0,0 +1,93 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../network/protocol.h"
+
+// Several server nodes sharing one database, each serving its own clients.
+// Every channel is owned by one live node, picked by consistent hashing: the
+// owner alone hands out the channel's seqs and logs its messages. A message
+// posted on another node is forwarded to the owner, which sequences it and
+// publishes it to every other node for their subscribers, in seq order.
+//
+// Nodes talk over one persistent link per pair, framed like client traffic
+// (src/network/protocol.c); the lower id dials. A node whose link drops
+// leaves the ring and its channels spread over the others; when it comes
+// back only the channels that hash to it move. A node losing channels hands
+// over how far it sequenced each one, and the new owner holds those channels
+// until it has heard from it, so a seq is never handed out twice while both
+// nodes are up. Messages a crashed owner logged but had not published yet are
+// the exception: its successor doesn't know about them.
+//
+// Ownership is not fenced. A node only learns that another one is gone from
+// its link, so when two live nodes lose their link to each other (a network
+// partition, or a stall longer than FEDERATION_DEAD_MS), each takes over the
+// other's channels. For those channels both hand out the same seqs and
+// deliver to their own clients until the link is back. Shipping keeps the
+// first row stored for a (channel, seq) and drops the other: the ingest log
+// checks for the seq under a per-channel lock, since the unique index of
+// migration 6 has to include the timestamp and lets both in. Messages posted
+// during the split can therefore be missing from history, never doubled. Running the
+// nodes on one network with the database limits this to stalls.
+//
+// Without FEDERATION_NODES there is a single node owning every channel.
+//
+// FEDERATION_NODES: every node, "id@host:port" comma-separated, own entry
+// included; the port is the one nodes link on, not the client port.
+// NODE_ID: this node's id (non-zero) in that list.
+
+#define FEDERATION_MAX_NODES 16
+// Points per node on the hash ring; more spread the channels more evenly
+#define FEDERATION_VNODES 64
+// Link keepalive: a ping every FEDERATION_PING_MS, and a link silent for
+// FEDERATION_DEAD_MS is dropped
+#define FEDERATION_PING_MS 1000
+#define FEDERATION_DEAD_MS 3000
+// Redial delay bounds
+#define FEDERATION_RETRY_MIN_MS 200
+#define FEDERATION_RETRY_MAX_MS 5000
+// At startup, how long to wait for the other nodes before serving clients
+#define FEDERATION_JOIN_WAIT_MS 3000
+// How long a new owner holds a channel waiting for the previous owner's handoff
+#define FEDERATION_HANDOFF_WAIT_MS 2000
+// How long a forwarded message waits for the owner's answer
+#define FEDERATION_FORWARD_TIMEOUT_MS 5000
+// Threads sequencing messages forwarded by other nodes
+#define FEDERATION_WORKERS 8
+
+typedef enum {
+    FEDERATION_ACCEPTED,
+    FEDERATION_REJECTED,
+    FEDERATION_MOVED,  // The channel changed owner meanwhile: route again
+    FEDERATION_UNKNOWN // Forwarded, but the owner never answered: it may have taken it
+} FederationAccept;
+
+// Sequences, logs and remembers a message of a channel this node owns, setting
+// chat->seq, chat->message_id and *sent_at. Must check federation_owns after
+// taking the seq and give it back if the channel moved.
+typedef FederationAccept (*FederationAcceptFn)(uint32_t sender_id, ChatMessage *chat, int64_t *sent_at);
+// Hands a sequenced message to this node's subscribers; the connection
+// sender_socket (-1: none) is its sender's and gets it with its client_id.
+// Called under the channel's order lock (src/server/message_window.h), in seq
+// order.
+typedef void (*FederationDeliverFn)(const ChatMessage *chat, int sender_socket);
+
+// Links up with the other nodes (waiting a little for them to answer) before
+// clients are served. False on a bad configuration or if the node port can't
+// be opened.
+bool federation_start(FederationAcceptFn accept, FederationDeliverFn deliver);
+void federation_stop(void);
+
+// Does this node own the channel right now?
+bool federation_owns(uint32_t channel_id);
+
+// Sequences a message posted by sender_id on this node's connection
+// sender_socket, here or on the channel's owner, which delivers it to every
+// subscriber, the sender included. FEDERATION_ACCEPTED sets chat->seq,
+// chat->message_id and *sent_at; FEDERATION_REJECTED means it was dropped.
+// FEDERATION_UNKNOWN: the owner went silent after it was forwarded. If the
+// owner took it, its publish still brings the sender's copy, with client_id.
+FederationAccept federation_submit(uint32_t sender_id, int sender_socket, ChatMessage *chat, int64_t *sent_at);
+
+#endif // FEDERATION_H
@@ -0,0 +1,79 @@
+#ifndef INGEST_LOG_H
+#define INGEST_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../network/protocol.h"
+
+// Durable ingest of chat messages. A message is appended to a local
+// write-ahead log and acknowledged once the log is fsync'd; messages that
+// arrive while a flush is in progress are written and synced together by the
+// next one (group commit), so one fsync covers every sender waiting on it.
+// A shipper thread loads the log into PostgreSQL in batches over its own
+// connection, so a slow or unreachable database delays storage, not chat.
+//
+// The log lives in INGEST_LOG_DIR as numbered segment files; the "shipped"
+// checkpoint next to them records how far the database has caught up, and
+// segments behind it are deleted. At startup whatever was logged but not
+// shipped is loaded before clients are accepted; a partial record at the end
+// of the last segment (a crash mid-write) is cut off, but a damaged record in
+// an earlier segment stops the server from starting rather than lose the
+// segments after it.
+//
+// Shipping is idempotent: a row whose channel and seq are already stored is
+// skipped, whether a batch is replayed after a crash or two nodes sequenced
+// the same seq (federation.h).
+//
+// A batch the database keeps refusing (INGEST_SHIP_MAX_FAILURES times in a
+// row over a working connection) is retried one message at a time, and a
+// message rejected for its data (SQLSTATE class 22 or 23, e.g. no partition
+// for its timestamp) is appended to "dead_letter.jsonl" in the log directory
+// and skipped, so it can't hold back the messages behind it.
+
+// Override with INGEST_LOG_DIR
+#define DEFAULT_INGEST_LOG_DIR "ingest_log"
+// A segment is closed once it grows past this
+#define INGEST_SEGMENT_BYTES (16 * 1024 * 1024)
+// Messages loaded into the database per statement
+#define INGEST_SHIP_BATCH 500
+// message_ids reserved ahead from messages_message_id_seq, so a message has
+// its id when it is acknowledged. Once they run out (the database has been
+// down a while) messages are acknowledged with message_id 0 and get one
+// when shipped.
+#define INGEST_ID_POOL 1024
+// Unshipped messages kept in memory for readers. Past this, readers fall back
+// to the database until the shipper has caught up.
+#define INGEST_TAIL_MAX 65536
+// Failed attempts at one batch before its messages are shipped one by one
+#define INGEST_SHIP_MAX_FAILURES 5
+// Retry delay bounds while the database is unavailable
+#define INGEST_RETRY_MIN_MS 100
+#define INGEST_RETRY_MAX_MS 5000
+
+// Opens the log, ships its unshipped tail and starts the flusher and shipper
+// threads. False if the log can't be opened or the database can't be reached.
+bool ingest_log_start(void);
+// Writes out what was appended and ships what the database takes
+void ingest_log_stop(void);
+
+// Logs a sequenced message from sender_id and waits until it is durable.
+// Repairs the content's UTF-8 and fills in chat->message_id and *sent_at.
+// False if the log can't be written: the message must not be acknowledged.
+bool ingest_log_append(uint32_t sender_id, ChatMessage *chat, int64_t *sent_at);
+
+// Highest seq logged for the channel since startup, unshipped tail included;
+// 0 if none. The messages table may not have caught up with it yet.
+uint64_t ingest_log_last_seq(uint32_t channel_id);
+// The durable messages of the channel after after_seq that the messages table
+// may not have yet, oldest first: the newest max of them go to out (and their
+// Unix send times to sent_at, if not NULL). Returns how many there are, which
+// may be more than max, or -1 if some of the unshipped tail isn't in memory.
+// Read it before the messages table: a message shipped in between then shows
+// up in both rather than in neither.
+int ingest_log_unshipped(uint32_t channel_id, uint64_t after_seq, ChatMessage *out, int64_t *sent_at, int max);
+// The channels with a logged seq, as a malloc'd array (caller frees); NULL
+// when there are none
+uint32_t* ingest_log_channels(size_t *count);
+
+#endif // INGEST_LOG_H
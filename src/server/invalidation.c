@@ -0,0 +1,205 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+#include "invalidation.h"
+#include "membership.h"
+#include "message_window.h"
+#include "session.h"
+#include "../database/db_connection.h"
+
+static PGconn *listen_db = NULL;
+static pthread_t listen_thread;
+static volatile bool listen_running = false;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+// Sleep in short naps so invalidation_stop never waits long
+static void nap(int ms) {
+    while (ms > 0 && listen_running) {
+        int step = ms < INVALIDATION_POLL_MS ? ms : INVALIDATION_POLL_MS;
+        sleep_ms(step);
+        ms -= step;
+    }
+}
+
+static bool subscribe(PGconn *conn) {
+    PGresult *res = PQexec(conn, "LISTEN " INVALIDATION_CHANNEL);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) fprintf(stderr, "Invalidation: LISTEN failed: %s\n", PQerrorMessage(conn));
+    PQclear(res);
+    return ok;
+}
+
+static int compare_user_id(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Reload the memberships of every cached user in one query; used after a
+// reconnect, when whatever was announced meanwhile is lost
+static void resync_memberships(void) {
+    size_t count;
+    uint32_t *users = membership_cached_users(&count);
+    if (!users) return;
+    qsort(users, count, sizeof(uint32_t), compare_user_id);
+
+    // "{1,2,3}": at most 10 digits and a separator per user
+    char *array = malloc(count * 11 + 3);
+    if (!array) {
+        free(users);
+        return;
+    }
+    size_t len = 0;
+    array[len++] = '{';
+    for (size_t i = 0; i < count; i++) {
+        len += (size_t)sprintf(array + len, i > 0 ? ",%u" : "%u", users[i]);
+    }
+    array[len++] = '}';
+    array[len] = '\0';
+
+    const char *params[1] = {array};
+    PGresult *res = PQexecParams(listen_db,
+        "SELECT user_id, channel_id, COALESCE(role_id, 0) FROM user_channels"
+        " WHERE user_id = ANY($1::int[]) ORDER BY user_id",
+        1, NULL, params, NULL, NULL, 0);
+    free(array);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "Invalidation: failed to reload memberships: %s\n", PQerrorMessage(listen_db));
+        PQclear(res);
+        free(users);
+        return;
+    }
+
+    int rows = PQntuples(res);
+    ChannelRole *roles = rows > 0 ? malloc((size_t)rows * sizeof(ChannelRole)) : NULL;
+    if (rows > 0 && !roles) {
+        PQclear(res);
+        free(users);
+        return;
+    }
+    // Both lists are ordered by user; users without a row end up with none
+    int row = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t n = 0;
+        while (row < rows && (uint32_t)strtoul(PQgetvalue(res, row, 0), NULL, 10) == users[i]) {
+            roles[n].channel_id = (uint32_t)strtoul(PQgetvalue(res, row, 1), NULL, 10);
+            roles[n].role_id = atoi(PQgetvalue(res, row, 2));
+            n++;
+            row++;
+        }
+        membership_replace(users[i], roles, n);
+    }
+    printf("🔄 Reloaded memberships of %zu cached user(s)\n", count);
+    free(roles);
+    PQclear(res);
+    free(users);
+}
+
+static void apply(const char *payload) {
+    unsigned user_id, channel_id;
+    int role_id;
+    if (sscanf(payload, "m+:%u:%u:%d", &user_id, &channel_id, &role_id) == 3) {
+        membership_add(user_id, channel_id, role_id);
+    } else if (sscanf(payload, "m-:%u:%u", &user_id, &channel_id) == 2) {
+        membership_remove(user_id, channel_id);
+    } else if (sscanf(payload, "c-:%u", &channel_id) == 1) {
+        message_window_drop(channel_id);
+    } else if (sscanf(payload, "u:%u", &user_id) == 1) {
+        session_revoke_user(user_id);
+    } else {
+        fprintf(stderr, "Invalidation: ignoring unknown payload '%s'\n", payload);
+    }
+}
+
+// Wait for the socket to become readable, at most INVALIDATION_POLL_MS.
+// False when the connection is broken.
+static bool wait_readable(void) {
+    int fd = PQsocket(listen_db);
+    if (fd < 0) return false;
+    fd_set readable;
+    FD_ZERO(&readable);
+    FD_SET(fd, &readable);
+    struct timeval timeout = {0, INVALIDATION_POLL_MS * 1000};
+    return select(fd + 1, &readable, NULL, NULL, &timeout) >= 0 || errno == EINTR;
+}
+
+// Bring the connection back and LISTEN again, backing off while the database
+// is down. True once resubscribed.
+static bool reconnect(int *retry_ms) {
+    PQreset(listen_db);
+    if (PQstatus(listen_db) == CONNECTION_OK && subscribe(listen_db)) {
+        printf("🔄 Invalidation listener reconnected\n");
+        *retry_ms = INVALIDATION_RETRY_MIN_MS;
+        return true;
+    }
+    nap(*retry_ms);
+    *retry_ms = *retry_ms * 2 > INVALIDATION_RETRY_MAX_MS ? INVALIDATION_RETRY_MAX_MS : *retry_ms * 2;
+    return false;
+}
+
+static void* listen_loop(void *arg) {
+    (void)arg;
+    int retry_ms = INVALIDATION_RETRY_MIN_MS;
+    while (listen_running) {
+        bool broken = PQstatus(listen_db) != CONNECTION_OK;
+        if (!broken && (!wait_readable() || !PQconsumeInput(listen_db))) {
+            fprintf(stderr, "Invalidation: connection lost: %s\n", PQerrorMessage(listen_db));
+            broken = true;
+        }
+        if (broken) {
+            // Subscribed again before reloading, so nothing falls in between
+            if (reconnect(&retry_ms)) resync_memberships();
+            continue;
+        }
+        PGnotify *notify;
+        while ((notify = PQnotifies(listen_db)) != NULL) {
+            apply(notify->extra);
+            PQfreemem(notify);
+        }
+    }
+    return NULL;
+}
+
+bool invalidation_start(void) {
+    listen_db = connect_to_db();
+    if (!listen_db || PQstatus(listen_db) != CONNECTION_OK || !subscribe(listen_db)) {
+        fprintf(stderr, "Invalidation: database unavailable: %s\n", listen_db ? PQerrorMessage(listen_db) : "no connection");
+        if (listen_db) PQfinish(listen_db);
+        listen_db = NULL;
+        return false;
+    }
+
+    listen_running = true;
+    if (pthread_create(&listen_thread, NULL, listen_loop, NULL) != 0) {
+        perror("Failed to start invalidation thread");
+        listen_running = false;
+        PQfinish(listen_db);
+        listen_db = NULL;
+        return false;
+    }
+    return true;
+}
+
+void invalidation_stop(void) {
+    if (!listen_running) return;
+    listen_running = false;
+    pthread_join(listen_thread, NULL);
+    PQfinish(listen_db);
+    listen_db = NULL;
+}
@@ -0,0 +1,27 @@
+#ifndef INVALIDATION_H
+#define INVALIDATION_H
+
+#include <stdbool.h>
+
+// Keeps this process's caches in step with writes made elsewhere (another
+// server process, an admin at psql). Triggers added by migration 8 NOTIFY
+// cache_invalidation when user_channels, channels or users change; a thread
+// LISTENs on its own connection and applies each payload as it arrives:
+// memberships are patched, deleted channels lose their message window and
+// users whose credentials changed lose their sessions.
+//
+// Notifications sent while the connection is down are lost, so after a
+// reconnect the memberships of every cached user are reloaded.
+
+#define INVALIDATION_CHANNEL "cache_invalidation"
+// How long the listener waits on the socket before checking for shutdown
+#define INVALIDATION_POLL_MS 500
+// Reconnect delay bounds while the database is unavailable
+#define INVALIDATION_RETRY_MIN_MS 500
+#define INVALIDATION_RETRY_MAX_MS 10000
+
+// False (and no thread) when the database can't be reached
+bool invalidation_start(void);
+void invalidation_stop(void);
+
+#endif // INVALIDATION_H
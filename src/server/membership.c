@@ -0,0 +1,203 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "membership.h"
+
+#define MEMBERSHIP_BUCKETS 1024
+
+typedef struct UserMemberships {
+    uint32_t user_id;
+    int refs;              // Authenticated connections of this user
+    size_t count;
+    size_t capacity;
+    ChannelRole *roles;    // Sorted by channel_id
+    struct UserMemberships *next;
+} UserMemberships;
+
+static UserMemberships *membership_buckets[MEMBERSHIP_BUCKETS];
+// Chat messages only read; writers are logins, joins and leaves
+static pthread_rwlock_t membership_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static int compare_channel_role(const void *a, const void *b) {
+    uint32_t x = ((const ChannelRole*)a)->channel_id;
+    uint32_t y = ((const ChannelRole*)b)->channel_id;
+    return (x > y) - (x < y);
+}
+
+// Must be called with membership_lock held
+static UserMemberships* find_user(uint32_t user_id) {
+    for (UserMemberships *u = membership_buckets[user_id % MEMBERSHIP_BUCKETS]; u; u = u->next) {
+        if (u->user_id == user_id) return u;
+    }
+    return NULL;
+}
+
+// Index of channel_id in u->roles, or of the slot where it would be inserted
+static size_t find_slot(const UserMemberships *u, uint32_t channel_id, bool *found) {
+    size_t lo = 0, hi = u->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (u->roles[mid].channel_id < channel_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *found = lo < u->count && u->roles[lo].channel_id == channel_id;
+    return lo;
+}
+
+bool membership_retain(uint32_t user_id) {
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (u) u->refs++;
+    pthread_rwlock_unlock(&membership_lock);
+    return u != NULL;
+}
+
+// Sorted copy of roles; false when it can't be allocated
+static bool copy_roles(uint32_t user_id, const ChannelRole *roles, size_t count, ChannelRole **copy) {
+    *copy = NULL;
+    if (count == 0) return true;
+    *copy = malloc(count * sizeof(ChannelRole));
+    if (!*copy) {
+        fprintf(stderr, "Failed to allocate memberships of user %u\n", user_id);
+        return false;
+    }
+    memcpy(*copy, roles, count * sizeof(ChannelRole));
+    qsort(*copy, count, sizeof(ChannelRole), compare_channel_role);
+    return true;
+}
+
+bool membership_store(uint32_t user_id, const ChannelRole *roles, size_t count) {
+    ChannelRole *copy;
+    if (!copy_roles(user_id, roles, count, &copy)) return false;
+
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (!u) {
+        u = calloc(1, sizeof(UserMemberships));
+        if (!u) {
+            pthread_rwlock_unlock(&membership_lock);
+            free(copy);
+            fprintf(stderr, "Failed to allocate memberships of user %u\n", user_id);
+            return false;
+        }
+        u->user_id = user_id;
+        u->next = membership_buckets[user_id % MEMBERSHIP_BUCKETS];
+        membership_buckets[user_id % MEMBERSHIP_BUCKETS] = u;
+    }
+    // Another connection of the same user may have stored a list concurrently;
+    // both came from the database, keep the newest
+    free(u->roles);
+    u->roles = copy;
+    u->count = u->capacity = count;
+    u->refs++;
+    pthread_rwlock_unlock(&membership_lock);
+    return true;
+}
+
+void membership_release(uint32_t user_id) {
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships **link = &membership_buckets[user_id % MEMBERSHIP_BUCKETS];
+    while (*link && (*link)->user_id != user_id) {
+        link = &(*link)->next;
+    }
+    UserMemberships *u = *link;
+    if (u && --u->refs <= 0) {
+        *link = u->next;
+        free(u->roles);
+        free(u);
+    }
+    pthread_rwlock_unlock(&membership_lock);
+}
+
+bool membership_lookup(uint32_t user_id, uint32_t channel_id, int *role_id) {
+    bool found = false;
+    pthread_rwlock_rdlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (u) {
+        size_t slot = find_slot(u, channel_id, &found);
+        if (found && role_id) *role_id = u->roles[slot].role_id;
+    }
+    pthread_rwlock_unlock(&membership_lock);
+    return found;
+}
+
+void membership_add(uint32_t user_id, uint32_t channel_id, int role_id) {
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (u) {
+        bool found;
+        size_t slot = find_slot(u, channel_id, &found);
+        if (found) {
+            u->roles[slot].role_id = role_id;
+        } else {
+            if (u->count == u->capacity) {
+                size_t capacity = u->capacity ? u->capacity * 2 : 8;
+                ChannelRole *grown = realloc(u->roles, capacity * sizeof(ChannelRole));
+                if (!grown) {
+                    // Not fatal: the next join of this channel goes to the database again
+                    pthread_rwlock_unlock(&membership_lock);
+                    fprintf(stderr, "Failed to grow memberships of user %u\n", user_id);
+                    return;
+                }
+                u->roles = grown;
+                u->capacity = capacity;
+            }
+            memmove(&u->roles[slot + 1], &u->roles[slot], (u->count - slot) * sizeof(ChannelRole));
+            u->roles[slot].channel_id = channel_id;
+            u->roles[slot].role_id = role_id;
+            u->count++;
+        }
+    }
+    pthread_rwlock_unlock(&membership_lock);
+}
+
+void membership_remove(uint32_t user_id, uint32_t channel_id) {
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (u) {
+        bool found;
+        size_t slot = find_slot(u, channel_id, &found);
+        if (found) {
+            memmove(&u->roles[slot], &u->roles[slot + 1], (u->count - slot - 1) * sizeof(ChannelRole));
+            u->count--;
+        }
+    }
+    pthread_rwlock_unlock(&membership_lock);
+}
+
+uint32_t* membership_cached_users(size_t *count) {
+    *count = 0;
+    pthread_rwlock_rdlock(&membership_lock);
+    size_t total = 0;
+    for (int i = 0; i < MEMBERSHIP_BUCKETS; i++) {
+        for (UserMemberships *u = membership_buckets[i]; u; u = u->next) total++;
+    }
+    uint32_t *users = total > 0 ? malloc(total * sizeof(uint32_t)) : NULL;
+    if (users) {
+        for (int i = 0; i < MEMBERSHIP_BUCKETS; i++) {
+            for (UserMemberships *u = membership_buckets[i]; u; u = u->next) users[(*count)++] = u->user_id;
+        }
+    }
+    pthread_rwlock_unlock(&membership_lock);
+    return users;
+}
+
+void membership_replace(uint32_t user_id, const ChannelRole *roles, size_t count) {
+    ChannelRole *copy;
+    if (!copy_roles(user_id, roles, count, &copy)) return;
+
+    pthread_rwlock_wrlock(&membership_lock);
+    UserMemberships *u = find_user(user_id);
+    if (u) {
+        free(u->roles);
+        u->roles = copy;
+        u->count = u->capacity = count;
+        copy = NULL;
+    }
+    pthread_rwlock_unlock(&membership_lock);
+    free(copy);
+}
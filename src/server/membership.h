@@ -0,0 +1,41 @@
+#ifndef MEMBERSHIP_H
+#define MEMBERSHIP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// In-memory copy of user_channels for the users that are connected, so
+// joins and chat messages are authorized without a database round trip.
+// Lookups are a binary search in the user's sorted channel list.
+
+typedef struct {
+    uint32_t channel_id;
+    int role_id; // 0 when the membership has no role
+} ChannelRole;
+
+// Take a reference on a user's cached memberships. Returns false if they are
+// not cached, in which case the caller loads them and calls membership_store.
+bool membership_retain(uint32_t user_id);
+
+// Cache the memberships of a user, replacing any previous list, and take a reference
+bool membership_store(uint32_t user_id, const ChannelRole *roles, size_t count);
+
+// Drop a reference; the list is freed when the user's last connection goes away
+void membership_release(uint32_t user_id);
+
+// Is user_id a member of channel_id? role_id (optional) receives the role.
+bool membership_lookup(uint32_t user_id, uint32_t channel_id, int *role_id);
+
+// Membership-change events. Ignored for users that are not cached.
+void membership_add(uint32_t user_id, uint32_t channel_id, int role_id);
+void membership_remove(uint32_t user_id, uint32_t channel_id);
+
+// The users whose memberships are cached, as a malloc'd array (caller frees);
+// NULL when there are none
+uint32_t* membership_cached_users(size_t *count);
+// Reload a cached user's list without taking a reference. Ignored if the user
+// is no longer cached.
+void membership_replace(uint32_t user_id, const ChannelRole *roles, size_t count);
+
+#endif // MEMBERSHIP_H
@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "message_window.h"
+
+#define CHANNEL_BUCKETS 256
+#define ORDER_LOCK_STRIPES 64
+
+typedef struct {
+    uint64_t seq; // 0 marks an empty slot
+    uint32_t message_id;
+    int64_t sent_at;
+    char sender[32];
+    char *content;
+    uint16_t content_len;
+} WindowEntry;
+
+typedef struct ChannelWindow {
+    uint32_t channel_id;
+    uint64_t next_seq;        // Next sequence number to hand out
+    uint64_t last_stored_seq; // Highest sequence number present in the ring
+    int pending;              // Sequence numbers handed out but not stored yet
+    size_t bytes;             // Memory charged to this channel against the budget
+    WindowEntry ring[MESSAGE_WINDOW_SIZE]; // Slot for seq is ring[seq % MESSAGE_WINDOW_SIZE]
+    WindowSnapshot *snapshot; // Cached encoding of the ring, NULL when stale
+    struct ChannelWindow *hash_next;
+    struct ChannelWindow *lru_prev; // Towards the most recently used channel
+    struct ChannelWindow *lru_next; // Towards the least recently used channel
+} ChannelWindow;
+
+static ChannelWindow *channel_buckets[CHANNEL_BUCKETS];
+static ChannelWindow *lru_head = NULL; // Most recently used
+static ChannelWindow *lru_tail = NULL; // First candidate for eviction
+static size_t total_bytes = 0;
+static size_t budget = (size_t)DEFAULT_HOT_WINDOW_BUDGET_MB * 1024 * 1024;
+static pthread_mutex_t window_mutex = PTHREAD_MUTEX_INITIALIZER;
+static RecentMessagesLoader recent_loader = NULL;
+static pthread_mutex_t order_locks[ORDER_LOCK_STRIPES];
+static pthread_once_t order_locks_once = PTHREAD_ONCE_INIT;
+
+// --- Helpers below must be called with window_mutex held ---
+
+static ChannelWindow* find_channel(uint32_t channel_id) {
+    for (ChannelWindow *w = channel_buckets[channel_id % CHANNEL_BUCKETS]; w; w = w->hash_next) {
+        if (w->channel_id == channel_id) return w;
+    }
+    return NULL;
+}
+
+static void lru_unlink(ChannelWindow *w) {
+    if (w->lru_prev) w->lru_prev->lru_next = w->lru_next; else lru_head = w->lru_next;
+    if (w->lru_next) w->lru_next->lru_prev = w->lru_prev; else lru_tail = w->lru_prev;
+    w->lru_prev = w->lru_next = NULL;
+}
+
+static void lru_touch(ChannelWindow *w) {
+    if (lru_head == w) return;
+    if (w->lru_prev || w->lru_next || lru_tail == w) lru_unlink(w);
+    w->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = w;
+    lru_head = w;
+    if (!lru_tail) lru_tail = w;
+}
+
+static void charge(ChannelWindow *w, size_t bytes) {
+    w->bytes += bytes;
+    total_bytes += bytes;
+}
+
+static void uncharge(ChannelWindow *w, size_t bytes) {
+    w->bytes -= bytes;
+    total_bytes -= bytes;
+}
+
+static void snapshot_unref(WindowSnapshot *snapshot) {
+    if (snapshot && --snapshot->refcount == 0) {
+        free(snapshot);
+    }
+}
+
+static void invalidate_snapshot(ChannelWindow *w) {
+    if (w->snapshot) {
+        uncharge(w, w->snapshot->length);
+        snapshot_unref(w->snapshot);
+        w->snapshot = NULL;
+    }
+}
+
+static void clear_entry(ChannelWindow *w, WindowEntry *entry) {
+    if (entry->content) {
+        uncharge(w, entry->content_len + 1u);
+        free(entry->content);
+    }
+    memset(entry, 0, sizeof(WindowEntry));
+}
+
+static void put_entry(ChannelWindow *w, const ChatMessage *chat, int64_t sent_at) {
+    WindowEntry *entry = &w->ring[chat->seq % MESSAGE_WINDOW_SIZE];
+    clear_entry(w, entry);
+
+    size_t content_len = strnlen(chat->content, sizeof(chat->content) - 1);
+    entry->content = malloc(content_len + 1);
+    if (!entry->content) {
+        fprintf(stderr, "Failed to allocate window entry for channel %u\n", w->channel_id);
+        return;
+    }
+    memcpy(entry->content, chat->content, content_len);
+    entry->content[content_len] = '\0';
+    entry->content_len = (uint16_t)content_len;
+    charge(w, content_len + 1);
+
+    entry->seq = chat->seq;
+    entry->message_id = chat->message_id;
+    entry->sent_at = sent_at;
+    strncpy(entry->sender, chat->sender_username, sizeof(entry->sender) - 1);
+
+    if (chat->seq > w->last_stored_seq) {
+        w->last_stored_seq = chat->seq;
+    }
+}
+
+static void destroy_channel(ChannelWindow *w) {
+    ChannelWindow **link = &channel_buckets[w->channel_id % CHANNEL_BUCKETS];
+    while (*link && *link != w) link = &(*link)->hash_next;
+    if (*link) *link = w->hash_next;
+    lru_unlink(w);
+
+    invalidate_snapshot(w);
+    for (int i = 0; i < MESSAGE_WINDOW_SIZE; i++) {
+        clear_entry(w, &w->ring[i]);
+    }
+    total_bytes -= w->bytes;
+    free(w);
+}
+
+// Drop cold channels until we fit the budget again. `keep` is the channel being
+// worked on; channels with in-flight sequence numbers are never dropped, since
+// reloading them from the DB could hand out a number twice.
+static void evict_over_budget(ChannelWindow *keep) {
+    ChannelWindow *w = lru_tail;
+    while (total_bytes > budget && w) {
+        ChannelWindow *prev = w->lru_prev;
+        if (w != keep && w->pending == 0) {
+            printf("🧊 Evicting cold message window for channel %u\n", w->channel_id);
+            destroy_channel(w);
+        }
+        w = prev;
+    }
+}
+
+// Look up a channel, loading it from the database if it is cold.
+// Takes window_mutex and returns with it held (even when returning NULL).
+static ChannelWindow* acquire_channel(uint32_t channel_id) {
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(channel_id);
+    if (w) {
+        lru_touch(w);
+        return w;
+    }
+    RecentMessagesLoader loader = recent_loader;
+    pthread_mutex_unlock(&window_mutex);
+
+    // Query the database without blocking every other channel
+    WindowMessage *recent = malloc(sizeof(WindowMessage) * MESSAGE_WINDOW_SIZE);
+    int count = 0;
+    uint64_t last_seq = 0;
+    bool loaded = recent && (!loader || loader(channel_id, recent, MESSAGE_WINDOW_SIZE, &count, &last_seq));
+
+    pthread_mutex_lock(&window_mutex);
+    w = find_channel(channel_id); // Another thread may have loaded it meanwhile
+    if (w || !loaded) {
+        if (w) lru_touch(w);
+        free(recent);
+        return w;
+    }
+
+    w = calloc(1, sizeof(ChannelWindow));
+    if (!w) {
+        fprintf(stderr, "Failed to allocate message window for channel %u\n", channel_id);
+        free(recent);
+        return NULL;
+    }
+    w->channel_id = channel_id;
+    w->next_seq = last_seq + 1;
+    w->last_stored_seq = last_seq;
+    charge(w, sizeof(ChannelWindow));
+    for (int i = 0; i < count; i++) {
+        if (recent[i].chat.seq > 0) {
+            put_entry(w, &recent[i].chat, recent[i].sent_at);
+        }
+    }
+    free(recent);
+
+    w->hash_next = channel_buckets[channel_id % CHANNEL_BUCKETS];
+    channel_buckets[channel_id % CHANNEL_BUCKETS] = w;
+    lru_touch(w);
+    evict_over_budget(w);
+    return w;
+}
+
+// Write the header of the frame that starts at frame_start and account for it
+static void close_frame(WindowSnapshot *snapshot, size_t frame_start, uint32_t payload_len,
+                        const ChannelSnapshotHeader *header) {
+    Message frame = {0};
+    frame.type = MSG_CHANNEL_SNAPSHOT;
+    frame.length = payload_len;
+    memcpy(snapshot->data + frame_start, &frame, sizeof(Message));
+    memcpy(snapshot->data + frame_start + sizeof(Message), header, sizeof(ChannelSnapshotHeader));
+    snapshot->length = frame_start + sizeof(Message) + payload_len;
+}
+
+// Encode the ring as MSG_CHANNEL_SNAPSHOT frames of at most MAX_PAYLOAD_SIZE each
+static WindowSnapshot* encode_snapshot(ChannelWindow *w) {
+    const size_t frame_overhead = sizeof(Message) + sizeof(ChannelSnapshotHeader);
+    uint64_t oldest = w->last_stored_seq >= MESSAGE_WINDOW_SIZE ? w->last_stored_seq - MESSAGE_WINDOW_SIZE + 1 : 1;
+
+    // Worst case every entry opens a new frame
+    size_t capacity = frame_overhead;
+    for (uint64_t seq = oldest; seq <= w->last_stored_seq; seq++) {
+        const WindowEntry *entry = &w->ring[seq % MESSAGE_WINDOW_SIZE];
+        if (entry->seq == seq) {
+            capacity += frame_overhead + sizeof(SnapshotEntry) + strlen(entry->sender) + entry->content_len;
+        }
+    }
+
+    WindowSnapshot *snapshot = malloc(sizeof(WindowSnapshot) + capacity);
+    if (!snapshot) {
+        fprintf(stderr, "Failed to allocate snapshot for channel %u\n", w->channel_id);
+        return NULL;
+    }
+    snapshot->refcount = 1;
+    snapshot->length = 0;
+
+    ChannelSnapshotHeader header = {0};
+    header.channel_id = w->channel_id;
+    header.flags = SNAPSHOT_FIRST;
+    size_t frame_start = 0;
+    uint32_t payload_len = sizeof(ChannelSnapshotHeader);
+
+    for (uint64_t seq = oldest; seq <= w->last_stored_seq; seq++) {
+        const WindowEntry *entry = &w->ring[seq % MESSAGE_WINDOW_SIZE];
+        if (entry->seq != seq) continue;
+
+        SnapshotEntry packed = {0};
+        packed.seq = entry->seq;
+        packed.sent_at = entry->sent_at;
+        packed.message_id = entry->message_id;
+        packed.sender_len = (uint8_t)strlen(entry->sender);
+        packed.content_len = entry->content_len;
+        size_t entry_size = sizeof(packed) + packed.sender_len + packed.content_len;
+
+        if (payload_len + entry_size > MAX_PAYLOAD_SIZE) {
+            close_frame(snapshot, frame_start, payload_len, &header);
+            frame_start = snapshot->length;
+            payload_len = sizeof(ChannelSnapshotHeader);
+            header.count = 0;
+            header.flags = 0;
+        }
+
+        char *out = snapshot->data + frame_start + sizeof(Message) + payload_len;
+        memcpy(out, &packed, sizeof(packed));
+        memcpy(out + sizeof(packed), entry->sender, packed.sender_len);
+        memcpy(out + sizeof(packed) + packed.sender_len, entry->content, packed.content_len);
+        payload_len += (uint32_t)entry_size;
+        header.count++;
+    }
+
+    header.flags |= SNAPSHOT_LAST;
+    close_frame(snapshot, frame_start, payload_len, &header);
+    return snapshot;
+}
+
+// --- Public API ---
+
+void message_window_init(RecentMessagesLoader loader, size_t budget_bytes) {
+    pthread_mutex_lock(&window_mutex);
+    recent_loader = loader;
+    if (budget_bytes > 0) {
+        budget = budget_bytes;
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+uint64_t message_window_next_seq(uint32_t channel_id) {
+    uint64_t seq = 0;
+    ChannelWindow *w = acquire_channel(channel_id);
+    if (w) {
+        seq = w->next_seq++;
+        w->pending++;
+    }
+    pthread_mutex_unlock(&window_mutex);
+    return seq;
+}
+
+void message_window_store(const ChatMessage *chat, int64_t sent_at) {
+    if (!chat || chat->seq == 0) return;
+
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(chat->channel_id);
+    if (w) {
+        if (w->pending > 0) w->pending--;
+        // Only keep messages that still fall inside the window
+        if (chat->seq + MESSAGE_WINDOW_SIZE > w->last_stored_seq) {
+            put_entry(w, chat, sent_at);
+            invalidate_snapshot(w);
+            evict_over_budget(w);
+        }
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+void message_window_cancel_seq(uint32_t channel_id, uint64_t seq) {
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(channel_id);
+    if (w) {
+        if (w->pending > 0) w->pending--;
+        // Nothing was handed out since: the next message takes it
+        if (w->next_seq == seq + 1) w->next_seq = seq;
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+int message_window_collect(uint32_t channel_id, uint64_t after_seq, ChatMessage *out, int max, bool *complete) {
+    int count = 0;
+    bool covered = false;
+
+    ChannelWindow *w = acquire_channel(channel_id);
+    if (w) {
+        uint64_t head = w->last_stored_seq;
+        // The oldest sequence number the ring can still hold
+        uint64_t oldest = head >= MESSAGE_WINDOW_SIZE ? head - MESSAGE_WINDOW_SIZE + 1 : 1;
+        covered = after_seq + 1 >= oldest;
+
+        for (uint64_t seq = after_seq + 1; covered && seq <= head && count < max; seq++) {
+            const WindowEntry *entry = &w->ring[seq % MESSAGE_WINDOW_SIZE];
+            if (entry->seq != seq) {
+                covered = false; // Not stored yet or overwritten
+                break;
+            }
+            ChatMessage *chat = &out[count++];
+            memset(chat, 0, sizeof(ChatMessage));
+            chat->channel_id = channel_id;
+            chat->message_id = entry->message_id;
+            chat->seq = entry->seq;
+            chat->sent_at = entry->sent_at;
+            strncpy(chat->sender_username, entry->sender, sizeof(chat->sender_username) - 1);
+            memcpy(chat->content, entry->content, entry->content_len);
+        }
+    }
+    pthread_mutex_unlock(&window_mutex);
+
+    if (complete) *complete = covered;
+    return covered ? count : 0;
+}
+
+WindowSnapshot* message_window_snapshot(uint32_t channel_id) {
+    WindowSnapshot *snapshot = NULL;
+
+    ChannelWindow *w = acquire_channel(channel_id);
+    if (w) {
+        if (!w->snapshot) {
+            w->snapshot = encode_snapshot(w);
+            if (w->snapshot) {
+                charge(w, w->snapshot->length);
+                evict_over_budget(w);
+            }
+        }
+        snapshot = w->snapshot;
+        if (snapshot) snapshot->refcount++;
+    }
+    pthread_mutex_unlock(&window_mutex);
+    return snapshot;
+}
+
+void message_window_snapshot_release(WindowSnapshot *snapshot) {
+    if (!snapshot) return;
+    pthread_mutex_lock(&window_mutex);
+    snapshot_unref(snapshot);
+    pthread_mutex_unlock(&window_mutex);
+}
+
+void message_window_drop(uint32_t channel_id) {
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(channel_id);
+    if (w && w->pending == 0) {
+        destroy_channel(w);
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+void message_window_observe(const ChatMessage *chat, int64_t sent_at) {
+    if (!chat || chat->seq == 0) return;
+
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(chat->channel_id);
+    if (w) {
+        if (chat->seq >= w->next_seq) w->next_seq = chat->seq + 1;
+        if (chat->seq + MESSAGE_WINDOW_SIZE > w->last_stored_seq) {
+            put_entry(w, chat, sent_at);
+            invalidate_snapshot(w);
+            evict_over_budget(w);
+        }
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+void message_window_raise_seq(uint32_t channel_id, uint64_t seq) {
+    ChannelWindow *w = acquire_channel(channel_id);
+    if (w && seq >= w->next_seq) {
+        w->next_seq = seq + 1;
+    }
+    pthread_mutex_unlock(&window_mutex);
+}
+
+uint64_t message_window_peek_seq(uint32_t channel_id) {
+    pthread_mutex_lock(&window_mutex);
+    ChannelWindow *w = find_channel(channel_id);
+    uint64_t seq = w ? w->next_seq - 1 : 0;
+    pthread_mutex_unlock(&window_mutex);
+    return seq;
+}
+
+static void init_order_locks(void) {
+    for (int i = 0; i < ORDER_LOCK_STRIPES; i++) {
+        pthread_mutex_init(&order_locks[i], NULL);
+    }
+}
+
+void message_window_order_lock(uint32_t channel_id) {
+    pthread_once(&order_locks_once, init_order_locks);
+    pthread_mutex_lock(&order_locks[channel_id % ORDER_LOCK_STRIPES]);
+}
+
+void message_window_order_unlock(uint32_t channel_id) {
+    pthread_mutex_unlock(&order_locks[channel_id % ORDER_LOCK_STRIPES]);
+}
+
+uint32_t* message_window_channels(size_t *count) {
+    *count = 0;
+    pthread_mutex_lock(&window_mutex);
+    size_t total = 0;
+    for (ChannelWindow *w = lru_head; w; w = w->lru_next) total++;
+    uint32_t *channels = total > 0 ? malloc(total * sizeof(uint32_t)) : NULL;
+    if (channels) {
+        for (ChannelWindow *w = lru_head; w; w = w->lru_next) channels[(*count)++] = w->channel_id;
+    }
+    pthread_mutex_unlock(&window_mutex);
+    return channels;
+}
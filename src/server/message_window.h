@@ -0,0 +1,82 @@
+#ifndef MESSAGE_WINDOW_H
+#define MESSAGE_WINDOW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "../network/protocol.h"
+
+// Number of recent messages kept per channel (power of two)
+#define MESSAGE_WINDOW_SIZE 256
+// Default memory budget for all windows; override with HOT_WINDOW_BUDGET_MB
+#define DEFAULT_HOT_WINDOW_BUDGET_MB 64
+
+typedef struct {
+    ChatMessage chat;
+    int64_t sent_at; // Unix time
+} WindowMessage;
+
+// Loads the most recent messages of a channel, oldest first, into out (at most max),
+// and the highest sequence number persisted for it. Called once per cold channel,
+// without the window lock held. Returns false on a database error.
+typedef bool (*RecentMessagesLoader)(uint32_t channel_id, WindowMessage *out, int max,
+                                     int *count, uint64_t *last_seq);
+
+// Pre-encoded MSG_CHANNEL_SNAPSHOT frames, shared by every joiner until the
+// channel changes. Treat as read-only and hand back with message_window_snapshot_release.
+typedef struct {
+    int refcount; // Guarded by the window lock
+    size_t length;
+    char data[];
+} WindowSnapshot;
+
+// Initialize the per-channel windows
+void message_window_init(RecentMessagesLoader loader, size_t budget_bytes);
+
+// Reserve the next sequence number for a channel (0 if the channel could not be loaded).
+// Every reserved number must be followed by message_window_store or message_window_cancel_seq.
+uint64_t message_window_next_seq(uint32_t channel_id);
+
+// Remember a sequenced, persisted message
+void message_window_store(const ChatMessage *chat, int64_t sent_at);
+
+// Give up on a reserved sequence number (e.g. the message could not be persisted).
+// Called under the channel's order lock it is handed out again, so no hole is left.
+void message_window_cancel_seq(uint32_t channel_id, uint64_t seq);
+
+// Copy up to max messages of channel_id with seq > after_seq into out, oldest first.
+// Sets *complete to false when the window no longer covers the whole gap, in which
+// case the caller has to fall back to the database.
+int message_window_collect(uint32_t channel_id, uint64_t after_seq, ChatMessage *out, int max, bool *complete);
+
+// Get the encoded window of a channel, loading the channel if it is cold. NULL on failure.
+WindowSnapshot* message_window_snapshot(uint32_t channel_id);
+void message_window_snapshot_release(WindowSnapshot *snapshot);
+
+// Forget a channel's window (the channel was deleted). Kept while sequence
+// numbers are in flight for it.
+void message_window_drop(uint32_t channel_id);
+
+// Remember a message sequenced by another server node. Only kept if the
+// channel is warm; never hands out its seq again.
+void message_window_observe(const ChatMessage *chat, int64_t sent_at);
+
+// Make sure the channel continues after seq (another node sequenced it up to
+// there), loading the channel if it is cold
+void message_window_raise_seq(uint32_t channel_id, uint64_t seq);
+
+// Last sequence number handed out for a warm channel, 0 if it is cold
+uint64_t message_window_peek_seq(uint32_t channel_id);
+
+// A channel's messages are sequenced and delivered under its order lock, and
+// a connection is brought up to date and starts receiving the channel under it
+// too, so every connection gets a channel in seq order and a joiner misses
+// nothing posted while it catches up. Striped: unrelated channels may share a
+// lock, so never hold two.
+void message_window_order_lock(uint32_t channel_id);
+void message_window_order_unlock(uint32_t channel_id);
+
+// The warm channels, as a malloc'd array (caller frees); NULL when there are none
+uint32_t* message_window_channels(size_t *count);
+
+#endif // MESSAGE_WINDOW_H
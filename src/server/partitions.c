@@ -0,0 +1,111 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "partitions.h"
+
+static pthread_t partitions_thread;
+static volatile bool partitions_running = false;
+
+static PGconn *partitions_db = NULL;
+static pthread_mutex_t *partitions_db_lock = NULL;
+static int months_ahead = DEFAULT_PARTITIONS_AHEAD;
+static int retain_months = DEFAULT_PARTITION_RETAIN_MONTHS;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+static bool create_partitions(void) {
+    char ahead_str[16];
+    snprintf(ahead_str, sizeof(ahead_str), "%d", months_ahead);
+    const char *params[1] = {ahead_str};
+
+    pthread_mutex_lock(partitions_db_lock);
+    PGresult *res = PQexecParams(partitions_db, "SELECT create_message_partitions(CURRENT_DATE, $1::int)",
+                                 1, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(partitions_db_lock);
+
+    bool ok = PQresultStatus(res) == PGRES_TUPLES_OK;
+    if (!ok) {
+        fprintf(stderr, "DB Error creating message partitions: %s\n", PQresultErrorMessage(res));
+    } else if (atoi(PQgetvalue(res, 0, 0)) > 0) {
+        printf("🗄️ Created %s message partition(s) up to %d months ahead\n", PQgetvalue(res, 0, 0), months_ahead);
+    }
+    PQclear(res);
+    return ok;
+}
+
+static void detach_partitions(void) {
+    if (retain_months <= 0) return;
+    char retain_str[16];
+    snprintf(retain_str, sizeof(retain_str), "%d", retain_months);
+    const char *params[1] = {retain_str};
+
+    // A partition goes once it ends before the first retained month
+    pthread_mutex_lock(partitions_db_lock);
+    PGresult *res = PQexecParams(partitions_db,
+        "SELECT detach_message_partitions((date_trunc('month', CURRENT_DATE) - make_interval(months => $1::int))::date)",
+        1, NULL, params, NULL, NULL, 0);
+    pthread_mutex_unlock(partitions_db_lock);
+
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error detaching message partitions: %s\n", PQresultErrorMessage(res));
+    } else {
+        for (int i = 0; i < PQntuples(res); i++) {
+            printf("🗄️ Detached message partition %s\n", PQgetvalue(res, i, 0));
+        }
+    }
+    PQclear(res);
+}
+
+static void* partitions_loop(void *arg) {
+    (void)arg;
+    int elapsed_s = 0;
+    while (partitions_running) {
+        sleep_ms(1000); // Short naps so partitions_stop doesn't wait an hour
+        if (++elapsed_s < PARTITION_CHECK_INTERVAL_S) continue;
+        elapsed_s = 0;
+        create_partitions();
+        detach_partitions();
+    }
+    return NULL;
+}
+
+bool partitions_start(PGconn *db_conn, pthread_mutex_t *db_lock) {
+    partitions_db = db_conn;
+    partitions_db_lock = db_lock;
+    months_ahead = env_int("MESSAGE_PARTITIONS_AHEAD", DEFAULT_PARTITIONS_AHEAD);
+    if (months_ahead < 1) months_ahead = 1;
+    retain_months = env_int("MESSAGE_PARTITION_RETAIN_MONTHS", DEFAULT_PARTITION_RETAIN_MONTHS);
+
+    if (!create_partitions()) return false;
+    detach_partitions();
+
+    partitions_running = true;
+    if (pthread_create(&partitions_thread, NULL, partitions_loop, NULL) != 0) {
+        perror("Failed to start partition upkeep thread");
+        partitions_running = false;
+        return false;
+    }
+    return true;
+}
+
+void partitions_stop(void) {
+    if (!partitions_running) return;
+    partitions_running = false;
+    pthread_join(partitions_thread, NULL);
+}
@@ -0,0 +1,27 @@
+#ifndef PARTITIONS_H
+#define PARTITIONS_H
+
+#include <stdbool.h>
+#include <libpq-fe.h>
+#include <pthread.h>
+
+// Upkeep of the monthly partitions of messages (see migration 3): the
+// partitions of the coming months are created well before a message needs
+// them, and with a retention set, months past it are detached whole instead
+// of being deleted row by row.
+
+// Months created past the current one; override with MESSAGE_PARTITIONS_AHEAD
+#define DEFAULT_PARTITIONS_AHEAD 3
+// Whole months kept attached before the current one; override with
+// MESSAGE_PARTITION_RETAIN_MONTHS. 0 keeps everything.
+#define DEFAULT_PARTITION_RETAIN_MONTHS 0
+// How often the partitions are checked
+#define PARTITION_CHECK_INTERVAL_S 3600
+
+// Create the missing partitions now (false if that fails: inserts would fail
+// too) and start the upkeep thread. db_conn must only be touched while
+// holding db_lock.
+bool partitions_start(PGconn *db_conn, pthread_mutex_t *db_lock);
+void partitions_stop(void);
+
+#endif // PARTITIONS_H
@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "presence.h"
+
+#define PRESENCE_BUCKETS 1024
+// Updates per MSG_PRESENCE_UPDATE frame
+#define UPDATES_PER_FRAME (MAX_PAYLOAD_SIZE / sizeof(PresenceUpdate))
+
+typedef struct PresenceEntry {
+    uint32_t user_id;
+    char username[50];
+    int connections;           // Live authenticated connections of this user
+    UserStatus status;         // Current status (source of truth)
+    UserStatus sent_status;    // Last status pushed to clients
+    UserStatus flushed_status; // Last status written to the database
+    struct PresenceEntry *next;
+} PresenceEntry;
+
+static PresenceEntry *presence_buckets[PRESENCE_BUCKETS];
+static pthread_mutex_t presence_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t presence_thread;
+static volatile bool presence_running = false;
+
+static PGconn *presence_db = NULL;
+static pthread_mutex_t *presence_db_lock = NULL;
+static PresenceDeliver presence_deliver = NULL;
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+static const char* status_name(UserStatus status) {
+    switch (status) {
+        case STATUS_ONLINE: return "online";
+        case STATUS_AWAY: return "away";
+        default: return "offline";
+    }
+}
+
+// Must be called with presence_mutex held
+static PresenceEntry* get_entry(uint32_t user_id, bool create) {
+    PresenceEntry **bucket = &presence_buckets[user_id % PRESENCE_BUCKETS];
+    for (PresenceEntry *e = *bucket; e; e = e->next) {
+        if (e->user_id == user_id) return e;
+    }
+    if (!create) return NULL;
+
+    PresenceEntry *e = calloc(1, sizeof(PresenceEntry));
+    if (!e) {
+        fprintf(stderr, "Failed to allocate presence entry for user %u\n", user_id);
+        return NULL;
+    }
+    e->user_id = user_id;
+    // The DB row was written as offline on the previous disconnect (or registration)
+    e->status = e->sent_status = e->flushed_status = STATUS_OFFLINE;
+    e->next = *bucket;
+    *bucket = e;
+    return e;
+}
+
+void presence_connect(uint32_t user_id, const char *username) {
+    pthread_mutex_lock(&presence_mutex);
+    PresenceEntry *e = get_entry(user_id, true);
+    if (e) {
+        if (username) {
+            strncpy(e->username, username, sizeof(e->username) - 1);
+        }
+        e->connections++;
+        e->status = STATUS_ONLINE;
+    }
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+void presence_disconnect(uint32_t user_id) {
+    pthread_mutex_lock(&presence_mutex);
+    PresenceEntry *e = get_entry(user_id, false);
+    if (e && e->connections > 0 && --e->connections == 0) {
+        e->status = STATUS_OFFLINE;
+    }
+    pthread_mutex_unlock(&presence_mutex);
+}
+
+UserStatus presence_status(uint32_t user_id) {
+    pthread_mutex_lock(&presence_mutex);
+    PresenceEntry *e = get_entry(user_id, false);
+    UserStatus status = e ? e->status : STATUS_OFFLINE;
+    pthread_mutex_unlock(&presence_mutex);
+    return status;
+}
+
+// Push every status that changed since the last tick as one set of frames.
+// A user who flapped offline and back within a tick produces nothing.
+static void broadcast_changes(void) {
+    size_t count = 0, capacity = 0;
+    PresenceUpdate *updates = NULL;
+
+    pthread_mutex_lock(&presence_mutex);
+    for (int b = 0; b < PRESENCE_BUCKETS; b++) {
+        for (PresenceEntry *e = presence_buckets[b]; e; e = e->next) {
+            if (e->status == e->sent_status) continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                PresenceUpdate *grown = realloc(updates, capacity * sizeof(PresenceUpdate));
+                if (!grown) break;
+                updates = grown;
+            }
+            memset(&updates[count], 0, sizeof(PresenceUpdate));
+            updates[count].user_id = e->user_id;
+            updates[count].status = (uint32_t)e->status;
+            memcpy(updates[count].username, e->username, sizeof(e->username));
+            e->sent_status = e->status;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&presence_mutex);
+
+    if (count == 0 || !presence_deliver) {
+        free(updates);
+        return;
+    }
+
+    // Encode once; the same bytes go to every interested client
+    size_t frames = (count + UPDATES_PER_FRAME - 1) / UPDATES_PER_FRAME;
+    size_t length = frames * sizeof(Message) + count * sizeof(PresenceUpdate);
+    char *buffer = malloc(length);
+    if (buffer) {
+        size_t offset = 0;
+        for (size_t i = 0; i < count; i += UPDATES_PER_FRAME) {
+            size_t n = count - i < UPDATES_PER_FRAME ? count - i : UPDATES_PER_FRAME;
+            Message frame = {0};
+            frame.type = MSG_PRESENCE_UPDATE;
+            frame.length = (uint32_t)(n * sizeof(PresenceUpdate));
+            memcpy(buffer + offset, &frame, sizeof(Message));
+            memcpy(buffer + offset + sizeof(Message), &updates[i], frame.length);
+            offset += sizeof(Message) + frame.length;
+        }
+        presence_deliver(buffer, length);
+        free(buffer);
+    }
+    free(updates);
+}
+
+typedef struct {
+    PresenceEntry *entry;
+    UserStatus status;
+} PendingFlush;
+
+// Write every status that differs from the database in a single UPDATE
+static void flush_to_db(void) {
+    size_t count = 0, capacity = 0;
+    PendingFlush *pending = NULL;
+
+    pthread_mutex_lock(&presence_mutex);
+    for (int b = 0; b < PRESENCE_BUCKETS; b++) {
+        for (PresenceEntry *e = presence_buckets[b]; e; e = e->next) {
+            if (e->status == e->flushed_status) continue;
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                PendingFlush *grown = realloc(pending, capacity * sizeof(PendingFlush));
+                if (!grown) break;
+                pending = grown;
+            }
+            pending[count].entry = e;
+            pending[count].status = e->status;
+            count++;
+        }
+    }
+    pthread_mutex_unlock(&presence_mutex);
+
+    if (count == 0 || !presence_db) {
+        free(pending);
+        return;
+    }
+
+    // Array literals for unnest(): "{1,2,3}" and "{online,offline,online}"
+    char *ids = malloc(count * 11 + 2);
+    char *statuses = malloc(count * 8 + 2);
+    if (!ids || !statuses) {
+        free(ids);
+        free(statuses);
+        free(pending);
+        return;
+    }
+    size_t ids_len = 0, statuses_len = 0;
+    ids[ids_len++] = '{';
+    statuses[statuses_len++] = '{';
+    for (size_t i = 0; i < count; i++) {
+        const char *sep = i > 0 ? "," : "";
+        ids_len += (size_t)sprintf(ids + ids_len, "%s%u", sep, pending[i].entry->user_id);
+        statuses_len += (size_t)sprintf(statuses + statuses_len, "%s%s", sep, status_name(pending[i].status));
+    }
+    strcpy(ids + ids_len, "}");
+    strcpy(statuses + statuses_len, "}");
+
+    const char *query = "UPDATE users AS u SET status = v.status "
+                        "FROM unnest($1::int[], $2::text[]) AS v(user_id, status) "
+                        "WHERE u.user_id = v.user_id";
+    const char *params[2] = {ids, statuses};
+
+    pthread_mutex_lock(presence_db_lock);
+    PGresult *res = PQexecParams(presence_db, query, 2, NULL, params, NULL, NULL, 0);
+    bool ok = PQresultStatus(res) == PGRES_COMMAND_OK;
+    if (!ok) {
+        fprintf(stderr, "DB Presence Flush Error (%zu users): %s\n", count, PQerrorMessage(presence_db));
+    }
+    PQclear(res);
+    pthread_mutex_unlock(presence_db_lock);
+
+    // On failure the entries stay dirty and are retried on the next flush.
+    // Entries are never freed, so the pointers are still valid.
+    if (ok) {
+        pthread_mutex_lock(&presence_mutex);
+        for (size_t i = 0; i < count; i++) {
+            pending[i].entry->flushed_status = pending[i].status;
+        }
+        pthread_mutex_unlock(&presence_mutex);
+        printf("🟢 Flushed %zu presence changes in one batch\n", count);
+    }
+
+    free(ids);
+    free(statuses);
+    free(pending);
+}
+
+static void* presence_loop(void *arg) {
+    (void)arg;
+    int ticks = 0;
+    while (presence_running) {
+        sleep_ms(PRESENCE_TICK_MS);
+        broadcast_changes();
+        if (++ticks >= PRESENCE_FLUSH_TICKS) {
+            flush_to_db();
+            ticks = 0;
+        }
+    }
+    return NULL;
+}
+
+bool presence_start(PGconn *db_conn, pthread_mutex_t *db_lock, PresenceDeliver deliver) {
+    presence_db = db_conn;
+    presence_db_lock = db_lock;
+    presence_deliver = deliver;
+    presence_running = true;
+    if (pthread_create(&presence_thread, NULL, presence_loop, NULL) != 0) {
+        perror("Failed to start presence thread");
+        presence_running = false;
+        return false;
+    }
+    return true;
+}
+
+void presence_stop(void) {
+    if (!presence_running) return;
+    presence_running = false;
+    pthread_join(presence_thread, NULL);
+    broadcast_changes();
+    flush_to_db();
+}
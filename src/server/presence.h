@@ -0,0 +1,34 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <libpq-fe.h>
+#include <pthread.h>
+#include "../network/protocol.h"
+
+// How often coalesced presence changes are pushed to clients
+#define PRESENCE_TICK_MS 500
+// How often changed statuses are written to the users table, in ticks
+#define PRESENCE_FLUSH_TICKS 4
+
+// Receives the pre-encoded MSG_PRESENCE_UPDATE frames of one tick
+typedef void (*PresenceDeliver)(const char *frames, size_t length);
+
+// Start the presence service. db_conn is used for the batched status flush and
+// must only be touched while holding db_lock.
+bool presence_start(PGconn *db_conn, pthread_mutex_t *db_lock, PresenceDeliver deliver);
+
+// Flush pending statuses and stop the service thread
+void presence_stop(void);
+
+// A connection of this user authenticated / went away. A user stays online
+// while at least one of their connections is alive.
+void presence_connect(uint32_t user_id, const char *username);
+void presence_disconnect(uint32_t user_id);
+
+// Current status of a user; users never seen since startup are offline
+UserStatus presence_status(uint32_t user_id);
+
+#endif // PRESENCE_H
@@ -0,0 +1,203 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#include "retention.h"
+#include "archive.h"
+#include "../database/db_connection.h"
+
+static PGconn *retention_db = NULL;
+static pthread_t retention_thread;
+static volatile bool retention_running = false;
+
+static int default_days = DEFAULT_RETENTION_DAYS;
+static int target_ms = DEFAULT_RETENTION_TARGET_MS;
+static int max_lag_ms = DEFAULT_RETENTION_MAX_LAG_MS;
+
+// Pace, carried from one batch (and one pass) to the next
+static int batch_size = RETENTION_BATCH_START;
+static int pause_ms = RETENTION_PAUSE_MS;
+
+// The oldest messages of one channel past its retention, with everything
+// hanging off them. Returns the messages deleted.
+static const char *purge_query =
+    "WITH doomed AS ("
+    "  SELECT message_id, timestamp FROM messages"
+    "  WHERE channel_id = $1::int AND timestamp < LOCALTIMESTAMP - make_interval(days => $2::int)"
+    "  ORDER BY timestamp, message_id LIMIT $3::int"
+    "), reactions_gone AS ("
+    "  DELETE FROM reactions WHERE message_id IN (SELECT message_id FROM doomed)"
+    "), files_gone AS ("
+    "  DELETE FROM files WHERE message_id IN (SELECT message_id FROM doomed)"
+    "), mentions_gone AS ("
+    "  DELETE FROM mentions WHERE message_id IN (SELECT message_id FROM doomed)"
+    "), messages_gone AS ("
+    "  DELETE FROM messages m USING doomed d"
+    "  WHERE m.message_id = d.message_id AND m.timestamp = d.timestamp RETURNING 1"
+    ") "
+    "SELECT count(*) FROM messages_gone";
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    usleep((useconds_t)ms * 1000);
+#endif
+}
+
+// Sleep in short naps so retention_stop never waits long
+static void nap(int ms) {
+    while (ms > 0 && retention_running) {
+        int step = ms < 500 ? ms : 500;
+        sleep_ms(step);
+        ms -= step;
+    }
+}
+
+static int env_int(const char *name, int fallback) {
+    const char *value = getenv(name);
+    return value && *value ? atoi(value) : fallback;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+// Replay lag of the slowest replica in ms; 0 without replicas or when the
+// server won't say (pg_stat_replication needs pg_monitor to show the lag)
+static int replication_lag_ms(void) {
+    PGresult *res = PQexec(retention_db,
+        "SELECT COALESCE(MAX(EXTRACT(EPOCH FROM replay_lag)) * 1000, 0)::int FROM pg_stat_replication");
+    int lag = 0;
+    if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) == 1) {
+        lag = atoi(PQgetvalue(res, 0, 0));
+    }
+    PQclear(res);
+    return lag;
+}
+
+// Additive increase while batches are fast and replicas keep up,
+// multiplicative decrease as soon as either isn't true
+static void adapt_pace(double batch_ms, int lag_ms) {
+    if (batch_ms > target_ms || lag_ms > max_lag_ms) {
+        batch_size = batch_size / 2 > RETENTION_BATCH_MIN ? batch_size / 2 : RETENTION_BATCH_MIN;
+        pause_ms = pause_ms * 2 < RETENTION_PAUSE_MAX_MS ? pause_ms * 2 : RETENTION_PAUSE_MAX_MS;
+        printf("🐢 Retention slowing down (batch %.0f ms, replica lag %d ms): %d rows every %d ms\n",
+               batch_ms, lag_ms, batch_size, pause_ms);
+    } else {
+        batch_size = batch_size + RETENTION_BATCH_MIN < RETENTION_BATCH_MAX ? batch_size + RETENTION_BATCH_MIN : RETENTION_BATCH_MAX;
+        pause_ms = pause_ms / 2 > RETENTION_PAUSE_MS ? pause_ms / 2 : RETENTION_PAUSE_MS;
+    }
+}
+
+// Purge one channel down to its retention. Returns the messages deleted, -1 on error.
+static long purge_channel(const char *channel_id, const char *days) {
+    long total = 0;
+    while (retention_running) {
+        char limit_str[16];
+        snprintf(limit_str, sizeof(limit_str), "%d", batch_size);
+        const char *params[3] = {channel_id, days, limit_str};
+
+        double start = now_ms();
+        PGresult *res = PQexecParams(retention_db, purge_query, 3, NULL, params, NULL, NULL, 0);
+        double batch_ms = now_ms() - start;
+        if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+            fprintf(stderr, "DB Error purging channel %s: %s\n", channel_id, PQresultErrorMessage(res));
+            PQclear(res);
+            return -1;
+        }
+        int deleted = atoi(PQgetvalue(res, 0, 0));
+        PQclear(res);
+
+        total += deleted;
+        int requested = batch_size;
+        adapt_pace(batch_ms, replication_lag_ms());
+        if (deleted < requested) break; // Nothing older is left
+        nap(pause_ms);
+    }
+    return total;
+}
+
+static void purge_pass(void) {
+    char default_str[16];
+    snprintf(default_str, sizeof(default_str), "%d", default_days);
+    const char *params[1] = {default_str};
+    PGresult *res = PQexecParams(retention_db,
+        "SELECT channel_id, COALESCE(retention_days, $1::int) FROM channels "
+        "WHERE COALESCE(retention_days, $1::int) > 0 ORDER BY channel_id",
+        1, NULL, params, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Error loading retention policies: %s\n", PQresultErrorMessage(res));
+        PQclear(res);
+        return;
+    }
+
+    for (int i = 0; i < PQntuples(res) && retention_running; i++) {
+        long deleted = purge_channel(PQgetvalue(res, i, 0), PQgetvalue(res, i, 1));
+        if (deleted > 0) {
+            printf("🧹 Purged %ld messages older than %s days from channel %s\n",
+                   deleted, PQgetvalue(res, i, 1), PQgetvalue(res, i, 0));
+        }
+        // Archived history expires under the same policy, a segment at a time
+        int segments = archive_drop_expired((uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10), atoi(PQgetvalue(res, i, 1)));
+        if (segments > 0) {
+            printf("🧹 Dropped %d archive segments of channel %s\n", segments, PQgetvalue(res, i, 0));
+        }
+    }
+    PQclear(res);
+}
+
+static void* retention_loop(void *arg) {
+    (void)arg;
+    while (retention_running) {
+        if (PQstatus(retention_db) != CONNECTION_OK) {
+            PQreset(retention_db); // Try again next pass if this fails
+        }
+        if (PQstatus(retention_db) == CONNECTION_OK) {
+            purge_pass();
+        }
+        nap(RETENTION_INTERVAL_S * 1000);
+    }
+    return NULL;
+}
+
+bool retention_start(void) {
+    default_days = env_int("MESSAGE_RETENTION_DAYS", DEFAULT_RETENTION_DAYS);
+    target_ms = env_int("RETENTION_TARGET_MS", DEFAULT_RETENTION_TARGET_MS);
+    max_lag_ms = env_int("RETENTION_MAX_LAG_MS", DEFAULT_RETENTION_MAX_LAG_MS);
+
+    retention_db = connect_to_db();
+    if (!retention_db || PQstatus(retention_db) != CONNECTION_OK) {
+        fprintf(stderr, "Retention: database unavailable: %s\n", retention_db ? PQerrorMessage(retention_db) : "no connection");
+        if (retention_db) PQfinish(retention_db);
+        retention_db = NULL;
+        return false;
+    }
+
+    retention_running = true;
+    if (pthread_create(&retention_thread, NULL, retention_loop, NULL) != 0) {
+        perror("Failed to start retention thread");
+        retention_running = false;
+        PQfinish(retention_db);
+        retention_db = NULL;
+        return false;
+    }
+    return true;
+}
+
+void retention_stop(void) {
+    if (!retention_running) return;
+    retention_running = false;
+    pthread_join(retention_thread, NULL);
+    PQfinish(retention_db);
+    retention_db = NULL;
+}
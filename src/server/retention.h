@@ -0,0 +1,36 @@
+#ifndef RETENTION_H
+#define RETENTION_H
+
+#include <stdbool.h>
+
+// Background purge of messages past their channel's retention (see migration
+// 4: channels.retention_days, or MESSAGE_RETENTION_DAYS when it is NULL).
+// Messages go in small batches along the (channel_id, timestamp) index, each
+// batch taking its reactions, files and mentions with it in the same
+// statement, with a pause in between. The batch shrinks and the pause grows
+// while a batch is slow or the replicas fall behind, and recover once they
+// catch up. Archive segments whose newest message has expired are dropped
+// too. Runs on its own database connection.
+
+// Server default retention in days; override with MESSAGE_RETENTION_DAYS. 0 keeps everything.
+#define DEFAULT_RETENTION_DAYS 0
+// How often channels are checked for expired messages
+#define RETENTION_INTERVAL_S 600
+
+// Batch size bounds, and the size a pass starts with
+#define RETENTION_BATCH_MIN 50
+#define RETENTION_BATCH_START 500
+#define RETENTION_BATCH_MAX 5000
+// Pause between batches while all is well, and the most it backs off to
+#define RETENTION_PAUSE_MS 200
+#define RETENTION_PAUSE_MAX_MS 10000
+// A batch slower than this, or replicas further behind, slow the purge down;
+// override with RETENTION_TARGET_MS / RETENTION_MAX_LAG_MS
+#define DEFAULT_RETENTION_TARGET_MS 250
+#define DEFAULT_RETENTION_MAX_LAG_MS 5000
+
+// False (and no thread) when the database can't be reached
+bool retention_start(void);
+void retention_stop(void);
+
+#endif // RETENTION_H
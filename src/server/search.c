@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#include "search.h"
+#include "../database/db_connection.h"
+
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+static PGconn *search_db = NULL;
+static pthread_mutex_t search_mutex = PTHREAD_MUTEX_INITIALIZER;
+static DbReplicaPool *search_replicas = NULL;
+
+// Ranked first, so the page cursor (rank, message_id) is a plain row comparison.
+// Visible channels are the user's memberships plus every public channel.
+static const char *search_query =
+    "SELECT hits.message_id, hits.channel_id, COALESCE(hits.seq, 0), COALESCE(u.email, ''),"
+    "  left(hits.content, " STRINGIFY(SEARCH_SNIPPET_MAX) "),"
+    "  EXTRACT(EPOCH FROM hits.created_at::timestamptz)::bigint, hits.rank "
+    "FROM ("
+    "  SELECT m.message_id, m.channel_id, m.seq, m.sender_id, m.content, m.timestamp AS created_at,"
+    "    ts_rank(m.content_tsv, q) AS rank"
+    "  FROM messages m, websearch_to_tsquery('simple', $2) q"
+    "  WHERE m.content_tsv @@ q"
+    "    AND ($3::int = 0 OR m.channel_id = $3::int)"
+    "    AND m.channel_id IN (SELECT channel_id FROM user_channels WHERE user_id = $1::int"
+    "                         UNION SELECT channel_id FROM channels WHERE NOT is_private)"
+    ") hits "
+    "LEFT JOIN users u ON u.user_id = hits.sender_id "
+    "WHERE $4::real IS NULL OR (hits.rank, hits.message_id) < ($4::real, $5::int) "
+    "ORDER BY hits.rank DESC, hits.message_id DESC "
+    "LIMIT $6::int";
+
+bool search_start(DbReplicaPool *replicas) {
+    search_replicas = replicas;
+    search_db = connect_to_db();
+    if (!search_db || PQstatus(search_db) != CONNECTION_OK) {
+        fprintf(stderr, "Search: database unavailable: %s\n", search_db ? PQerrorMessage(search_db) : "no connection");
+        if (search_db) PQfinish(search_db);
+        search_db = NULL;
+        return false;
+    }
+    return true;
+}
+
+void search_stop(void) {
+    pthread_mutex_lock(&search_mutex);
+    if (search_db) PQfinish(search_db);
+    search_db = NULL;
+    pthread_mutex_unlock(&search_mutex);
+}
+
+Message* search_messages(uint32_t user_id, const SearchRequest *request) {
+    char query_text[SEARCH_QUERY_MAX];
+    memcpy(query_text, request->query, sizeof(query_text));
+    query_text[sizeof(query_text) - 1] = '\0';
+
+    char user_id_str[32], channel_id_str[32], rank_str[32], message_id_str[32], limit_str[16];
+    snprintf(user_id_str, sizeof(user_id_str), "%u", user_id);
+    snprintf(channel_id_str, sizeof(channel_id_str), "%u", request->channel_id);
+    snprintf(rank_str, sizeof(rank_str), "%.9g", request->after_rank); // Round-trips a float4 exactly
+    snprintf(message_id_str, sizeof(message_id_str), "%u", request->after_message_id);
+    snprintf(limit_str, sizeof(limit_str), "%d", SEARCH_PAGE_SIZE + 1); // One more tells there is a next page
+    bool has_cursor = request->after_message_id != 0;
+    const char *params[6] = {user_id_str, query_text, channel_id_str,
+                             has_cursor ? rank_str : NULL, has_cursor ? message_id_str : NULL, limit_str};
+
+    if (!search_db && !search_replicas) return NULL;
+    PGresult *res = db_exec_read(search_replicas, search_db, &search_mutex, search_query, 6, params);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK) {
+        fprintf(stderr, "DB Search Error for user %u: %s\n", user_id, PQresultErrorMessage(res));
+        PQclear(res);
+        return NULL;
+    }
+
+    Message *msg = create_message(MSG_SEARCH_RESULTS, NULL, MAX_PAYLOAD_SIZE);
+    if (!msg) {
+        PQclear(res);
+        return NULL;
+    }
+    SearchResultsHeader header = {request->request_id, 0, 0};
+    size_t length = sizeof(header);
+    int rows = PQntuples(res);
+    for (int i = 0; i < rows; i++) {
+        if (i == SEARCH_PAGE_SIZE) {
+            header.flags |= SEARCH_MORE;
+            break;
+        }
+        const char *sender = PQgetvalue(res, i, 3);
+        const char *content = PQgetvalue(res, i, 4);
+        SearchResultEntry entry = {0};
+        entry.message_id = (uint32_t)strtoul(PQgetvalue(res, i, 0), NULL, 10);
+        entry.channel_id = (uint32_t)strtoul(PQgetvalue(res, i, 1), NULL, 10);
+        entry.seq = strtoull(PQgetvalue(res, i, 2), NULL, 10);
+        entry.sent_at = strtoll(PQgetvalue(res, i, 5), NULL, 10);
+        entry.rank = strtof(PQgetvalue(res, i, 6), NULL);
+        entry.sender_len = (uint8_t)(strlen(sender) > UINT8_MAX ? UINT8_MAX : strlen(sender));
+        entry.content_len = (uint16_t)strlen(content);
+
+        size_t entry_size = sizeof(entry) + entry.sender_len + entry.content_len;
+        if (length + entry_size > MAX_PAYLOAD_SIZE) {
+            header.flags |= SEARCH_MORE; // The client continues from the last entry sent
+            break;
+        }
+        memcpy(msg->payload + length, &entry, sizeof(entry));
+        memcpy(msg->payload + length + sizeof(entry), sender, entry.sender_len);
+        memcpy(msg->payload + length + sizeof(entry) + entry.sender_len, content, entry.content_len);
+        length += entry_size;
+        header.count++;
+    }
+    PQclear(res);
+
+    memcpy(msg->payload, &header, sizeof(header));
+    msg->length = (uint32_t)length;
+    return msg;
+}
@@ -0,0 +1,26 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../network/protocol.h"
+#include "../database/db_connection.h"
+
+// Full-text message search, served from the GIN-indexed content_tsv column.
+// Searches run on a read replica when one is usable, otherwise on their own
+// database connection, so a slow one never holds the lock that chat traffic needs.
+
+// Results per page (fewer when they don't fit in one frame)
+#define SEARCH_PAGE_SIZE 20
+// Characters of each message sent back as its snippet
+#define SEARCH_SNIPPET_MAX 160
+
+// replicas may be NULL
+bool search_start(DbReplicaPool *replicas);
+void search_stop(void);
+
+// Run one search for user_id, over the channels they can see, and encode the
+// page as a MSG_SEARCH_RESULTS message (caller frees). NULL on error.
+Message* search_messages(uint32_t user_id, const SearchRequest *request);
+
+#endif // SEARCH_H
@@ -0,0 +1,226 @@
+#ifdef _WIN32
+#define _CRT_RAND_S // Enables rand_s() in stdlib.h
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "session.h"
+
+// Number of neighbouring slots probed for a token before giving up
+#define SESSION_PROBE_LIMIT 16
+// A resume refreshes the stored last_used at most this often
+#define SESSION_TOUCH_SECONDS (15 * 60)
+
+// Tokens are stored hashed, so a leaked table does not hand out sessions
+#define TOKEN_HASH_SQL "encode(sha256(convert_to($1, 'UTF8')), 'hex')"
+
+typedef struct {
+    char token[SESSION_TOKEN_SIZE]; // Empty string marks a free slot
+    uint32_t user_id;
+    char username[50];
+    time_t last_used;
+    time_t touched; // When last_used was last written to the database
+} Session;
+
+static Session session_table[SESSION_TABLE_SIZE];
+static pthread_mutex_t session_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PGconn *session_db = NULL;
+static pthread_mutex_t *session_db_lock = NULL;
+
+// Fill buf with cryptographically random bytes
+static bool fill_random(unsigned char *buf, size_t len) {
+#ifdef _WIN32
+    for (size_t i = 0; i < len; i++) {
+        unsigned int value;
+        if (rand_s(&value) != 0) return false;
+        buf[i] = (unsigned char)value;
+    }
+    return true;
+#else
+    FILE *urandom = fopen("/dev/urandom", "rb");
+    if (!urandom) {
+        perror("Could not open /dev/urandom");
+        return false;
+    }
+    size_t got = fread(buf, 1, len, urandom);
+    fclose(urandom);
+    return got == len;
+#endif
+}
+
+// FNV-1a over the hex token; tokens are random so this only needs to spread them
+static uint32_t token_hash(const char *token) {
+    uint32_t hash = 2166136261u;
+    for (const char *p = token; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool session_expired(const Session *session, time_t now) {
+    return session->token[0] == '\0' || now - session->last_used > SESSION_TTL_SECONDS;
+}
+
+// Run a statement on the sessions table; returns the result for a query, or
+// NULL after logging on error (commands return NULL as well)
+static PGresult* session_exec(const char *query, int count, const char *const *params, ExecStatusType expected) {
+    pthread_mutex_lock(session_db_lock);
+    PGresult *res = PQexecParams(session_db, query, count, NULL, params, NULL, NULL, 0);
+    bool ok = PQresultStatus(res) == expected;
+    if (!ok) fprintf(stderr, "DB Session Error: %s\n", PQerrorMessage(session_db));
+    pthread_mutex_unlock(session_db_lock);
+    if (ok && expected == PGRES_TUPLES_OK) return res;
+    PQclear(res);
+    return NULL;
+}
+
+bool session_table_init(PGconn *db_conn, pthread_mutex_t *db_lock) {
+    session_db = db_conn;
+    session_db_lock = db_lock;
+    pthread_mutex_lock(&session_mutex);
+    memset(session_table, 0, sizeof(session_table));
+    pthread_mutex_unlock(&session_mutex);
+
+    char ttl[16];
+    snprintf(ttl, sizeof(ttl), "%d", SESSION_TTL_SECONDS);
+    const char *params[1] = {ttl};
+    session_exec("DELETE FROM sessions WHERE last_used < CURRENT_TIMESTAMP - $1::int * INTERVAL '1 second'",
+                 1, params, PGRES_COMMAND_OK);
+    return true;
+}
+
+// Cache a session in memory, preferring a free or expired slot, otherwise
+// evicting the least recently used one of the probed slots
+static void session_store(const char *token, uint32_t user_id, const char *username, time_t now) {
+    uint32_t start = token_hash(token) & (SESSION_TABLE_SIZE - 1);
+
+    pthread_mutex_lock(&session_mutex);
+    Session *target = &session_table[start];
+    for (int i = 0; i < SESSION_PROBE_LIMIT; i++) {
+        Session *slot = &session_table[(start + i) & (SESSION_TABLE_SIZE - 1)];
+        if (session_expired(slot, now)) {
+            target = slot;
+            break;
+        }
+        if (slot->last_used < target->last_used) {
+            target = slot;
+        }
+    }
+    memcpy(target->token, token, SESSION_TOKEN_SIZE);
+    target->user_id = user_id;
+    strncpy(target->username, username, sizeof(target->username) - 1);
+    target->username[sizeof(target->username) - 1] = '\0';
+    target->last_used = now;
+    target->touched = now;
+    pthread_mutex_unlock(&session_mutex);
+}
+
+bool session_create(uint32_t user_id, const char *username, char *token_out) {
+    if (!username || !token_out) return false;
+
+    unsigned char raw[(SESSION_TOKEN_SIZE - 1) / 2];
+    if (!fill_random(raw, sizeof(raw))) {
+        fprintf(stderr, "Failed to generate session token\n");
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(raw); i++) {
+        snprintf(token_out + i * 2, 3, "%02x", raw[i]);
+    }
+    token_out[SESSION_TOKEN_SIZE - 1] = '\0';
+
+    // Without the row the session still works until this process restarts
+    char user_str[16];
+    snprintf(user_str, sizeof(user_str), "%u", user_id);
+    const char *params[2] = {token_out, user_str};
+    session_exec("INSERT INTO sessions (token_hash, user_id) VALUES (" TOKEN_HASH_SQL ", $2::int)",
+                 2, params, PGRES_COMMAND_OK);
+
+    session_store(token_out, user_id, username, time(NULL));
+    return true;
+}
+
+// Must be called with session_mutex held
+static Session* session_find(const char *token, time_t now) {
+    uint32_t start = token_hash(token) & (SESSION_TABLE_SIZE - 1);
+    for (int i = 0; i < SESSION_PROBE_LIMIT; i++) {
+        Session *slot = &session_table[(start + i) & (SESSION_TABLE_SIZE - 1)];
+        if (!session_expired(slot, now) && strcmp(slot->token, token) == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+bool session_resume(const char *token, uint32_t *user_id, char *username, size_t username_size) {
+    if (!token || strlen(token) != SESSION_TOKEN_SIZE - 1) return false;
+
+    time_t now = time(NULL);
+    bool found = false;
+    bool touch = false;
+    uint32_t found_user = 0;
+    char found_name[50] = {0};
+
+    pthread_mutex_lock(&session_mutex);
+    Session *session = session_find(token, now);
+    if (session) {
+        session->last_used = now;
+        if (now - session->touched >= SESSION_TOUCH_SECONDS) {
+            session->touched = now;
+            touch = true;
+        }
+        found_user = session->user_id;
+        memcpy(found_name, session->username, sizeof(found_name));
+        found = true;
+    }
+    pthread_mutex_unlock(&session_mutex);
+
+    char ttl[16];
+    snprintf(ttl, sizeof(ttl), "%d", SESSION_TTL_SECONDS);
+    const char *params[2] = {token, ttl};
+    if (touch) {
+        session_exec("UPDATE sessions SET last_used = CURRENT_TIMESTAMP WHERE token_hash = " TOKEN_HASH_SQL,
+                     1, params, PGRES_COMMAND_OK);
+    } else if (!found) {
+        // Issued before a restart, by another process, or evicted from memory
+        PGresult *res = session_exec(
+            "UPDATE sessions s SET last_used = CURRENT_TIMESTAMP FROM users u "
+            "WHERE s.token_hash = " TOKEN_HASH_SQL " AND u.user_id = s.user_id "
+            "  AND s.last_used >= CURRENT_TIMESTAMP - $2::int * INTERVAL '1 second' "
+            "RETURNING s.user_id, u.email",
+            2, params, PGRES_TUPLES_OK);
+        if (res && PQntuples(res) == 1) {
+            found_user = (uint32_t)strtoul(PQgetvalue(res, 0, 0), NULL, 10);
+            strncpy(found_name, PQgetvalue(res, 0, 1), sizeof(found_name) - 1);
+            session_store(token, found_user, found_name, now);
+            found = true;
+        }
+        PQclear(res);
+    }
+
+    if (found) {
+        if (user_id) *user_id = found_user;
+        if (username && username_size > 0) {
+            strncpy(username, found_name, username_size - 1);
+            username[username_size - 1] = '\0';
+        }
+    }
+    return found;
+}
+
+void session_revoke_user(uint32_t user_id) {
+    int revoked = 0;
+    pthread_mutex_lock(&session_mutex);
+    for (int i = 0; i < SESSION_TABLE_SIZE; i++) {
+        if (session_table[i].token[0] != '\0' && session_table[i].user_id == user_id) {
+            memset(&session_table[i], 0, sizeof(Session));
+            revoked++;
+        }
+    }
+    pthread_mutex_unlock(&session_mutex);
+    if (revoked > 0) {
+        printf("🔒 Revoked %d session(s) of user %u\n", revoked, user_id);
+    }
+}
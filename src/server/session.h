@@ -0,0 +1,34 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#include "../network/protocol.h"
+
+// How long a session token stays valid after it was last used
+#define SESSION_TTL_SECONDS (12 * 60 * 60)
+// Maximum number of live sessions kept in memory (power of two)
+#define SESSION_TABLE_SIZE 4096
+
+// Initialize the in-memory session table in front of the sessions table, and
+// delete expired rows. db_lock guards db_conn, which is shared with the caller.
+bool session_table_init(PGconn *db_conn, pthread_mutex_t *db_lock);
+
+// Create a session for an authenticated user and write its token to token_out
+// (SESSION_TOKEN_SIZE bytes). Returns false if no token could be generated.
+// The session is also stored in the database so it survives a restart.
+bool session_create(uint32_t user_id, const char *username, char *token_out);
+
+// Look up a token, in memory first, then in the database (a restarted server
+// or another process issued it). On success fills user_id/username and
+// extends the session TTL.
+bool session_resume(const char *token, uint32_t *user_id, char *username, size_t username_size);
+
+// Forget every cached session of a user (credentials changed or account
+// deleted). The database rows are dropped by triggers on users.
+void session_revoke_user(uint32_t user_id);
+
+#endif // SESSION_H
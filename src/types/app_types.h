@@ -6,9 +6,20 @@
 #include <libpq-fe.h>
 #include "../network/platform.h"
 #include "../network/protocol.h"
+#include "../components/chat_history_view.h"
 
 #define BUFFER_SIZE 1024
 
+struct SearchPanel;
+
+// State of the link to the server, shown in the chat page
+typedef enum {
+    CONNECTION_ONLINE,
+    CONNECTION_RECONNECTING, // Lost; waiting for or making the next attempt
+    CONNECTION_RESUMING,     // Connected again, waiting for MSG_RESUME_SUCCESS
+    CONNECTION_OFFLINE       // Gave up after RECONNECT_MAX_ATTEMPTS
+} ConnectionState;
+
 // Structure to hold all application widgets
 typedef struct {
     GtkWidget *window;
@@ -25,30 +36,72 @@ typedef struct {
     GtkWidget *register_email_entry;
     GtkWidget *register_password_entry;
     GtkWidget *chat_input;
-    GtkWidget *chat_history;
+    ChatHistoryView *chat_history;
     GtkWidget *chat_channels_list;
     GtkWidget *contacts_list;
     GtkWidget *channel_name;
     GtkWidget *user_display_label;
+    GtkWidget *connection_status;
+    struct SearchPanel *search_panel;
     SOCKET server_socket;
+    pthread_mutex_t socket_mutex; // Guards server_socket: the receive thread swaps it on reconnect
     pthread_t receive_thread;
     gboolean is_running;
     uint32_t current_channel_id;
     char username[256];
     PGconn *db_conn;
+    struct DbReplicaPool *db_replicas;      // Lag-tolerant reads (PG_REPLICAS), NULL without replicas
+    char session_token[SESSION_TOKEN_SIZE]; // Issued on login, used to resume after a reconnect
+    GHashTable *contact_rows;               // user_id -> contacts_list label, updated in place
+    GHashTable *channel_rows;               // channel_id -> chat_channels_list row, updated in place
+    uint32_t next_client_id;                // Local id of the last message sent
+    GHashTable *pending_messages;           // client_id -> ChatMessage, sent and not yet acknowledged
+    ConnectionState connection_state;       // Main thread copy, updated by apply_connection_state
 } AppWidgets;
 
-// Structure for chat update data
+// Structure for one MSG_USER_LIST frame handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    uint32_t length;
+    char payload[];
+} SnapshotUpdateData;
+
+// Structure for one MSG_PRESENCE_UPDATE frame handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    uint32_t count;
+    PresenceUpdate updates[];
+} PresenceUpdateData;
+
+// Structure for one MSG_CHAT_ACK handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    ChatAck ack;
+} ChatAckData;
+
+// Structure for one MSG_SEARCH_RESULTS frame handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    uint32_t length;
+    char payload[];
+} SearchResultsData;
+
+// Structure for one MSG_CHANNEL_ACTIVITY handed to the UI thread
+typedef struct {
+    AppWidgets *widgets;
+    ChannelActivity activity;
+} ChannelActivityData;
+
+// Structure for a connection state change handed to the UI thread
 typedef struct {
     AppWidgets *widgets;
-    char sender[128];
-    char content[BUFFER_SIZE];
-    uint32_t channel_id;
-} ChatUpdateData;
+    ConnectionState state;
+    uint32_t attempt;  // CONNECTION_RECONNECTING: 1-based attempt about to be made
+    uint32_t delay_ms; // CONNECTION_RECONNECTING: wait before that attempt
+} ConnectionStateData;
 
 // Function declarations
 extern void show_error_dialog(GtkWidget *parent, const char *message);
-extern void load_channel_history(AppWidgets *widgets, uint32_t channel_id);
 extern Message* create_registration_message(const char *firstname, const char *lastname, const char *email, const char *password);
 
 // === initialize application ===
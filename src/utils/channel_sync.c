@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "channel_sync.h"
+#include "chat_utils.h"
+
+static pthread_mutex_t sync_mutex = PTHREAD_MUTEX_INITIALIZER;
+static AppWidgets *sync_widgets = NULL;
+static uint32_t sync_channel = 0;
+static uint64_t resume_point = 0;
+static uint64_t ahead[CHANNEL_SYNC_MAX_AHEAD]; // Received past a hole, ascending, all > resume_point + 1
+static int ahead_count = 0;
+static bool gap_timer = false;
+
+// --- Helpers below must be called with sync_mutex held ---
+
+// Move the resume point over the seqs that now follow it
+static void absorb_ahead(void) {
+    int used = 0;
+    while (used < ahead_count && ahead[used] <= resume_point + 1) {
+        if (ahead[used] == resume_point + 1) resume_point++;
+        used++;
+    }
+    memmove(ahead, ahead + used, sizeof(uint64_t) * (size_t)(ahead_count - used));
+    ahead_count -= used;
+}
+
+// False if seq is already remembered
+static bool remember_ahead(uint64_t seq) {
+    int i = ahead_count;
+    while (i > 0 && ahead[i - 1] > seq) i--;
+    if (i > 0 && ahead[i - 1] == seq) return false;
+    if (ahead_count == CHANNEL_SYNC_MAX_AHEAD) return true; // Shown, and replayed later
+    memmove(ahead + i + 1, ahead + i, sizeof(uint64_t) * (size_t)(ahead_count - i));
+    ahead[i] = seq;
+    ahead_count++;
+    return true;
+}
+
+static gboolean on_gap_timeout(gpointer data);
+
+static void watch_gap(void) {
+    if (ahead_count > 0 && !gap_timer) {
+        gap_timer = true;
+        g_timeout_add(CHANNEL_SYNC_GAP_WAIT_MS, on_gap_timeout, NULL);
+    }
+}
+
+// ---
+
+// Main thread: the hole is still there, ask for what is missing
+static gboolean on_gap_timeout(gpointer data) {
+    (void)data;
+    pthread_mutex_lock(&sync_mutex);
+    gap_timer = false;
+    uint32_t channel_id = sync_channel;
+    uint64_t after_seq = resume_point;
+    bool open = ahead_count > 0;
+    pthread_mutex_unlock(&sync_mutex);
+
+    if (!open || channel_id == 0 || !sync_widgets || sync_widgets->connection_state != CONNECTION_ONLINE) {
+        return G_SOURCE_REMOVE; // A resume replays from the resume point anyway
+    }
+    printf("🕳️ Channel %u: messages missing after seq %llu, asking for them again\n", channel_id, (unsigned long long)after_seq);
+    Message *msg = create_replay_request_message(channel_id, after_seq);
+    if (msg) {
+        if (send_to_server(sync_widgets, msg) < 0) {
+            perror("Failed to send REPLAY_REQUEST message");
+        }
+        free(msg);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void channel_sync_init(AppWidgets *widgets) {
+    sync_widgets = widgets;
+}
+
+void channel_sync_begin(uint32_t channel_id, uint64_t after_seq) {
+    pthread_mutex_lock(&sync_mutex);
+    sync_channel = channel_id;
+    resume_point = after_seq;
+    ahead_count = 0;
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+bool channel_sync_note(uint32_t channel_id, uint64_t seq) {
+    bool fresh = true;
+    pthread_mutex_lock(&sync_mutex);
+    if (channel_id == sync_channel && seq != 0) {
+        if (seq <= resume_point) {
+            fresh = false;
+        } else if (seq == resume_point + 1) {
+            resume_point = seq;
+            absorb_ahead();
+        } else {
+            fresh = remember_ahead(seq);
+            watch_gap();
+        }
+    }
+    pthread_mutex_unlock(&sync_mutex);
+    return fresh;
+}
+
+void channel_sync_synced(uint32_t channel_id, uint64_t seq) {
+    pthread_mutex_lock(&sync_mutex);
+    if (channel_id == sync_channel) {
+        if (seq > resume_point) resume_point = seq;
+        absorb_ahead();
+        watch_gap(); // Whatever is still ahead arrived from another node first
+    }
+    pthread_mutex_unlock(&sync_mutex);
+}
+
+uint64_t channel_sync_resume_point(void) {
+    pthread_mutex_lock(&sync_mutex);
+    uint64_t seq = resume_point;
+    pthread_mutex_unlock(&sync_mutex);
+    return seq;
+}
@@ -0,0 +1,35 @@
+#ifndef CHANNEL_SYNC_H
+#define CHANNEL_SYNC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../types/app_types.h"
+
+// How far the client has the channel on screen. The resume point is the seq
+// up to which every message arrived: resumes, rejoins and read markers carry
+// on from it. A message arriving past a hole (e.g. its channel just changed
+// server node) is shown in its place right away; if the hole is still open
+// CHANNEL_SYNC_GAP_WAIT_MS later the server is asked to replay from the
+// resume point. MSG_CHANNEL_SYNCED closes every hole below its seq.
+// Any thread.
+
+#define CHANNEL_SYNC_GAP_WAIT_MS 500
+// Seqs remembered past a hole; later ones are still shown and the replay
+// brings the resume point past them
+#define CHANNEL_SYNC_MAX_AHEAD 256
+
+void channel_sync_init(AppWidgets *widgets);
+
+// The user switched to channel_id, which is cached up to after_seq
+void channel_sync_begin(uint32_t channel_id, uint64_t after_seq);
+
+// A message of channel_id arrived. False if it already had, in which case it is dropped.
+bool channel_sync_note(uint32_t channel_id, uint64_t seq);
+
+// MSG_CHANNEL_SYNCED: the server sent everything of channel_id up to seq
+void channel_sync_synced(uint32_t channel_id, uint64_t seq);
+
+// Resume point of the current channel
+uint64_t channel_sync_resume_point(void);
+
+#endif // CHANNEL_SYNC_H
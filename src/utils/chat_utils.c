@@ -3,66 +3,39 @@
 #include <string.h>
 #include <libpq-fe.h>
 #include <time.h>
-#include "../utils/gtk_string_utils.h" // For sanitize_utf8
+#include "channel_sync.h"
+#include "history_cache.h"
+#include "history_loader.h"
+#include "read_marker.h"
+#include "../database/db_connection.h"
 
-bool store_message(AppWidgets *widgets, const char *message, uint32_t channel_id) {
-    if (!widgets || !message || channel_id == 0) {
-        printf("❌ Invalid parameters for store_message\n");
-        return false;
-    }
-
-    printf("💾 Storing message for channel ID: %u\n", channel_id);
-    
-    // Get user_id for the current user
-    const char *get_user_query = "SELECT user_id FROM users WHERE email = $1";
-    const char *get_user_params[1] = {widgets->username};
-    PGresult *user_res = PQexecParams(widgets->db_conn, get_user_query, 1, NULL, get_user_params, NULL, NULL, 0);
-    
-    if (PQresultStatus(user_res) != PGRES_TUPLES_OK || PQntuples(user_res) == 0) {
-        printf("❌ Failed to get user information\n");
-        PQclear(user_res);
-        return false;
-    }
-
-    const char *user_id_str = PQgetvalue(user_res, 0, 0);
-    printf("👤 Found user ID: %s\n", user_id_str);
-    
-    // Store message with proper UTF-8 handling
-    const char *insert_query = "INSERT INTO messages (channel_id, sender_id, content) VALUES ($1, $2, $3)";
-    const char *insert_params[3];
-    char channel_id_str[32];
-    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
-    insert_params[0] = channel_id_str;
-    insert_params[1] = user_id_str;
-    insert_params[2] = message;
-    
-    PGresult *insert_res = PQexecParams(widgets->db_conn, insert_query, 3, NULL, insert_params, NULL, NULL, 0);
-    bool success = (PQresultStatus(insert_res) == PGRES_COMMAND_OK);
-    
-    if (!success) {
-        printf("❌ Failed to store message in database: %s\n", PQerrorMessage(widgets->db_conn));
-    } else {
-        printf("✅ Message stored successfully\n");
-    }
-    
-    PQclear(insert_res);
-    PQclear(user_res);
-    return success;
-}
+// Display names by email, so rendering a channel doesn't query the DB once per message.
+// Only touched from the GTK main thread.
+static GHashTable *display_name_cache = NULL;
 
 // Function to fetch the display name ("First Last") from DB
 void get_display_name(AppWidgets *widgets, const char *sender_email, char *display_name, size_t size) {
     if (!widgets || !sender_email || !display_name || size == 0)
         return;
 
+    if (!display_name_cache) {
+        display_name_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    }
+    const char *cached = g_hash_table_lookup(display_name_cache, sender_email);
+    if (cached) {
+        g_strlcpy(display_name, cached, size);
+        return;
+    }
+
     const char *query = "SELECT first_name, last_name FROM users WHERE email = $1";
     const char *params[1] = {sender_email};
 
-    PGresult *res = PQexecParams(widgets->db_conn, query, 1, NULL, params, NULL, NULL, 0);
+    PGresult *res = db_exec_read(widgets->db_replicas, widgets->db_conn, NULL, query, 1, params);
     if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) {
         const char *first_name = PQgetvalue(res, 0, 0);
         const char *last_name = PQgetvalue(res, 0, 1);
         snprintf(display_name, size, "%s %s", first_name, last_name);
+        g_hash_table_insert(display_name_cache, g_strdup(sender_email), g_strdup(display_name));
     } else {
         strncpy(display_name, sender_email, size - 1);
         display_name[size - 1] = '\0';
@@ -70,248 +43,342 @@ void get_display_name(AppWidgets *widgets, const char *sender_email, char *displ
     PQclear(res);
 }
 
-// Helper function to add a message row to the list box and scroll
-static void add_message_to_list_box(GtkListBox *list_box, const char *markup) {
-    GtkWidget *label = gtk_label_new(NULL);
-    gtk_label_set_markup(GTK_LABEL(label), markup);
-    gtk_label_set_xalign(GTK_LABEL(label), 0.0); // Align text to the left
-    gtk_label_set_line_wrap(GTK_LABEL(label), TRUE); // Enable line wrapping
-    gtk_label_set_line_wrap_mode(GTK_LABEL(label), PANGO_WRAP_WORD_CHAR);
-    gtk_widget_set_margin_start(label, 10); // Add some left margin
-    gtk_widget_set_margin_end(label, 10);   // Add some right margin
-    gtk_widget_set_margin_top(label, 5);    // Add some top margin
-    gtk_widget_set_margin_bottom(label, 5); // Add some bottom margin
-
-    GtkWidget *row = gtk_list_box_row_new();
-    gtk_container_add(GTK_CONTAINER(row), label);
-    gtk_widget_set_name(row, "chat-message-row"); // Add CSS class for styling
-    gtk_list_box_insert(list_box, row, -1); // Add to the end
-    gtk_widget_show_all(row);
+// Sending under the lock keeps the socket from being closed or replaced mid-frame
+int send_to_server(AppWidgets *widgets, const Message *msg) {
+    pthread_mutex_lock(&widgets->socket_mutex);
+    int result = widgets->server_socket == INVALID_SOCKET ? -1 : send_message(widgets->server_socket, msg);
+    pthread_mutex_unlock(&widgets->socket_mutex);
+    return result;
+}
 
-    // Auto-scroll logic for GtkListBox in GtkScrolledWindow
-    GtkWidget *scrolled_window = gtk_widget_get_ancestor(GTK_WIDGET(list_box), GTK_TYPE_SCROLLED_WINDOW);
-    if (scrolled_window) {
-        GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
-        // Scroll only if the user is near the bottom or hasn't scrolled up manually
-        // A simple approach is to always scroll for now
-        // TODO: Add logic to check if user scrolled up
-        gtk_adjustment_set_value(vadj, gtk_adjustment_get_upper(vadj) - gtk_adjustment_get_page_size(vadj));
-    }
+SOCKET swap_server_socket(AppWidgets *widgets, SOCKET sock) {
+    pthread_mutex_lock(&widgets->socket_mutex);
+    SOCKET old = widgets->server_socket;
+    widgets->server_socket = sock;
+    pthread_mutex_unlock(&widgets->socket_mutex);
+    return old;
 }
 
-void update_chat_history(AppWidgets *widgets, const char *sender, const char *message, const char *channel_name) {
-    if (!widgets || !widgets->chat_history || !message) {
-        printf("❌ Invalid parameters for update_chat_history\n");
-        return;
+// Show the message right away as pending, then send it. The view repairs and
+// escapes the text when it builds the markup; nothing here waits on the server.
+bool send_chat_message(AppWidgets *widgets, const char *text) {
+    if (!widgets || !widgets->chat_history || !text) {
+        printf("❌ Invalid parameters for send_chat_message\n");
+        return false;
     }
 
-    GtkListBox *list_box = GTK_LIST_BOX(widgets->chat_history);
-
-    char display_name[128];
-    get_display_name(widgets, sender, display_name, sizeof(display_name));
+    ChatMessage *chat = g_new0(ChatMessage, 1);
+    chat->channel_id = widgets->current_channel_id;
+    chat->client_id = ++widgets->next_client_id;
+    if (chat->client_id == 0) chat->client_id = ++widgets->next_client_id; // 0 means "no id"
+    g_strlcpy(chat->sender_username, widgets->username, sizeof(chat->sender_username));
+    g_strlcpy(chat->content, text, sizeof(chat->content));
 
     time_t now = time(NULL);
-    struct tm *tm_info = localtime(&now);
     char time_str[32];
-    strftime(time_str, sizeof(time_str), "%H:%M:%S", tm_info);
-
-    printf("📝 Updating chat history (ListBox): [%s] %s: %s\n", time_str, display_name, message);
+    strftime(time_str, sizeof(time_str), "%H:%M:%S", localtime(&now));
+    char display_name[128];
+    get_display_name(widgets, widgets->username, display_name, sizeof(display_name));
+    chat_history_view_append_local(widgets->chat_history, chat->client_id, display_name, time_str, chat->content);
 
-    const char *safe_display_name_raw = sanitize_utf8(display_name);
-    const char *safe_message = sanitize_utf8(message);
+    // While reconnecting nothing would carry it; the row tells the user it wasn't sent
+    Message *msg = NULL;
+    if (widgets->connection_state == CONNECTION_ONLINE) {
+        msg = create_message(MSG_CHAT, chat, sizeof(ChatMessage));
+    }
+    if (!msg || send_to_server(widgets, msg) < 0) {
+        fprintf(stderr, "❌ Failed to send message %u\n", chat->client_id);
+        chat_history_view_set_state(widgets->chat_history, chat->client_id, CHAT_ROW_FAILED);
+        free(msg);
+        g_free(chat);
+        return false;
+    }
+    free(msg);
 
-    char *escaped_display_name = g_markup_escape_text(safe_display_name_raw, -1);
-    char *escaped_message = g_markup_escape_text(safe_message, -1);
-    if (!escaped_display_name) escaped_display_name = g_strdup("");
-    if (!escaped_message) escaped_message = g_strdup("");
+    g_hash_table_insert(widgets->pending_messages, GUINT_TO_POINTER(chat->client_id), chat);
+    return true;
+}
 
-    // Construct Pango markup string (similar format, maybe adjust later)
-    char markup[BUFFER_SIZE + 256];
-    snprintf(markup, sizeof(markup),
-             "<b><span foreground='#786ee1' size='large'>%s</span></b> <span foreground='grey' size='small'>%s</span>\n%s",
-             escaped_display_name, time_str, escaped_message);
+// Apply one MSG_CHAT_ACK: place the pending row by its seq, or fail it. Our
+// own copy of the message confirms it as well, whichever comes first, and
+// is what moves the resume point and feeds the local cache.
+gboolean apply_chat_ack(gpointer data) {
+    ChatAckData *ack_data = (ChatAckData *)data;
+    AppWidgets *widgets = ack_data->widgets;
+    const ChatAck *ack = &ack_data->ack;
+
+    if (g_hash_table_contains(widgets->pending_messages, GUINT_TO_POINTER(ack->client_id))) {
+        if (ack->status == CHAT_ACK_ACCEPTED) {
+            chat_history_view_confirm(widgets->chat_history, ack->client_id, ack->seq);
+        } else if (ack->status == CHAT_ACK_UNKNOWN) {
+            // Confirmed by its echo (chat_history_view_confirm) if it went through after all
+            chat_history_view_set_state(widgets->chat_history, ack->client_id, CHAT_ROW_UNCONFIRMED);
+            fprintf(stderr, "⚠️ The server couldn't tell whether message %u was posted\n", ack->client_id);
+        } else {
+            chat_history_view_set_state(widgets->chat_history, ack->client_id, CHAT_ROW_FAILED);
+            fprintf(stderr, "❌ Message %u was rejected by the server\n", ack->client_id);
+        }
+        g_hash_table_remove(widgets->pending_messages, GUINT_TO_POINTER(ack->client_id));
+    }
 
-    add_message_to_list_box(list_box, markup);
+    free(ack_data);
+    return G_SOURCE_REMOVE;
+}
 
-    g_free(escaped_display_name);
-    g_free(escaped_message);
+gint compare_list_rows(GtkListBoxRow *a, GtkListBoxRow *b, gpointer user_data) {
+    (void)user_data;
+    const char *key_a = g_object_get_data(G_OBJECT(a), "sort_key");
+    const char *key_b = g_object_get_data(G_OBJECT(b), "sort_key");
+    return strcmp(key_a ? key_a : "", key_b ? key_b : "");
+}
 
-    /* Hyperlink detection logic would need to be adapted or removed if using simple labels */
+// Give a row the name it is ordered by. Returns whether the key changed, in
+// which case an inserted row must be re-sorted with gtk_list_box_row_changed.
+static gboolean set_row_sort_key(GtkWidget *row, const char *name) {
+    char *key = g_utf8_collate_key(name, -1);
+    const char *old_key = g_object_get_data(G_OBJECT(row), "sort_key");
+    if (old_key && strcmp(old_key, key) == 0) {
+        g_free(key);
+        return FALSE;
+    }
+    g_object_set_data_full(G_OBJECT(row), "sort_key", key, g_free);
+    return TRUE;
 }
 
-gboolean update_chat_history_from_network(gpointer data) {
-    ChatUpdateData *update_data = (ChatUpdateData *)data;
-    if (!update_data || !update_data->widgets) {
-        free(update_data);
-        return G_SOURCE_REMOVE;
+// Create or update the contacts_list row of one user, without touching the others.
+// With create false only an existing row (a member of the current channel) is updated.
+static void set_contact_row(AppWidgets *widgets, uint32_t user_id, const char *username, UserStatus status, gboolean create) {
+    char user_text[96];
+    snprintf(user_text, sizeof(user_text), "%s (%s)", username,
+             status == STATUS_ONLINE ? "online" :
+             status == STATUS_AWAY ? "away" : "offline");
+
+    GtkWidget *label = g_hash_table_lookup(widgets->contact_rows, GUINT_TO_POINTER(user_id));
+    if (label) {
+        gtk_label_set_text(GTK_LABEL(label), user_text);
+        GtkWidget *row = gtk_widget_get_parent(label);
+        if (set_row_sort_key(row, username)) gtk_list_box_row_changed(GTK_LIST_BOX_ROW(row));
+        return;
     }
+    if (!create) return;
+
+    label = gtk_label_new(user_text);
+    gtk_widget_set_halign(label, GTK_ALIGN_START);
+    gtk_widget_set_margin_start(label, 10);
+    GtkWidget *row = gtk_list_box_row_new();
+    gtk_container_add(GTK_CONTAINER(row), label);
+    set_row_sort_key(row, username);
+    gtk_list_box_insert(GTK_LIST_BOX(widgets->contacts_list), row, -1); // Sorted into place
+    gtk_widget_show_all(row);
+    g_hash_table_insert(widgets->contact_rows, GUINT_TO_POINTER(user_id), label);
+}
 
-    update_chat_history(update_data->widgets, 
-                       update_data->sender, 
-                       update_data->content, 
-                       NULL);
+// Apply one MSG_PRESENCE_UPDATE frame: only the rows of users that changed are touched
+gboolean apply_presence_updates(gpointer data) {
+    PresenceUpdateData *update_data = (PresenceUpdateData *)data;
+    AppWidgets *widgets = update_data->widgets;
+
+    for (uint32_t i = 0; i < update_data->count; i++) {
+        PresenceUpdate *update = &update_data->updates[i];
+        update->username[sizeof(update->username) - 1] = '\0';
+        if (update->user_id == 0 || !g_utf8_validate(update->username, -1, NULL)) continue;
+        set_contact_row(widgets, update->user_id, update->username, (UserStatus)update->status, FALSE);
+    }
 
     free(update_data);
     return G_SOURCE_REMOVE;
 }
 
-// Function to load channel history
-void load_channel_history(AppWidgets *widgets, uint32_t channel_id) {
-    if (!widgets || channel_id == 0) {
-        printf("❌ Invalid parameters for load_channel_history\n");
-        return;
+static void remove_contact_row(AppWidgets *widgets, uint32_t user_id) {
+    GtkWidget *label = g_hash_table_lookup(widgets->contact_rows, GUINT_TO_POINTER(user_id));
+    if (!label) return;
+    // The list box wrapped the label in a row; destroying the row removes both
+    gtk_widget_destroy(gtk_widget_get_parent(label));
+    g_hash_table_remove(widgets->contact_rows, GUINT_TO_POINTER(user_id));
+}
+
+// Apply one MSG_USER_LIST frame of the current channel
+gboolean apply_user_list(gpointer data) {
+    SnapshotUpdateData *update_data = (SnapshotUpdateData *)data;
+    AppWidgets *widgets = update_data->widgets;
+
+    UserListHeader header;
+    memcpy(&header, update_data->payload, sizeof(header));
+    if (header.channel_id != widgets->current_channel_id) {
+        free(update_data);
+        return G_SOURCE_REMOVE;
+    }
+    if (header.op == USER_LIST_SNAPSHOT && (header.flags & SNAPSHOT_FIRST)) {
+        clear_contacts(widgets);
+    }
+
+    size_t offset = sizeof(UserListHeader);
+    UserListEntry entry;
+    const char *username;
+    while (user_list_next_entry(update_data->payload, update_data->length, &offset, &entry, &username)) {
+        if (header.op == USER_LIST_REMOVE) {
+            remove_contact_row(widgets, entry.user_id);
+            continue;
+        }
+        char name[256];
+        memcpy(name, username, entry.username_len);
+        name[entry.username_len] = '\0';
+        if (!g_utf8_validate(name, -1, NULL)) continue;
+        set_contact_row(widgets, entry.user_id, name, (UserStatus)entry.status, TRUE);
     }
 
-    GtkListBox *list_box = GTK_LIST_BOX(widgets->chat_history);
+    free(update_data);
+    return G_SOURCE_REMOVE;
+}
 
-    // Clear existing messages
-    GList *children = gtk_container_get_children(GTK_CONTAINER(list_box));
+void clear_contacts(AppWidgets *widgets) {
+    GList *children = gtk_container_get_children(GTK_CONTAINER(widgets->contacts_list));
     for (GList *iter = children; iter != NULL; iter = iter->next) {
         gtk_widget_destroy(GTK_WIDGET(iter->data));
     }
     g_list_free(children);
+    g_hash_table_remove_all(widgets->contact_rows);
+}
 
-    char channel_id_str[32];
-    snprintf(channel_id_str, sizeof(channel_id_str), "%u", channel_id);
-
-    const char *query = "SELECT u.email, m.content, m.timestamp FROM messages m "
-                       "JOIN users u ON m.sender_id = u.user_id "
-                       "WHERE m.channel_id = $1 ORDER BY m.timestamp ASC";
-    const char *params[1] = {channel_id_str};
-
-    PGresult *res = PQexecParams(widgets->db_conn, query, 1, NULL, params, NULL, NULL, 0);
-    if (PQresultStatus(res) == PGRES_TUPLES_OK) {
-        int rows = PQntuples(res);
-
-        for (int i = 0; i < rows; i++) {
-            const char *sender_email = PQgetvalue(res, i, 0);
-            const char *content = PQgetvalue(res, i, 1);
-            const char *db_timestamp = PQgetvalue(res, i, 2);
-
-            char formatted_time[32];
-            format_timestamp(db_timestamp, formatted_time, sizeof(formatted_time));
+// Show a channel row's title ("# name") and its unread / mention badges
+static void update_channel_row_label(GtkWidget *row) {
+    GtkWidget *channel_label = g_object_get_data(G_OBJECT(row), "channel_name");
+    const char *title = g_object_get_data(G_OBJECT(row), "channel_title");
+    guint unread = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "unread"));
+    guint mentions = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "mentions"));
 
-            char display_name[128];
-            get_display_name(widgets, sender_email, display_name, sizeof(display_name));
+    if (unread == 0) {
+        gtk_label_set_text(GTK_LABEL(channel_label), title);
+        return;
+    }
+    char *markup;
+    if (mentions > 0) {
+        markup = g_markup_printf_escaped("<b>%s</b>  <span foreground='#e05252'>@%u</span> <span foreground='grey'>%u</span>",
+                                         title, mentions, unread);
+    } else {
+        markup = g_markup_printf_escaped("<b>%s</b>  <span foreground='grey'>%u</span>", title, unread);
+    }
+    gtk_label_set_markup(GTK_LABEL(channel_label), markup);
+    g_free(markup);
+}
 
-            const char *safe_display_name_raw_loop = sanitize_utf8(display_name);
-            const char *safe_content = sanitize_utf8(content);
+// Set a row's unread count from the materialized read state. Mentions are
+// only counted live; they stay until the channel is read.
+static void set_channel_unread(GtkWidget *row, guint unread) {
+    if (GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "unread")) == unread) return;
+    g_object_set_data(G_OBJECT(row), "unread", GUINT_TO_POINTER(unread));
+    if (unread == 0) g_object_set_data(G_OBJECT(row), "mentions", NULL);
+    update_channel_row_label(row);
+}
 
-            char *escaped_display_name_loop = g_markup_escape_text(safe_display_name_raw_loop, -1);
-            char *escaped_content = g_markup_escape_text(safe_content, -1);
-            if (!escaped_display_name_loop) escaped_display_name_loop = g_strdup("");
-            if (!escaped_content) escaped_content = g_strdup("");
+// Clear the unread badges of a channel
+static void mark_channel_seen(AppWidgets *widgets, uint32_t channel_id) {
+    GtkWidget *row = g_hash_table_lookup(widgets->channel_rows, GUINT_TO_POINTER(channel_id));
+    if (!row || !g_object_get_data(G_OBJECT(row), "unread")) return;
+    g_object_set_data(G_OBJECT(row), "unread", NULL);
+    g_object_set_data(G_OBJECT(row), "mentions", NULL);
+    update_channel_row_label(row);
+}
 
-            char markup[BUFFER_SIZE + 256];
-            snprintf(markup, sizeof(markup),
-                     "<b><span foreground='#786ee1' size='large'>%s</span></b> <span foreground='grey' size='small'>%s</span>\n%s",
-                     escaped_display_name_loop, formatted_time, escaped_content);
+// Apply one MSG_CHANNEL_ACTIVITY: a message arrived in a channel not on screen
+gboolean apply_channel_activity(gpointer data) {
+    ChannelActivityData *activity_data = (ChannelActivityData *)data;
+    AppWidgets *widgets = activity_data->widgets;
+    const ChannelActivity *activity = &activity_data->activity;
+
+    GtkWidget *row = g_hash_table_lookup(widgets->channel_rows, GUINT_TO_POINTER(activity->channel_id));
+    // Activity for the channel on screen was sent before we switched to it,
+    // and the history the switch loads covers the message
+    if (row && activity->channel_id != widgets->current_channel_id) {
+        guint unread = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "unread"));
+        guint mentions = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(row), "mentions"));
+        g_object_set_data(G_OBJECT(row), "unread", GUINT_TO_POINTER(unread + 1));
+        if (activity->mention) {
+            g_object_set_data(G_OBJECT(row), "mentions", GUINT_TO_POINTER(mentions + 1));
+        }
+        update_channel_row_label(row);
+    }
 
-            // Add message as a new row
-            add_message_to_list_box(list_box, markup);
+    free(activity_data);
+    return G_SOURCE_REMOVE;
+}
 
-            g_free(escaped_display_name_loop);
-            g_free(escaped_content);
-        }
-        // Auto-scroll to the bottom after loading all messages
-        // The add_message_to_list_box function handles scrolling incrementally,
-        // but a final scroll ensures we are at the very bottom.
-        GtkWidget *scrolled_window = gtk_widget_get_ancestor(GTK_WIDGET(list_box), GTK_TYPE_SCROLLED_WINDOW);
-        if (scrolled_window) {
-            GtkAdjustment *vadj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(scrolled_window));
-            gtk_adjustment_set_value(vadj, gtk_adjustment_get_upper(vadj) - gtk_adjustment_get_page_size(vadj));
+// Make channel_id the current channel and tell the server, which replies with
+// what is newer than the local cache (or a MSG_CHANNEL_SNAPSHOT), then
+// MSG_CHANNEL_SYNCED
+void join_channel(AppWidgets *widgets, uint32_t channel_id) {
+    read_marker_flush(widgets); // For the channel we are leaving
+    widgets->current_channel_id = channel_id;
+    mark_channel_seen(widgets, channel_id);
+    history_loader_begin(channel_id); // Drops whatever is still loading for the previous channel
+
+    // Cached messages are painted locally; the server only sends what came after them
+    uint64_t after_seq = history_cache_high_water(channel_id);
+    channel_sync_begin(channel_id, after_seq);
+
+    // While reconnecting, the resume request rejoins whatever channel is current by then
+    if (widgets->connection_state != CONNECTION_ONLINE) return;
+
+    printf("🚀 Sending JOIN_CHANNEL message for channel ID: %u (cached up to seq %llu)\n", channel_id, (unsigned long long)after_seq);
+    Message *join_msg = create_join_channel_message(channel_id, after_seq);
+    if (join_msg) {
+        if (send_to_server(widgets, join_msg) < 0) {
+            perror("Failed to send JOIN_CHANNEL message");
         }
+        free(join_msg);
     } else {
-        printf("❌ Failed to load channel history: %s\n", PQerrorMessage(widgets->db_conn));
-        // Optionally add an error message row to the list box
-        add_message_to_list_box(list_box, "<span foreground='red'>Error loading history.</span>");
+        fprintf(stderr, "Failed to create JOIN_CHANNEL message\n");
     }
-    PQclear(res);
 }
 
-// Function to ensure user has proper channel associations
-void ensure_user_channel_associations(AppWidgets *widgets, const char *user_id) {
-    printf("🔄 Ensuring user channel associations for user %s\n", widgets->username);
-    
-    // First, get all channels
-    const char *get_channels_query = "SELECT channel_id FROM channels";
-    PGresult *channels_res = PQexec(widgets->db_conn, get_channels_query);
-    
-    if (PQresultStatus(channels_res) != PGRES_TUPLES_OK) {
-        printf("❌ Failed to query channels for association check: %s\n", PQerrorMessage(widgets->db_conn));
-        PQclear(channels_res);
-        return;
-    }
-    
-    int num_channels = PQntuples(channels_res);
-    if (num_channels == 0) {
-        printf("⚠️ No channels found to associate with user\n");
-        PQclear(channels_res);
-        return;
-    }
-    
-    printf("✅ Found %d channels to check for user associations\n", num_channels);
-    
-    // For each channel, check if user is associated, and if not, create the association
-    for (int i = 0; i < num_channels; i++) {
-        const char *channel_id = PQgetvalue(channels_res, i, 0);
-        
-        // Check if association exists
-        const char *check_query = 
-            "SELECT 1 FROM user_channels WHERE user_id = $1 AND channel_id = $2";
-        const char *check_params[2] = {user_id, channel_id};
-        PGresult *check_res = PQexecParams(widgets->db_conn, check_query, 2, NULL, check_params, NULL, NULL, 0);
-        
-        if (PQresultStatus(check_res) == PGRES_TUPLES_OK && PQntuples(check_res) == 0) {
-            // Association doesn't exist, create it
-            printf("➕ Creating association for user %s with channel %s\n", user_id, channel_id);
-            
-            // Default to role_id 1 (regular user)
-            const char *insert_query = 
-                "INSERT INTO user_channels (user_id, channel_id, role_id) VALUES ($1, $2, 1)";
-            const char *insert_params[2] = {user_id, channel_id};
-            PGresult *insert_res = PQexecParams(widgets->db_conn, insert_query, 2, NULL, insert_params, NULL, NULL, 0);
-            
-            if (PQresultStatus(insert_res) != PGRES_COMMAND_OK) {
-                printf("❌ Failed to create user-channel association: %s\n", PQerrorMessage(widgets->db_conn));
-            } else {
-                printf("✅ Created user-channel association for channel %s\n", channel_id);
-            }
-            
-            PQclear(insert_res);
-        } else {
-            printf("✓ User already associated with channel %s\n", channel_id);
+// Create or update the chat_channels_list row of one channel. Returns the row.
+static GtkWidget* set_channel_row(AppWidgets *widgets, uint32_t channel_id, const char *channel_name) {
+    char label_text[64];
+    snprintf(label_text, sizeof(label_text), "# %s", channel_name);
+
+    GtkWidget *row = g_hash_table_lookup(widgets->channel_rows, GUINT_TO_POINTER(channel_id));
+    if (row) {
+        if (strcmp(g_object_get_data(G_OBJECT(row), "channel_title"), label_text) != 0) {
+            printf("📝 Renaming channel %u to %s\n", channel_id, channel_name);
+            g_object_set_data_full(G_OBJECT(row), "channel_title", g_strdup(label_text), g_free);
+            update_channel_row_label(row);
+            if (set_row_sort_key(row, channel_name)) gtk_list_box_row_changed(GTK_LIST_BOX_ROW(row));
         }
-        
-        PQclear(check_res);
+        return row;
     }
-    
-    PQclear(channels_res);
+
+    printf("📝 Adding channel: %s (ID: %u)\n", channel_name, channel_id);
+    GtkWidget *channel_label = gtk_label_new(label_text);
+    gtk_widget_set_halign(channel_label, GTK_ALIGN_START);
+    gtk_widget_set_margin_start(channel_label, 10);
+
+    // Create row and store channel ID string, title and channel_name widget
+    row = gtk_list_box_row_new();
+    gtk_container_add(GTK_CONTAINER(row), channel_label);
+    g_object_set_data_full(G_OBJECT(row), "channel_id", g_strdup_printf("%u", channel_id), g_free);
+    g_object_set_data_full(G_OBJECT(row), "channel_title", g_strdup(label_text), g_free);
+    g_object_set_data(G_OBJECT(row), "channel_name", channel_label);
+    set_row_sort_key(row, channel_name);
+    gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), row, -1); // Sorted into place
+    gtk_widget_show_all(row);
+    g_hash_table_insert(widgets->channel_rows, GUINT_TO_POINTER(channel_id), row);
+    return row;
 }
 
-// Function to refresh the channel list
+// Function to refresh the channel list. Rows are keyed by channel_id: only
+// channels that appeared, disappeared or were renamed touch the list box.
 void refresh_channel_list(AppWidgets *widgets) {
 
     printf("🔄 Refreshing channel list\n");
 
-    // Clear existing channels first
-    GList *children = gtk_container_get_children(GTK_CONTAINER(widgets->chat_channels_list));
-    for (GList *iter = children; iter != NULL; iter = iter->next) {
-        gtk_widget_destroy(GTK_WIDGET(iter->data));
-    }
-    g_list_free(children);
-
     // Get user ID first
     const char *get_user_query = "SELECT user_id FROM users WHERE email = $1";
     const char *get_user_params[1] = {widgets->username};
     PGresult *user_res = PQexecParams(widgets->db_conn, get_user_query, 1, NULL, get_user_params, NULL, NULL, 0);
     
     if (PQresultStatus(user_res) != PGRES_TUPLES_OK || PQntuples(user_res) == 0) {
+        // Keep the rows we have; they are more useful than an empty list
         printf("❌ Failed to get user information for channel list refresh\n");
-        GtkWidget *error_label = gtk_label_new("Error loading channels");
-        gtk_widget_set_halign(error_label, GTK_ALIGN_START);
-        gtk_widget_set_margin_start(error_label, 10);
-        gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), error_label, -1);
         PQclear(user_res);
         return;
     }
@@ -319,77 +386,69 @@ void refresh_channel_list(AppWidgets *widgets) {
     const char *user_id_str = PQgetvalue(user_res, 0, 0);
     printf("👤 Found user ID: %s for channel refresh\n", user_id_str);
     
-    // Ensure user has channel associations
-    ensure_user_channel_associations(widgets, user_id_str);
-    
-    // Get channels from database - two approaches:
-    // 1. Get all channels visible to the user through user_channels
+    // Get all channels visible to the user through user_channels, plus the public ones,
+    // with their unread counts: one query, every join on a primary key. The
+    // server syncs the memberships at login; this reads the primary, which has them.
     const char *get_channels_query = 
-        "SELECT DISTINCT c.channel_id, c.name FROM channels c "
-        "LEFT JOIN user_channels uc ON c.channel_id = uc.channel_id "
-        "WHERE (uc.user_id = $1 AND uc.channel_id IS NOT NULL) OR c.is_private = FALSE "
-        "ORDER BY c.name";
+        "SELECT c.channel_id, c.name, GREATEST(COALESCE(s.last_seq, 0) - COALESCE(r.last_read_seq, 0), 0) "
+        "FROM channels c "
+        "LEFT JOIN user_channels uc ON uc.channel_id = c.channel_id AND uc.user_id = $1::int "
+        "LEFT JOIN channel_summary s ON s.channel_id = c.channel_id "
+        "LEFT JOIN channel_read_state r ON r.channel_id = c.channel_id AND r.user_id = $1::int "
+        "WHERE uc.user_id IS NOT NULL OR c.is_private = FALSE";
     
     const char *params[1] = {user_id_str};
     PGresult *channels_res = PQexecParams(widgets->db_conn, get_channels_query, 1, NULL, params, NULL, NULL, 0);
     
     if (PQresultStatus(channels_res) == PGRES_TUPLES_OK) {
         int rows = PQntuples(channels_res);
+        printf("✅ Found %d channels for user in database\n", rows);
+
+        GHashTable *seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+        for (int i = 0; i < rows; i++) {
+            uint32_t channel_id = (uint32_t)strtoul(PQgetvalue(channels_res, i, 0), NULL, 10);
+            GtkWidget *row = set_channel_row(widgets, channel_id, PQgetvalue(channels_res, i, 1));
+            g_hash_table_add(seen, GUINT_TO_POINTER(channel_id));
+            if (channel_id != widgets->current_channel_id) {
+                set_channel_unread(row, (guint)strtoul(PQgetvalue(channels_res, i, 2), NULL, 10));
+            }
+
+            // Keep the current channel selected (on_channel_selected ignores it)
+            if (channel_id == widgets->current_channel_id &&
+                gtk_list_box_get_selected_row(GTK_LIST_BOX(widgets->chat_channels_list)) != GTK_LIST_BOX_ROW(row)) {
+                gtk_list_box_select_row(GTK_LIST_BOX(widgets->chat_channels_list), GTK_LIST_BOX_ROW(row));
+            }
+        }
+
+        // Drop the rows of channels that are no longer visible
+        GHashTableIter iter;
+        gpointer key, value;
+        g_hash_table_iter_init(&iter, widgets->channel_rows);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            if (g_hash_table_contains(seen, key)) continue;
+            printf("➖ Removing channel %u\n", GPOINTER_TO_UINT(key));
+            gtk_widget_destroy(GTK_WIDGET(value));
+            g_hash_table_iter_remove(&iter);
+        }
+        g_hash_table_destroy(seen);
+
         if (rows == 0) {
             printf("⚠️ No channels found in database for user %s\n", widgets->username);
-            // Create a label to show no channels
-            GtkWidget *no_channels_label = gtk_label_new("No channels available");
-            gtk_widget_set_halign(no_channels_label, GTK_ALIGN_START);
-            gtk_widget_set_margin_start(no_channels_label, 10);
-            gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), no_channels_label, -1);
-        } else {
-            printf("✅ Found %d channels for user in database\n", rows);
-            for (int i = 0; i < rows; i++) {
-                const char *channel_id_str = PQgetvalue(channels_res, i, 0);
-                const char *channel_name = PQgetvalue(channels_res, i, 1);
-                printf("📝 Adding channel: %s (ID: %s)\n", channel_name, channel_id_str);
-                
-                char label_text[64];
-                snprintf(label_text, sizeof(label_text), "# %s", channel_name);
-                
-                GtkWidget *channel_label = gtk_label_new(label_text);
-                gtk_widget_set_halign(channel_label, GTK_ALIGN_START);
-                gtk_widget_set_margin_start(channel_label, 10);
-                
-                // Create row and store channel ID string and channel_name widget
-                GtkWidget *row = gtk_list_box_row_new();
-                gtk_container_add(GTK_CONTAINER(row), channel_label);
-                char *channel_id_copy = g_strdup(channel_id_str);
-                g_object_set_data_full(G_OBJECT(row), "channel_id", channel_id_copy, g_free);
-                g_object_set_data(G_OBJECT(row), "channel_name", channel_label);
-                gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), row, -1);
-                
-                // Select the general channel by default
-                if (strcmp(channel_name, "general") == 0) {
-                    gtk_list_box_select_row(GTK_LIST_BOX(widgets->chat_channels_list), GTK_LIST_BOX_ROW(row));
-                    widgets->current_channel_id = (uint32_t)atoi(channel_id_str);
-                }
-            }
         }
     } else {
         printf("❌ Failed to query channels: %s\n", PQerrorMessage(widgets->db_conn));
-        GtkWidget *error_label = gtk_label_new("Error loading channels");
-        gtk_widget_set_halign(error_label, GTK_ALIGN_START);
-        gtk_widget_set_margin_start(error_label, 10);
-        gtk_list_box_insert(GTK_LIST_BOX(widgets->chat_channels_list), error_label, -1);
     }
     
     PQclear(channels_res);
     PQclear(user_res);
-    gtk_widget_show_all(widgets->chat_channels_list);
 }
 
 // Renamed from handle_successful_login
-// This function is now called via g_idle_add from receive_messages
+// This function is now called via ui_dispatch from receive_messages
 // after the server confirms login with MSG_LOGIN_SUCCESS.
 // It takes the confirmed username as input (needs casting and freeing).
 gboolean finalize_login_ui_setup(gpointer user_data) {
-    char *username = (char *)user_data; // Cast the username passed from g_idle_add
+    char *username = (char *)user_data; // Cast the username passed through ui_dispatch
     if (!username) return G_SOURCE_REMOVE;
 
     // Find the AppWidgets pointer (assuming it's stored on the main window)
@@ -413,6 +472,7 @@ gboolean finalize_login_ui_setup(gpointer user_data) {
     // 1. Store username locally in AppWidgets
     strncpy(widgets->username, username, sizeof(widgets->username) - 1);
     widgets->username[sizeof(widgets->username) - 1] = '\0';
+    history_cache_open(widgets->username);
 
     // Update the user display label
     if (widgets->user_display_label) {
@@ -486,9 +546,9 @@ gboolean finalize_login_ui_setup(gpointer user_data) {
     // 4. Refresh the channel list UI
     refresh_channel_list(widgets);
 
-    // 5. Load channel history for the default/selected channel
+    // 5. Join the default/selected channel; its history arrives as a server snapshot
     if (widgets->current_channel_id > 0) {
-        load_channel_history(widgets, widgets->current_channel_id);
+        join_channel(widgets, widgets->current_channel_id);
 
         // Update channel name label
         const char *get_name_query = "SELECT name FROM channels WHERE channel_id = $1";
@@ -507,16 +567,10 @@ gboolean finalize_login_ui_setup(gpointer user_data) {
         // If no default channel selected (e.g., 'general' didn't exist or user lookup failed)
         // Set channel name label appropriately
         gtk_label_set_text(GTK_LABEL(widgets->channel_name), "# Select a channel");
-        // Clear chat history explicitly if needed
-        GtkListBox *list_box = GTK_LIST_BOX(widgets->chat_history);
-        GList *children = gtk_container_get_children(GTK_CONTAINER(list_box));
-        for (GList *iter = children; iter != NULL; iter = iter->next) {
-            gtk_widget_destroy(GTK_WIDGET(iter->data));
-        }
-        g_list_free(children);
+        chat_history_view_clear(widgets->chat_history);
     }
 
-    g_free(username); // Free the username string passed via g_idle_add
+    g_free(username); // Free the username string passed via ui_dispatch
     return G_SOURCE_REMOVE; // Run only once
 }
 
@@ -532,22 +586,62 @@ void format_timestamp(const char *db_timestamp, char *formatted_time, size_t siz
     snprintf(formatted_time, size, "%02d:%02d:%02d", hour, minute, second);
 }
 
-// Function to update user status
-void update_user_status(AppWidgets *widgets, const char *username, const char *status) {
-    if (!widgets || !widgets->db_conn || !username || !status) {
-        printf("❌ Invalid parameters for update_user_status\n");
-        return;
+// Fail every message still waiting for an ack; the connection that would carry it is gone
+static void fail_pending_messages(AppWidgets *widgets) {
+    GHashTableIter iter;
+    gpointer key;
+    g_hash_table_iter_init(&iter, widgets->pending_messages);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        chat_history_view_set_state(widgets->chat_history, GPOINTER_TO_UINT(key), CHAT_ROW_FAILED);
     }
+    g_hash_table_remove_all(widgets->pending_messages);
+}
 
-    printf("🔄 Updating status for user %s to %s\n", username, status);
-
-    const char *update_query = "UPDATE users SET status = $1 WHERE email = $2";
-    const char *update_params[2] = {status, username};
-    PGresult *update_res = PQexecParams(widgets->db_conn, update_query, 2, NULL, update_params, NULL, NULL, 0);
+// Apply a connection state change from the receive thread to the UI
+gboolean apply_connection_state(gpointer data) {
+    ConnectionStateData *state_data = (ConnectionStateData *)data;
+    AppWidgets *widgets = state_data->widgets;
 
-    if (PQresultStatus(update_res) != PGRES_COMMAND_OK) {
-        printf("❌ Failed to update user status: %s\n", PQerrorMessage(widgets->db_conn));
+    if (state_data->state != CONNECTION_ONLINE) {
+        fail_pending_messages(widgets);
+    }
+    widgets->connection_state = state_data->state;
+
+    char text[128];
+    switch (state_data->state) {
+        case CONNECTION_ONLINE:
+            snprintf(text, sizeof(text), "<span foreground='#43b581'>●</span> Connected");
+            break;
+        case CONNECTION_RECONNECTING:
+            snprintf(text, sizeof(text), "<span foreground='#faa61a'>●</span> Reconnecting in %.1f s (attempt %u)",
+                     state_data->delay_ms / 1000.0, state_data->attempt);
+            break;
+        case CONNECTION_RESUMING:
+            snprintf(text, sizeof(text), "<span foreground='#faa61a'>●</span> Rejoining…");
+            break;
+        case CONNECTION_OFFLINE:
+            snprintf(text, sizeof(text), "<span foreground='#e05252'>●</span> Offline, restart to reconnect");
+            break;
+    }
+    if (widgets->connection_status) {
+        gtk_label_set_markup(GTK_LABEL(widgets->connection_status), text);
     }
 
-    PQclear(update_res);
-} 
\ No newline at end of file
+    free(state_data);
+    return G_SOURCE_REMOVE;
+}
+
+void end_chat_session(AppWidgets *widgets) {
+    clear_contacts(widgets);
+    fail_pending_messages(widgets); // Acks for them won't come any more
+    history_cache_close();
+    read_marker_reset();
+    memset(widgets->session_token, 0, sizeof(widgets->session_token)); // Nothing to resume any more
+
+    gtk_stack_set_visible_child_name(GTK_STACK(widgets->stack), "login");
+    gtk_entry_set_text(GTK_ENTRY(widgets->username_entry), ""); // Clear username on login page
+    gtk_entry_set_text(GTK_ENTRY(widgets->password_entry), ""); // Clear password on login page
+    widgets->current_channel_id = 0; // Reset current channel
+    chat_history_view_clear(widgets->chat_history);
+    gtk_label_set_text(GTK_LABEL(widgets->channel_name), "# Select a channel"); // Reset channel name label
+}
@@ -2,16 +2,42 @@
 #define CHAT_UTILS_H
 
 #include <gtk/gtk.h>
+#include <stdbool.h>
 #include "../types/app_types.h"
 
-// Function to store a message in the database
-bool store_message(AppWidgets *widgets, const char *message, uint32_t channel_id);
+// Function to send a frame on the current connection from any thread; the
+// receive thread may swap the socket at any time. Returns -1 on failure.
+int send_to_server(AppWidgets *widgets, const Message *msg);
 
-// Function to update chat history with a new message
-void update_chat_history(AppWidgets *widgets, const char *sender, const char *message, const char *channel_name);
+// Function to put a new connection in place (INVALID_SOCKET for none) and
+// return the previous one, which the caller closes
+SOCKET swap_server_socket(AppWidgets *widgets, SOCKET sock);
 
-// Function to update chat history from network messages
-gboolean update_chat_history_from_network(gpointer data);
+// Function to send a message to the current channel. It is shown at once as
+// pending and confirmed (or marked failed) when the server acknowledges it.
+bool send_chat_message(AppWidgets *widgets, const char *text);
+
+// Function to apply a MSG_CHAT_ACK to the pending message it refers to
+gboolean apply_chat_ack(gpointer data);
+
+// Function to count a MSG_CHANNEL_ACTIVITY in the channel list's unread badges
+gboolean apply_channel_activity(gpointer data);
+
+// Function to apply a member list snapshot or delta frame to the contacts list
+gboolean apply_user_list(gpointer data);
+
+// Function to apply a batch of presence changes to the contacts list
+gboolean apply_presence_updates(gpointer data);
+
+// Function to empty the contacts list (on logout)
+void clear_contacts(AppWidgets *widgets);
+
+// Function to apply a connection state change: updates the indicator and,
+// unless online, fails the messages still waiting for an ack
+gboolean apply_connection_state(gpointer data);
+
+// Function to leave the chat page after a logout or a rejected resume
+void end_chat_session(AppWidgets *widgets);
 
 // Function to handle successful login confirmation from server and set up UI
 // Note: Renamed from handle_successful_login
@@ -20,19 +46,16 @@ gboolean finalize_login_ui_setup(gpointer user_data);
 // Function to fetch the display name ("First Last") from DB
 void get_display_name(AppWidgets *widgets, const char *sender_email, char *display_name, size_t size);
 
-// Function to refresh the channel list
+// Function to refresh the channel list, touching only the rows that changed
 void refresh_channel_list(AppWidgets *widgets);
 
-// Function to ensure user has proper channel associations
-void ensure_user_channel_associations(AppWidgets *widgets, const char *user_id);
+// Sort function of the channel and contact lists: by name, in collation order
+gint compare_list_rows(GtkListBoxRow *a, GtkListBoxRow *b, gpointer user_data);
 
-// Function to load channel history
-void load_channel_history(AppWidgets *widgets, uint32_t channel_id);
+// Function to switch to a channel and request its history snapshot from the server
+void join_channel(AppWidgets *widgets, uint32_t channel_id);
 
 // Function to format timestamp (potentially move definition too)
 void format_timestamp(const char *db_timestamp, char *formatted_time, size_t size);
 
-// Function to update user status in the database
-void update_user_status(AppWidgets *widgets, const char *username, const char *status);
-
 #endif 
\ No newline at end of file
@@ -1,5 +1,4 @@
 #ifndef GTK_STRING_UTILS_H
 #define GTK_STRING_UTILS_H
-const char* sanitize_utf8(const char* input);
 const char* sanitize_utf8_gtk(const char *str);
 #endif //GTK_STRING_UTILS_H
@@ -0,0 +1,424 @@
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include "history_cache.h"
+
+#define CACHE_MAGIC 0x48325843 // "CX2H"
+// 2: seqs renumbered by the server's migration 10; older files are refetched
+// 3: high-water mark in the header
+#define CACHE_VERSION 3
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t channel_id;
+    uint32_t reserved;
+    uint64_t high_water; // Seq of the last record, written after the records
+} CacheFileHeader;
+
+// Every record is followed by sender_len + content_len bytes, padded to 8
+typedef struct {
+    uint64_t seq;
+    int64_t sent_at;
+    uint32_t message_id;
+    uint16_t content_len;
+    uint8_t sender_len;
+    uint8_t reserved;
+} CacheRecord;
+
+#define RECORD_SIZE(sender_len, content_len) \
+    ((sizeof(CacheRecord) + (size_t)(sender_len) + (size_t)(content_len) + 7) & ~(size_t)7)
+
+typedef struct {
+    uint32_t channel_id;
+    uint64_t high_water;
+    gint64 size;          // Length of the intact part of the file
+    gint64 disk_size;     // Real file length, longer than size after a torn write
+    gint64 last_used;     // Unix time, for LRU eviction
+    gboolean scanned;     // size and high_water are known
+    gboolean uncacheable; // Has messages without a sequence number
+} CacheChannel;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *cache_dir = NULL;
+static GHashTable *channels = NULL; // channel_id -> CacheChannel*
+static gint64 total_bytes = 0;      // Sum of disk_size
+static gint64 budget_bytes = 0;
+
+static char* channel_path(uint32_t channel_id) {
+    return g_strdup_printf("%s" G_DIR_SEPARATOR_S "%u.hist", cache_dir, channel_id);
+}
+
+// Walk the records of a mapped channel file, stopping at the first one that is
+// cut short, out of order or past the header's high-water mark (a write
+// interrupted by a crash). fn may be NULL.
+// Returns the length of the intact part.
+static gsize walk_records(const char *data, gsize length, uint32_t channel_id,
+                          CachedMessageFn fn, void *user_data, uint64_t *high_water, int *count) {
+    CacheFileHeader header;
+    if (length < sizeof(header)) return 0;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.channel_id != channel_id) {
+        return 0;
+    }
+
+    gsize offset = sizeof(header);
+    uint64_t last_seq = 0;
+    int n = 0;
+    while (length - offset >= sizeof(CacheRecord)) {
+        CacheRecord record;
+        memcpy(&record, data + offset, sizeof(record));
+        size_t size = RECORD_SIZE(record.sender_len, record.content_len);
+        if (size > length - offset || record.seq <= last_seq || record.seq > header.high_water) break;
+
+        if (fn) {
+            const char *sender = data + offset + sizeof(record);
+            CachedMessage message = {
+                .seq = record.seq,
+                .sent_at = record.sent_at,
+                .message_id = record.message_id,
+                .sender = sender,
+                .sender_len = record.sender_len,
+                .content = sender + record.sender_len,
+                .content_len = record.content_len
+            };
+            fn(&message, user_data);
+        }
+        last_seq = record.seq;
+        offset += size;
+        n++;
+    }
+    if (high_water) *high_water = last_seq;
+    if (count) *count = n;
+    return offset;
+}
+
+static void scan_channel(CacheChannel *ch) {
+    char *path = channel_path(ch->channel_id);
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    g_free(path);
+
+    total_bytes -= ch->disk_size;
+    ch->size = 0;
+    ch->disk_size = 0;
+    ch->high_water = 0;
+    if (file) {
+        ch->disk_size = (gint64)g_mapped_file_get_length(file);
+        ch->size = (gint64)walk_records(g_mapped_file_get_contents(file), g_mapped_file_get_length(file),
+                                        ch->channel_id, NULL, NULL, &ch->high_water, NULL);
+        g_mapped_file_unref(file);
+    }
+    total_bytes += ch->disk_size;
+    ch->scanned = TRUE;
+}
+
+static CacheChannel* get_channel(uint32_t channel_id) {
+    CacheChannel *ch = g_hash_table_lookup(channels, GUINT_TO_POINTER(channel_id));
+    if (!ch) {
+        ch = g_new0(CacheChannel, 1);
+        ch->channel_id = channel_id;
+        ch->last_used = g_get_real_time() / G_USEC_PER_SEC;
+        g_hash_table_insert(channels, GUINT_TO_POINTER(channel_id), ch);
+    }
+    if (!ch->scanned) {
+        scan_channel(ch);
+    }
+    return ch;
+}
+
+static void forget_file(CacheChannel *ch) {
+    char *path = channel_path(ch->channel_id);
+    g_remove(path);
+    g_free(path);
+    total_bytes -= ch->disk_size;
+    ch->size = 0;
+    ch->disk_size = 0;
+    ch->high_water = 0;
+}
+
+// Replace the file by its intact records from the first one at or after
+// min_from. Cuts off a torn tail (min_from 0) or drops the older part of an
+// oversized channel.
+static void rewrite_channel(CacheChannel *ch, gsize min_from) {
+    char *path = channel_path(ch->channel_id);
+    char *tmp_path = g_strconcat(path, ".tmp", NULL);
+    gsize kept = 0;
+    bool ok = false;
+
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (file && g_mapped_file_get_length(file) >= (gsize)ch->size) {
+        const char *data = g_mapped_file_get_contents(file);
+        gsize from = sizeof(CacheFileHeader);
+        while (from < min_from && from < (gsize)ch->size) {
+            CacheRecord record;
+            memcpy(&record, data + from, sizeof(record));
+            from += RECORD_SIZE(record.sender_len, record.content_len);
+        }
+        kept = (gsize)ch->size - from;
+
+        FILE *out = g_fopen(tmp_path, "wb");
+        if (out) {
+            CacheFileHeader header = {CACHE_MAGIC, CACHE_VERSION, ch->channel_id, 0, ch->high_water};
+            ok = fwrite(&header, sizeof(header), 1, out) == 1 &&
+                 (kept == 0 || fwrite(data + from, 1, kept, out) == kept);
+            if (fclose(out) != 0) ok = false;
+        }
+    }
+    // Unmapped before the rename, which Windows refuses on a mapped file
+    if (file) g_mapped_file_unref(file);
+
+    if (ok && g_rename(tmp_path, path) == 0) {
+        gint64 new_size = (gint64)(sizeof(CacheFileHeader) + kept);
+        total_bytes += new_size - ch->disk_size;
+        ch->size = new_size;
+        ch->disk_size = new_size;
+    } else {
+        fprintf(stderr, "Failed to rewrite history cache %s\n", path);
+        g_remove(tmp_path);
+        forget_file(ch);
+    }
+    g_free(tmp_path);
+    g_free(path);
+}
+
+static gint compare_last_used(gconstpointer a, gconstpointer b) {
+    const CacheChannel *x = a;
+    const CacheChannel *y = b;
+    return (x->last_used > y->last_used) - (x->last_used < y->last_used);
+}
+
+// Drop whole channels, least recently used first, until the budget is met
+static void evict_channels(uint32_t keep_channel) {
+    if (total_bytes <= budget_bytes) return;
+    GList *all = g_list_sort(g_hash_table_get_values(channels), compare_last_used);
+    for (GList *l = all; l && total_bytes > budget_bytes; l = l->next) {
+        CacheChannel *ch = l->data;
+        if (ch->channel_id == keep_channel || ch->disk_size == 0) continue;
+        printf("🧹 Evicting cached history of channel %u (%lld KB)\n", ch->channel_id, (long long)(ch->disk_size / 1024));
+        forget_file(ch);
+    }
+    g_list_free(all);
+}
+
+bool history_cache_open(const char *username) {
+    history_cache_close();
+
+    char *user_dir = g_strcanon(g_strdup(username), G_CSET_a_2_z G_CSET_A_2_Z G_CSET_DIGITS ".-_@", '_');
+    char *dir = g_build_filename(g_get_user_cache_dir(), "x-2r", "history", user_dir, NULL);
+    g_free(user_dir);
+    if (g_mkdir_with_parents(dir, 0700) != 0) {
+        fprintf(stderr, "Failed to create history cache directory %s\n", dir);
+        g_free(dir);
+        return false;
+    }
+
+    const char *budget_mb = getenv("HISTORY_CACHE_BUDGET_MB");
+    pthread_mutex_lock(&cache_mutex);
+    cache_dir = dir;
+    channels = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    total_bytes = 0;
+    budget_bytes = (gint64)(budget_mb ? atoi(budget_mb) : DEFAULT_HISTORY_CACHE_BUDGET_MB) * 1024 * 1024;
+
+    // Only sizes and ages here; a channel's file is read when it is first used
+    GDir *listing = g_dir_open(dir, 0, NULL);
+    if (listing) {
+        const char *name;
+        while ((name = g_dir_read_name(listing)) != NULL) {
+            char *end;
+            unsigned long channel_id = strtoul(name, &end, 10);
+            if (channel_id == 0 || channel_id > UINT32_MAX || strcmp(end, ".hist") != 0) continue;
+
+            char *path = g_build_filename(dir, name, NULL);
+            GStatBuf st;
+            if (g_stat(path, &st) == 0) {
+                CacheChannel *ch = g_new0(CacheChannel, 1);
+                ch->channel_id = (uint32_t)channel_id;
+                ch->disk_size = (gint64)st.st_size;
+                ch->last_used = (gint64)st.st_mtime;
+                g_hash_table_insert(channels, GUINT_TO_POINTER(ch->channel_id), ch);
+                total_bytes += ch->disk_size;
+            }
+            g_free(path);
+        }
+        g_dir_close(listing);
+    }
+    printf("💾 History cache for %s: %u channels, %lld KB\n", username, g_hash_table_size(channels), (long long)(total_bytes / 1024));
+    pthread_mutex_unlock(&cache_mutex);
+    return true;
+}
+
+void history_cache_close(void) {
+    pthread_mutex_lock(&cache_mutex);
+    if (channels) {
+        g_hash_table_destroy(channels);
+        channels = NULL;
+    }
+    g_free(cache_dir);
+    cache_dir = NULL;
+    total_bytes = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// The high-water mark from the file header, without walking the records
+static uint64_t read_header_high_water(uint32_t channel_id) {
+    char *path = channel_path(channel_id);
+    FILE *file = g_fopen(path, "rb");
+    g_free(path);
+    if (!file) return 0;
+    CacheFileHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+    if (!ok || header.magic != CACHE_MAGIC || header.version != CACHE_VERSION || header.channel_id != channel_id) {
+        return 0;
+    }
+    return header.high_water;
+}
+
+uint64_t history_cache_high_water(uint32_t channel_id) {
+    uint64_t high_water = 0;
+    pthread_mutex_lock(&cache_mutex);
+    if (channels) {
+        // Called on every channel switch: until the loader has walked the
+        // file, only its header is read
+        CacheChannel *ch = g_hash_table_lookup(channels, GUINT_TO_POINTER(channel_id));
+        if (ch) high_water = ch->scanned ? ch->high_water : read_header_high_water(channel_id);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return high_water;
+}
+
+int history_cache_read(uint32_t channel_id, CachedMessageFn fn, void *user_data) {
+    char *path = NULL;
+    gsize size = 0;
+    pthread_mutex_lock(&cache_mutex);
+    if (channels) {
+        CacheChannel *ch = get_channel(channel_id);
+        if (ch->size > 0) {
+            size = (gsize)ch->size;
+            path = channel_path(channel_id);
+            ch->last_used = g_get_real_time() / G_USEC_PER_SEC;
+            g_utime(path, NULL); // Keeps the LRU order across restarts
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (!path) return 0;
+
+    // Only this thread changes the files, so the intact prefix stays valid unlocked
+    int count = 0;
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (file) {
+        if (g_mapped_file_get_length(file) >= size) {
+            walk_records(g_mapped_file_get_contents(file), size, channel_id, fn, user_data, NULL, &count);
+        }
+        g_mapped_file_unref(file);
+    }
+    g_free(path);
+    return count;
+}
+
+void history_cache_append(uint32_t channel_id, const CachedMessage *messages, int count) {
+    if (count <= 0) return;
+    pthread_mutex_lock(&cache_mutex);
+    if (!channels) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+    CacheChannel *ch = get_channel(channel_id);
+
+    // Messages stored before sequence numbers existed can't be fetched "after
+    // the high-water mark", so such a channel is always loaded from the server
+    for (int i = 0; i < count && !ch->uncacheable; i++) {
+        if (messages[i].seq == 0) {
+            forget_file(ch);
+            ch->uncacheable = TRUE;
+        }
+    }
+    if (ch->uncacheable) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+
+    size_t bytes = 0;
+    uint64_t high_water = ch->high_water;
+    for (int i = 0; i < count; i++) {
+        if (messages[i].seq <= high_water) continue;
+        bytes += RECORD_SIZE(messages[i].sender_len, messages[i].content_len);
+        high_water = messages[i].seq;
+    }
+    if (bytes == 0) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+
+    char *buffer = g_malloc0(bytes);
+    char *out = buffer;
+    high_water = ch->high_water;
+    for (int i = 0; i < count; i++) {
+        const CachedMessage *m = &messages[i];
+        if (m->seq <= high_water) continue;
+        CacheRecord record = {m->seq, m->sent_at, m->message_id, m->content_len, m->sender_len, 0};
+        memcpy(out, &record, sizeof(record));
+        memcpy(out + sizeof(record), m->sender, m->sender_len);
+        memcpy(out + sizeof(record) + m->sender_len, m->content, m->content_len);
+        out += RECORD_SIZE(m->sender_len, m->content_len);
+        high_water = m->seq;
+    }
+
+    if (ch->disk_size != ch->size) {
+        // Torn tail left by a crash: appending after it would hide the new records
+        if (ch->size == 0) {
+            forget_file(ch);
+        } else {
+            rewrite_channel(ch, 0);
+        }
+    }
+    if (ch->size > 0 && ch->size + (gint64)bytes > HISTORY_CACHE_CHANNEL_MAX_BYTES) {
+        rewrite_channel(ch, (gsize)ch->size / 2);
+    }
+
+    char *path = channel_path(channel_id);
+    FILE *file = g_fopen(path, ch->size == 0 ? "wb" : "r+b");
+    gint64 written = 0;
+    bool ok = file != NULL;
+    if (ok && ch->size == 0) {
+        CacheFileHeader header = {CACHE_MAGIC, CACHE_VERSION, channel_id, 0, 0};
+        ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        written += sizeof(header);
+    }
+    ok = ok && fseek(file, (long)(ch->size + written), SEEK_SET) == 0 && fwrite(buffer, 1, bytes, file) == bytes;
+    written += (gint64)bytes;
+    // Only then the header: records past its mark are not there yet
+    ok = ok && fflush(file) == 0 && fseek(file, (long)offsetof(CacheFileHeader, high_water), SEEK_SET) == 0 &&
+         fwrite(&high_water, sizeof(high_water), 1, file) == 1;
+    if (file && fclose(file) != 0) ok = false;
+
+    if (ok) {
+        ch->size += written;
+        ch->disk_size = ch->size;
+        ch->high_water = high_water;
+        ch->last_used = g_get_real_time() / G_USEC_PER_SEC;
+        total_bytes += written;
+    } else {
+        fprintf(stderr, "Failed to write history cache %s\n", path);
+        forget_file(ch);
+    }
+    g_free(path);
+    g_free(buffer);
+
+    evict_channels(channel_id);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void history_cache_reset(uint32_t channel_id) {
+    pthread_mutex_lock(&cache_mutex);
+    if (channels) {
+        CacheChannel *ch = get_channel(channel_id);
+        forget_file(ch);
+        ch->uncacheable = FALSE;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
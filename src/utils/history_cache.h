@@ -0,0 +1,50 @@
+#ifndef HISTORY_CACHE_H
+#define HISTORY_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Local copy of each channel's history, so switching channels paints from
+// disk at once and only asks the server for messages newer than the cached
+// high-water mark. One append-only file per channel, in sequence order,
+// under <user cache dir>/x-2r/history/<username>/, read through a memory map.
+
+// A channel file is compacted to its newer half when it grows past this
+#define HISTORY_CACHE_CHANNEL_MAX_BYTES (4 * 1024 * 1024)
+// Default budget for all channels of a user; override with HISTORY_CACHE_BUDGET_MB.
+// Least recently used channels are evicted whole when it is exceeded.
+#define DEFAULT_HISTORY_CACHE_BUDGET_MB 64
+
+typedef struct {
+    uint64_t seq;
+    int64_t sent_at; // Unix time
+    uint32_t message_id;
+    const char *sender; // Not NUL-terminated
+    uint8_t sender_len;
+    const char *content; // Not NUL-terminated
+    uint16_t content_len;
+} CachedMessage;
+
+typedef void (*CachedMessageFn)(const CachedMessage *message, void *user_data);
+
+// Main thread, after login / on logout. Without an open cache every call below is a no-op.
+bool history_cache_open(const char *username);
+void history_cache_close(void);
+
+// Highest sequence number cached for the channel, 0 if nothing is cached.
+// Any thread: it is kept in the file header, so the file is not walked.
+uint64_t history_cache_high_water(uint32_t channel_id);
+
+// The functions below change or map the files and must all be called from
+// the same thread (the history loader's worker).
+
+// Call fn for every cached message of the channel, oldest first. Returns the count.
+int history_cache_read(uint32_t channel_id, CachedMessageFn fn, void *user_data);
+
+// Append messages in sequence order; those at or below the high-water mark are skipped
+void history_cache_append(uint32_t channel_id, const CachedMessage *messages, int count);
+
+// Forget the channel, e.g. because the server sent a fresh snapshot
+void history_cache_reset(uint32_t channel_id);
+
+#endif // HISTORY_CACHE_H
@@ -0,0 +1,467 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "history_loader.h"
+#include "chat_utils.h"
+#include "history_cache.h"
+#include "read_marker.h"
+#include "ui_dispatch.h"
+#include "utf8_markup.h"
+#include "../database/db_connection.h"
+
+// Jobs already queued are folded into one UI task, up to this many
+#define HISTORY_BATCH_JOBS 64
+
+typedef enum {
+    JOB_CACHED, // Paint what the local cache has for the channel
+    JOB_SNAPSHOT,
+    JOB_CHAT,
+    JOB_PAGE, // Older messages the user scrolled back to: shown above, not cached
+    JOB_STOP
+} HistoryJobType;
+
+typedef struct {
+    HistoryJobType type;
+    uint32_t channel_id;
+    uint32_t length;
+    char payload[]; // Snapshot or history page payload, or ChatMessage
+} HistoryJob;
+
+typedef enum {
+    ROW_MESSAGE,  // Appended below
+    ROW_OLDER,    // Part of a history page, prepended above
+    ROW_RESET,    // Clears the view
+    ROW_PAGE_END  // A history page is complete
+} HistoryRowKind;
+
+// One decoded row, ready for the view, or a marker
+typedef struct {
+    gint generation;
+    HistoryRowKind kind;
+    gboolean oldest; // ROW_PAGE_END: the start of the channel was reached
+    uint64_t seq;
+    uint32_t local_id; // ROW_MESSAGE: our own copy of a message sent from here
+    char time[12];
+    char *sender;  // Points into text
+    char *content; // Points into text
+    char text[];
+} HistoryRow;
+
+// The rows decoded from one batch of jobs, applied by a single ui_dispatch task
+typedef struct {
+    guint count;
+    HistoryRow *rows[];
+} RowBatch;
+
+static AppWidgets *loader_widgets = NULL;
+static pthread_t loader_thread;
+static GAsyncQueue *jobs = NULL; // NULL once stopped; guarded by jobs_mutex
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static HistoryJob stop_job = {.type = JOB_STOP};
+
+// Bumped by every history_loader_begin; work tagged with an older value is stale
+static gint generation = 0;
+static gint current_channel = 0;
+
+// Scrollback, main thread only: the oldest seq shown and the page in flight
+static uint64_t oldest_seq = 0;
+static gboolean page_pending = FALSE;
+static gboolean reached_oldest = FALSE;
+
+// "Time to first message painted", main thread only
+static gint64 load_started_us = 0;
+static gboolean first_paint_pending = FALSE;
+static gulong after_paint_handler = 0;
+
+// Worker-only state
+static PGconn *worker_db = NULL;
+static GHashTable *worker_names = NULL;
+static char *worker_scratch = NULL; // Repaired content, grown as needed
+static size_t worker_scratch_size = 0;
+
+// --- Worker ---
+
+// Same lookup as get_display_name, but on a replica or the worker's own connection
+static const char* resolve_display_name(const char *email) {
+    const char *cached = g_hash_table_lookup(worker_names, email);
+    if (cached) return cached;
+
+    char *display_name = NULL;
+    if (worker_db || loader_widgets->db_replicas) {
+        const char *query = "SELECT first_name, last_name FROM users WHERE email = $1";
+        const char *params[1] = {email};
+        PGresult *res = db_exec_read(loader_widgets->db_replicas, worker_db, NULL, query, 1, params);
+        if (PQresultStatus(res) == PGRES_TUPLES_OK && PQntuples(res) > 0) {
+            display_name = g_strdup_printf("%s %s", PQgetvalue(res, 0, 0), PQgetvalue(res, 0, 1));
+        }
+        PQclear(res);
+    }
+    if (!display_name) display_name = g_strdup(email);
+    g_hash_table_insert(worker_names, g_strdup(email), display_name);
+    return display_name;
+}
+
+static HistoryRow* make_row(gint gen, uint64_t seq, const char *sender, const char *content, size_t content_len, time_t sent_at) {
+    const char *display_name = resolve_display_name(sender);
+
+    // Repair the text here, off the UI thread; markup escaping happens when a row is shown
+    size_t display_len = strlen(display_name);
+    size_t needed = UTF8_MARKUP_MAX_OUTPUT(display_len) + UTF8_MARKUP_MAX_OUTPUT(content_len);
+    if (needed > worker_scratch_size) {
+        worker_scratch = g_realloc(worker_scratch, needed);
+        worker_scratch_size = needed;
+    }
+    size_t sender_len = utf8_markup_copy(display_name, display_len, worker_scratch, worker_scratch_size, false);
+    size_t safe_len = utf8_markup_copy(content, content_len, worker_scratch + sender_len + 1,
+                                       worker_scratch_size - sender_len - 1, false);
+
+    HistoryRow *row = g_malloc(sizeof(HistoryRow) + sender_len + safe_len + 2);
+    row->generation = gen;
+    row->kind = ROW_MESSAGE;
+    row->oldest = FALSE;
+    row->seq = seq;
+    row->local_id = 0;
+    row->sender = row->text;
+    row->content = row->text + sender_len + 1;
+    memcpy(row->text, worker_scratch, sender_len + safe_len + 2);
+
+    struct tm *tm_info = localtime(&sent_at);
+    strftime(row->time, sizeof(row->time), "%H:%M:%S", tm_info);
+    return row;
+}
+
+static gboolean apply_rows(gpointer data);
+
+// Hand the decoded rows to the UI as one task
+static void publish_rows(GQueue *rows) {
+    guint count = g_queue_get_length(rows);
+    if (count == 0) return;
+    RowBatch *batch = g_malloc(sizeof(RowBatch) + count * sizeof(HistoryRow*));
+    batch->count = count;
+    for (guint i = 0; i < count; i++) {
+        batch->rows[i] = g_queue_pop_head(rows);
+    }
+    ui_dispatch(apply_rows, batch);
+}
+
+static HistoryRow* make_marker(gint gen, HistoryRowKind kind) {
+    HistoryRow *marker = g_malloc0(sizeof(HistoryRow));
+    marker->generation = gen;
+    marker->kind = kind;
+    return marker;
+}
+
+// A snapshot frame, or a history page (same layout) when older is set
+static void decode_snapshot(HistoryJob *job, gint gen, gboolean older, GQueue *rows) {
+    ChannelSnapshotHeader header;
+    memcpy(&header, job->payload, sizeof(header));
+
+    // Every join answer starts with a FIRST frame: replace what is shown
+    if (!older && (header.flags & SNAPSHOT_FIRST)) {
+        g_queue_push_tail(rows, make_marker(gen, ROW_RESET));
+    }
+
+    size_t offset = sizeof(ChannelSnapshotHeader);
+    SnapshotEntry entry;
+    const char *sender, *content;
+    while (snapshot_next_entry(job->payload, job->length, &offset, &entry, &sender, &content)) {
+        // The user moved on: stop decoding a load nobody will see
+        if (g_atomic_int_get(&generation) != gen) {
+            return;
+        }
+        char sender_str[64];
+        size_t sender_len = MIN(sizeof(sender_str) - 1, (size_t)entry.sender_len);
+        memcpy(sender_str, sender, sender_len);
+        sender_str[sender_len] = '\0';
+        HistoryRow *row = make_row(gen, entry.seq, sender_str, content, entry.content_len, (time_t)entry.sent_at);
+        if (older) row->kind = ROW_OLDER;
+        g_queue_push_tail(rows, row);
+    }
+    if (older) {
+        HistoryRow *end = make_marker(gen, ROW_PAGE_END);
+        end->oldest = (header.flags & HISTORY_OLDEST) != 0;
+        g_queue_push_tail(rows, end);
+    }
+}
+
+typedef struct {
+    gint generation;
+    GQueue *rows;
+} CachedRowsContext;
+
+static void add_cached_row(const CachedMessage *message, void *user_data) {
+    CachedRowsContext *ctx = user_data;
+    char sender_str[64];
+    size_t sender_len = MIN(sizeof(sender_str) - 1, (size_t)message->sender_len);
+    memcpy(sender_str, message->sender, sender_len);
+    sender_str[sender_len] = '\0';
+    g_queue_push_tail(ctx->rows, make_row(ctx->generation, message->seq, sender_str, message->content, message->content_len, (time_t)message->sent_at));
+}
+
+// Keep the local cache in step with what the server sent, whichever channel is shown
+static void cache_job(HistoryJob *job) {
+    if (job->type == JOB_SNAPSHOT) {
+        ChannelSnapshotHeader header;
+        memcpy(&header, job->payload, sizeof(header));
+        // A snapshot answers a join without a usable high-water mark: start over
+        if (header.flags & SNAPSHOT_FIRST) {
+            history_cache_reset(header.channel_id);
+        }
+        CachedMessage *messages = g_new(CachedMessage, MAX(header.count, 1));
+        int count = 0;
+        size_t offset = sizeof(ChannelSnapshotHeader);
+        SnapshotEntry entry;
+        const char *sender, *content;
+        while (count < header.count && snapshot_next_entry(job->payload, job->length, &offset, &entry, &sender, &content)) {
+            messages[count++] = (CachedMessage){entry.seq, entry.sent_at, entry.message_id,
+                                                sender, entry.sender_len, content, entry.content_len};
+        }
+        history_cache_append(header.channel_id, messages, count);
+        g_free(messages);
+    } else if (job->type == JOB_CHAT) {
+        ChatMessage *chat = (ChatMessage *)job->payload;
+        // Below the high-water mark a live message fills a hole the file
+        // already skipped and can't take in its place: start over
+        if (chat->seq != 0 && chat->seq < history_cache_high_water(chat->channel_id)) {
+            printf("💾 Channel %u: message %llu arrived late, dropping the cached history\n", chat->channel_id, (unsigned long long)chat->seq);
+            history_cache_reset(chat->channel_id);
+            return;
+        }
+        CachedMessage message = {chat->seq, chat->sent_at, chat->message_id,
+                                 chat->sender_username, (uint8_t)strlen(chat->sender_username),
+                                 chat->content, (uint16_t)strlen(chat->content)};
+        history_cache_append(chat->channel_id, &message, 1);
+    }
+}
+
+static void process_job(HistoryJob *job, GQueue *rows) {
+    cache_job(job);
+
+    gint gen = g_atomic_int_get(&generation);
+    if (job->channel_id != (uint32_t)g_atomic_int_get(&current_channel)) {
+        return;
+    }
+    if (job->type == JOB_CACHED) {
+        CachedRowsContext ctx = {gen, rows};
+        int count = history_cache_read(job->channel_id, add_cached_row, &ctx);
+        if (count > 0) {
+            printf("💾 Channel %u: %d messages from the local cache\n", job->channel_id, count);
+        }
+    } else if (job->type == JOB_SNAPSHOT || job->type == JOB_PAGE) {
+        decode_snapshot(job, gen, job->type == JOB_PAGE, rows);
+    } else {
+        ChatMessage *chat = (ChatMessage *)job->payload;
+        HistoryRow *row = make_row(gen, chat->seq, chat->sender_username, chat->content, strlen(chat->content), (time_t)chat->sent_at);
+        row->local_id = chat->client_id;
+        g_queue_push_tail(rows, row);
+    }
+}
+
+static void* loader_main(void *arg) {
+    GAsyncQueue *queue = arg;
+    worker_db = connect_to_db();
+    if (worker_db && PQstatus(worker_db) != CONNECTION_OK) {
+        fprintf(stderr, "History loader: database unavailable, showing emails: %s\n", PQerrorMessage(worker_db));
+        PQfinish(worker_db);
+        worker_db = NULL;
+    }
+    worker_names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+    gboolean stopping = FALSE;
+    while (!stopping) {
+        // A burst of messages becomes one UI task instead of one per message
+        GQueue rows = G_QUEUE_INIT;
+        HistoryJob *job = g_async_queue_pop(queue);
+        for (int handled = 0; job; job = g_async_queue_try_pop(queue)) {
+            if (job->type == JOB_STOP) {
+                stopping = TRUE;
+                break;
+            }
+            process_job(job, &rows);
+            free(job);
+            if (++handled >= HISTORY_BATCH_JOBS) break;
+        }
+        publish_rows(&rows);
+    }
+
+    g_hash_table_destroy(worker_names);
+    g_free(worker_scratch);
+    if (worker_db) PQfinish(worker_db);
+    return NULL;
+}
+
+// --- Main thread ---
+
+static void on_after_paint(GdkFrameClock *clock, gpointer user_data) {
+    uint32_t channel_id = GPOINTER_TO_UINT(user_data);
+    printf("⏱️ Channel %u: first message painted %.1f ms after selection\n",
+           channel_id, (g_get_monotonic_time() - load_started_us) / 1000.0);
+    g_signal_handler_disconnect(clock, after_paint_handler);
+    after_paint_handler = 0;
+}
+
+static void note_seq(uint64_t seq) {
+    if (seq > 0 && (oldest_seq == 0 || seq < oldest_seq)) oldest_seq = seq;
+}
+
+// The view's top was reached: ask for the page before the oldest message shown
+static void request_older(gpointer user_data) {
+    (void)user_data;
+    uint32_t channel_id = (uint32_t)g_atomic_int_get(&current_channel);
+    if (page_pending || reached_oldest || oldest_seq <= 1 || channel_id == 0) return;
+    if (loader_widgets->connection_state != CONNECTION_ONLINE) return;
+
+    Message *msg = create_history_request_message(channel_id, oldest_seq);
+    if (!msg) return;
+    if (send_to_server(loader_widgets, msg) < 0) {
+        perror("Failed to send HISTORY_REQUEST message");
+    } else {
+        page_pending = TRUE;
+    }
+    free(msg);
+}
+
+// Runs inside the frame dispatch; the view lays the rows out once afterwards
+static gboolean apply_rows(gpointer data) {
+    RowBatch *batch = data;
+    gint gen = g_atomic_int_get(&generation);
+    gboolean painted = FALSE;
+    // The rows of a history page are contiguous and inserted at once
+    ChatHistoryLine *older = g_new(ChatHistoryLine, batch->count);
+    guint older_count = 0;
+    for (guint i = 0; i < batch->count; i++) {
+        HistoryRow *row = batch->rows[i];
+        if (row->generation != gen) continue;
+        switch (row->kind) {
+            case ROW_RESET:
+                chat_history_view_clear(loader_widgets->chat_history);
+                oldest_seq = 0;
+                break;
+            case ROW_MESSAGE:
+                // Our own message, shown as pending since it was sent: now it has its place
+                if (row->local_id && chat_history_view_confirm(loader_widgets->chat_history, row->local_id, row->seq)) {
+                    // Settled: an ack still on its way, even an unknown outcome, has nothing to add
+                    g_hash_table_remove(loader_widgets->pending_messages, GUINT_TO_POINTER(row->local_id));
+                    note_seq(row->seq);
+                    break;
+                }
+                if (chat_history_view_insert(loader_widgets->chat_history, row->seq, row->sender, row->time, row->content)) {
+                    note_seq(row->seq);
+                    painted = TRUE;
+                }
+                break;
+            case ROW_OLDER:
+                older[older_count++] = (ChatHistoryLine){row->sender, row->time, row->content, row->seq};
+                note_seq(row->seq);
+                break;
+            case ROW_PAGE_END:
+                chat_history_view_prepend(loader_widgets->chat_history, older, older_count);
+                older_count = 0;
+                page_pending = FALSE;
+                if (row->oldest) reached_oldest = TRUE;
+                break;
+        }
+    }
+    // Rows point into their HistoryRow, so these go once the page is in the view
+    for (guint i = 0; i < batch->count; i++) {
+        g_free(batch->rows[i]);
+    }
+    g_free(older);
+    g_free(batch);
+    if (painted) read_marker_note(loader_widgets);
+
+    // These rows are painted at the end of this frame; time it there
+    if (painted && first_paint_pending) {
+        GdkFrameClock *clock = gtk_widget_get_frame_clock(chat_history_view_get_container(loader_widgets->chat_history));
+        if (clock) {
+            first_paint_pending = FALSE;
+            if (after_paint_handler) g_signal_handler_disconnect(clock, after_paint_handler);
+            after_paint_handler = g_signal_connect(clock, "after-paint", G_CALLBACK(on_after_paint),
+                                                   GUINT_TO_POINTER((uint32_t)g_atomic_int_get(&current_channel)));
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+bool history_loader_start(AppWidgets *widgets) {
+    loader_widgets = widgets;
+    chat_history_view_set_top_reached(widgets->chat_history, request_older, NULL);
+    jobs = g_async_queue_new();
+    if (pthread_create(&loader_thread, NULL, loader_main, jobs) != 0) {
+        perror("Failed to create history loader thread");
+        g_async_queue_unref(jobs);
+        jobs = NULL;
+        return false;
+    }
+    return true;
+}
+
+void history_loader_stop(void) {
+    // The receive thread may still be submitting: from here on it is refused
+    pthread_mutex_lock(&jobs_mutex);
+    GAsyncQueue *queue = jobs;
+    jobs = NULL;
+    pthread_mutex_unlock(&jobs_mutex);
+    if (!queue) return;
+
+    g_async_queue_push_front(queue, &stop_job);
+    pthread_join(loader_thread, NULL);
+    // Jobs behind the stop were never run
+    HistoryJob *job;
+    while ((job = g_async_queue_try_pop(queue)) != NULL) free(job);
+    g_async_queue_unref(queue);
+}
+
+static void submit(HistoryJobType type, uint32_t channel_id, const void *payload, uint32_t length) {
+    if (!jobs) return;
+    // Cheap early drop; the worker checks again
+    if (channel_id != (uint32_t)g_atomic_int_get(&current_channel)) return;
+    HistoryJob *job = malloc(sizeof(HistoryJob) + length);
+    if (!job) {
+        fprintf(stderr, "Failed to allocate history job\n");
+        return;
+    }
+    job->type = type;
+    job->channel_id = channel_id;
+    job->length = length;
+    if (length > 0) memcpy(job->payload, payload, length);
+    pthread_mutex_lock(&jobs_mutex);
+    if (jobs) g_async_queue_push(jobs, job);
+    else free(job);
+    pthread_mutex_unlock(&jobs_mutex);
+}
+
+void history_loader_begin(uint32_t channel_id) {
+    g_atomic_int_set(&current_channel, (gint)channel_id);
+    g_atomic_int_inc(&generation);
+    load_started_us = g_get_monotonic_time();
+    first_paint_pending = TRUE;
+    oldest_seq = 0;
+    page_pending = FALSE;
+    reached_oldest = FALSE;
+    chat_history_view_clear(loader_widgets->chat_history);
+    submit(JOB_CACHED, channel_id, NULL, 0);
+}
+
+void history_loader_submit_snapshot(const char *payload, uint32_t length) {
+    if (length < sizeof(ChannelSnapshotHeader)) return;
+    ChannelSnapshotHeader header;
+    memcpy(&header, payload, sizeof(header));
+    submit(JOB_SNAPSHOT, header.channel_id, payload, length);
+}
+
+void history_loader_submit_page(const char *payload, uint32_t length) {
+    if (length < sizeof(ChannelSnapshotHeader)) return;
+    ChannelSnapshotHeader header;
+    memcpy(&header, payload, sizeof(header));
+    submit(JOB_PAGE, header.channel_id, payload, length);
+}
+
+void history_loader_submit_chat(const ChatMessage *chat) {
+    ChatMessage copy = *chat;
+    copy.sender_username[sizeof(copy.sender_username) - 1] = '\0';
+    copy.content[sizeof(copy.content) - 1] = '\0';
+    submit(JOB_CHAT, copy.channel_id, &copy, sizeof(copy));
+}
@@ -0,0 +1,30 @@
+#ifndef HISTORY_LOADER_H
+#define HISTORY_LOADER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "../types/app_types.h"
+
+// Background pipeline between the network and the chat history view.
+// Snapshot frames and live messages are decoded on a worker thread (which
+// also resolves display names over its own database connection) and the
+// resulting rows reach the view through the per-frame UI dispatch.
+
+bool history_loader_start(AppWidgets *widgets);
+void history_loader_stop(void);
+
+// Main thread: the user switched to channel_id. Rows still queued for an
+// earlier load are dropped, the "first message painted" timer starts and
+// whatever the local history cache holds for the channel is painted.
+void history_loader_begin(uint32_t channel_id);
+
+// Receive thread: hand over a MSG_CHANNEL_SNAPSHOT payload or a live message
+void history_loader_submit_snapshot(const char *payload, uint32_t length);
+// Receive thread: a MSG_HISTORY_PAGE, asked for when the user scrolled to the
+// oldest message shown. Its rows go above, and are not cached.
+void history_loader_submit_page(const char *payload, uint32_t length);
+// A live message, or our own copy of one sent from here (client_id set),
+// which confirms its pending row
+void history_loader_submit_chat(const ChatMessage *chat);
+
+#endif // HISTORY_LOADER_H
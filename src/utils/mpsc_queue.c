@@ -0,0 +1,48 @@
+#include <stddef.h>
+#include "mpsc_queue.h"
+
+void mpsc_queue_init(MpscQueue *q) {
+    atomic_store(&q->stub.next, NULL);
+    atomic_store(&q->head, &q->stub);
+    q->tail = &q->stub;
+}
+
+void mpsc_queue_push(MpscQueue *q, MpscNode *node) {
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    MpscNode *prev = atomic_exchange_explicit(&q->head, node, memory_order_acq_rel);
+    // Between these two lines the node is not reachable from tail yet
+    atomic_store_explicit(&prev->next, node, memory_order_release);
+}
+
+MpscNode* mpsc_queue_pop(MpscQueue *q) {
+    MpscNode *tail = q->tail;
+    MpscNode *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+
+    if (tail == &q->stub) {
+        if (!next) return NULL;
+        q->tail = next;
+        tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+
+    // tail is the last node: it can only be handed out once the stub is
+    // queued behind it, otherwise the queue would lose its anchor
+    if (tail != atomic_load_explicit(&q->head, memory_order_acquire)) {
+        return NULL; // A producer is mid-push
+    }
+    mpsc_queue_push(q, &q->stub);
+    next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (next) {
+        q->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+
+bool mpsc_queue_is_empty(MpscQueue *q) {
+    return q->tail == &q->stub && atomic_load_explicit(&q->head, memory_order_acquire) == &q->stub;
+}
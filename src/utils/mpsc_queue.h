@@ -0,0 +1,32 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// Intrusive lock-free multi-producer / single-consumer queue (Vyukov).
+// Producers never block each other or the consumer; push is one atomic
+// exchange. Embed an MpscNode in the queued struct and recover it with
+// offsetof/container arithmetic, or put the node first.
+
+typedef struct MpscNode {
+    _Atomic(struct MpscNode*) next;
+} MpscNode;
+
+typedef struct {
+    _Atomic(MpscNode*) head; // Producers' end
+    MpscNode *tail;          // Consumer's end, only touched by the consumer
+    MpscNode stub;
+} MpscQueue;
+
+void mpsc_queue_init(MpscQueue *q);
+
+// Any thread
+void mpsc_queue_push(MpscQueue *q, MpscNode *node);
+
+// Consumer thread only. May return NULL while a push is halfway done;
+// mpsc_queue_is_empty tells that case apart from a really empty queue.
+MpscNode* mpsc_queue_pop(MpscQueue *q);
+bool mpsc_queue_is_empty(MpscQueue *q);
+
+#endif // MPSC_QUEUE_H
@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "read_marker.h"
+#include "channel_sync.h"
+#include "chat_utils.h"
+
+static guint debounce_source = 0;
+static AppWidgets *debounce_widgets = NULL;
+static GHashTable *sent_seqs = NULL; // channel_id -> guint64 seq last sent
+
+static gboolean on_debounce(gpointer data) {
+    (void)data;
+    debounce_source = 0;
+    read_marker_flush(debounce_widgets);
+    return G_SOURCE_REMOVE;
+}
+
+void read_marker_note(AppWidgets *widgets) {
+    if (debounce_source) return; // The pending flush will cover these messages too
+    debounce_widgets = widgets;
+    debounce_source = g_timeout_add(READ_MARKER_DEBOUNCE_MS, on_debounce, NULL);
+}
+
+void read_marker_flush(AppWidgets *widgets) {
+    if (debounce_source) {
+        g_source_remove(debounce_source);
+        debounce_source = 0;
+    }
+    uint32_t channel_id = widgets->current_channel_id;
+    uint64_t seq = channel_sync_resume_point();
+    if (channel_id == 0 || seq == 0 || widgets->connection_state != CONNECTION_ONLINE) return;
+
+    if (!sent_seqs) {
+        sent_seqs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    }
+    guint64 *sent = g_hash_table_lookup(sent_seqs, GUINT_TO_POINTER(channel_id));
+    if (sent && *sent >= seq) return;
+
+    Message *msg = create_read_marker_message(channel_id, seq);
+    if (!msg) return;
+    if (send_to_server(widgets, msg) < 0) {
+        perror("Failed to send READ_MARKER message");
+        free(msg);
+        return;
+    }
+    free(msg);
+
+    if (!sent) {
+        sent = g_new(guint64, 1);
+        g_hash_table_insert(sent_seqs, GUINT_TO_POINTER(channel_id), sent);
+    }
+    *sent = seq;
+}
+
+void read_marker_reset(void) {
+    if (debounce_source) {
+        g_source_remove(debounce_source);
+        debounce_source = 0;
+    }
+    if (sent_seqs) g_hash_table_remove_all(sent_seqs);
+}
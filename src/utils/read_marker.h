@@ -0,0 +1,22 @@
+#ifndef READ_MARKER_H
+#define READ_MARKER_H
+
+#include "../types/app_types.h"
+
+// Tells the server how far the user has read the channel on screen, so
+// unread counts survive restarts. A burst of messages produces one
+// MSG_READ_MARKER per READ_MARKER_DEBOUNCE_MS, not one per message.
+// Main thread only.
+
+#define READ_MARKER_DEBOUNCE_MS 2000
+
+// Messages of the current channel were shown; a marker goes out after the debounce
+void read_marker_note(AppWidgets *widgets);
+
+// Send the pending marker now, e.g. before switching away from the channel
+void read_marker_flush(AppWidgets *widgets);
+
+// Forget what was sent (on logout)
+void read_marker_reset(void);
+
+#endif // READ_MARKER_H
@@ -0,0 +1,80 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ui_dispatch.h"
+#include "mpsc_queue.h"
+
+typedef struct {
+    MpscNode node; // First, so a node pointer is a task pointer
+    GSourceFunc fn;
+    gpointer data;
+} UiTask;
+
+static MpscQueue tasks;
+static atomic_bool tick_active = false;
+static GtkWidget *clock_widget = NULL;
+static UiFrameDone frame_done = NULL;
+static gpointer frame_done_data = NULL;
+
+static gboolean drain_tasks(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    (void)widget;
+    (void)clock;
+    (void)user_data;
+    gint64 deadline = g_get_monotonic_time() + UI_DISPATCH_FRAME_BUDGET_US;
+    gboolean ran = FALSE;
+
+    MpscNode *node;
+    while ((node = mpsc_queue_pop(&tasks)) != NULL) {
+        UiTask *task = (UiTask *)node;
+        task->fn(task->data);
+        free(task);
+        ran = TRUE;
+        if (g_get_monotonic_time() >= deadline) break;
+    }
+    if (ran && frame_done) {
+        frame_done(frame_done_data);
+    }
+
+    if (!mpsc_queue_is_empty(&tasks)) {
+        return G_SOURCE_CONTINUE;
+    }
+    // Going idle. A producer that pushed before seeing the flag cleared relies
+    // on us noticing its task, so look once more after clearing it.
+    atomic_store(&tick_active, false);
+    if (!mpsc_queue_is_empty(&tasks) && !atomic_exchange(&tick_active, true)) {
+        return G_SOURCE_CONTINUE;
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean start_tick(gpointer data) {
+    (void)data;
+    gtk_widget_add_tick_callback(clock_widget, drain_tasks, NULL, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+void ui_dispatch_init(GtkWidget *widget, UiFrameDone done, gpointer user_data) {
+    mpsc_queue_init(&tasks);
+    clock_widget = widget;
+    frame_done = done;
+    frame_done_data = user_data;
+}
+
+void ui_dispatch(GSourceFunc fn, gpointer data) {
+    UiTask *task = malloc(sizeof(UiTask));
+    if (!task) {
+        // Still run it, out of order with the queued tasks, rather than
+        // dropping the update and leaking its data
+        fprintf(stderr, "Failed to allocate UI task, using an idle source\n");
+        g_idle_add(fn, data);
+        return;
+    }
+    task->fn = fn;
+    task->data = data;
+    mpsc_queue_push(&tasks, &task->node);
+
+    // Only the push that wakes the dispatcher pays for an idle source
+    if (!atomic_exchange(&tick_active, true)) {
+        g_idle_add(start_tick, NULL);
+    }
+}
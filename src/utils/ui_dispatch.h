@@ -0,0 +1,26 @@
+#ifndef UI_DISPATCH_H
+#define UI_DISPATCH_H
+
+#include <gtk/gtk.h>
+
+// Hands work from background threads to the GTK main thread without one
+// g_idle_add per message: tasks go into a lock-free queue that a single
+// frame-clock callback drains once per frame. Use it for frequent updates
+// (history rows, presence, member lists) and for anything they must stay in
+// order with. A modal dialog must not run inside a frame: a task that needs
+// one posts it to an idle source.
+
+// Time spent running tasks per frame; the rest waits for the next frame
+#define UI_DISPATCH_FRAME_BUDGET_US 8000
+
+typedef void (*UiFrameDone)(gpointer user_data);
+
+// clock_widget provides the frame clock (the main window). frame_done runs
+// once after each frame's batch, e.g. to lay out what the tasks appended.
+void ui_dispatch_init(GtkWidget *clock_widget, UiFrameDone frame_done, gpointer user_data);
+
+// Any thread. fn runs on the main thread with data and should return
+// G_SOURCE_REMOVE: if the task cannot be queued it runs from an idle source.
+void ui_dispatch(GSourceFunc fn, gpointer data);
+
+#endif // UI_DISPATCH_H
@@ -0,0 +1,226 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "utf8_markup.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_MARKUP_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(UTF8_MARKUP_SSE2) && defined(__GNUC__)
+#define UTF8_MARKUP_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+static const char replacement[] = "\xEF\xBF\xBD"; // U+FFFD
+
+static inline unsigned first_set_bit(uint32_t mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+// ASCII bytes that can't be copied as they are
+static inline bool is_special(unsigned char c, bool escape_markup) {
+    if (c == 0) return true;
+    if (!escape_markup) return false;
+    if (c < 0x20) return c != '\t' && c != '\n' && c != '\r';
+    return c == '&' || c == '<' || c == '>' || c == '\'' || c == '"' || c == 0x7f;
+}
+
+static size_t plain_run_scalar(const unsigned char *s, size_t len, bool escape_markup) {
+    size_t i = 0;
+    while (i < len && s[i] < 0x80 && !is_special(s[i], escape_markup)) i++;
+    return i;
+}
+
+#ifdef UTF8_MARKUP_SSE2
+// Length of the leading run of bytes copied verbatim. A signed compare against
+// 0x20 (or 1) flags non-ASCII bytes and control characters at once; tab and
+// newline are flagged too and simply take the per-character path.
+static size_t plain_run_sse2(const unsigned char *s, size_t len, bool escape_markup) {
+    const __m128i limit = _mm_set1_epi8(escape_markup ? 0x20 : 0x01);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i bad = _mm_cmplt_epi8(v, limit);
+        if (escape_markup) {
+            bad = _mm_or_si128(bad, _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('&')), _mm_cmpeq_epi8(v, _mm_set1_epi8('<'))),
+                _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('>')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')))));
+            bad = _mm_or_si128(bad, _mm_or_si128(
+                _mm_cmpeq_epi8(v, _mm_set1_epi8('"')), _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f))));
+        }
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(bad);
+        if (mask) return i + first_set_bit(mask);
+    }
+    return i + plain_run_scalar(s + i, len - i, escape_markup);
+}
+#endif
+
+#ifdef UTF8_MARKUP_AVX2
+__attribute__((target("avx2")))
+static size_t plain_run_avx2(const unsigned char *s, size_t len, bool escape_markup) {
+    const __m256i limit = _mm256_set1_epi8(escape_markup ? 0x20 : 0x01);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i bad = _mm256_cmpgt_epi8(limit, v);
+        if (escape_markup) {
+            bad = _mm256_or_si256(bad, _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<'))),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')))));
+            bad = _mm256_or_si256(bad, _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f))));
+        }
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(bad);
+        if (mask) return i + first_set_bit(mask);
+    }
+    _mm256_zeroupper();
+    return i + plain_run_sse2(s + i, len - i, escape_markup);
+}
+
+static bool cpu_has_avx2(void) {
+    // 0: unknown, 1: no, 2: yes. Racing first callers store the same answer.
+    static atomic_int state = 0;
+    int known = atomic_load_explicit(&state, memory_order_relaxed);
+    if (known == 0) {
+        __builtin_cpu_init();
+        known = __builtin_cpu_supports("avx2") ? 2 : 1;
+        atomic_store_explicit(&state, known, memory_order_relaxed);
+    }
+    return known == 2;
+}
+#endif
+
+static size_t plain_run(const unsigned char *s, size_t len, bool escape_markup) {
+#if defined(UTF8_MARKUP_AVX2)
+    if (len >= 32 && cpu_has_avx2()) return plain_run_avx2(s, len, escape_markup);
+    return plain_run_sse2(s, len, escape_markup);
+#elif defined(UTF8_MARKUP_SSE2)
+    return plain_run_sse2(s, len, escape_markup);
+#else
+    return plain_run_scalar(s, len, escape_markup);
+#endif
+}
+
+// Length of the well-formed sequence starting at s (no overlongs, surrogates
+// or code points past U+10FFFF), 0 if there is none
+static size_t sequence_length(const unsigned char *s, size_t avail) {
+    unsigned char c = s[0];
+    unsigned char lo = 0x80, hi = 0xBF; // Allowed range of the second byte
+    size_t len;
+    if (c >= 0xC2 && c <= 0xDF) {
+        len = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        len = 3;
+        if (c == 0xE0) lo = 0xA0;
+        else if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        len = 4;
+        if (c == 0xF0) lo = 0x90;
+        else if (c == 0xF4) hi = 0x8F;
+    } else {
+        return 0;
+    }
+    if (avail < len || s[1] < lo || s[1] > hi) return 0;
+    for (size_t k = 2; k < len; k++) {
+        if ((s[k] & 0xC0) != 0x80) return 0;
+    }
+    return len;
+}
+
+static size_t put_char_reference(char *buf, unsigned code_point) {
+    static const char hex[] = "0123456789abcdef";
+    size_t n = 0;
+    buf[n++] = '&';
+    buf[n++] = '#';
+    buf[n++] = 'x';
+    if (code_point >= 0x10) buf[n++] = hex[code_point >> 4];
+    buf[n++] = hex[code_point & 0xF];
+    buf[n++] = ';';
+    return n;
+}
+
+// Output for the character at s that plain_run stopped on; sets *consumed.
+// buf needs room for 8 bytes.
+static size_t encode_char(const unsigned char *s, size_t avail, bool escape_markup, char *buf, size_t *consumed) {
+    unsigned char c = s[0];
+    *consumed = 1;
+    if (c < 0x80) {
+        if (c == 0) {
+            memcpy(buf, replacement, 3);
+            return 3;
+        }
+        if (escape_markup) {
+            switch (c) {
+                case '&':  memcpy(buf, "&amp;", 5); return 5;
+                case '<':  memcpy(buf, "&lt;", 4); return 4;
+                case '>':  memcpy(buf, "&gt;", 4); return 4;
+                case '\'': memcpy(buf, "&#39;", 5); return 5;
+                case '"':  memcpy(buf, "&quot;", 6); return 6;
+                default:
+                    if (is_special(c, true)) return put_char_reference(buf, c);
+            }
+        }
+        buf[0] = (char)c;
+        return 1;
+    }
+
+    size_t len = sequence_length(s, avail);
+    if (len == 0) {
+        memcpy(buf, replacement, 3);
+        return 3;
+    }
+    *consumed = len;
+    // C1 controls except NEL, like g_markup_escape_text
+    if (escape_markup && c == 0xC2 && s[1] <= 0x9F && s[1] != 0x85) {
+        return put_char_reference(buf, s[1]);
+    }
+    memcpy(buf, s, len);
+    return len;
+}
+
+size_t utf8_markup_copy(const char *in, size_t in_len, char *out, size_t out_size, bool escape_markup) {
+    if (out_size == 0) return 0;
+    const unsigned char *s = (const unsigned char *)in;
+    size_t room = out_size - 1; // The NUL always fits
+    size_t i = 0, o = 0;
+
+    while (i < in_len && o < room) {
+        // Vector path only where a plain byte starts a run, so text that is
+        // mostly non-ASCII doesn't pay for a failed vector test per character
+        // (tab and newline come back as an empty run and are copied below)
+        if (s[i] < 0x80 && !is_special(s[i], escape_markup)) {
+            size_t run = plain_run(s + i, in_len - i, escape_markup);
+            if (run > 0) {
+                if (run > room - o) run = room - o;
+                memcpy(out + o, s + i, run);
+                i += run;
+                o += run;
+                continue;
+            }
+        }
+
+        size_t consumed;
+        if (room - o >= 8) {
+            o += encode_char(s + i, in_len - i, escape_markup, out + o, &consumed);
+        } else {
+            char buf[8];
+            size_t n = encode_char(s + i, in_len - i, escape_markup, buf, &consumed);
+            if (n > room - o) break;
+            memcpy(out + o, buf, n);
+            o += n;
+        }
+        i += consumed;
+    }
+    out[o] = '\0';
+    return o;
+}
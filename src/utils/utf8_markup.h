@@ -0,0 +1,21 @@
+#ifndef UTF8_MARKUP_H
+#define UTF8_MARKUP_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Repairs UTF-8 and escapes Pango markup in a single pass, into a buffer the
+// caller owns: no static state, so it is safe on any thread. Invalid bytes
+// (and NULs) become U+FFFD. With escape_markup, & < > ' " become entities and
+// control characters markup can't carry become numeric references, as
+// g_markup_escape_text does. Plain ASCII runs are copied 16 or 32 bytes at a
+// time where SSE2/AVX2 are available.
+
+// Output size that always fits an input of len bytes, NUL included
+#define UTF8_MARKUP_MAX_OUTPUT(len) ((len) * 6 + 1)
+
+// Writes at most out_size bytes, NUL included, stopping at a character
+// boundary if the result doesn't fit. Returns the length written without the NUL.
+size_t utf8_markup_copy(const char *in, size_t in_len, char *out, size_t out_size, bool escape_markup);
+
+#endif // UTF8_MARKUP_H